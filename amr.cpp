@@ -0,0 +1,1313 @@
+#include "amr.hpp"
+#include "profiler.hpp"
+#include "threadpool.hpp"
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace
+{
+// the fields a patch advances, in the order of the per-patch arrays
+enum StateIndex
+{
+    StateU = 0,
+    StateV,
+    StateDensity,
+    StateTemperature,
+    StateCount
+};
+const FluidField StateFields[StateCount] = {FluidField::VelocityU, FluidField::VelocityV, FluidField::Density,
+                                            FluidField::Temperature};
+const BoundaryKind StateBoundaries[StateCount] = {BoundaryKind::VelocityU, BoundaryKind::VelocityV,
+                                                  BoundaryKind::Scalar, BoundaryKind::Scalar};
+// density and temperature, advected in flux form and refluxed
+constexpr int ConservedCount = 2;
+
+enum Side
+{
+    SideLeft = 0,
+    SideRight,
+    SideBottom,
+    SideTop
+};
+
+// caps the substeps of one level per parent step should the flow blow up
+constexpr int MaxSubsteps = 256;
+
+bool isPowerOfTwo(int value)
+{
+    return value > 0 && (value & (value - 1)) == 0;
+}
+
+int powerOf(int ratio, int level)
+{
+    int scale = 1;
+    for (int l = 0; l < level; ++l)
+    {
+        scale *= ratio;
+    }
+    return scale;
+}
+
+// bilinear sample of an interior field; the position is clamped to [0, n-1]
+float sampleInterior(const ScalarField& field, float x, float y)
+{
+    int nx = field.getNx();
+    int ny = field.getNy();
+    x = std::min(std::max(x, 0.0f), static_cast<float>(nx - 1));
+    y = std::min(std::max(y, 0.0f), static_cast<float>(ny - 1));
+    int i0 = std::min(static_cast<int>(x), std::max(nx - 2, 0));
+    int j0 = std::min(static_cast<int>(y), std::max(ny - 2, 0));
+    float s1 = x - i0;
+    float t1 = y - j0;
+    const float* r0 = field.row(j0);
+    const float* r1 = field.row(j0 + 1);
+    return (1.0f - s1)*((1.0f - t1)*r0[i0] + t1*r1[i0]) + s1*((1.0f - t1)*r0[i0 + 1] + t1*r1[i0 + 1]);
+}
+
+void copyGhostRing(ScalarField& dst, const ScalarField& src)
+{
+    int nx = dst.getNx();
+    int ny = dst.getNy();
+    int g = dst.getGhost();
+    for (int j = -g; j < ny + g; ++j)
+    {
+        float* d = dst.row(j);
+        const float* s = src.row(j);
+        if (j < 0 || j >= ny)
+        {
+            std::copy(s - g, s + nx + g, d - g);
+            continue;
+        }
+        for (int k = 0; k < g; ++k)
+        {
+            d[-1 - k] = s[-1 - k];
+            d[nx + k] = s[nx + k];
+        }
+    }
+}
+
+// applyBoundary restricted to one side; bottom and top run over the full
+// width, so applied after left and right they also fill the corners
+void applyWallSide(ScalarField& field, BoundaryKind kind, int side)
+{
+    int nx = field.getNx();
+    int ny = field.getNy();
+    int g = field.getGhost();
+    float signX = (kind == BoundaryKind::VelocityU) ? -1.0f : 1.0f;
+    float signY = (kind == BoundaryKind::VelocityV) ? -1.0f : 1.0f;
+    if (side == SideLeft || side == SideRight)
+    {
+        for (int j = 0; j < ny; ++j)
+        {
+            float* r = field.row(j);
+            for (int k = 0; k < g; ++k)
+            {
+                if (side == SideLeft)
+                    r[-1 - k] = signX * r[std::min(k, nx - 1)];
+                else
+                    r[nx + k] = signX * r[std::max(nx - 1 - k, 0)];
+            }
+        }
+        return;
+    }
+    for (int k = 0; k < g; ++k)
+    {
+        const float* src = field.row(side == SideBottom ? std::min(k, ny - 1) : std::max(ny - 1 - k, 0));
+        float* dst = field.row(side == SideBottom ? -1 - k : ny + k);
+        for (int i = -g; i < nx + g; ++i)
+        {
+            dst[i] = signY * src[i];
+        }
+    }
+}
+
+//--------------------------------CLUSTERING---------------------------------------
+// cut in [1, n-1) where the tag count is zero, closest to the middle; -1 without one
+int findHole(const std::vector<int>& signature)
+{
+    int n = static_cast<int>(signature.size());
+    int best = -1;
+    int bestDistance = n;
+    for (int k = 1; k < n - 1; ++k)
+    {
+        int distance = std::abs(2*k - n);
+        if (signature[k] == 0 && distance < bestDistance)
+        {
+            best = k;
+            bestDistance = distance;
+        }
+    }
+    return best;
+}
+
+// cut where the second difference of the tag counts changes sign most
+// sharply, ties going to the middle; -1 without a sign change
+int findInflection(const std::vector<int>& signature, int& strength)
+{
+    int n = static_cast<int>(signature.size());
+    int best = -1;
+    int bestDistance = n;
+    strength = 0;
+    auto laplacian = [&](int k) { return signature[k - 1] - 2*signature[k] + signature[k + 1]; };
+    for (int k = 1; k + 2 < n; ++k)
+    {
+        int a = laplacian(k);
+        int b = laplacian(k + 1);
+        if ((a < 0 && b > 0) || (a > 0 && b < 0))
+        {
+            int jump = std::abs(b - a);
+            int distance = std::abs(2*(k + 1) - n);
+            if (jump > strength || (jump == strength && distance < bestDistance))
+            {
+                best = k + 1;
+                strength = jump;
+                bestDistance = distance;
+            }
+        }
+    }
+    return best;
+}
+
+void clusterBox(const std::vector<unsigned char>& tags, int width, const AmrBox& box, float efficiency,
+                int maxSize, std::vector<AmrBox>& out)
+{
+    std::vector<int> columns(box.getWidth(), 0);
+    std::vector<int> rows(box.getHeight(), 0);
+    int count = 0;
+    for (int j = box.j0; j < box.j1; ++j)
+    {
+        const unsigned char* row = &tags[static_cast<std::size_t>(j)*width];
+        for (int i = box.i0; i < box.i1; ++i)
+        {
+            if (row[i])
+            {
+                ++columns[i - box.i0];
+                ++rows[j - box.j0];
+                ++count;
+            }
+        }
+    }
+    if (count == 0)
+    {
+        return;
+    }
+
+    // shrink to the tags
+    int a0 = 0;
+    int a1 = box.getWidth();
+    int b0 = 0;
+    int b1 = box.getHeight();
+    while (columns[a0] == 0) ++a0;
+    while (columns[a1 - 1] == 0) --a1;
+    while (rows[b0] == 0) ++b0;
+    while (rows[b1 - 1] == 0) --b1;
+    AmrBox tight{box.i0 + a0, box.j0 + b0, box.i0 + a1, box.j0 + b1};
+    columns = std::vector<int>(columns.begin() + a0, columns.begin() + a1);
+    rows = std::vector<int>(rows.begin() + b0, rows.begin() + b1);
+
+    bool efficient = count >= efficiency*tight.getCellCount();
+    bool fits = tight.getWidth() <= maxSize && tight.getHeight() <= maxSize;
+    if ((efficient && fits) || tight.getCellCount() == 1)
+    {
+        out.push_back(tight);
+        return;
+    }
+
+    int axis = -1;
+    int cut = -1;
+    if (!efficient)
+    {
+        int holeX = findHole(columns);
+        int holeY = findHole(rows);
+        if (holeX >= 0 && (holeY < 0 || tight.getWidth() >= tight.getHeight()))
+        {
+            axis = 0;
+            cut = holeX;
+        }
+        else if (holeY >= 0)
+        {
+            axis = 1;
+            cut = holeY;
+        }
+        else
+        {
+            int strengthX = 0;
+            int strengthY = 0;
+            int inflectionX = findInflection(columns, strengthX);
+            int inflectionY = findInflection(rows, strengthY);
+            if (inflectionX >= 0 && (inflectionY < 0 || strengthX >= strengthY))
+            {
+                axis = 0;
+                cut = inflectionX;
+            }
+            else if (inflectionY >= 0)
+            {
+                axis = 1;
+                cut = inflectionY;
+            }
+        }
+    }
+    if (axis < 0)
+    {
+        axis = tight.getWidth() >= tight.getHeight() ? 0 : 1;
+        cut = (axis == 0 ? tight.getWidth() : tight.getHeight()) / 2;
+    }
+
+    AmrBox lower = tight;
+    AmrBox upper = tight;
+    if (axis == 0)
+    {
+        lower.i1 = tight.i0 + cut;
+        upper.i0 = tight.i0 + cut;
+    }
+    else
+    {
+        lower.j1 = tight.j0 + cut;
+        upper.j0 = tight.j0 + cut;
+    }
+    clusterBox(tags, width, lower, efficiency, maxSize, out);
+    clusterBox(tags, width, upper, efficiency, maxSize, out);
+}
+}
+
+std::vector<AmrBox> clusterTaggedCells(const std::vector<unsigned char>& tags, int width, int height,
+                                       float efficiency, int maxSize)
+{
+    if (width < 0 || height < 0 || tags.size() != static_cast<std::size_t>(width)*height)
+    {
+        throw std::invalid_argument("clusterTaggedCells: tag mask does not match its dimensions");
+    }
+    std::vector<AmrBox> boxes;
+    if (width > 0 && height > 0)
+    {
+        clusterBox(tags, width, AmrBox{0, 0, width, height}, efficiency, std::max(maxSize, 1), boxes);
+    }
+    return boxes;
+}
+
+//--------------------------------PATCHES------------------------------------------
+struct AmrSolver::Patch
+{
+    int level{0};
+    AmrBox box;
+    int parent{-1};                        // index into the level below
+    std::array<bool, 4> wall{};            // which edges lie on the domain boundary, by Side
+    std::unique_ptr<FluidGrid> ownedGrid;
+    FluidGrid* grid{nullptr};              // the base grid itself on level 0
+    std::unique_ptr<FluidSolver> solver;
+    // obstacle with the true ghost cells: solid past the domain walls, open across
+    // coarse-fine edges, where grid->obstacle() is closed for the projection
+    ScalarField solid;
+    ScalarField uPrev;
+    ScalarField vPrev;
+    // state at the start of the current step, for the children's time interpolation
+    std::array<ScalarField, StateCount> start;
+    // ghost values of the current substep; the stages overwrite ghosts with walls
+    std::array<ScalarField, StateCount> ghosts;
+    // mass through the left (bottom) face of every cell in the last step, nx+1 by ny (nx by ny+1)
+    std::array<ScalarField, ConservedCount> fluxX;
+    std::array<ScalarField, ConservedCount> fluxY;
+    // mass through each edge summed over the substeps of the parent's step
+    std::array<std::array<std::vector<double>, 4>, ConservedCount> sideFlux;
+
+    ScalarField& state(int s) { return this->grid->field(StateFields[s]); }
+    const ScalarField& state(int s) const { return this->grid->field(StateFields[s]); }
+    const ScalarField& trueSolid() const { return this->level == 0 ? this->grid->obstacle() : this->solid; }
+
+    void allocate()
+    {
+        int nx = this->grid->getNx();
+        int ny = this->grid->getNy();
+        this->solid = this->grid->makeScratchField();
+        this->uPrev = this->grid->makeScratchField();
+        this->vPrev = this->grid->makeScratchField();
+        for (int s = 0; s < StateCount; ++s)
+        {
+            this->start[s] = this->grid->makeScratchField();
+            this->ghosts[s] = this->grid->makeScratchField();
+        }
+        for (int c = 0; c < ConservedCount; ++c)
+        {
+            this->fluxX[c] = ScalarField(nx + 1, ny);
+            this->fluxY[c] = ScalarField(nx, ny + 1);
+            this->sideFlux[c][SideLeft].assign(ny, 0.0);
+            this->sideFlux[c][SideRight].assign(ny, 0.0);
+            this->sideFlux[c][SideBottom].assign(nx, 0.0);
+            this->sideFlux[c][SideTop].assign(nx, 0.0);
+        }
+    }
+};
+
+AmrSolver::AmrSolver(FluidGrid& base, int numThreads)
+    : base(base), pool(new ThreadPool(numThreads))
+{
+    std::unique_ptr<Patch> root(new Patch);
+    root->box = AmrBox{0, 0, base.getNx(), base.getNy()};
+    root->wall = {true, true, true, true};
+    root->grid = &base;
+    root->solver.reset(new FluidSolver(base, *this->pool));
+    root->solver->usePressureSolver(this->pressureKind);
+    root->allocate();
+    this->levels.resize(1);
+    this->levels[0].push_back(std::move(root));
+    this->substeps.assign(1, 0);
+}
+
+AmrSolver::~AmrSolver()
+{
+}
+
+void AmrSolver::setCriteria(const AmrCriteria& criteria)
+{
+    if (!isPowerOfTwo(criteria.refinementRatio) || criteria.refinementRatio < 2)
+    {
+        throw std::invalid_argument("AmrSolver: the refinement ratio must be a power of two of at least 2");
+    }
+    if (criteria.maxLevel < 0 || criteria.blockingFactor < 1 || criteria.bufferCells < 0 ||
+        criteria.maxPatchSize < 1 || !(criteria.cfl > 0.0f) || !(criteria.clusterEfficiency > 0.0f))
+    {
+        throw std::invalid_argument("AmrSolver: criteria sizes and limits must be positive");
+    }
+    this->criteria = criteria;
+}
+
+void AmrSolver::usePressureSolver(PressureSolverKind kind)
+{
+    this->pressureKind = kind;
+    for (std::vector<std::unique_ptr<Patch>>& patches : this->levels)
+    {
+        for (std::unique_ptr<Patch>& patch : patches)
+        {
+            patch->solver->usePressureSolver(kind);
+        }
+    }
+}
+
+void AmrSolver::setObstacle(std::function<bool(float, float)> solid)
+{
+    this->obstacleShape = std::move(solid);
+    if (!this->obstacleShape)
+    {
+        return;
+    }
+    for (int j = 0; j < this->base.getNy(); ++j)
+    {
+        for (int i = 0; i < this->base.getNx(); ++i)
+        {
+            this->base.setSolid(i, j, this->obstacleShape(i + 0.5f, j + 0.5f));
+        }
+    }
+    for (std::size_t level = 1; level < this->levels.size(); ++level)
+    {
+        for (std::unique_ptr<Patch>& patch : this->levels[level])
+        {
+            rasterizeObstacle(*patch);
+        }
+    }
+}
+
+ScalarField& AmrSolver::densitySource()
+{
+    return this->levels[0][0]->solver->densitySource();
+}
+
+ScalarField& AmrSolver::temperatureSource()
+{
+    return this->levels[0][0]->solver->temperatureSource();
+}
+
+ScalarField& AmrSolver::uSource()
+{
+    return this->levels[0][0]->solver->uSource();
+}
+
+ScalarField& AmrSolver::vSource()
+{
+    return this->levels[0][0]->solver->vSource();
+}
+
+int AmrSolver::getPatchCount(int level) const
+{
+    return static_cast<int>(this->levels[level].size());
+}
+
+const AmrBox& AmrSolver::getPatchBox(int level, int patch) const
+{
+    return this->levels[level][patch]->box;
+}
+
+const FluidGrid& AmrSolver::getPatchGrid(int level, int patch) const
+{
+    return *this->levels[level][patch]->grid;
+}
+
+AmrBox AmrSolver::getLevelDomain(int level) const
+{
+    int scale = powerOf(this->ratio, level);
+    return AmrBox{0, 0, this->base.getNx()*scale, this->base.getNy()*scale};
+}
+
+float AmrSolver::getLevelCellSize(int level) const
+{
+    return this->base.getCellSize() / powerOf(this->ratio, level);
+}
+
+int AmrSolver::getSubsteps(int level) const
+{
+    return level < static_cast<int>(this->substeps.size()) ? this->substeps[level] : 0;
+}
+
+int AmrSolver::findPatch(int level, int i, int j, int hint) const
+{
+    const std::vector<std::unique_ptr<Patch>>& patches = this->levels[level];
+    if (hint >= 0 && patches[hint]->box.contains(i, j))
+    {
+        return hint;
+    }
+    for (std::size_t k = 0; k < patches.size(); ++k)
+    {
+        if (patches[k]->box.contains(i, j))
+        {
+            return static_cast<int>(k);
+        }
+    }
+    return -1;
+}
+
+// bilinear in space across whichever patches of `level` hold the four cells,
+// linear in time between the start and the end of their current step; x and y
+// are in cells of `level` with centres on integers
+float AmrSolver::sampleLevel(int level, int state, float fraction, float x, float y, int hint) const
+{
+    AmrBox domain = getLevelDomain(level);
+    int i0 = static_cast<int>(std::floor(x));
+    int j0 = static_cast<int>(std::floor(y));
+    float s1 = x - i0;
+    float t1 = y - j0;
+    auto value = [&](int i, int j) {
+        i = std::min(std::max(i, 0), domain.i1 - 1);
+        j = std::min(std::max(j, 0), domain.j1 - 1);
+        int k = findPatch(level, i, j, hint);
+        if (k < 0)
+        {
+            // nesting keeps this from happening; fall back on the nearest cell of the hint
+            k = hint;
+            i = std::min(std::max(i, this->levels[level][k]->box.i0), this->levels[level][k]->box.i1 - 1);
+            j = std::min(std::max(j, this->levels[level][k]->box.j0), this->levels[level][k]->box.j1 - 1);
+        }
+        const Patch& patch = *this->levels[level][k];
+        int li = i - patch.box.i0;
+        int lj = j - patch.box.j0;
+        return (1.0f - fraction)*patch.start[state].at(li, lj) + fraction*patch.state(state).at(li, lj);
+    };
+    return (1.0f - s1)*((1.0f - t1)*value(i0, j0) + t1*value(i0, j0 + 1)) +
+           s1*((1.0f - t1)*value(i0 + 1, j0) + t1*value(i0 + 1, j0 + 1));
+}
+
+std::unique_ptr<AmrSolver::Patch> AmrSolver::makePatch(int level, const AmrBox& box, int parent)
+{
+    std::unique_ptr<Patch> patch(new Patch);
+    patch->level = level;
+    patch->box = box;
+    patch->parent = parent;
+    AmrBox domain = getLevelDomain(level);
+    patch->wall = {box.i0 == 0, box.i1 == domain.i1, box.j0 == 0, box.j1 == domain.j1};
+    patch->ownedGrid.reset(new FluidGrid(box.getWidth(), box.getHeight(), 1, getLevelCellSize(level)));
+    patch->grid = patch->ownedGrid.get();
+    patch->solver.reset(new FluidSolver(*patch->grid, *this->pool));
+    patch->solver->usePressureSolver(this->pressureKind);
+    patch->allocate();
+    rasterizeObstacle(*patch);
+    return patch;
+}
+
+void AmrSolver::rasterizeObstacle(Patch& patch)
+{
+    int scale = powerOf(this->ratio, patch.level);
+    AmrBox domain = getLevelDomain(patch.level);
+    int nx = patch.grid->getNx();
+    int ny = patch.grid->getNy();
+    for (int j = -1; j <= ny; ++j)
+    {
+        for (int i = -1; i <= nx; ++i)
+        {
+            int gi = patch.box.i0 + i;
+            int gj = patch.box.j0 + j;
+            bool solid = true;
+            if (domain.contains(gi, gj))
+            {
+                solid = this->obstacleShape ? this->obstacleShape((gi + 0.5f) / scale, (gj + 0.5f) / scale)
+                                            : this->base.isSolid(gi / scale, gj / scale);
+            }
+            patch.solid.at(i, j) = solid ? 1.0f : 0.0f;
+        }
+    }
+    patch.grid->obstacle().copyFrom(patch.solid);
+    markWallsSolid(patch.grid->obstacle());
+}
+
+// velocity interpolated bilinearly, scalars injected so the patch holds the
+// parent's mass; then whatever the previous patches of the level covered
+void AmrSolver::initializeFromParent(Patch& patch, const std::vector<std::unique_ptr<Patch>>& previous)
+{
+    const Patch& parent = *this->levels[patch.level - 1][patch.parent];
+    FluidGrid& grid = *patch.grid;
+    int r = this->ratio;
+    float inverse = 1.0f / r;
+    int nx = grid.getNx();
+    int ny = grid.getNy();
+    int pnx = parent.grid->getNx();
+    int pny = parent.grid->getNy();
+    for (int j = -1; j <= ny; ++j)
+    {
+        int gj = patch.box.j0 + j;
+        float y = (gj + 0.5f)*inverse - 0.5f - parent.box.j0;
+        int cj = std::min(std::max(gj / r - parent.box.j0, 0), pny - 1);
+        for (int i = -1; i <= nx; ++i)
+        {
+            int gi = patch.box.i0 + i;
+            float x = (gi + 0.5f)*inverse - 0.5f - parent.box.i0;
+            int ci = std::min(std::max(gi / r - parent.box.i0, 0), pnx - 1);
+            float fluid = 1.0f - patch.solid.at(i, j);
+            grid.u().at(i, j) = fluid*sampleInterior(parent.grid->u(), x, y);
+            grid.v().at(i, j) = fluid*sampleInterior(parent.grid->v(), x, y);
+            grid.density().at(i, j) = parent.grid->density().at(ci, cj);
+            grid.temperature().at(i, j) = parent.grid->temperature().at(ci, cj);
+            grid.pressure().at(i, j) = parent.grid->pressure().at(ci, cj);
+        }
+    }
+
+    for (const std::unique_ptr<Patch>& old : previous)
+    {
+        AmrBox overlap = old->box.intersect(patch.box);
+        for (int gj = overlap.j0; gj < overlap.j1; ++gj)
+        {
+            for (int gi = overlap.i0; gi < overlap.i1; ++gi)
+            {
+                for (FluidField f : {FluidField::VelocityU, FluidField::VelocityV, FluidField::Density,
+                                     FluidField::Temperature, FluidField::Pressure})
+                {
+                    grid.field(f).at(gi - patch.box.i0, gj - patch.box.j0) =
+                        old->grid->field(f).at(gi - old->box.i0, gj - old->box.j0);
+                }
+            }
+        }
+    }
+}
+
+//--------------------------------REGRIDDING---------------------------------------
+void AmrSolver::tagCells(const Patch& patch, std::vector<unsigned char>& tags) const
+{
+    const FluidGrid& grid = *patch.grid;
+    const ScalarField& u = grid.u();
+    const ScalarField& v = grid.v();
+    const ScalarField& density = grid.density();
+    const ScalarField& solid = patch.trueSolid();
+    AmrBox domain = getLevelDomain(patch.level);
+    int nx = grid.getNx();
+    int ny = grid.getNy();
+    tags.assign(static_cast<std::size_t>(nx)*ny, 0);
+    for (int j = 0; j < ny; ++j)
+    {
+        for (int i = 0; i < nx; ++i)
+        {
+            bool isSolid = solid.at(i, j) > 0.5f;
+            bool tagged = false;
+            if (!isSolid)
+            {
+                float curl = 0.5f*((v.at(i + 1, j) - v.at(i - 1, j)) - (u.at(i, j + 1) - u.at(i, j - 1)));
+                float gx = 0.5f*(density.at(i + 1, j) - density.at(i - 1, j));
+                float gy = 0.5f*(density.at(i, j + 1) - density.at(i, j - 1));
+                tagged = std::fabs(curl) > this->criteria.vorticityThreshold ||
+                         std::sqrt(gx*gx + gy*gy) > this->criteria.gradientThreshold;
+            }
+            if (!tagged && this->criteria.refineObstacles)
+            {
+                // obstacle edges, not the domain walls
+                const int offsets[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+                for (const int* o : offsets)
+                {
+                    int gi = patch.box.i0 + i + o[0];
+                    int gj = patch.box.j0 + j + o[1];
+                    if (domain.contains(gi, gj) && (solid.at(i + o[0], j + o[1]) > 0.5f) != isSolid)
+                    {
+                        tagged = true;
+                    }
+                }
+            }
+            tags[static_cast<std::size_t>(j)*nx + i] = tagged;
+        }
+    }
+}
+
+void AmrSolver::computeFineBoxes(int level, std::vector<AmrBox>& boxes, std::vector<int>& parents)
+{
+    const std::vector<std::unique_ptr<Patch>>& patches = this->levels[level];
+    int count = static_cast<int>(patches.size());
+    std::vector<std::vector<unsigned char>> patchTags(count);
+    this->pool->run(count, [&](int k) { tagCells(*patches[k], patchTags[k]); });
+
+    // tags dilated by the buffer and coarsened onto blocks
+    AmrBox domain = getLevelDomain(level);
+    int block = this->criteria.blockingFactor;
+    int grow = this->criteria.bufferCells;
+    int blocksX = (domain.i1 + block - 1) / block;
+    int blocksY = (domain.j1 + block - 1) / block;
+    std::vector<unsigned char> blockTags(static_cast<std::size_t>(blocksX)*blocksY, 0);
+    for (int k = 0; k < count; ++k)
+    {
+        const Patch& patch = *patches[k];
+        int nx = patch.box.getWidth();
+        for (int j = 0; j < patch.box.getHeight(); ++j)
+        {
+            for (int i = 0; i < nx; ++i)
+            {
+                if (!patchTags[k][static_cast<std::size_t>(j)*nx + i])
+                {
+                    continue;
+                }
+                int gi = patch.box.i0 + i;
+                int gj = patch.box.j0 + j;
+                int bi1 = std::min(gi + grow, domain.i1 - 1) / block;
+                int bj1 = std::min(gj + grow, domain.j1 - 1) / block;
+                for (int bj = std::max(gj - grow, 0) / block; bj <= bj1; ++bj)
+                {
+                    for (int bi = std::max(gi - grow, 0) / block; bi <= bi1; ++bi)
+                    {
+                        blockTags[static_cast<std::size_t>(bj)*blocksX + bi] = 1;
+                    }
+                }
+            }
+        }
+    }
+
+    int maxBlocks = std::max(this->criteria.maxPatchSize / (block*this->ratio), 1);
+    std::vector<AmrBox> clusters = clusterTaggedCells(blockTags, blocksX, blocksY,
+                                                      this->criteria.clusterEfficiency, maxBlocks);
+    for (const AmrBox& cluster : clusters)
+    {
+        AmrBox cells = cluster.refine(block).intersect(domain);
+        // split over the parents; a piece keeps a cell of this level around it
+        // except along the walls, so its sides shrink where they would touch
+        // cells no patch holds
+        for (int k = 0; k < count; ++k)
+        {
+            AmrBox piece = cells.intersect(patches[k]->box);
+            bool shrunk = true;
+            while (shrunk && !piece.isEmpty())
+            {
+                shrunk = false;
+                auto exposed = [&](int i0, int j0, int i1, int j1) {
+                    for (int j = j0; j < j1; ++j)
+                    {
+                        for (int i = i0; i < i1; ++i)
+                        {
+                            if (domain.contains(i, j) && findPatch(level, i, j, k) < 0)
+                            {
+                                return true;
+                            }
+                        }
+                    }
+                    return false;
+                };
+                if (exposed(piece.i0 - 1, piece.j0 - 1, piece.i0, piece.j1 + 1))
+                {
+                    ++piece.i0;
+                    shrunk = true;
+                }
+                if (exposed(piece.i1, piece.j0 - 1, piece.i1 + 1, piece.j1 + 1))
+                {
+                    --piece.i1;
+                    shrunk = true;
+                }
+                if (exposed(piece.i0 - 1, piece.j0 - 1, piece.i1 + 1, piece.j0))
+                {
+                    ++piece.j0;
+                    shrunk = true;
+                }
+                if (exposed(piece.i0 - 1, piece.j1, piece.i1 + 1, piece.j1 + 1))
+                {
+                    --piece.j1;
+                    shrunk = true;
+                }
+            }
+            if (!piece.isEmpty())
+            {
+                boxes.push_back(piece.refine(this->ratio));
+                parents.push_back(k);
+            }
+        }
+    }
+}
+
+void AmrSolver::regrid()
+{
+    SIMFLUID_PROFILE_ZONE("AMR regrid");
+    if (this->ratio != this->criteria.refinementRatio)
+    {
+        // patches of another ratio cannot seed the new ones
+        this->levels.resize(1);
+        this->ratio = this->criteria.refinementRatio;
+    }
+    const std::vector<std::unique_ptr<Patch>> none;
+    int level = 0;
+    for (; level < this->criteria.maxLevel; ++level)
+    {
+        std::vector<AmrBox> boxes;
+        std::vector<int> parents;
+        computeFineBoxes(level, boxes, parents);
+        if (boxes.empty())
+        {
+            break;
+        }
+        std::vector<std::unique_ptr<Patch>> fine(boxes.size());
+        for (std::size_t k = 0; k < boxes.size(); ++k)
+        {
+            fine[k] = makePatch(level + 1, boxes[k], parents[k]);
+        }
+        bool replacing = level + 1 < getNumLevels();
+        const std::vector<std::unique_ptr<Patch>>& previous = replacing ? this->levels[level + 1] : none;
+        this->pool->run(static_cast<int>(fine.size()), [&](int k) { initializeFromParent(*fine[k], previous); });
+        if (replacing)
+        {
+            this->levels[level + 1] = std::move(fine);
+        }
+        else
+        {
+            this->levels.push_back(std::move(fine));
+        }
+    }
+    this->levels.resize(level + 1);
+}
+
+//--------------------------------STEPPING-----------------------------------------
+void AmrSolver::step()
+{
+    SIMFLUID_PROFILE_ZONE("AmrSolver::step");
+    if (this->stepCount % std::max(this->criteria.regridInterval, 1) == 0)
+    {
+        regrid();
+    }
+    this->substeps.assign(this->levels.size(), 0);
+    for (int level = 1; level < getNumLevels(); ++level)
+    {
+        std::vector<std::unique_ptr<Patch>>& patches = this->levels[level];
+        this->pool->run(static_cast<int>(patches.size()), [&](int k) { injectSources(*patches[k]); });
+    }
+
+    float dt = this->params.timeStep;
+    int count = countSubsteps(0, dt);
+    for (int s = 0; s < count; ++s)
+    {
+        advanceLevel(0, dt / count, 0.0f);
+    }
+
+    FluidSolver& root = *this->levels[0][0]->solver;
+    root.uSource().fill(0.0f);
+    root.vSource().fill(0.0f);
+    root.densitySource().fill(0.0f);
+    root.temperatureSource().fill(0.0f);
+    ++this->stepCount;
+}
+
+// the base sources repeated over the patch cells; each substep adds its share
+void AmrSolver::injectSources(Patch& patch)
+{
+    FluidSolver& root = *this->levels[0][0]->solver;
+    FluidSolver& solver = *patch.solver;
+    const ScalarField* from[4] = {&root.uSource(), &root.vSource(), &root.densitySource(), &root.temperatureSource()};
+    ScalarField* to[4] = {&solver.uSource(), &solver.vSource(), &solver.densitySource(), &solver.temperatureSource()};
+    int scale = powerOf(this->ratio, patch.level);
+    for (int f = 0; f < 4; ++f)
+    {
+        for (int j = 0; j < patch.box.getHeight(); ++j)
+        {
+            const float* src = from[f]->row((patch.box.j0 + j) / scale);
+            float* dst = to[f]->row(j);
+            for (int i = 0; i < patch.box.getWidth(); ++i)
+            {
+                dst[i] = src[(patch.box.i0 + i) / scale];
+            }
+        }
+    }
+}
+
+int AmrSolver::countSubsteps(int level, float dt)
+{
+    std::vector<std::unique_ptr<Patch>>& patches = this->levels[level];
+    std::vector<float> speeds(patches.size(), 0.0f);
+    this->pool->run(static_cast<int>(patches.size()), [&](int k) {
+        const FluidGrid& grid = *patches[k]->grid;
+        float speed = 0.0f;
+        for (int j = 0; j < grid.getNy(); ++j)
+        {
+            const float* u = grid.u().row(j);
+            const float* v = grid.v().row(j);
+            for (int i = 0; i < grid.getNx(); ++i)
+            {
+                speed = std::max(speed, std::max(std::fabs(u[i]), std::fabs(v[i])));
+            }
+        }
+        speeds[k] = speed;
+    });
+    float speed = speeds.empty() ? 0.0f : *std::max_element(speeds.begin(), speeds.end());
+    float needed = speed*dt / (this->criteria.cfl*getLevelCellSize(level));
+    if (!(needed > 1.0f))
+    {
+        return 1;
+    }
+    return needed >= MaxSubsteps ? MaxSubsteps : static_cast<int>(std::ceil(needed));
+}
+
+void AmrSolver::advanceLevel(int level, float dt, float parentFraction)
+{
+    SIMFLUID_PROFILE_ZONE("AMR level step");
+    std::vector<std::unique_ptr<Patch>>& patches = this->levels[level];
+    int count = static_cast<int>(patches.size());
+
+    // ghosts only read the parent and the siblings' interiors, so every patch fills its own at once
+    this->pool->run(count, [&](int k) {
+        Patch& patch = *patches[k];
+        if (level > 0)
+        {
+            fillGhosts(patch, parentFraction);
+        }
+        for (int s = 0; s < StateCount; ++s)
+        {
+            patch.start[s].copyFrom(patch.state(s));
+        }
+    });
+    this->pool->run(count, [&](int k) { stepPatch(*patches[k], dt); });
+    if (level > 0)
+    {
+        matchSiblingFluxes(level);
+        this->pool->run(count, [&](int k) {
+            Patch& patch = *patches[k];
+            int nx = patch.grid->getNx();
+            int ny = patch.grid->getNy();
+            for (int c = 0; c < ConservedCount; ++c)
+            {
+                for (int j = 0; j < ny; ++j)
+                {
+                    patch.sideFlux[c][SideLeft][j] += patch.fluxX[c].at(0, j);
+                    patch.sideFlux[c][SideRight][j] += patch.fluxX[c].at(nx, j);
+                }
+                for (int i = 0; i < nx; ++i)
+                {
+                    patch.sideFlux[c][SideBottom][i] += patch.fluxY[c].at(i, 0);
+                    patch.sideFlux[c][SideTop][i] += patch.fluxY[c].at(i, ny);
+                }
+            }
+        });
+    }
+    ++this->substeps[level];
+
+    if (level + 1 < getNumLevels())
+    {
+        for (std::unique_ptr<Patch>& child : this->levels[level + 1])
+        {
+            for (std::array<std::vector<double>, 4>& sides : child->sideFlux)
+            {
+                for (std::vector<double>& side : sides)
+                {
+                    std::fill(side.begin(), side.end(), 0.0);
+                }
+            }
+        }
+        int children = countSubsteps(level + 1, dt);
+        for (int s = 0; s < children; ++s)
+        {
+            advanceLevel(level + 1, dt / children, static_cast<float>(s) / children);
+        }
+        synchronize(level + 1);
+    }
+}
+
+// parent-level values at the substep's time, then siblings, then the walls
+void AmrSolver::fillGhosts(Patch& patch, float parentFraction)
+{
+    float inverse = 1.0f / this->ratio;
+    int nx = patch.grid->getNx();
+    int ny = patch.grid->getNy();
+    int g = patch.grid->getGhost();
+    AmrBox ring{patch.box.i0 - g, patch.box.j0 - g, patch.box.i1 + g, patch.box.j1 + g};
+    for (int s = 0; s < StateCount; ++s)
+    {
+        ScalarField& field = patch.state(s);
+        for (int j = -g; j < ny + g; ++j)
+        {
+            float y = (patch.box.j0 + j + 0.5f)*inverse - 0.5f;
+            bool inside = j >= 0 && j < ny;
+            for (int i = -g; i < nx + g; i = (inside && i == -1) ? nx : i + 1)
+            {
+                float x = (patch.box.i0 + i + 0.5f)*inverse - 0.5f;
+                field.at(i, j) = sampleLevel(patch.level - 1, s, parentFraction, x, y, patch.parent);
+            }
+        }
+        for (const std::unique_ptr<Patch>& sibling : this->levels[patch.level])
+        {
+            if (sibling.get() == &patch)
+            {
+                continue;
+            }
+            AmrBox overlap = ring.intersect(sibling->box);
+            const ScalarField& other = sibling->state(s);
+            for (int gj = overlap.j0; gj < overlap.j1; ++gj)
+            {
+                for (int gi = overlap.i0; gi < overlap.i1; ++gi)
+                {
+                    field.at(gi - patch.box.i0, gj - patch.box.j0) = other.at(gi - sibling->box.i0, gj - sibling->box.j0);
+                }
+            }
+        }
+        for (int side = SideLeft; side <= SideTop; ++side)
+        {
+            if (patch.wall[side])
+            {
+                applyWallSide(field, StateBoundaries[s], side);
+            }
+        }
+        copyGhostRing(patch.ghosts[s], field);
+    }
+}
+
+void AmrSolver::resetGhosts(Patch& patch, int state)
+{
+    if (patch.level == 0)
+    {
+        applyBoundary(patch.state(state), StateBoundaries[state]);
+        return;
+    }
+    copyGhostRing(patch.state(state), patch.ghosts[state]);
+}
+
+// FluidSolver's velocity step, minus diffusion, with the patch ghosts put back
+// after every stage; then the scalars in flux form
+void AmrSolver::stepPatch(Patch& patch, float dt)
+{
+    SIMFLUID_PROFILE_ZONE("AMR patch step");
+    FluidSolver& solver = *patch.solver;
+    FluidGrid& grid = *patch.grid;
+    ScalarField& u = grid.u();
+    ScalarField& v = grid.v();
+
+    solver.addSource(u, solver.uSource(), dt);
+    solver.addSource(v, solver.vSource(), dt);
+    if (this->params.buoyancy != 0.0f)
+    {
+        solver.addSource(v, grid.temperature(), dt*this->params.buoyancy);
+    }
+    resetGhosts(patch, StateU);
+    resetGhosts(patch, StateV);
+    solver.project();
+    resetGhosts(patch, StateU);
+    resetGhosts(patch, StateV);
+
+    patch.uPrev.copyFrom(u);
+    patch.vPrev.copyFrom(v);
+    solver.advect(u, patch.uPrev, patch.uPrev, patch.vPrev, dt, BoundaryKind::VelocityU);
+    solver.advect(v, patch.vPrev, patch.uPrev, patch.vPrev, dt, BoundaryKind::VelocityV);
+    resetGhosts(patch, StateU);
+    resetGhosts(patch, StateV);
+    solver.project();
+    resetGhosts(patch, StateU);
+    resetGhosts(patch, StateV);
+
+    solver.addSource(grid.density(), solver.densitySource(), dt);
+    solver.addSource(grid.temperature(), solver.temperatureSource(), dt);
+    for (int c = 0; c < ConservedCount; ++c)
+    {
+        resetGhosts(patch, StateDensity + c);
+        advectConservative(patch, c, dt);
+        resetGhosts(patch, StateDensity + c);
+    }
+}
+
+// Donor-cell upwind fluxes on the faces, with the face velocity the mean of the
+// two cells and zero next to a solid. Fluxes are mass (value times area), so
+// they add up across levels.
+void AmrSolver::advectConservative(Patch& patch, int conserved, float dt)
+{
+    FluidGrid& grid = *patch.grid;
+    ScalarField& field = patch.state(StateDensity + conserved);
+    const ScalarField& u = grid.u();
+    const ScalarField& v = grid.v();
+    const ScalarField& solid = patch.trueSolid();
+    ScalarField& fluxX = patch.fluxX[conserved];
+    ScalarField& fluxY = patch.fluxY[conserved];
+    int nx = grid.getNx();
+    int ny = grid.getNy();
+    float h = grid.getCellSize();
+    float scale = dt*h;
+
+    parallelFor(this->pool.get(), 0, ny + 1, [&](int j0, int j1) {
+        for (int j = j0; j < j1; ++j)
+        {
+            if (j < ny)
+            {
+                const float* uc = u.row(j);
+                const float* sc = solid.row(j);
+                const float* q = field.row(j);
+                float* out = fluxX.row(j);
+                for (int i = 0; i <= nx; ++i)
+                {
+                    float face = 0.5f*(uc[i - 1] + uc[i])*(1.0f - sc[i - 1])*(1.0f - sc[i]);
+                    out[i] = scale*face*(face > 0.0f ? q[i - 1] : q[i]);
+                }
+            }
+            const float* vd = v.row(j - 1);
+            const float* vc = v.row(j);
+            const float* sd = solid.row(j - 1);
+            const float* sc = solid.row(j);
+            const float* qd = field.row(j - 1);
+            const float* qc = field.row(j);
+            float* out = fluxY.row(j);
+            for (int i = 0; i < nx; ++i)
+            {
+                float face = 0.5f*(vd[i] + vc[i])*(1.0f - sd[i])*(1.0f - sc[i]);
+                out[i] = scale*face*(face > 0.0f ? qd[i] : qc[i]);
+            }
+        }
+    });
+
+    float inverseArea = 1.0f / (h*h);
+    parallelFor(this->pool.get(), 0, ny, [&](int j0, int j1) {
+        for (int j = j0; j < j1; ++j)
+        {
+            float* q = field.row(j);
+            const float* left = fluxX.row(j);
+            const float* bottom = fluxY.row(j);
+            const float* top = fluxY.row(j + 1);
+            for (int i = 0; i < nx; ++i)
+            {
+                q[i] -= inverseArea*(left[i + 1] - left[i] + top[i] - bottom[i]);
+            }
+        }
+    });
+}
+
+// Two siblings computed the flux through their shared faces from their own
+// sides; both take the mean, and the cells next to the face absorb the change.
+void AmrSolver::matchSiblingFluxes(int level)
+{
+    std::vector<std::unique_ptr<Patch>>& patches = this->levels[level];
+    float h = getLevelCellSize(level);
+    float inverseArea = 1.0f / (h*h);
+    for (std::unique_ptr<Patch>& first : patches)
+    {
+        for (std::unique_ptr<Patch>& second : patches)
+        {
+            Patch& a = *first;
+            Patch& b = *second;
+            int widthA = a.grid->getNx();
+            int heightA = a.grid->getNy();
+            for (int c = 0; c < ConservedCount; ++c)
+            {
+                ScalarField& qa = a.state(StateDensity + c);
+                ScalarField& qb = b.state(StateDensity + c);
+                if (a.box.i1 == b.box.i0)
+                {
+                    // a on the left
+                    for (int gj = std::max(a.box.j0, b.box.j0); gj < std::min(a.box.j1, b.box.j1); ++gj)
+                    {
+                        float& fa = a.fluxX[c].at(widthA, gj - a.box.j0);
+                        float& fb = b.fluxX[c].at(0, gj - b.box.j0);
+                        float mean = 0.5f*(fa + fb);
+                        qa.at(widthA - 1, gj - a.box.j0) += (fa - mean)*inverseArea;
+                        qb.at(0, gj - b.box.j0) += (mean - fb)*inverseArea;
+                        fa = mean;
+                        fb = mean;
+                    }
+                }
+                if (a.box.j1 == b.box.j0)
+                {
+                    // a below
+                    for (int gi = std::max(a.box.i0, b.box.i0); gi < std::min(a.box.i1, b.box.i1); ++gi)
+                    {
+                        float& fa = a.fluxY[c].at(gi - a.box.i0, heightA);
+                        float& fb = b.fluxY[c].at(gi - b.box.i0, 0);
+                        float mean = 0.5f*(fa + fb);
+                        qa.at(gi - a.box.i0, heightA - 1) += (fa - mean)*inverseArea;
+                        qb.at(gi - b.box.i0, 0) += (mean - fb)*inverseArea;
+                        fa = mean;
+                        fb = mean;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// averages `level` down onto its parents and refluxes the parent cells next to it
+void AmrSolver::synchronize(int level)
+{
+    SIMFLUID_PROFILE_ZONE("AMR synchronize");
+    std::vector<std::unique_ptr<Patch>>& children = this->levels[level];
+    std::vector<std::unique_ptr<Patch>>& parents = this->levels[level - 1];
+    int r = this->ratio;
+    float norm = 1.0f / (r*r);
+
+    this->pool->run(static_cast<int>(children.size()), [&](int k) {
+        Patch& child = *children[k];
+        Patch& parent = *parents[child.parent];
+        for (int s = 0; s < StateCount; ++s)
+        {
+            ScalarField& coarse = parent.state(s);
+            const ScalarField& fine = child.state(s);
+            for (int cj = child.box.j0 / r; cj < child.box.j1 / r; ++cj)
+            {
+                for (int ci = child.box.i0 / r; ci < child.box.i1 / r; ++ci)
+                {
+                    float sum = 0.0f;
+                    for (int b = 0; b < r; ++b)
+                    {
+                        const float* row = fine.row(cj*r + b - child.box.j0);
+                        for (int a = 0; a < r; ++a)
+                        {
+                            sum += row[ci*r + a - child.box.i0];
+                        }
+                    }
+                    coarse.at(ci - parent.box.i0, cj - parent.box.j0) = sum*norm;
+                }
+            }
+        }
+    });
+    if (!this->refluxing)
+    {
+        return;
+    }
+
+    // serial: two children can border the same parent cell
+    float hc = getLevelCellSize(level - 1);
+    double inverseArea = 1.0 / (static_cast<double>(hc)*hc);
+    for (std::unique_ptr<Patch>& childPointer : children)
+    {
+        Patch& child = *childPointer;
+        int ci0 = child.box.i0 / r;
+        int ci1 = child.box.i1 / r;
+        int cj0 = child.box.j0 / r;
+        int cj1 = child.box.j1 / r;
+        for (int c = 0; c < ConservedCount; ++c)
+        {
+            const std::array<std::vector<double>, 4>& fine = child.sideFlux[c];
+            // the outside cell (ci, cj), in whichever parent holds it, used its own flux
+            // through the face at (fi, fj); sign is +1 when that is its right or top face
+            auto reflux = [&](int ci, int cj, int fi, int fj, bool xFace, double fineFlux, double sign) {
+                int k = findPatch(level - 1, ci, cj, child.parent);
+                if (k < 0 || findPatch(level, ci*r, cj*r, -1) >= 0)
+                {
+                    return;
+                }
+                Patch& parent = *parents[k];
+                const AmrBox& pbox = parent.box;
+                float coarseFlux = (xFace ? parent.fluxX[c] : parent.fluxY[c]).at(fi - pbox.i0, fj - pbox.j0);
+                parent.state(StateDensity + c).at(ci - pbox.i0, cj - pbox.j0) +=
+                    static_cast<float>(sign*(coarseFlux - fineFlux)*inverseArea);
+            };
+            auto fineSum = [&](int side, int first) {
+                double sum = 0.0;
+                for (int a = 0; a < r; ++a)
+                {
+                    sum += fine[side][first + a];
+                }
+                return sum;
+            };
+            for (int cj = cj0; cj < cj1 && !child.wall[SideLeft]; ++cj)
+            {
+                reflux(ci0 - 1, cj, ci0, cj, true, fineSum(SideLeft, cj*r - child.box.j0), 1.0);
+            }
+            for (int cj = cj0; cj < cj1 && !child.wall[SideRight]; ++cj)
+            {
+                reflux(ci1, cj, ci1, cj, true, fineSum(SideRight, cj*r - child.box.j0), -1.0);
+            }
+            for (int ci = ci0; ci < ci1 && !child.wall[SideBottom]; ++ci)
+            {
+                reflux(ci, cj0 - 1, ci, cj0, false, fineSum(SideBottom, ci*r - child.box.i0), 1.0);
+            }
+            for (int ci = ci0; ci < ci1 && !child.wall[SideTop]; ++ci)
+            {
+                reflux(ci, cj1, ci, cj1, false, fineSum(SideTop, ci*r - child.box.i0), -1.0);
+            }
+        }
+    }
+}
+
+//--------------------------------COMPOSITE----------------------------------------
+double AmrSolver::compositeSum(FluidField field) const
+{
+    double total = 0.0;
+    for (int level = 0; level < getNumLevels(); ++level)
+    {
+        double area = 1.0 / (static_cast<double>(powerOf(this->ratio, level))*powerOf(this->ratio, level));
+        for (const std::unique_ptr<Patch>& patch : this->levels[level])
+        {
+            int nx = patch->box.getWidth();
+            int ny = patch->box.getHeight();
+            std::vector<unsigned char> covered(static_cast<std::size_t>(nx)*ny, 0);
+            if (level + 1 < getNumLevels())
+            {
+                for (const std::unique_ptr<Patch>& fine : this->levels[level + 1])
+                {
+                    AmrBox shadow{fine->box.i0 / this->ratio, fine->box.j0 / this->ratio,
+                                  fine->box.i1 / this->ratio, fine->box.j1 / this->ratio};
+                    shadow = shadow.intersect(patch->box);
+                    for (int gj = shadow.j0; gj < shadow.j1; ++gj)
+                    {
+                        for (int gi = shadow.i0; gi < shadow.i1; ++gi)
+                        {
+                            covered[static_cast<std::size_t>(gj - patch->box.j0)*nx + gi - patch->box.i0] = 1;
+                        }
+                    }
+                }
+            }
+            const ScalarField& values = patch->grid->field(field);
+            double sum = 0.0;
+            for (int j = 0; j < ny; ++j)
+            {
+                for (int i = 0; i < nx; ++i)
+                {
+                    if (!covered[static_cast<std::size_t>(j)*nx + i])
+                    {
+                        sum += values.at(i, j);
+                    }
+                }
+            }
+            total += sum*area;
+        }
+    }
+    return total;
+}
+
+void AmrSolver::sampleComposite(FluidField field, int level, ScalarField& out) const
+{
+    AmrBox target = getLevelDomain(level);
+    if (out.getNx() != target.getWidth() || out.getNy() != target.getHeight())
+    {
+        throw std::invalid_argument("AmrSolver::sampleComposite: output does not match the level's domain");
+    }
+    for (int l = 0; l <= level && l < getNumLevels(); ++l)
+    {
+        int scale = powerOf(this->ratio, level - l);
+        for (const std::unique_ptr<Patch>& patch : this->levels[l])
+        {
+            const ScalarField& values = patch->grid->field(field);
+            for (int j = 0; j < patch->box.getHeight(); ++j)
+            {
+                for (int i = 0; i < patch->box.getWidth(); ++i)
+                {
+                    float value = values.at(i, j);
+                    for (int b = 0; b < scale; ++b)
+                    {
+                        float* row = out.row((patch->box.j0 + j)*scale + b);
+                        for (int a = 0; a < scale; ++a)
+                        {
+                            row[(patch->box.i0 + i)*scale + a] = value;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
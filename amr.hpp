@@ -0,0 +1,184 @@
+#ifndef AMR_HPP
+#define AMR_HPP
+
+#include "fluidgrid.hpp"
+#include "fluidsolver.hpp"
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class ThreadPool;
+
+// Cells [i0, i1) x [j0, j1) in the index space of one refinement level.
+struct AmrBox
+{
+    int i0{0};
+    int j0{0};
+    int i1{0};
+    int j1{0};
+
+    int getWidth() const { return this->i1 - this->i0; }
+    int getHeight() const { return this->j1 - this->j0; }
+    int getCellCount() const { return isEmpty() ? 0 : getWidth()*getHeight(); }
+    bool isEmpty() const { return this->i1 <= this->i0 || this->j1 <= this->j0; }
+    bool contains(int i, int j) const { return i >= this->i0 && i < this->i1 && j >= this->j0 && j < this->j1; }
+    bool contains(const AmrBox& other) const
+    {
+        return other.i0 >= this->i0 && other.i1 <= this->i1 && other.j0 >= this->j0 && other.j1 <= this->j1;
+    }
+    AmrBox intersect(const AmrBox& other) const
+    {
+        return {std::max(this->i0, other.i0), std::max(this->j0, other.j0),
+                std::min(this->i1, other.i1), std::min(this->j1, other.j1)};
+    }
+    AmrBox refine(int ratio) const { return {this->i0*ratio, this->j0*ratio, this->i1*ratio, this->j1*ratio}; }
+};
+
+// Covers the tagged cells of a width x height mask (row-major, nonzero means
+// tagged) with disjoint boxes after Berger and Rigoutsos: a box shrunk to its
+// tags is kept once at least `efficiency` of its cells are tagged, and is
+// otherwise cut at a hole in the row or column tag counts, else at the
+// strongest inflection of their second difference, else in half. Boxes with a
+// side longer than maxSize are halved as well.
+std::vector<AmrBox> clusterTaggedCells(const std::vector<unsigned char>& tags, int width, int height,
+                                       float efficiency, int maxSize);
+
+struct AmrCriteria
+{
+    // finest level; level l has refinementRatio^l times the base resolution
+    int maxLevel{2};
+    // a power of two
+    int refinementRatio{2};
+    // cells are tagged where the velocity (curl) or the density changes by more
+    // than these across a cell of their level, as in QuadtreeCriteria
+    float vorticityThreshold{0.05f};
+    float gradientThreshold{0.05f};
+    bool refineObstacles{true};
+    // tags are clustered on blocks of this many cells, dilated by bufferCells
+    int blockingFactor{8};
+    int bufferCells{2};
+    float clusterEfficiency{0.7f};
+    // longest patch side in cells of its level; smaller patches spread better over the pool
+    int maxPatchSize{64};
+    // base steps between regrids
+    int regridInterval{4};
+    // every level takes as many equal substeps as keep max|u| dt / h below this
+    float cfl{0.5f};
+};
+
+// Block-structured adaptive refinement over a base FluidGrid (Berger-Oliger).
+// Level 0 is the base grid; every finer level is a set of disjoint rectangular
+// patches, each its own FluidGrid at refinementRatio times the resolution of
+// its parent level and stepped by its own FluidSolver. A patch lies inside one
+// parent patch, with at least one cell of the parent level (in that patch or
+// an adjacent sibling) around it except along the domain walls, so its ghost
+// cells can always be interpolated from the level below.
+//
+// One step() advances the base level by parameters().timeStep, split into
+// CFL-limited substeps. After each step of a level its children take as many
+// substeps of their own as their CFL limit needs to catch up, with ghost
+// values interpolated in space and linearly in time from the parent (or copied
+// from adjacent siblings). Then the children are averaged down onto the
+// parent and the parent cells next to them are refluxed: density and
+// temperature are advected in flux form, and the parent's fluxes through the
+// coarse-fine faces are replaced by the sum of the children's, so both are
+// conserved across levels. Fluxes through faces shared by two sibling patches
+// are made to agree the same way. Velocity is semi-Lagrangian and projected
+// per patch, with the patch edges closed to the correction (zero pressure
+// gradient) and the edge velocities taken from the parent.
+//
+// The patches of a level are stepped in parallel as tasks of one pool, and the
+// row loops inside each patch run nested on the same pool.
+//
+// Only timeStep and buoyancy of parameters() apply; viscosity and diffusion
+// are not modelled on the hierarchy.
+class AmrSolver
+{
+public:
+    explicit AmrSolver(FluidGrid& base, int numThreads = 0);
+    ~AmrSolver();
+
+    FluidGrid& getBaseGrid() { return this->base; }
+    ThreadPool& getThreadPool() { return *this->pool; }
+    FluidParameters& parameters() { return this->params; }
+
+    // takes effect at the next regrid; throws std::invalid_argument for a
+    // refinement ratio that is not a power of two or non-positive sizes
+    void setCriteria(const AmrCriteria& criteria);
+    const AmrCriteria& getCriteria() const { return this->criteria; }
+    // every level, current patches and future ones
+    void usePressureSolver(PressureSolverKind kind);
+    // solid(x, y) with x, y in base cells, sampled at the cell centres of every
+    // level; without it fine patches inherit the base obstacle cell by cell
+    void setObstacle(std::function<bool(float, float)> solid);
+    // false skips the reflux, leaving the coarse-fine fluxes mismatched
+    void setRefluxing(bool enabled) { this->refluxing = enabled; }
+
+    // at base resolution, added at the start of the next step on every level and then cleared
+    ScalarField& densitySource();
+    ScalarField& temperatureSource();
+    ScalarField& uSource();
+    ScalarField& vSource();
+
+    void step();
+    // rebuilds every level above the base from the tags of the level below;
+    // step() calls it every regridInterval steps
+    void regrid();
+
+    // levels that hold patches, the base included
+    int getNumLevels() const { return static_cast<int>(this->levels.size()); }
+    int getPatchCount(int level) const;
+    const AmrBox& getPatchBox(int level, int patch) const;
+    const FluidGrid& getPatchGrid(int level, int patch) const;
+    // the whole domain in cells of `level`
+    AmrBox getLevelDomain(int level) const;
+    float getLevelCellSize(int level) const;
+    // steps `level` took during the last step()
+    int getSubsteps(int level) const;
+
+    // integral of a field over the composite grid (the finest data wherever
+    // present), in units of value times base-cell area
+    double compositeSum(FluidField field) const;
+    // the composite field resampled to the resolution of `level`; coarser data
+    // is repeated over the cells it covers. Throws std::invalid_argument unless
+    // `out` has the shape of getLevelDomain(level).
+    void sampleComposite(FluidField field, int level, ScalarField& out) const;
+
+private:
+    struct Patch;
+
+    std::unique_ptr<Patch> makePatch(int level, const AmrBox& box, int parent);
+    void rasterizeObstacle(Patch& patch);
+    void initializeFromParent(Patch& patch, const std::vector<std::unique_ptr<Patch>>& previous);
+    void computeFineBoxes(int level, std::vector<AmrBox>& boxes, std::vector<int>& parents);
+    void tagCells(const Patch& patch, std::vector<unsigned char>& tags) const;
+
+    void advanceLevel(int level, float dt, float parentFraction);
+    int countSubsteps(int level, float dt);
+    void fillGhosts(Patch& patch, float parentFraction);
+    void resetGhosts(Patch& patch, int state);
+    void stepPatch(Patch& patch, float dt);
+    void advectConservative(Patch& patch, int conserved, float dt);
+    void matchSiblingFluxes(int level);
+    void synchronize(int level);
+    void injectSources(Patch& patch);
+    // the patch of `level` holding cell (i, j), trying `hint` first; -1 if none
+    int findPatch(int level, int i, int j, int hint) const;
+    float sampleLevel(int level, int state, float fraction, float x, float y, int hint) const;
+
+    FluidGrid& base;
+    FluidParameters params;
+    AmrCriteria criteria;
+    PressureSolverKind pressureKind{PressureSolverKind::Multigrid};
+    std::function<bool(float, float)> obstacleShape;
+    bool refluxing{true};
+    int ratio{2};                 // the current patches were built with this refinement ratio
+    int stepCount{0};
+    std::vector<int> substeps;
+    // declared before the levels so the patch solvers go first
+    std::unique_ptr<ThreadPool> pool;
+    std::vector<std::vector<std::unique_ptr<Patch>>> levels;
+};
+
+#endif // AMR_HPP
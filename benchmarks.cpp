@@ -0,0 +1,487 @@
+// SimFluidBench: microbenchmarks for the hot kernels of the physics library
+// and the CPU side of the renderer. Threaded kernels take (n, threads) and
+// report wall time; cells/s is reported as items_per_second everywhere.
+//
+// Results meant for diffing across commits:
+//   SimFluidBench --benchmark_out=bench.json --benchmark_out_format=json
+// (the bench_json target does exactly that into the build directory), then
+// compare two files with tools/compare.py from Google Benchmark.
+#include <benchmark/benchmark.h>
+#include "fluidgrid.hpp"
+#include "fluidsolver.hpp"
+#include "pressuresolver.hpp"
+#include "multigridsolver.hpp"
+#include "pcgsolver.hpp"
+#include "smoothers.hpp"
+#include "gridlayout.hpp"
+#include "quadtree.hpp"
+#include "amr.hpp"
+#include "threadpool.hpp"
+#include "cpudispatch.hpp"
+#include "fieldimage.hpp"
+#include "gridgeometry.hpp"
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace
+{
+const std::vector<std::int64_t> GridSizes{128, 256, 512, 1024};
+const std::vector<std::int64_t> ThreadCounts{1, 2, 4, 8};
+
+// a smooth swirl and a blob of density, so backtraces land everywhere in the grid
+void fillTestState(FluidGrid& grid)
+{
+    int nx = grid.getNx();
+    int ny = grid.getNy();
+    const float pi = 3.14159265f;
+    for (int j = 0; j < ny; ++j)
+    {
+        for (int i = 0; i < nx; ++i)
+        {
+            float x = (i + 0.5f) / nx;
+            float y = (j + 0.5f) / ny;
+            grid.u().at(i, j) = 4.0f*std::sin(pi*x)*std::cos(pi*y);
+            grid.v().at(i, j) = -4.0f*std::cos(pi*x)*std::sin(pi*y);
+            float dx = x - 0.5f;
+            float dy = y - 0.3f;
+            grid.density().at(i, j) = std::exp(-40.0f*(dx*dx + dy*dy));
+        }
+    }
+    applyBoundary(grid.u(), BoundaryKind::VelocityU);
+    applyBoundary(grid.v(), BoundaryKind::VelocityV);
+    applyBoundary(grid.density(), BoundaryKind::Scalar);
+}
+
+void setCellsProcessed(benchmark::State& state, std::int64_t cellsPerIteration)
+{
+    state.SetItemsProcessed(state.iterations()*cellsPerIteration);
+}
+
+//--------------------------------SOLVER KERNELS-----------------------------------
+// args: n, threads, ISA level
+void BM_Advect(benchmark::State& state)
+{
+    int n = static_cast<int>(state.range(0));
+    IsaLevel level = static_cast<IsaLevel>(state.range(2));
+    if (static_cast<int>(level) > static_cast<int>(detectIsaLevel()))
+    {
+        state.SkipWithError("ISA level not supported by this CPU");
+        return;
+    }
+    FluidGrid grid(n, n);
+    FluidSolver solver(grid, static_cast<int>(state.range(1)));
+    fillTestState(grid);
+    ScalarField out = grid.makeScratchField();
+
+    IsaLevel previous = getIsaLevel();
+    forceIsaLevel(level);
+    for (auto _ : state)
+    {
+        solver.advect(out, grid.density(), grid.u(), grid.v(), 0.1f, BoundaryKind::Scalar);
+        benchmark::DoNotOptimize(out.row(0));
+        benchmark::ClobberMemory();
+    }
+    forceIsaLevel(previous);
+    state.SetLabel(isaLevelName(level));
+    setCellsProcessed(state, static_cast<std::int64_t>(n)*n);
+}
+BENCHMARK(BM_Advect)
+    ->ArgNames({"n", "threads", "isa"})
+    ->ArgsProduct({GridSizes, ThreadCounts,
+                   {static_cast<int>(IsaLevel::Scalar), static_cast<int>(IsaLevel::Sse42),
+                    static_cast<int>(IsaLevel::Avx2), static_cast<int>(IsaLevel::Avx512)}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+// args: n, threads
+void BM_Divergence(benchmark::State& state)
+{
+    int n = static_cast<int>(state.range(0));
+    FluidGrid grid(n, n);
+    FluidSolver solver(grid, static_cast<int>(state.range(1)));
+    fillTestState(grid);
+    ScalarField out = grid.makeScratchField();
+    for (auto _ : state)
+    {
+        solver.computeDivergence(out);
+        benchmark::DoNotOptimize(out.row(0));
+        benchmark::ClobberMemory();
+    }
+    setCellsProcessed(state, static_cast<std::int64_t>(n)*n);
+}
+BENCHMARK(BM_Divergence)
+    ->ArgNames({"n", "threads"})
+    ->ArgsProduct({GridSizes, ThreadCounts})
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+// Eight relaxation sweeps, plain (sweepsPerTile 1) or temporally blocked;
+// sweeps/s is the figure to compare. args: smoother kind, n, sweeps per tile, threads
+void BM_Smoother(benchmark::State& state)
+{
+    const int sweeps = 8;
+    SmootherKind kind = static_cast<SmootherKind>(state.range(0));
+    int n = static_cast<int>(state.range(1));
+    FluidGrid grid(n, n);
+    fillTestState(grid);
+    ThreadPool pool(static_cast<int>(state.range(3)));
+    ScalarField rhs = grid.makeScratchField();
+    FluidSolver(grid, 1).computeDivergence(rhs);
+    removeFluidMean(rhs, grid.obstacle());
+
+    PoissonSmoother smoother(&pool, kind);
+    smoother.setSweepsPerTile(static_cast<int>(state.range(2)));
+    ScalarField& p = grid.pressure();
+    for (auto _ : state)
+    {
+        smoother.smooth(p, rhs, grid.obstacle(), sweeps);
+        benchmark::DoNotOptimize(p.row(0));
+        benchmark::ClobberMemory();
+    }
+    state.SetLabel(kind == SmootherKind::RedBlackGaussSeidel ? "rbgs" : "jacobi");
+    state.counters["sweeps/s"] = benchmark::Counter(static_cast<double>(state.iterations())*sweeps,
+                                                    benchmark::Counter::kIsRate);
+    setCellsProcessed(state, static_cast<std::int64_t>(sweeps)*n*n);
+}
+BENCHMARK(BM_Smoother)
+    ->ArgNames({"kind", "n", "tile_sweeps", "threads"})
+    ->ArgsProduct({{static_cast<int>(SmootherKind::RedBlackGaussSeidel), static_cast<int>(SmootherKind::WeightedJacobi)},
+                   GridSizes, {1, 2, 4, 8}, ThreadCounts})
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+// The same Jacobi sweep over each storage layout; the sizes reach past the
+// point where row-major vertical neighbours stop sharing pages. args: n, threads
+template <class Layout>
+void BM_LayoutJacobi(benchmark::State& state)
+{
+    int n = static_cast<int>(state.range(0));
+    FluidGrid grid(n, n);
+    fillTestState(grid);
+    ScalarField divergence = grid.makeScratchField();
+    FluidSolver(grid, 1).computeDivergence(divergence);
+    removeFluidMean(divergence, grid.obstacle());
+
+    ThreadPool pool(static_cast<int>(state.range(1)));
+    LayoutField<Layout> p(n, n), out(n, n), rhs(n, n), obstacle(n, n);
+    rhs.copyFrom(divergence);
+    obstacle.copyFrom(grid.obstacle());
+    for (auto _ : state)
+    {
+        layoutJacobiSweep(p, rhs, obstacle, out, &pool);
+        p.swap(out);
+        benchmark::ClobberMemory();
+    }
+    state.SetLabel(Layout::Name);
+    setCellsProcessed(state, static_cast<std::int64_t>(n)*n);
+}
+BENCHMARK_TEMPLATE(BM_LayoutJacobi, RowMajorLayout)
+    ->ArgNames({"n", "threads"})
+    ->ArgsProduct({{256, 1024, 2048, 4096}, ThreadCounts})
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_LayoutJacobi, Tiled8Layout)
+    ->ArgNames({"n", "threads"})
+    ->ArgsProduct({{256, 1024, 2048, 4096}, ThreadCounts})
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_LayoutJacobi, Tiled16Layout)
+    ->ArgNames({"n", "threads"})
+    ->ArgsProduct({{256, 1024, 2048, 4096}, ThreadCounts})
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_LayoutJacobi, MortonLayout)
+    ->ArgNames({"n", "threads"})
+    ->ArgsProduct({{256, 1024, 2048, 4096}, ThreadCounts})
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+// A fixed number of iterations (sweeps, V-cycles or CG steps) with the
+// tolerance disabled, so the time is the cost per iteration rather than
+// convergence speed. args: solver kind, n, threads
+void BM_PressureIterations(benchmark::State& state)
+{
+    const int iterations = 10;
+    PressureSolverKind kind = static_cast<PressureSolverKind>(state.range(0));
+    int n = static_cast<int>(state.range(1));
+    FluidGrid grid(n, n);
+    FluidSolver solver(grid, static_cast<int>(state.range(2)));
+    solver.usePressureSolver(kind);
+    PressureSolver& pressure = solver.getPressureSolver();
+    pressure.setTolerance(0.0);
+    pressure.setMaxIterations(iterations);
+    if (kind == PressureSolverKind::Jacobi)
+    {
+        // only the final residual check, like a production sweep count
+        static_cast<JacobiPressureSolver&>(pressure).setCheckInterval(iterations);
+    }
+
+    fillTestState(grid);
+    ScalarField rhs = grid.makeScratchField();
+    solver.computeDivergence(rhs);
+    removeFluidMean(rhs, grid.obstacle());
+    ScalarField& p = grid.pressure();
+    for (auto _ : state)
+    {
+        p.fill(0.0f);
+        PressureSolveStats stats = pressure.solve(p, rhs, grid.obstacle());
+        benchmark::DoNotOptimize(stats.iterations);
+    }
+    setCellsProcessed(state, static_cast<std::int64_t>(n)*n*iterations);
+    state.counters["iterations"] = iterations;
+}
+BENCHMARK(BM_PressureIterations)
+    ->ArgNames({"solver", "n", "threads"})
+    ->ArgsProduct({{static_cast<int>(PressureSolverKind::Jacobi), static_cast<int>(PressureSolverKind::Multigrid),
+                    static_cast<int>(PressureSolverKind::ConjugateGradient)},
+                   GridSizes, ThreadCounts})
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+// One adaptive projection solve: rebuilding the quadtree on the test state plus
+// the leaf solve to the default tolerance. args: n, threads
+void BM_QuadtreeProjection(benchmark::State& state)
+{
+    int n = static_cast<int>(state.range(0));
+    FluidGrid grid(n, n);
+    FluidSolver solver(grid, static_cast<int>(state.range(1)));
+    solver.usePressureSolver(PressureSolverKind::Quadtree);
+    auto& pressure = static_cast<QuadtreePressureSolver&>(solver.getPressureSolver());
+
+    fillTestState(grid);
+    ScalarField rhs = grid.makeScratchField();
+    solver.computeDivergence(rhs);
+    removeFluidMean(rhs, grid.obstacle());
+    ScalarField& p = grid.pressure();
+    int iterations = 0;
+    for (auto _ : state)
+    {
+        p.fill(0.0f);
+        pressure.adaptTo(grid);
+        PressureSolveStats stats = pressure.solve(p, rhs, grid.obstacle());
+        iterations = stats.iterations;
+    }
+    setCellsProcessed(state, static_cast<std::int64_t>(n)*n);
+    state.counters["leaves"] = pressure.getTree().getLeafCount();
+    state.counters["iterations"] = iterations;
+}
+BENCHMARK(BM_QuadtreeProjection)
+    ->ArgNames({"n", "threads"})
+    ->ArgsProduct({GridSizes, {1, 4}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+// args: n, threads
+void BM_SolverStep(benchmark::State& state)
+{
+    int n = static_cast<int>(state.range(0));
+    FluidGrid grid(n, n);
+    FluidSolver solver(grid, static_cast<int>(state.range(1)));
+    solver.usePressureSolver(PressureSolverKind::Multigrid);
+    solver.parameters().buoyancy = 2.0f;
+    fillTestState(grid);
+    for (auto _ : state)
+    {
+        solver.densitySource().at(n/2, 4) = 10.0f;
+        solver.temperatureSource().at(n/2, 4) = 5.0f;
+        solver.step();
+    }
+    setCellsProcessed(state, static_cast<std::int64_t>(n)*n);
+}
+BENCHMARK(BM_SolverStep)
+    ->ArgNames({"n", "threads"})
+    ->ArgsProduct({GridSizes, ThreadCounts})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+// args: n, sparse, threads. A plume from a small source in otherwise still air,
+// which is what sparse blocks are for; "active" is the fraction of blocks visited.
+void BM_SparseStep(benchmark::State& state)
+{
+    int n = static_cast<int>(state.range(0));
+    FluidGrid grid(n, n);
+    FluidSolver solver(grid, static_cast<int>(state.range(2)));
+    solver.usePressureSolver(PressureSolverKind::Multigrid);
+    solver.parameters().buoyancy = 2.0f;
+    solver.setSparse(state.range(1) != 0);
+    auto addPlume = [&]() {
+        for (int j = 4; j < 8; ++j)
+        {
+            for (int i = n/2 - 4; i < n/2 + 4; ++i)
+            {
+                solver.densitySource().at(i, j) = 10.0f;
+                solver.temperatureSource().at(i, j) = 5.0f;
+            }
+        }
+    };
+    for (int warmUp = 0; warmUp < 20; ++warmUp)
+    {
+        addPlume();
+        solver.step();
+    }
+    for (auto _ : state)
+    {
+        addPlume();
+        solver.step();
+    }
+    setCellsProcessed(state, static_cast<std::int64_t>(n)*n);
+    state.counters["active"] = solver.getSparseMemoryUsage().getActiveFraction();
+}
+BENCHMARK(BM_SparseStep)
+    ->ArgNames({"n", "sparse", "threads"})
+    ->ArgsProduct({GridSizes, {0, 1}, ThreadCounts})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+// args: n, threads. The same plume on an AMR hierarchy over an n x n base, two
+// levels of refinement following it; "patches" and "fineCells" describe the
+// hierarchy after the last step.
+void BM_AmrStep(benchmark::State& state)
+{
+    int n = static_cast<int>(state.range(0));
+    FluidGrid grid(n, n);
+    AmrSolver amr(grid, static_cast<int>(state.range(1)));
+    amr.parameters().buoyancy = 2.0f;
+    auto addPlume = [&]() {
+        for (int j = 4; j < 8; ++j)
+        {
+            for (int i = n/2 - 4; i < n/2 + 4; ++i)
+            {
+                amr.densitySource().at(i, j) = 10.0f;
+                amr.temperatureSource().at(i, j) = 5.0f;
+            }
+        }
+    };
+    for (int warmUp = 0; warmUp < 20; ++warmUp)
+    {
+        addPlume();
+        amr.step();
+    }
+    for (auto _ : state)
+    {
+        addPlume();
+        amr.step();
+    }
+    setCellsProcessed(state, static_cast<std::int64_t>(n)*n);
+    int patches = 0;
+    std::int64_t fineCells = 0;
+    for (int level = 1; level < amr.getNumLevels(); ++level)
+    {
+        patches += amr.getPatchCount(level);
+        for (int k = 0; k < amr.getPatchCount(level); ++k)
+            fineCells += amr.getPatchBox(level, k).getCellCount();
+    }
+    state.counters["patches"] = patches;
+    state.counters["fineCells"] = static_cast<double>(fineCells);
+}
+BENCHMARK(BM_AmrStep)
+    ->ArgNames({"n", "threads"})
+    ->ArgsProduct({{128, 256}, ThreadCounts})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+//--------------------------------RENDER PREP--------------------------------------
+// CPU reference of the shader's colormap lookup, i.e. what the old per-vertex
+// colour path paid every frame
+void BM_ColormapToRgba(benchmark::State& state)
+{
+    int n = static_cast<int>(state.range(0));
+    FluidGrid grid(n, n);
+    fillTestState(grid);
+    const ScalarField& field = grid.density();
+    std::vector<float> lut = buildColormapLut(Colormap::Inferno);
+    std::vector<float> rgba(static_cast<std::size_t>(n)*n*4);
+    FieldRange range{0.0f, 1.0f};
+    for (auto _ : state)
+    {
+        float* out = rgba.data();
+        for (int j = 0; j < n; ++j)
+        {
+            const float* r = field.row(j);
+            for (int i = 0; i < n; ++i, out += 4)
+            {
+                mapToRgba(lut, range, r[i], out);
+            }
+        }
+        benchmark::DoNotOptimize(rgba.data());
+    }
+    setCellsProcessed(state, static_cast<std::int64_t>(n)*n);
+}
+BENCHMARK(BM_ColormapToRgba)->ArgName("n")->ArgsProduct({GridSizes})->Unit(benchmark::kMicrosecond);
+
+void BM_ComputeFieldRange(benchmark::State& state)
+{
+    int n = static_cast<int>(state.range(0));
+    FluidGrid grid(n, n);
+    fillTestState(grid);
+    for (auto _ : state)
+    {
+        FieldRange range = computeFieldRange(grid.density());
+        benchmark::DoNotOptimize(range);
+    }
+    setCellsProcessed(state, static_cast<std::int64_t>(n)*n);
+}
+BENCHMARK(BM_ComputeFieldRange)->ArgName("n")->ArgsProduct({GridSizes})->Unit(benchmark::kMicrosecond);
+
+// what the streamed R32F upload does per frame: one copy plus the range
+void BM_PackFieldRows(benchmark::State& state)
+{
+    int n = static_cast<int>(state.range(0));
+    FluidGrid grid(n, n);
+    fillTestState(grid);
+    std::vector<float> packed(static_cast<std::size_t>(n)*n);
+    for (auto _ : state)
+    {
+        FieldRange range = packFieldRows(grid.density(), packed.data());
+        benchmark::DoNotOptimize(range);
+        benchmark::DoNotOptimize(packed.data());
+    }
+    setCellsProcessed(state, static_cast<std::int64_t>(n)*n);
+    state.SetBytesProcessed(state.iterations()*static_cast<std::int64_t>(n)*n*sizeof(float));
+}
+BENCHMARK(BM_PackFieldRows)->ArgName("n")->ArgsProduct({GridSizes})->Unit(benchmark::kMicrosecond);
+
+void BM_PackFieldAsHalf(benchmark::State& state)
+{
+    int n = static_cast<int>(state.range(0));
+    FluidGrid grid(n, n);
+    fillTestState(grid);
+    std::vector<std::uint16_t> packed;
+    for (auto _ : state)
+    {
+        packFieldAsHalf(grid.density(), packed);
+        benchmark::DoNotOptimize(packed.data());
+    }
+    setCellsProcessed(state, static_cast<std::int64_t>(n)*n);
+}
+BENCHMARK(BM_PackFieldAsHalf)->ArgName("n")->ArgsProduct({GridSizes})->Unit(benchmark::kMicrosecond);
+
+// the vertex and index buffers SceneView builds for its IndexedBuffers geometry mode
+void BM_BuildGridVertices(benchmark::State& state)
+{
+    int n = static_cast<int>(state.range(0));
+    for (auto _ : state)
+    {
+        std::vector<float> vertices = buildGridVertices(n);
+        benchmark::DoNotOptimize(vertices.data());
+    }
+    setCellsProcessed(state, static_cast<std::int64_t>(n + 1)*(n + 1));
+}
+BENCHMARK(BM_BuildGridVertices)->ArgName("n")->ArgsProduct({GridSizes})->Unit(benchmark::kMicrosecond);
+
+void BM_BuildGridIndices(benchmark::State& state)
+{
+    int n = static_cast<int>(state.range(0));
+    for (auto _ : state)
+    {
+        std::vector<int> indices = buildGridIndices(n);
+        benchmark::DoNotOptimize(indices.data());
+    }
+    setCellsProcessed(state, static_cast<std::int64_t>(n)*n);
+}
+BENCHMARK(BM_BuildGridIndices)->ArgName("n")->ArgsProduct({GridSizes})->Unit(benchmark::kMicrosecond);
+}
+
+BENCHMARK_MAIN();
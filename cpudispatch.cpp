@@ -0,0 +1,168 @@
+#include "cpudispatch.hpp"
+#include <atomic>
+#include <cstdlib>
+
+#if defined(SIMFLUID_X86_KERNELS)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace
+{
+#if defined(SIMFLUID_X86_KERNELS)
+void cpuid(unsigned leaf, unsigned subleaf, unsigned regs[4])
+{
+#if defined(_MSC_VER)
+    int values[4];
+    __cpuidex(values, static_cast<int>(leaf), static_cast<int>(subleaf));
+    for (int k = 0; k < 4; ++k)
+    {
+        regs[k] = static_cast<unsigned>(values[k]);
+    }
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// XCR0: which register files the OS saves on context switches
+unsigned long long readXcr0()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+}
+
+IsaLevel queryCpu()
+{
+    unsigned regs[4];
+    cpuid(0, 0, regs);
+    unsigned maxLeaf = regs[0];
+    cpuid(1, 0, regs);
+    unsigned ecx1 = regs[2];
+    bool sse42 = (ecx1 >> 20) & 1u;
+    bool fma = (ecx1 >> 12) & 1u;
+    bool osxsave = (ecx1 >> 27) & 1u;
+    bool avx = (ecx1 >> 28) & 1u;
+    if (!sse42)
+    {
+        return IsaLevel::Scalar;
+    }
+    if (!osxsave || !avx || maxLeaf < 7)
+    {
+        return IsaLevel::Sse42;
+    }
+    unsigned long long xcr0 = readXcr0();
+    bool ymmSaved = (xcr0 & 0x6) == 0x6;
+    bool zmmSaved = (xcr0 & 0xe6) == 0xe6;
+    cpuid(7, 0, regs);
+    bool avx2 = (regs[1] >> 5) & 1u;
+    bool avx512f = (regs[1] >> 16) & 1u;
+    if (!ymmSaved || !avx2 || !fma)
+    {
+        return IsaLevel::Sse42;
+    }
+    return (avx512f && zmmSaved) ? IsaLevel::Avx512 : IsaLevel::Avx2;
+}
+#endif
+
+IsaLevel clampToCpu(IsaLevel level)
+{
+    IsaLevel detected = detectIsaLevel();
+    return (static_cast<int>(level) > static_cast<int>(detected)) ? detected : level;
+}
+
+IsaLevel initialLevel()
+{
+    IsaLevel level = detectIsaLevel();
+    const char* requested = std::getenv("SIMFLUID_ISA");
+    IsaLevel parsed;
+    if (requested && parseIsaLevel(requested, parsed))
+    {
+        level = clampToCpu(parsed);
+    }
+    return level;
+}
+
+std::atomic<int>& activeLevel()
+{
+    static std::atomic<int> level{static_cast<int>(initialLevel())};
+    return level;
+}
+}
+
+IsaLevel detectIsaLevel()
+{
+#if defined(SIMFLUID_X86_KERNELS)
+    static const IsaLevel detected = queryCpu();
+    return detected;
+#else
+    return IsaLevel::Scalar;
+#endif
+}
+
+IsaLevel getIsaLevel()
+{
+    return static_cast<IsaLevel>(activeLevel().load(std::memory_order_relaxed));
+}
+
+void forceIsaLevel(IsaLevel level)
+{
+    activeLevel().store(static_cast<int>(clampToCpu(level)), std::memory_order_relaxed);
+}
+
+const char* isaLevelName(IsaLevel level)
+{
+    switch (level)
+    {
+    case IsaLevel::Scalar:
+        return "scalar";
+    case IsaLevel::Sse42:
+        return "sse42";
+    case IsaLevel::Avx2:
+        return "avx2";
+    case IsaLevel::Avx512:
+        return "avx512";
+    }
+    return "unknown";
+}
+
+bool parseIsaLevel(const std::string& name, IsaLevel& level)
+{
+    for (IsaLevel candidate : {IsaLevel::Scalar, IsaLevel::Sse42, IsaLevel::Avx2, IsaLevel::Avx512})
+    {
+        if (name == isaLevelName(candidate))
+        {
+            level = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+const KernelTable& kernelsFor(IsaLevel level)
+{
+    switch (clampToCpu(level))
+    {
+    case IsaLevel::Sse42:
+        return sse42KernelTable();
+    case IsaLevel::Avx2:
+        return avx2KernelTable();
+    case IsaLevel::Avx512:
+        return avx512KernelTable();
+    case IsaLevel::Scalar:
+        break;
+    }
+    return scalarKernelTable();
+}
+
+const KernelTable& activeKernels()
+{
+    return kernelsFor(getIsaLevel());
+}
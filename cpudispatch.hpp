@@ -0,0 +1,35 @@
+#ifndef CPUDISPATCH_HPP
+#define CPUDISPATCH_HPP
+
+#include "simdkernels.hpp"
+#include <string>
+
+enum class IsaLevel
+{
+    Scalar,   // baseline compiler flags
+    Sse42,
+    Avx2,     // AVX2 + FMA
+    Avx512    // AVX-512F
+};
+
+// Highest level the CPU and the OS (saved vector state) support, read with
+// CPUID once. Always Scalar off x86.
+IsaLevel detectIsaLevel();
+
+// Level whose kernels activeKernels() returns. Defaults to the detected level,
+// or to the SIMFLUID_ISA environment variable (scalar, sse42, avx2, avx512)
+// when that is set, clamped to what the CPU supports.
+IsaLevel getIsaLevel();
+// Forces a level for benchmarking; clamped to detectIsaLevel(). Not meant to
+// be called while solvers are running on other threads.
+void forceIsaLevel(IsaLevel level);
+
+const char* isaLevelName(IsaLevel level);
+// accepts the names returned by isaLevelName; returns false otherwise
+bool parseIsaLevel(const std::string& name, IsaLevel& level);
+
+// kernel table of a level; levels above detectIsaLevel() return the detected one
+const KernelTable& kernelsFor(IsaLevel level);
+const KernelTable& activeKernels();
+
+#endif // CPUDISPATCH_HPP
@@ -0,0 +1,276 @@
+#include "fft.hpp"
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+namespace
+{
+const double Pi = 3.14159265358979323846;
+
+bool isPowerOfTwo(int n)
+{
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+int nextPowerOfTwo(int n)
+{
+    int p = 1;
+    while (p < n)
+    {
+        p <<= 1;
+    }
+    return p;
+}
+}
+
+//--------------------------------COMPLEX FFT--------------------------------------
+FftPlan::FftPlan(int n)
+    : n(n)
+{
+    if (n <= 0)
+    {
+        throw std::invalid_argument("FftPlan: length must be positive");
+    }
+    this->powerOfTwo = isPowerOfTwo(n);
+    this->paddedSize = this->powerOfTwo ? n : nextPowerOfTwo(2*n - 1);
+    int size = this->paddedSize;
+
+    int bits = 0;
+    while ((1 << bits) < size)
+    {
+        ++bits;
+    }
+    this->bitReverse.resize(size);
+    for (int k = 0; k < size; ++k)
+    {
+        int reversed = 0;
+        for (int b = 0; b < bits; ++b)
+        {
+            reversed |= ((k >> b) & 1) << (bits - 1 - b);
+        }
+        this->bitReverse[k] = reversed;
+    }
+    this->twiddles.resize(size / 2 > 0 ? size / 2 : 1);
+    for (int k = 0; k < size / 2; ++k)
+    {
+        this->twiddles[k] = std::polar(1.0, -2.0*Pi*k/size);
+    }
+
+    if (!this->powerOfTwo)
+    {
+        // chirp_k = exp(-i pi k^2 / n); k^2 is reduced mod 2n to keep precision
+        this->chirp.resize(n);
+        for (int k = 0; k < n; ++k)
+        {
+            long long k2 = (static_cast<long long>(k)*k) % (2LL*n);
+            this->chirp[k] = std::polar(1.0, -Pi*static_cast<double>(k2)/n);
+        }
+        this->kernelSpectrum.assign(size, std::complex<double>(0.0, 0.0));
+        this->kernelSpectrum[0] = std::conj(this->chirp[0]);
+        for (int k = 1; k < n; ++k)
+        {
+            this->kernelSpectrum[k] = std::conj(this->chirp[k]);
+            this->kernelSpectrum[size - k] = std::conj(this->chirp[k]);
+        }
+        radix2(this->kernelSpectrum.data());
+    }
+}
+
+std::size_t FftPlan::getScratchSize() const
+{
+    return this->powerOfTwo ? 0 : static_cast<std::size_t>(this->paddedSize);
+}
+
+void FftPlan::radix2(std::complex<double>* data) const
+{
+    int size = this->paddedSize;
+    for (int k = 0; k < size; ++k)
+    {
+        int r = this->bitReverse[k];
+        if (k < r)
+        {
+            std::swap(data[k], data[r]);
+        }
+    }
+    for (int length = 2; length <= size; length <<= 1)
+    {
+        int half = length / 2;
+        int step = size / length;
+        for (int start = 0; start < size; start += length)
+        {
+            for (int k = 0; k < half; ++k)
+            {
+                std::complex<double> t = this->twiddles[k*step] * data[start + k + half];
+                data[start + k + half] = data[start + k] - t;
+                data[start + k] += t;
+            }
+        }
+    }
+}
+
+void FftPlan::forward(std::complex<double>* data, std::complex<double>* scratch) const
+{
+    if (this->powerOfTwo)
+    {
+        radix2(data);
+        return;
+    }
+
+    int size = this->paddedSize;
+    for (int k = 0; k < this->n; ++k)
+    {
+        scratch[k] = data[k] * this->chirp[k];
+    }
+    for (int k = this->n; k < size; ++k)
+    {
+        scratch[k] = 0.0;
+    }
+    radix2(scratch);
+    for (int k = 0; k < size; ++k)
+    {
+        scratch[k] = std::conj(scratch[k] * this->kernelSpectrum[k]);
+    }
+    // inverse via conjugation
+    radix2(scratch);
+    double scale = 1.0 / size;
+    for (int k = 0; k < this->n; ++k)
+    {
+        data[k] = this->chirp[k] * std::conj(scratch[k]) * scale;
+    }
+}
+
+void FftPlan::inverse(std::complex<double>* data, std::complex<double>* scratch) const
+{
+    for (int k = 0; k < this->n; ++k)
+    {
+        data[k] = std::conj(data[k]);
+    }
+    forward(data, scratch);
+    for (int k = 0; k < this->n; ++k)
+    {
+        data[k] = std::conj(data[k]);
+    }
+}
+
+//--------------------------------REAL TRANSFORMS----------------------------------
+namespace
+{
+int embeddedLength(RealTransformKind kind, int n)
+{
+    switch (kind)
+    {
+    case RealTransformKind::Hartley:
+        return n;
+    case RealTransformKind::Dst1:
+        return 2*(n + 1);
+    case RealTransformKind::Dct2:
+    case RealTransformKind::Dct3:
+        return 2*n;
+    }
+    return n;
+}
+}
+
+RealTransformPlan::RealTransformPlan(RealTransformKind kind, int n)
+    : kind(kind), n(n), fft(embeddedLength(kind, n))
+{
+    if (kind == RealTransformKind::Dct2 || kind == RealTransformKind::Dct3)
+    {
+        // exp(-i pi k / 2n) for DCT-II, its conjugate for DCT-III
+        double sign = (kind == RealTransformKind::Dct2) ? -1.0 : 1.0;
+        this->phase.resize(n);
+        for (int k = 0; k < n; ++k)
+        {
+            this->phase[k] = std::polar(1.0, sign*Pi*k/(2.0*n));
+        }
+    }
+}
+
+std::size_t RealTransformPlan::getScratchSize() const
+{
+    return static_cast<std::size_t>(this->fft.size()) + this->fft.getScratchSize();
+}
+
+double RealTransformPlan::getInverseScale() const
+{
+    switch (this->kind)
+    {
+    case RealTransformKind::Hartley:
+        return 1.0 / this->n;
+    case RealTransformKind::Dst1:
+        return 2.0 / (this->n + 1);
+    case RealTransformKind::Dct2:
+    case RealTransformKind::Dct3:
+        return 1.0 / this->n;
+    }
+    return 1.0;
+}
+
+void RealTransformPlan::apply(const double* in, double* out, std::complex<double>* scratch) const
+{
+    int n = this->n;
+    int length = this->fft.size();
+    std::complex<double>* y = scratch;
+    std::complex<double>* fftScratch = scratch + length;
+
+    switch (this->kind)
+    {
+    case RealTransformKind::Hartley:
+        for (int k = 0; k < n; ++k)
+        {
+            y[k] = in[k];
+        }
+        this->fft.forward(y, fftScratch);
+        for (int k = 0; k < n; ++k)
+        {
+            out[k] = y[k].real() - y[k].imag();
+        }
+        break;
+
+    case RealTransformKind::Dst1:
+        // odd extension [0, x, 0, -reverse(x)]
+        y[0] = 0.0;
+        y[n + 1] = 0.0;
+        for (int k = 0; k < n; ++k)
+        {
+            y[k + 1] = in[k];
+            y[length - 1 - k] = -in[k];
+        }
+        this->fft.forward(y, fftScratch);
+        for (int k = 0; k < n; ++k)
+        {
+            out[k] = -0.5*y[k + 1].imag();
+        }
+        break;
+
+    case RealTransformKind::Dct2:
+        // even extension [x, reverse(x)]
+        for (int k = 0; k < n; ++k)
+        {
+            y[k] = in[k];
+            y[length - 1 - k] = in[k];
+        }
+        this->fft.forward(y, fftScratch);
+        for (int k = 0; k < n; ++k)
+        {
+            out[k] = 0.5*(this->phase[k]*y[k]).real();
+        }
+        break;
+
+    case RealTransformKind::Dct3:
+        // Hermitian spectrum whose inverse DFT is the cosine sum
+        y[0] = in[0];
+        y[n] = 0.0;
+        for (int k = 1; k < n; ++k)
+        {
+            y[k] = in[k]*this->phase[k];
+            y[length - k] = std::conj(y[k]);
+        }
+        this->fft.inverse(y, fftScratch);
+        for (int k = 0; k < n; ++k)
+        {
+            out[k] = y[k].real();
+        }
+        break;
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef FFT_HPP
+#define FFT_HPP
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+// Precomputed complex DFT of one length. Powers of two use an iterative
+// radix-2 transform; other lengths go through Bluestein's chirp-z algorithm
+// on a padded power-of-two transform, so every length is O(n log n).
+// Plans are immutable after construction and safe to share between threads
+// as long as each thread passes its own scratch buffer.
+class FftPlan
+{
+public:
+    explicit FftPlan(int n);
+
+    int size() const { return this->n; }
+    std::size_t getScratchSize() const;
+
+    // unnormalised, exp(-2 pi i k n / N)
+    void forward(std::complex<double>* data, std::complex<double>* scratch) const;
+    // unnormalised, exp(+2 pi i k n / N)
+    void inverse(std::complex<double>* data, std::complex<double>* scratch) const;
+
+private:
+    void radix2(std::complex<double>* data) const;
+
+    int n{0};
+    int paddedSize{0};
+    bool powerOfTwo{false};
+    std::vector<int> bitReverse;
+    std::vector<std::complex<double>> twiddles;
+    // Bluestein only
+    std::vector<std::complex<double>> chirp;
+    std::vector<std::complex<double>> kernelSpectrum;
+};
+
+enum class RealTransformKind
+{
+    Hartley,   // DHT, diagonalises periodic stencils; self inverse up to 1/N
+    Dst1,      // DST-I, zero values just outside both ends; self inverse up to 2/(N+1)
+    Dct2,      // DCT-II, zero gradient at both ends (cell centred)
+    Dct3       // DCT-III, inverse of DCT-II up to 1/N
+};
+
+// real-to-real transform of one length built on an embedded FftPlan
+class RealTransformPlan
+{
+public:
+    RealTransformPlan(RealTransformKind kind, int n);
+
+    RealTransformKind getKind() const { return this->kind; }
+    int size() const { return this->n; }
+    std::size_t getScratchSize() const;
+
+    // out may alias in
+    void apply(const double* in, double* out, std::complex<double>* scratch) const;
+
+    // scale that turns apply(apply(x)) back into x for the self-inverse kinds
+    // and apply<Dct3>(apply<Dct2>(x)) into x for the cosine pair
+    double getInverseScale() const;
+
+private:
+    RealTransformKind kind;
+    int n{0};
+    FftPlan fft;
+    std::vector<std::complex<double>> phase;
+};
+
+#endif // FFT_HPP
@@ -0,0 +1,223 @@
+#include "fieldimage.hpp"
+#include "fluidgrid.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+struct ColorStop
+{
+    float t, r, g, b;
+};
+
+// control points sampled from the reference colormaps; the LUT interpolates between them
+const ColorStop InfernoStops[] = {
+    {0.00f, 0.001f, 0.000f, 0.014f}, {0.25f, 0.258f, 0.039f, 0.406f}, {0.50f, 0.735f, 0.216f, 0.330f},
+    {0.75f, 0.978f, 0.557f, 0.035f}, {1.00f, 0.988f, 0.998f, 0.645f}};
+const ColorStop CoolWarmStops[] = {
+    {0.00f, 0.230f, 0.299f, 0.754f}, {0.50f, 0.865f, 0.865f, 0.865f}, {1.00f, 0.706f, 0.016f, 0.150f}};
+const ColorStop GrayscaleStops[] = {
+    {0.00f, 0.0f, 0.0f, 0.0f}, {1.00f, 1.0f, 1.0f, 1.0f}};
+
+template <std::size_t N>
+void interpolateStops(const ColorStop (&stops)[N], float t, float* rgb)
+{
+    std::size_t k = 1;
+    while (k + 1 < N && stops[k].t < t)
+    {
+        ++k;
+    }
+    const ColorStop& a = stops[k - 1];
+    const ColorStop& b = stops[k];
+    float w = (t - a.t) / (b.t - a.t);
+    rgb[0] = a.r + w*(b.r - a.r);
+    rgb[1] = a.g + w*(b.g - a.g);
+    rgb[2] = a.b + w*(b.b - a.b);
+}
+}
+
+//--------------------------------COLORMAPS----------------------------------------
+std::vector<float> buildColormapLut(Colormap map, int size)
+{
+    size = std::max(size, 2);
+    std::vector<float> lut(4*size);
+    for (int k = 0; k < size; ++k)
+    {
+        float t = static_cast<float>(k) / (size - 1);
+        float* rgba = &lut[4*k];
+        switch (map)
+        {
+        case Colormap::Grayscale:
+            interpolateStops(GrayscaleStops, t, rgba);
+            break;
+        case Colormap::Inferno:
+            interpolateStops(InfernoStops, t, rgba);
+            break;
+        case Colormap::CoolWarm:
+            interpolateStops(CoolWarmStops, t, rgba);
+            break;
+        }
+        rgba[3] = 1.0f;
+    }
+    return lut;
+}
+
+void mapToRgba(const std::vector<float>& lut, FieldRange range, float value, float rgba[4])
+{
+    int size = static_cast<int>(lut.size() / 4);
+    float span = range.max - range.min;
+    float t = (span != 0.0f) ? (value - range.min) / span : 0.0f;
+    t = std::min(std::max(t, 0.0f), 1.0f);
+    // same addressing as a linearly filtered 1D texture with clamp-to-edge
+    float x = std::min(std::max(t*size - 0.5f, 0.0f), static_cast<float>(size - 1));
+    int k0 = std::min(static_cast<int>(x), size - 2);
+    float w = x - k0;
+    for (int c = 0; c < 4; ++c)
+    {
+        rgba[c] = (1.0f - w)*lut[4*k0 + c] + w*lut[4*(k0 + 1) + c];
+    }
+}
+
+FieldRange computeFieldRange(const ScalarField& field)
+{
+    FieldRange range{field.at(0, 0), field.at(0, 0)};
+    for (int j = 0; j < field.getNy(); ++j)
+    {
+        const float* r = field.row(j);
+        for (int i = 0; i < field.getNx(); ++i)
+        {
+            range.min = std::min(range.min, r[i]);
+            range.max = std::max(range.max, r[i]);
+        }
+    }
+    if (range.max == range.min)
+    {
+        range.max = range.min + 1.0f;
+    }
+    return range;
+}
+
+//--------------------------------HALF FLOATS--------------------------------------
+std::uint16_t floatToHalf(float value)
+{
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    std::uint32_t sign = (bits >> 16) & 0x8000u;
+    std::uint32_t magnitude = bits & 0x7fffffffu;
+
+    if (magnitude >= 0x7f800000u)
+    {
+        // infinity stays infinity, NaN keeps a quiet payload bit
+        return static_cast<std::uint16_t>(sign | 0x7c00u | (magnitude > 0x7f800000u ? 0x0200u : 0u));
+    }
+    if (magnitude >= 0x477ff000u)
+    {
+        // rounds to above the largest finite half
+        return static_cast<std::uint16_t>(sign | 0x7c00u);
+    }
+    if (magnitude < 0x38800000u)
+    {
+        // subnormal half or zero: shift the implicit-one mantissa into place, round to nearest even
+        if (magnitude < 0x33000000u)
+        {
+            return static_cast<std::uint16_t>(sign);
+        }
+        std::uint32_t exponent = magnitude >> 23;
+        std::uint32_t mantissa = (magnitude & 0x007fffffu) | 0x00800000u;
+        std::uint32_t shift = 126u - exponent;
+        std::uint32_t half = mantissa >> shift;
+        std::uint32_t remainder = mantissa & ((1u << shift) - 1u);
+        std::uint32_t midpoint = 1u << (shift - 1u);
+        if (remainder > midpoint || (remainder == midpoint && (half & 1u)))
+        {
+            ++half;
+        }
+        return static_cast<std::uint16_t>(sign | half);
+    }
+    // normal: rebias the exponent and round the 13 dropped mantissa bits to nearest even
+    std::uint32_t half = (magnitude - 0x38000000u) >> 13;
+    std::uint32_t remainder = magnitude & 0x1fffu;
+    if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1u)))
+    {
+        ++half;
+    }
+    return static_cast<std::uint16_t>(sign | half);
+}
+
+float halfToFloat(std::uint16_t value)
+{
+    std::uint32_t sign = (static_cast<std::uint32_t>(value) & 0x8000u) << 16;
+    std::uint32_t exponent = (value >> 10) & 0x1fu;
+    std::uint32_t mantissa = value & 0x3ffu;
+    std::uint32_t bits;
+    if (exponent == 0x1fu)
+    {
+        bits = sign | 0x7f800000u | (mantissa << 13);
+    }
+    else if (exponent != 0)
+    {
+        bits = sign | ((exponent + 112u) << 23) | (mantissa << 13);
+    }
+    else if (mantissa == 0)
+    {
+        bits = sign;
+    }
+    else
+    {
+        // subnormal half: normalise into a float
+        exponent = 113u;
+        while (!(mantissa & 0x400u))
+        {
+            mantissa <<= 1;
+            --exponent;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+    }
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+void packFieldAsHalf(const ScalarField& field, std::vector<std::uint16_t>& out)
+{
+    int nx = field.getNx();
+    out.resize(static_cast<std::size_t>(nx)*field.getNy());
+    for (int j = 0; j < field.getNy(); ++j)
+    {
+        const float* r = field.row(j);
+        std::uint16_t* dst = &out[static_cast<std::size_t>(j)*nx];
+        for (int i = 0; i < nx; ++i)
+        {
+            dst[i] = floatToHalf(r[i]);
+        }
+    }
+}
+
+FieldRange packFieldRows(const ScalarField& field, float* out)
+{
+    int nx = field.getNx();
+    FieldRange range{field.at(0, 0), field.at(0, 0)};
+    for (int j = 0; j < field.getNy(); ++j)
+    {
+        const float* r = field.row(j);
+        float* dst = out + static_cast<std::size_t>(j)*nx;
+        for (int i = 0; i < nx; ++i)
+        {
+            dst[i] = r[i];
+            range.min = std::min(range.min, r[i]);
+            range.max = std::max(range.max, r[i]);
+        }
+    }
+    if (range.max == range.min)
+    {
+        range.max = range.min + 1.0f;
+    }
+    return range;
+}
+
+std::size_t fieldUploadBytes(const ScalarField& field, FieldTextureFormat format)
+{
+    std::size_t cells = static_cast<std::size_t>(field.getNx())*field.getNy();
+    return cells*(format == FieldTextureFormat::R16F ? 2 : 4);
+}
@@ -0,0 +1,53 @@
+#ifndef FIELDIMAGE_HPP
+#define FIELDIMAGE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ScalarField;
+
+// Qt-free helpers that prepare a ScalarField for display. The GPU path uploads
+// the raw field as a single-channel texture and looks colours up in a 1D LUT
+// built here; mapToRgba is the CPU reference of that lookup.
+
+enum class Colormap
+{
+    Grayscale,
+    Inferno,    // perceptually ordered black-purple-orange-yellow
+    CoolWarm    // diverging blue-white-red, for signed fields
+};
+
+enum class FieldTextureFormat
+{
+    R32F,   // 4 bytes per cell, uploaded straight from the field rows
+    R16F    // 2 bytes per cell, converted on the CPU before upload
+};
+
+struct FieldRange
+{
+    float min{0.0f};
+    float max{1.0f};
+};
+
+// size RGBA entries in [0, 1], interleaved
+std::vector<float> buildColormapLut(Colormap map, int size = 256);
+// linear LUT lookup of (value - range.min) / (range.max - range.min), clamped to [0, 1]
+void mapToRgba(const std::vector<float>& lut, FieldRange range, float value, float rgba[4]);
+
+// min and max over the interior; a constant field gets a unit-wide range
+FieldRange computeFieldRange(const ScalarField& field);
+
+// IEEE 754 binary16, round to nearest even, with infinities, NaN and subnormals
+std::uint16_t floatToHalf(float value);
+float halfToFloat(std::uint16_t value);
+// interior of the field as tightly packed nx*ny halves, row by row
+void packFieldAsHalf(const ScalarField& field, std::vector<std::uint16_t>& out);
+// interior copied into out (nx*ny floats, row by row) while tracking its range,
+// so a streaming upload reads the field once; same range as computeFieldRange
+FieldRange packFieldRows(const ScalarField& field, float* out);
+
+// bytes uploaded per frame for one field at the given format
+std::size_t fieldUploadBytes(const ScalarField& field, FieldTextureFormat format);
+
+#endif // FIELDIMAGE_HPP
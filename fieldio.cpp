@@ -0,0 +1,96 @@
+#include "fieldio.hpp"
+#include "fluidgrid.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+bool hostIsLittleEndian()
+{
+    std::uint32_t probe = 1;
+    unsigned char first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+void check(const std::ios& stream, const char* what, const std::string& path)
+{
+    if (!stream)
+    {
+        throw std::runtime_error(std::string(what) + ": cannot access '" + path + "'");
+    }
+}
+}
+
+void writeFieldPfm(const ScalarField& field, const std::string& path)
+{
+    std::ofstream out(path, std::ios::binary);
+    check(out, "writeFieldPfm", path);
+    int nx = field.getNx();
+    // a negative scale marks little-endian data
+    out << "Pf\n" << nx << " " << field.getNy() << "\n" << (hostIsLittleEndian() ? "-1.0" : "1.0") << "\n";
+    for (int j = 0; j < field.getNy(); ++j)
+    {
+        out.write(reinterpret_cast<const char*>(field.row(j)), static_cast<std::streamsize>(nx*sizeof(float)));
+    }
+    check(out, "writeFieldPfm", path);
+}
+
+ScalarField readFieldPfm(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    check(in, "readFieldPfm", path);
+    std::string magic;
+    int nx = 0;
+    int ny = 0;
+    double scale = 0.0;
+    in >> magic >> nx >> ny >> scale;
+    if (!in || magic != "Pf" || nx <= 0 || ny <= 0)
+    {
+        throw std::runtime_error("readFieldPfm: '" + path + "' is not a single-channel PFM");
+    }
+    in.get();   // the single whitespace after the header
+    bool swapBytes = (scale < 0.0) != hostIsLittleEndian();
+
+    ScalarField field(nx, ny);
+    for (int j = 0; j < ny; ++j)
+    {
+        float* r = field.row(j);
+        in.read(reinterpret_cast<char*>(r), static_cast<std::streamsize>(nx*sizeof(float)));
+        if (swapBytes)
+        {
+            for (int i = 0; i < nx; ++i)
+            {
+                unsigned char* bytes = reinterpret_cast<unsigned char*>(&r[i]);
+                std::reverse(bytes, bytes + sizeof(float));
+            }
+        }
+    }
+    check(in, "readFieldPfm", path);
+    return field;
+}
+
+void writeFieldPgm(const ScalarField& field, FieldRange range, const std::string& path)
+{
+    std::ofstream out(path, std::ios::binary);
+    check(out, "writeFieldPgm", path);
+    int nx = field.getNx();
+    out << "P5\n" << nx << " " << field.getNy() << "\n255\n";
+    float scale = (range.max != range.min) ? 255.0f / (range.max - range.min) : 0.0f;
+    std::vector<unsigned char> line(static_cast<std::size_t>(nx));
+    for (int j = field.getNy() - 1; j >= 0; --j)
+    {
+        const float* r = field.row(j);
+        for (int i = 0; i < nx; ++i)
+        {
+            float level = std::min(std::max((r[i] - range.min)*scale, 0.0f), 255.0f);
+            line[i] = static_cast<unsigned char>(level + 0.5f);
+        }
+        out.write(reinterpret_cast<const char*>(line.data()), static_cast<std::streamsize>(nx));
+    }
+    check(out, "writeFieldPgm", path);
+}
@@ -0,0 +1,20 @@
+#ifndef FIELDIO_HPP
+#define FIELDIO_HPP
+
+#include "fieldimage.hpp"
+#include <string>
+
+class ScalarField;
+
+// Snapshots of a field's interior. Both formats store rows bottom to top in
+// file order of a PFM, i.e. row j = 0 first, matching ScalarField. Failures
+// throw std::runtime_error.
+
+// portable float map ("Pf"), little-endian float32, exact values
+void writeFieldPfm(const ScalarField& field, const std::string& path);
+ScalarField readFieldPfm(const std::string& path);
+// binary 8-bit PGM ("P5") of (value - range.min) / (range.max - range.min), clamped;
+// written top row first as viewers expect
+void writeFieldPgm(const ScalarField& field, FieldRange range, const std::string& path);
+
+#endif // FIELDIO_HPP
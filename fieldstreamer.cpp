@@ -0,0 +1,215 @@
+#include "fieldstreamer.hpp"
+#include "fluidgrid.hpp"
+#include <QOpenGLContext>
+#include <QDebug>
+#include <cstring>
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+namespace
+{
+typedef void (QOPENGLF_APIENTRYP BufferStorageFunction)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+// glBufferStorage is not part of QOpenGLExtraFunctions; resolve it only when the context advertises it
+BufferStorageFunction resolveBufferStorage()
+{
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    if (!context || context->isOpenGLES())
+    {
+        return nullptr;
+    }
+    QSurfaceFormat format = context->format();
+    bool core44 = format.majorVersion() > 4 || (format.majorVersion() == 4 && format.minorVersion() >= 4);
+    if (!core44 && !context->hasExtension(QByteArrayLiteral("GL_ARB_buffer_storage")))
+    {
+        return nullptr;
+    }
+    return reinterpret_cast<BufferStorageFunction>(context->getProcAddress("glBufferStorage"));
+}
+}
+
+//--------------------------------SETUP--------------------------------------------
+void FieldStreamer::initialize(QOpenGLExtraFunctions* functions, int nx, int ny)
+{
+    destroy();
+    this->gl = functions;
+    this->nx = nx;
+    this->ny = ny;
+    this->slotBytes = static_cast<GLsizeiptr>(nx)*ny*static_cast<GLsizeiptr>(sizeof(float));
+    this->ring.reset();
+
+    BufferStorageFunction bufferStorage = resolveBufferStorage();
+    this->persistent = bufferStorage != nullptr;
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    gl->glGenBuffers(UploadSlotRing::NumSlots, buffers);
+    for (int k = 0; k < UploadSlotRing::NumSlots; ++k)
+    {
+        gl->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[k]);
+        if (this->persistent)
+        {
+            // immutable storage, mapped for the lifetime of the streamer
+            bufferStorage(GL_PIXEL_UNPACK_BUFFER, this->slotBytes, nullptr, flags);
+            mapped[k] = static_cast<float*>(gl->glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, this->slotBytes, flags));
+            if (!mapped[k])
+            {
+                qDebug() << "FieldStreamer: persistent mapping failed, falling back to orphaning";
+                this->persistent = false;
+            }
+        }
+        if (!this->persistent)
+        {
+            gl->glBufferData(GL_PIXEL_UNPACK_BUFFER, this->slotBytes, nullptr, GL_STREAM_DRAW);
+        }
+    }
+    if (!this->persistent)
+    {
+        // a failed mapping part way leaves immutable buffers behind; start over with mutable ones
+        for (int k = 0; k < UploadSlotRing::NumSlots; ++k)
+        {
+            if (mapped[k])
+            {
+                gl->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[k]);
+                gl->glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                mapped[k] = nullptr;
+            }
+            staging[k].assign(static_cast<std::size_t>(nx)*ny, 0.0f);
+        }
+        if (bufferStorage)
+        {
+            gl->glDeleteBuffers(UploadSlotRing::NumSlots, buffers);
+            gl->glGenBuffers(UploadSlotRing::NumSlots, buffers);
+            for (int k = 0; k < UploadSlotRing::NumSlots; ++k)
+            {
+                gl->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[k]);
+                gl->glBufferData(GL_PIXEL_UNPACK_BUFFER, this->slotBytes, nullptr, GL_STREAM_DRAW);
+            }
+        }
+    }
+    gl->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    this->initialized.store(true, std::memory_order_release);
+}
+
+void FieldStreamer::destroy()
+{
+    if (!this->gl)
+    {
+        return;
+    }
+    this->initialized.store(false, std::memory_order_release);
+    for (int k = 0; k < UploadSlotRing::NumSlots; ++k)
+    {
+        if (fences[k])
+        {
+            gl->glDeleteSync(fences[k]);
+            fences[k] = nullptr;
+        }
+        if (mapped[k])
+        {
+            gl->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[k]);
+            gl->glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            mapped[k] = nullptr;
+        }
+        staging[k].clear();
+        staging[k].shrink_to_fit();
+    }
+    gl->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    gl->glDeleteBuffers(UploadSlotRing::NumSlots, buffers);
+    for (GLuint& buffer : buffers)
+    {
+        buffer = 0;
+    }
+    this->ring.reset();
+    this->gl = nullptr;
+}
+
+//--------------------------------PRODUCER-----------------------------------------
+bool FieldStreamer::publish(const ScalarField& field)
+{
+    if (!isInitialized() || field.getNx() != this->nx || field.getNy() != this->ny)
+    {
+        return false;
+    }
+    int slot = this->ring.acquireForWrite();
+    if (slot < 0)
+    {
+        return false;
+    }
+    float* destination = this->persistent ? mapped[slot] : staging[slot].data();
+    ranges[slot] = packFieldRows(field, destination);
+    this->ring.publish(slot);
+    return true;
+}
+
+//--------------------------------CONSUMER-----------------------------------------
+void FieldStreamer::retireCompletedUploads()
+{
+    for (int k = 0; k < UploadSlotRing::NumSlots; ++k)
+    {
+        if (this->ring.getState(k) != UploadSlotRing::SlotState::InFlight)
+        {
+            continue;
+        }
+        // zero timeout: poll, never wait
+        GLenum status = gl->glClientWaitSync(fences[k], 0, 0);
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+        {
+            gl->glDeleteSync(fences[k]);
+            fences[k] = nullptr;
+            this->ring.release(k);
+        }
+    }
+}
+
+bool FieldStreamer::uploadLatest(unsigned int texture, FieldRange& range)
+{
+    if (!isInitialized())
+    {
+        return false;
+    }
+    retireCompletedUploads();
+    int slot = this->ring.acquireLatestForUpload();
+    if (slot < 0)
+    {
+        return false;
+    }
+
+    gl->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[slot]);
+    if (!this->persistent)
+    {
+        // orphan the old storage so the driver never syncs with a pending read of it
+        gl->glBufferData(GL_PIXEL_UNPACK_BUFFER, this->slotBytes, nullptr, GL_STREAM_DRAW);
+        void* destination = gl->glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, this->slotBytes,
+                                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (destination)
+        {
+            std::memcpy(destination, staging[slot].data(), static_cast<std::size_t>(this->slotBytes));
+            gl->glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+    }
+
+    gl->glBindTexture(GL_TEXTURE_2D, texture);
+    gl->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    // with an unpack buffer bound the data pointer is an offset into it
+    gl->glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, this->nx, this->ny, GL_RED, GL_FLOAT, nullptr);
+    gl->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    range = ranges[slot];
+
+    if (this->persistent)
+    {
+        // the producer may not touch this buffer until the copy has been executed
+        fences[slot] = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        this->ring.markInFlight(slot);
+    }
+    else
+    {
+        // the frame now lives in orphaned driver storage; the CPU copy is free again
+        this->ring.release(slot);
+    }
+    return true;
+}
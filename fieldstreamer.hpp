@@ -0,0 +1,63 @@
+#ifndef FIELDSTREAMER_HPP
+#define FIELDSTREAMER_HPP
+
+#include <QOpenGLExtraFunctions>
+#include "fieldimage.hpp"
+#include "uploadslotring.hpp"
+#include <atomic>
+#include <vector>
+
+class ScalarField;
+
+// Streams R32F field frames to a texture through three pixel unpack buffers.
+// With GL_ARB_buffer_storage (core in 4.4) the buffers are mapped once,
+// persistently and coherently, and publish() packs the field straight into
+// GPU-visible memory from any thread; a fence per buffer tells when the
+// texture copy has finished reading it. Without it, publish() fills a CPU copy
+// and uploadLatest() orphans the buffer before refilling it, which never waits
+// on the GPU either. UploadSlotRing decides who owns which buffer.
+class FieldStreamer
+{
+public:
+    FieldStreamer() = default;
+    FieldStreamer(const FieldStreamer&) = delete;
+    FieldStreamer& operator=(const FieldStreamer&) = delete;
+
+    //--------------GL thread, context current---------------
+    void initialize(QOpenGLExtraFunctions* functions, int nx, int ny);
+    // producers must have stopped publishing before this is called
+    void destroy();
+    // uploads the newest published frame into texture (R32F, nx x ny storage
+    // already allocated) and returns its value range; false when nothing new
+    bool uploadLatest(unsigned int texture, FieldRange& range);
+
+    //--------------any single producer thread----------------
+    // packs the interior of field into a free buffer; false drops the frame
+    // (not initialized, size mismatch, or all buffers busy)
+    bool publish(const ScalarField& field);
+
+    bool isInitialized() const { return this->initialized.load(std::memory_order_acquire); }
+    bool isPersistent() const { return this->persistent; }
+    int getNx() const { return this->nx; }
+    int getNy() const { return this->ny; }
+    const UploadSlotRing& getRing() const { return this->ring; }
+
+private:
+    void retireCompletedUploads();
+
+    QOpenGLExtraFunctions* gl{nullptr};
+    UploadSlotRing ring;
+    std::atomic<bool> initialized{false};
+    bool persistent{false};
+    int nx{0};
+    int ny{0};
+    GLsizeiptr slotBytes{0};
+
+    GLuint buffers[UploadSlotRing::NumSlots]{};
+    float* mapped[UploadSlotRing::NumSlots]{};                 // persistent path
+    std::vector<float> staging[UploadSlotRing::NumSlots];     // orphaning path
+    GLsync fences[UploadSlotRing::NumSlots]{};
+    FieldRange ranges[UploadSlotRing::NumSlots];
+};
+
+#endif // FIELDSTREAMER_HPP
@@ -0,0 +1,400 @@
+#include "flipsolver.hpp"
+#include "fluidsolver.hpp"
+#include "profiler.hpp"
+#include "threadpool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+namespace
+{
+// bilinear sample of an interior field; the position is clamped to [0, n-1]
+float sampleInterior(const ScalarField& field, float x, float y)
+{
+    int nx = field.getNx();
+    int ny = field.getNy();
+    x = std::min(std::max(x, 0.0f), static_cast<float>(nx - 1));
+    y = std::min(std::max(y, 0.0f), static_cast<float>(ny - 1));
+    int i0 = std::min(static_cast<int>(x), std::max(nx - 2, 0));
+    int j0 = std::min(static_cast<int>(y), std::max(ny - 2, 0));
+    float s1 = x - i0;
+    float t1 = y - j0;
+    const float* r0 = field.row(j0);
+    const float* r1 = field.row(j0 + 1);
+    return (1.0f - s1)*((1.0f - t1)*r0[i0] + t1*r1[i0]) + s1*((1.0f - t1)*r0[i0 + 1] + t1*r1[i0 + 1]);
+}
+}
+
+FlipSolver::FlipSolver(FluidSolver& gridSolver)
+    : gridSolver(gridSolver), grid(gridSolver.getGrid()),
+      weightSum(grid.makeScratchField()), uOld(grid.makeScratchField()), vOld(grid.makeScratchField())
+{
+    if (this->grid.getNx() < 2 || this->grid.getNy() < 2)
+    {
+        throw std::invalid_argument("FlipSolver: grid must be at least 2x2");
+    }
+    setupTiles();
+}
+
+void FlipSolver::setupTiles()
+{
+    int tile = this->params.tileSize;
+    if (tile < 2)
+    {
+        // a 1-cell tile's scatter footprint reaches the next tile of the same colour
+        throw std::invalid_argument("FlipSolver: tileSize must be at least 2");
+    }
+    this->configuredTileSize = tile;
+    this->tilesX = (this->grid.getNx() + tile - 1) / tile;
+    this->tilesY = (this->grid.getNy() + tile - 1) / tile;
+    for (int c = 0; c < 4; ++c)
+    {
+        this->colourTiles[c].clear();
+    }
+    for (int ty = 0; ty < this->tilesY; ++ty)
+    {
+        for (int tx = 0; tx < this->tilesX; ++tx)
+        {
+            this->colourTiles[(tx & 1) + 2*(ty & 1)].push_back(ty*this->tilesX + tx);
+        }
+    }
+}
+
+int FlipSolver::sortKey(float px, float py) const
+{
+    // nearest sample; its bilinear stencil lies within one cell of it
+    int tile = this->configuredTileSize;
+    int ci = std::min(static_cast<int>(px + 0.5f), this->grid.getNx() - 1);
+    int cj = std::min(static_cast<int>(py + 0.5f), this->grid.getNy() - 1);
+    int tileIndex = (cj / tile)*this->tilesX + ci / tile;
+    return (tileIndex*tile + cj % tile)*tile + ci % tile;
+}
+
+//--------------------------------PARTICLES----------------------------------------
+void FlipSolver::addParticle(float px, float py, float pvx, float pvy)
+{
+    this->x.push_back(std::min(std::max(px, 0.0f), static_cast<float>(this->grid.getNx() - 1)));
+    this->y.push_back(std::min(std::max(py, 0.0f), static_cast<float>(this->grid.getNy() - 1)));
+    this->vx.push_back(pvx);
+    this->vy.push_back(pvy);
+    this->c00.push_back(0.0f);
+    this->c01.push_back(0.0f);
+    this->c10.push_back(0.0f);
+    this->c11.push_back(0.0f);
+}
+
+void FlipSolver::seedRectangle(int i0, int j0, int i1, int j1, int perAxis)
+{
+    std::minstd_rand random(static_cast<unsigned>(this->x.size()) + 1u);
+    std::uniform_real_distribution<float> jitter(-0.25f, 0.25f);
+    float spacing = 1.0f / perAxis;
+    for (int j = std::max(j0, 0); j <= std::min(j1, this->grid.getNy() - 1); ++j)
+    {
+        for (int i = std::max(i0, 0); i <= std::min(i1, this->grid.getNx() - 1); ++i)
+        {
+            if (this->grid.isSolid(i, j))
+            {
+                continue;
+            }
+            for (int b = 0; b < perAxis; ++b)
+            {
+                for (int a = 0; a < perAxis; ++a)
+                {
+                    float px = i - 0.5f + (a + 0.5f + jitter(random))*spacing;
+                    float py = j - 0.5f + (b + 0.5f + jitter(random))*spacing;
+                    addParticle(px, py);
+                }
+            }
+        }
+    }
+}
+
+//--------------------------------STEP---------------------------------------------
+void FlipSolver::step()
+{
+    SIMFLUID_PROFILE_ZONE("FlipSolver::step");
+    float dt = this->gridSolver.parameters().timeStep;
+    ScalarField& u = this->grid.u();
+    ScalarField& v = this->grid.v();
+
+    sortParticles();
+    particlesToGrid();
+    this->uOld.copyFrom(u);
+    this->vOld.copyFrom(v);
+
+    this->gridSolver.addSource(u, this->gridSolver.uSource(), dt);
+    this->gridSolver.addSource(v, this->gridSolver.vSource(), dt);
+    this->gridSolver.uSource().fill(0.0f);
+    this->gridSolver.vSource().fill(0.0f);
+    applyBoundary(u, BoundaryKind::VelocityU);
+    applyBoundary(v, BoundaryKind::VelocityV);
+    this->gridSolver.project();
+
+    gridToParticles();
+    advectParticles(dt);
+    this->grid.density().copyFrom(this->weightSum);
+}
+
+void FlipSolver::sortParticles()
+{
+    SIMFLUID_PROFILE_ZONE("sort particles");
+    if (this->params.tileSize != this->configuredTileSize)
+    {
+        setupTiles();
+    }
+    ThreadPool& pool = this->gridSolver.getThreadPool();
+    int count = getNumParticles();
+    int tile = this->configuredTileSize;
+    int cellsPerTile = tile*tile;
+    int numTiles = this->tilesX*this->tilesY;
+    int numKeys = numTiles*cellsPerTile;
+    int numChunks = std::max(1, std::min(pool.getNumThreads(), count));
+    this->keys.resize(count);
+    this->order.resize(count);
+    this->keyStart.assign(numKeys + 1, 0);
+    this->chunkCounts.resize(numChunks);
+
+    // parallel counting sort on (tile, cell in tile), same scheme as the SPH cell list
+    pool.run(numChunks, [&](int c) {
+        int begin, end;
+        ThreadPool::chunkRange(0, count, numChunks, c, begin, end);
+        std::vector<int>& counts = this->chunkCounts[c];
+        counts.assign(numKeys, 0);
+        for (int p = begin; p < end; ++p)
+        {
+            int key = sortKey(this->x[p], this->y[p]);
+            this->keys[p] = key;
+            ++counts[key];
+        }
+    });
+    for (int k = 0; k < numKeys; ++k)
+    {
+        int total = 0;
+        for (int c = 0; c < numChunks; ++c)
+        {
+            total += this->chunkCounts[c][k];
+        }
+        this->keyStart[k + 1] = this->keyStart[k] + total;
+    }
+    pool.parallelFor(0, numKeys, [&](int k0, int k1) {
+        for (int k = k0; k < k1; ++k)
+        {
+            int offset = this->keyStart[k];
+            for (int c = 0; c < numChunks; ++c)
+            {
+                int n = this->chunkCounts[c][k];
+                this->chunkCounts[c][k] = offset;
+                offset += n;
+            }
+        }
+    });
+    pool.run(numChunks, [&](int c) {
+        int begin, end;
+        ThreadPool::chunkRange(0, count, numChunks, c, begin, end);
+        std::vector<int>& offsets = this->chunkCounts[c];
+        for (int p = begin; p < end; ++p)
+        {
+            this->order[offsets[this->keys[p]]++] = p;
+        }
+    });
+
+    // permute every particle array so both transfers stream in grid order
+    this->permuteBuffer.resize(count);
+    for (std::vector<float>* field : {&this->x, &this->y, &this->vx, &this->vy,
+                                      &this->c00, &this->c01, &this->c10, &this->c11})
+    {
+        std::vector<float>& values = *field;
+        pool.parallelFor(0, count, [&](int begin, int end) {
+            for (int k = begin; k < end; ++k)
+            {
+                this->permuteBuffer[k] = values[this->order[k]];
+            }
+        });
+        values.swap(this->permuteBuffer);
+    }
+
+    this->tileStart.resize(numTiles + 1);
+    for (int t = 0; t <= numTiles; ++t)
+    {
+        this->tileStart[t] = this->keyStart[t*cellsPerTile];
+    }
+}
+
+//--------------------------------TRANSFERS----------------------------------------
+void FlipSolver::scatterTile(int tile)
+{
+    ScalarField& u = this->grid.u();
+    ScalarField& v = this->grid.v();
+    bool affine = this->params.mode == TransferMode::Apic;
+    for (int p = this->tileStart[tile]; p < this->tileStart[tile + 1]; ++p)
+    {
+        float px = this->x[p];
+        float py = this->y[p];
+        int i0 = std::min(static_cast<int>(px), this->grid.getNx() - 2);
+        int j0 = std::min(static_cast<int>(py), this->grid.getNy() - 2);
+        float s1 = px - i0;
+        float t1 = py - j0;
+        for (int b = 0; b < 2; ++b)
+        {
+            float wy = b ? t1 : 1.0f - t1;
+            float dy = (j0 + b) - py;
+            float* ur = u.row(j0 + b);
+            float* vr = v.row(j0 + b);
+            float* wr = this->weightSum.row(j0 + b);
+            for (int a = 0; a < 2; ++a)
+            {
+                float w = wy*(a ? s1 : 1.0f - s1);
+                float dx = (i0 + a) - px;
+                float pu = this->vx[p];
+                float pv = this->vy[p];
+                if (affine)
+                {
+                    pu += this->c00[p]*dx + this->c01[p]*dy;
+                    pv += this->c10[p]*dx + this->c11[p]*dy;
+                }
+                ur[i0 + a] += w*pu;
+                vr[i0 + a] += w*pv;
+                wr[i0 + a] += w;
+            }
+        }
+    }
+}
+
+void FlipSolver::particlesToGrid()
+{
+    SIMFLUID_PROFILE_ZONE("particles to grid");
+    ScalarField& u = this->grid.u();
+    ScalarField& v = this->grid.v();
+    ThreadPool& pool = this->gridSolver.getThreadPool();
+    int nx = this->grid.getNx();
+
+    u.fillInterior(0.0f);
+    v.fillInterior(0.0f);
+    this->weightSum.fillInterior(0.0f);
+
+    // same-colour tiles never share a grid node, so each phase needs no atomics
+    for (const std::vector<int>& tiles : this->colourTiles)
+    {
+        pool.run(static_cast<int>(tiles.size()), [&](int k) { scatterTile(tiles[k]); });
+    }
+
+    const ScalarField& obstacle = this->grid.obstacle();
+    pool.parallelFor(0, this->grid.getNy(), [&](int j0, int j1) {
+        for (int j = j0; j < j1; ++j)
+        {
+            float* ur = u.row(j);
+            float* vr = v.row(j);
+            const float* wr = this->weightSum.row(j);
+            const float* solid = obstacle.row(j);
+            for (int i = 0; i < nx; ++i)
+            {
+                float inverse = (wr[i] > 0.0f && solid[i] < 0.5f) ? 1.0f / wr[i] : 0.0f;
+                ur[i] *= inverse;
+                vr[i] *= inverse;
+            }
+        }
+    });
+    applyBoundary(u, BoundaryKind::VelocityU);
+    applyBoundary(v, BoundaryKind::VelocityV);
+}
+
+void FlipSolver::gridToParticles()
+{
+    SIMFLUID_PROFILE_ZONE("grid to particles");
+    const ScalarField& u = this->grid.u();
+    const ScalarField& v = this->grid.v();
+    ThreadPool& pool = this->gridSolver.getThreadPool();
+    TransferMode mode = this->params.mode;
+    float ratio = this->params.flipRatio;
+    int maxI = this->grid.getNx() - 2;
+    int maxJ = this->grid.getNy() - 2;
+
+    // every particle only writes itself, and neighbouring particles read neighbouring nodes
+    pool.parallelFor(0, getNumParticles(), [&](int begin, int end) {
+        for (int p = begin; p < end; ++p)
+        {
+            float px = this->x[p];
+            float py = this->y[p];
+            int i0 = std::min(static_cast<int>(px), maxI);
+            int j0 = std::min(static_cast<int>(py), maxJ);
+            float s1 = px - i0;
+            float t1 = py - j0;
+            float picU = 0.0f, picV = 0.0f;
+            float deltaU = 0.0f, deltaV = 0.0f;
+            float g00 = 0.0f, g01 = 0.0f, g10 = 0.0f, g11 = 0.0f;
+            for (int b = 0; b < 2; ++b)
+            {
+                float wy = b ? t1 : 1.0f - t1;
+                float gy = b ? 1.0f : -1.0f;
+                const float* ur = u.row(j0 + b);
+                const float* vr = v.row(j0 + b);
+                const float* uo = this->uOld.row(j0 + b);
+                const float* vo = this->vOld.row(j0 + b);
+                for (int a = 0; a < 2; ++a)
+                {
+                    float wx = a ? s1 : 1.0f - s1;
+                    float w = wx*wy;
+                    float nodeU = ur[i0 + a];
+                    float nodeV = vr[i0 + a];
+                    picU += w*nodeU;
+                    picV += w*nodeV;
+                    deltaU += w*(nodeU - uo[i0 + a]);
+                    deltaV += w*(nodeV - vo[i0 + a]);
+                    // gradient of the bilinear weight reproduces affine fields exactly
+                    float dwdx = (a ? 1.0f : -1.0f)*wy;
+                    float dwdy = gy*wx;
+                    g00 += nodeU*dwdx;
+                    g01 += nodeU*dwdy;
+                    g10 += nodeV*dwdx;
+                    g11 += nodeV*dwdy;
+                }
+            }
+            if (mode == TransferMode::Flip)
+            {
+                this->vx[p] = ratio*(this->vx[p] + deltaU) + (1.0f - ratio)*picU;
+                this->vy[p] = ratio*(this->vy[p] + deltaV) + (1.0f - ratio)*picV;
+            }
+            else
+            {
+                this->vx[p] = picU;
+                this->vy[p] = picV;
+            }
+            bool affine = mode == TransferMode::Apic;
+            this->c00[p] = affine ? g00 : 0.0f;
+            this->c01[p] = affine ? g01 : 0.0f;
+            this->c10[p] = affine ? g10 : 0.0f;
+            this->c11[p] = affine ? g11 : 0.0f;
+        }
+    });
+}
+
+void FlipSolver::advectParticles(float dt)
+{
+    SIMFLUID_PROFILE_ZONE("advect particles");
+    // midpoint rule through the divergence-free grid velocity
+    const ScalarField& u = this->grid.u();
+    const ScalarField& v = this->grid.v();
+    ThreadPool& pool = this->gridSolver.getThreadPool();
+    float dt0 = dt / this->grid.getCellSize();
+    float maxX = static_cast<float>(this->grid.getNx() - 1);
+    float maxY = static_cast<float>(this->grid.getNy() - 1);
+
+    pool.parallelFor(0, getNumParticles(), [&](int begin, int end) {
+        for (int p = begin; p < end; ++p)
+        {
+            float px = this->x[p];
+            float py = this->y[p];
+            float midX = px + 0.5f*dt0*sampleInterior(u, px, py);
+            float midY = py + 0.5f*dt0*sampleInterior(v, px, py);
+            float newX = std::min(std::max(px + dt0*sampleInterior(u, midX, midY), 0.0f), maxX);
+            float newY = std::min(std::max(py + dt0*sampleInterior(v, midX, midY), 0.0f), maxY);
+            // particles that would end up inside an obstacle stay where they are
+            if (!this->grid.isSolid(static_cast<int>(newX + 0.5f), static_cast<int>(newY + 0.5f)))
+            {
+                this->x[p] = newX;
+                this->y[p] = newY;
+            }
+        }
+    });
+}
@@ -0,0 +1,97 @@
+#ifndef FLIPSOLVER_HPP
+#define FLIPSOLVER_HPP
+
+#include "fluidgrid.hpp"
+#include <vector>
+
+class FluidSolver;
+
+enum class TransferMode
+{
+    Pic,    // grid velocity only; very dissipative
+    Flip,   // blend of particle velocity plus grid change and PIC (see flipRatio)
+    Apic    // affine particle-in-cell: PIC plus a per-particle velocity gradient
+};
+
+struct FlipParameters
+{
+    TransferMode mode{TransferMode::Apic};
+    float flipRatio{0.95f};   // FLIP share of the blend in Flip mode
+    int tileSize{8};          // cells per tile side for the coloured scatter, at least 2
+};
+
+// Hybrid particle/grid solver. Velocity lives on particles; every step it is
+// transferred to the FluidGrid, made divergence free by the FluidSolver's
+// projection (so any PressureSolver can be used), and transferred back.
+// The time step and the u/v sources come from the FluidSolver. Particle
+// positions are in grid index space, where sample (i, j) sits at (i, j);
+// velocities are in world units like the grid's. The domain is treated as
+// completely filled (no free surface): cells without particles get zero
+// velocity before the projection.
+//
+// Particles are kept sorted tile-major and cell-major inside each tile, so
+// both transfers walk memory in grid order. The particle-to-grid scatter
+// processes tiles in four colour phases (tile parity in x and y); tiles of one
+// colour are at least one tile apart, their 1-cell scatter footprints never
+// overlap, and each phase runs in parallel without atomics.
+class FlipSolver
+{
+public:
+    explicit FlipSolver(FluidSolver& gridSolver);
+
+    FlipParameters& parameters() { return this->params; }
+
+    void addParticle(float x, float y, float vx = 0.0f, float vy = 0.0f);
+    // seeds `perAxis` x `perAxis` jittered particles in every cell of the rectangle
+    void seedRectangle(int i0, int j0, int i1, int j1, int perAxis = 2);
+    int getNumParticles() const { return static_cast<int>(this->x.size()); }
+
+    void step();
+
+    //--------------individual stages, public for benchmarking---------------
+    void sortParticles();
+    void particlesToGrid();
+    void gridToParticles();
+    void advectParticles(float dt);
+
+    const std::vector<float>& positionsX() const { return this->x; }
+    const std::vector<float>& positionsY() const { return this->y; }
+    const std::vector<float>& velocitiesX() const { return this->vx; }
+    const std::vector<float>& velocitiesY() const { return this->vy; }
+    // first particle of every tile after sortParticles(); size numTiles + 1
+    const std::vector<int>& getTileStart() const { return this->tileStart; }
+    int getNumTilesX() const { return this->tilesX; }
+    int getNumTilesY() const { return this->tilesY; }
+
+private:
+    void setupTiles();
+    int sortKey(float px, float py) const;
+    void scatterTile(int tile);
+
+    FluidSolver& gridSolver;
+    FluidGrid& grid;
+    FlipParameters params;
+    int tilesX{0};
+    int tilesY{0};
+    int configuredTileSize{0};
+
+    // particle state, including the APIC affine matrix C
+    std::vector<float> x, y, vx, vy, c00, c01, c10, c11;
+
+    // sort workspace
+    std::vector<int> keys;
+    std::vector<int> order;
+    std::vector<int> keyStart;
+    std::vector<int> tileStart;
+    std::vector<int> colourTiles[4];
+    std::vector<std::vector<int>> chunkCounts;
+    std::vector<float> permuteBuffer;
+
+    // transfer weights (copied to the density field for display) and the
+    // pre-projection velocity for FLIP
+    ScalarField weightSum;
+    ScalarField uOld;
+    ScalarField vOld;
+};
+
+#endif // FLIPSOLVER_HPP
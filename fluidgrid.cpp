@@ -0,0 +1,212 @@
+#include "fluidgrid.hpp"
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+namespace
+{
+int roundUp(int value, int multiple)
+{
+    return ((value + multiple - 1) / multiple) * multiple;
+}
+}
+
+//--------------------------------SCALAR FIELD-------------------------------------
+void ScalarField::AlignedDeleter::operator()(float* p) const
+{
+    ::operator delete[](p, std::align_val_t(ScalarField::AlignmentBytes));
+}
+
+ScalarField::ScalarField()
+{
+}
+
+ScalarField::ScalarField(int nx, int ny, int ghost)
+    : nx(nx), ny(ny), ghost(ghost)
+{
+    if (nx <= 0 || ny <= 0 || ghost < 0)
+    {
+        throw std::invalid_argument("ScalarField: dimensions must be positive");
+    }
+    allocate();
+}
+
+ScalarField::ScalarField(const ScalarField& other)
+    : nx(other.nx), ny(other.ny), ghost(other.ghost)
+{
+    if (other.storage)
+    {
+        allocate();
+        std::memcpy(this->storage.get(), other.storage.get(), this->allocatedFloats*sizeof(float));
+    }
+}
+
+ScalarField::ScalarField(ScalarField&& other) noexcept
+{
+    swap(other);
+}
+
+ScalarField& ScalarField::operator=(const ScalarField& other)
+{
+    if (this != &other)
+    {
+        ScalarField copy(other);
+        swap(copy);
+    }
+    return *this;
+}
+
+ScalarField& ScalarField::operator=(ScalarField&& other) noexcept
+{
+    ScalarField moved(std::move(other));
+    swap(moved);
+    return *this;
+}
+
+void ScalarField::allocate()
+{
+    // put the first interior column on a cache line, then pad the row so the
+    // next row starts on one as well
+    this->columnOffset = roundUp(this->ghost, AlignmentFloats);
+    this->stride = roundUp(this->columnOffset + this->nx + this->ghost, AlignmentFloats);
+    this->allocatedFloats = static_cast<std::size_t>(this->stride) * (this->ny + 2*this->ghost);
+
+    float* raw = static_cast<float*>(::operator new[](this->allocatedFloats*sizeof(float),
+                                                      std::align_val_t(AlignmentBytes)));
+    this->storage.reset(raw);
+    std::fill(raw, raw + this->allocatedFloats, 0.0f);
+    this->origin = raw + static_cast<std::ptrdiff_t>(this->ghost)*this->stride + this->columnOffset;
+}
+
+bool ScalarField::sameShape(const ScalarField& other) const
+{
+    return this->nx == other.nx && this->ny == other.ny && this->ghost == other.ghost;
+}
+
+void ScalarField::fill(float value)
+{
+    std::fill(this->storage.get(), this->storage.get() + this->allocatedFloats, value);
+}
+
+void ScalarField::fillInterior(float value)
+{
+    for (int j = 0; j < this->ny; ++j)
+    {
+        std::fill(row(j), row(j) + this->nx, value);
+    }
+}
+
+void ScalarField::copyFrom(const ScalarField& other)
+{
+    if (!sameShape(other))
+    {
+        throw std::invalid_argument("ScalarField::copyFrom: shape mismatch");
+    }
+    std::memcpy(this->storage.get(), other.storage.get(), this->allocatedFloats*sizeof(float));
+}
+
+void ScalarField::swap(ScalarField& other) noexcept
+{
+    std::swap(this->nx, other.nx);
+    std::swap(this->ny, other.ny);
+    std::swap(this->ghost, other.ghost);
+    std::swap(this->stride, other.stride);
+    std::swap(this->columnOffset, other.columnOffset);
+    std::swap(this->allocatedFloats, other.allocatedFloats);
+    std::swap(this->storage, other.storage);
+    std::swap(this->origin, other.origin);
+}
+
+//--------------------------------BOUNDARIES---------------------------------------
+void applyBoundary(ScalarField& field, BoundaryKind kind)
+{
+    int nx = field.getNx();
+    int ny = field.getNy();
+    int g = field.getGhost();
+    float signX = (kind == BoundaryKind::VelocityU) ? -1.0f : 1.0f;
+    float signY = (kind == BoundaryKind::VelocityV) ? -1.0f : 1.0f;
+
+    // left/right walls over the interior rows
+    for (int j = 0; j < ny; ++j)
+    {
+        float* r = field.row(j);
+        for (int k = 0; k < g; ++k)
+        {
+            r[-1 - k] = signX * r[std::min(k, nx - 1)];
+            r[nx + k] = signX * r[std::max(nx - 1 - k, 0)];
+        }
+    }
+    // bottom/top walls over the full width, which also fills the corners
+    for (int k = 0; k < g; ++k)
+    {
+        const float* srcBottom = field.row(std::min(k, ny - 1));
+        const float* srcTop = field.row(std::max(ny - 1 - k, 0));
+        float* dstBottom = field.row(-1 - k);
+        float* dstTop = field.row(ny + k);
+        for (int i = -g; i < nx + g; ++i)
+        {
+            dstBottom[i] = signY * srcBottom[i];
+            dstTop[i] = signY * srcTop[i];
+        }
+    }
+}
+
+void markWallsSolid(ScalarField& obstacle)
+{
+    int nx = obstacle.getNx();
+    int ny = obstacle.getNy();
+    int g = obstacle.getGhost();
+    for (int j = -g; j < ny + g; ++j)
+    {
+        float* r = obstacle.row(j);
+        for (int i = -g; i < nx + g; ++i)
+        {
+            bool interior = (i >= 0 && i < nx && j >= 0 && j < ny);
+            if (!interior)
+            {
+                r[i] = 1.0f;
+            }
+        }
+    }
+}
+
+//--------------------------------FLUID GRID---------------------------------------
+FluidGrid::FluidGrid(int nx, int ny, int ghost, float cellSize)
+    : nx(nx), ny(ny), ghost(ghost), cellSize(cellSize)
+{
+    for (ScalarField& f : this->fields)
+    {
+        f = ScalarField(nx, ny, ghost);
+    }
+    markWallsSolid(obstacle());
+}
+
+ScalarField FluidGrid::makeScratchField() const
+{
+    return ScalarField(this->nx, this->ny, this->ghost);
+}
+
+void FluidGrid::setSolid(int i, int j, bool solid)
+{
+    obstacle().at(i, j) = solid ? 1.0f : 0.0f;
+}
+
+void FluidGrid::clear()
+{
+    for (ScalarField& f : this->fields)
+    {
+        f.fill(0.0f);
+    }
+    markWallsSolid(obstacle());
+}
+
+std::size_t FluidGrid::getMemoryBytes() const
+{
+    std::size_t total = 0;
+    for (const ScalarField& f : this->fields)
+    {
+        total += f.getAllocatedBytes();
+    }
+    return total;
+}
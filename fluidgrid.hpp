@@ -0,0 +1,145 @@
+#ifndef FLUIDGRID_HPP
+#define FLUIDGRID_HPP
+
+#include <array>
+#include <cstddef>
+#include <memory>
+
+// A single 2D float field stored row-major in one 64-byte aligned allocation.
+// The interior is nx x ny cells, surrounded by `ghost` layers on every side.
+// Indices run from -ghost to nx+ghost-1 (resp. ny), so at(0,0) is the first
+// interior cell. Every row starts on a cache line and the interior of every
+// row starts on a cache line too, so unit-stride loops over i vectorize
+// without peeling.
+class ScalarField
+{
+public:
+    static constexpr int AlignmentBytes = 64;
+    static constexpr int AlignmentFloats = AlignmentBytes / static_cast<int>(sizeof(float));
+
+    ScalarField();
+    ScalarField(int nx, int ny, int ghost = 1);
+    ScalarField(const ScalarField& other);
+    ScalarField(ScalarField&& other) noexcept;
+    ScalarField& operator=(const ScalarField& other);
+    ScalarField& operator=(ScalarField&& other) noexcept;
+    ~ScalarField() = default;
+
+    int getNx() const { return this->nx; }
+    int getNy() const { return this->ny; }
+    int getGhost() const { return this->ghost; }
+    int getStride() const { return this->stride; }
+    bool sameShape(const ScalarField& other) const;
+
+    float& at(int i, int j) { return this->origin[static_cast<std::ptrdiff_t>(j)*this->stride + i]; }
+    float at(int i, int j) const { return this->origin[static_cast<std::ptrdiff_t>(j)*this->stride + i]; }
+
+    // pointer to cell (0, j); valid for i in [-ghost, nx+ghost)
+    float* row(int j) { return this->origin + static_cast<std::ptrdiff_t>(j)*this->stride; }
+    const float* row(int j) const { return this->origin + static_cast<std::ptrdiff_t>(j)*this->stride; }
+
+    // raw allocation including padding and ghost layers
+    float* data() { return this->storage.get(); }
+    const float* data() const { return this->storage.get(); }
+    std::size_t getAllocatedFloats() const { return this->allocatedFloats; }
+    std::size_t getAllocatedBytes() const { return this->allocatedFloats * sizeof(float); }
+
+    void fill(float value);
+    void fillInterior(float value);
+    void copyFrom(const ScalarField& other);
+    void swap(ScalarField& other) noexcept;
+
+private:
+    struct AlignedDeleter
+    {
+        void operator()(float* p) const;
+    };
+
+    void allocate();
+
+    int nx{0};
+    int ny{0};
+    int ghost{0};
+    int stride{0};
+    int columnOffset{0};
+    std::size_t allocatedFloats{0};
+    std::unique_ptr<float[], AlignedDeleter> storage;
+    float* origin{nullptr};
+};
+
+// how the ghost layers mirror the interior at the domain walls
+enum class BoundaryKind
+{
+    Scalar,     // zero normal gradient
+    VelocityU,  // x-velocity: no penetration through left/right walls
+    VelocityV   // y-velocity: no penetration through bottom/top walls
+};
+
+void applyBoundary(ScalarField& field, BoundaryKind kind);
+
+// obstacle masks store 1 for solid cells; the ghost layers count as solid so
+// the domain walls look like any other obstacle to the solvers
+void markWallsSolid(ScalarField& obstacle);
+
+
+enum class FluidField
+{
+    VelocityU = 0,
+    VelocityV,
+    Pressure,
+    Density,
+    Temperature,
+    Obstacle,
+    Count
+};
+
+// Structure-of-arrays container for all simulation state. Each field is its
+// own aligned ScalarField with identical shape, so stencil loops stream
+// through one or two arrays at a time instead of striding over interleaved
+// records. Deliberately free of Qt so it can be used headlessly.
+class FluidGrid
+{
+public:
+    static constexpr int NumFields = static_cast<int>(FluidField::Count);
+
+    FluidGrid(int nx, int ny, int ghost = 1, float cellSize = 1.0f);
+
+    int getNx() const { return this->nx; }
+    int getNy() const { return this->ny; }
+    int getGhost() const { return this->ghost; }
+    float getCellSize() const { return this->cellSize; }
+
+    ScalarField& field(FluidField f) { return this->fields[static_cast<int>(f)]; }
+    const ScalarField& field(FluidField f) const { return this->fields[static_cast<int>(f)]; }
+
+    ScalarField& u() { return field(FluidField::VelocityU); }
+    ScalarField& v() { return field(FluidField::VelocityV); }
+    ScalarField& pressure() { return field(FluidField::Pressure); }
+    ScalarField& density() { return field(FluidField::Density); }
+    ScalarField& temperature() { return field(FluidField::Temperature); }
+    ScalarField& obstacle() { return field(FluidField::Obstacle); }
+    const ScalarField& u() const { return field(FluidField::VelocityU); }
+    const ScalarField& v() const { return field(FluidField::VelocityV); }
+    const ScalarField& pressure() const { return field(FluidField::Pressure); }
+    const ScalarField& density() const { return field(FluidField::Density); }
+    const ScalarField& temperature() const { return field(FluidField::Temperature); }
+    const ScalarField& obstacle() const { return field(FluidField::Obstacle); }
+
+    // a fresh ScalarField with the same shape as the grid fields
+    ScalarField makeScratchField() const;
+
+    bool isSolid(int i, int j) const { return obstacle().at(i, j) > 0.5f; }
+    void setSolid(int i, int j, bool solid);
+    void clear();
+
+    std::size_t getMemoryBytes() const;
+
+private:
+    int nx{0};
+    int ny{0};
+    int ghost{0};
+    float cellSize{1.0f};
+    std::array<ScalarField, NumFields> fields;
+};
+
+#endif // FLUIDGRID_HPP
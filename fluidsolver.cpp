@@ -0,0 +1,418 @@
+#include "fluidsolver.hpp"
+#include "cpudispatch.hpp"
+#include "multigridsolver.hpp"
+#include "pcgsolver.hpp"
+#include "profiler.hpp"
+#include "quadtree.hpp"
+#include "spectralsolver.hpp"
+#include "threadpool.hpp"
+#include <algorithm>
+#include <cmath>
+
+FluidSolver::FluidSolver(FluidGrid& grid, int numThreads)
+    : FluidSolver(grid, nullptr, std::unique_ptr<ThreadPool>(new ThreadPool(numThreads)))
+{
+}
+
+FluidSolver::FluidSolver(FluidGrid& grid, ThreadPool& sharedPool)
+    : FluidSolver(grid, &sharedPool, nullptr)
+{
+}
+
+FluidSolver::FluidSolver(FluidGrid& grid, ThreadPool* sharedPool, std::unique_ptr<ThreadPool> ownPool)
+    : grid(grid),
+      ownedPool(std::move(ownPool)),
+      pool(sharedPool ? sharedPool : this->ownedPool.get()),
+      densitySrc(grid.makeScratchField()),
+      temperatureSrc(grid.makeScratchField()),
+      uSrc(grid.makeScratchField()),
+      vSrc(grid.makeScratchField()),
+      scratch(grid.makeScratchField()),
+      scratch2(grid.makeScratchField()),
+      uPrev(grid.makeScratchField()),
+      vPrev(grid.makeScratchField()),
+      rhs(grid.makeScratchField())
+{
+    std::unique_ptr<JacobiPressureSolver> jacobi(new JacobiPressureSolver(this->pool));
+    jacobi->setMaxIterations(60);
+    jacobi->setTolerance(1e-3);
+    this->pressureSolver = std::move(jacobi);
+}
+
+FluidSolver::~FluidSolver()
+{
+}
+
+void FluidSolver::setPressureSolver(std::unique_ptr<PressureSolver> solver)
+{
+    if (solver)
+    {
+        this->pressureSolver = std::move(solver);
+    }
+}
+
+void FluidSolver::usePressureSolver(PressureSolverKind kind)
+{
+    ThreadPool* threads = this->pool;
+    switch (kind)
+    {
+    case PressureSolverKind::Jacobi:
+        setPressureSolver(std::unique_ptr<PressureSolver>(new JacobiPressureSolver(threads)));
+        break;
+    case PressureSolverKind::Multigrid:
+        setPressureSolver(std::unique_ptr<PressureSolver>(new MultigridPressureSolver(threads)));
+        break;
+    case PressureSolverKind::ConjugateGradient:
+        setPressureSolver(std::unique_ptr<PressureSolver>(new PcgPressureSolver(threads)));
+        break;
+    case PressureSolverKind::PipelinedConjugateGradient:
+    {
+        std::unique_ptr<PcgPressureSolver> pcg(new PcgPressureSolver(threads));
+        pcg->setPipelined(true);
+        setPressureSolver(std::move(pcg));
+        break;
+    }
+    case PressureSolverKind::Spectral:
+        setPressureSolver(std::unique_ptr<PressureSolver>(new SpectralPressureSolver(SpectralBoundary::Neumann, threads)));
+        break;
+    case PressureSolverKind::Quadtree:
+        setPressureSolver(std::unique_ptr<PressureSolver>(new QuadtreePressureSolver(threads)));
+        break;
+    }
+}
+
+//--------------------------------SPARSE BLOCKS------------------------------------
+void FluidSolver::setSparse(bool enabled, float threshold, float velocityThreshold)
+{
+    if (!enabled)
+    {
+        this->activeBlocks.reset();
+        return;
+    }
+    if (!this->activeBlocks)
+    {
+        // starts with every block active; the first update zeroes whatever it drops
+        this->activeBlocks.reset(new ActiveBlockSet(this->grid.getNx(), this->grid.getNy()));
+    }
+    this->sparseThreshold = threshold;
+    this->sparseVelocityThreshold = velocityThreshold;
+}
+
+SparseMemoryUsage FluidSolver::getSparseMemoryUsage() const
+{
+    if (!this->activeBlocks)
+    {
+        // every block active and no active set held
+        ActiveBlockSet everything(this->grid.getNx(), this->grid.getNy());
+        SparseMemoryUsage usage = everything.getMemoryUsage(this->grid, 4);
+        usage.activeSetBytes = 0;
+        return usage;
+    }
+    return this->activeBlocks->getMemoryUsage(this->grid, 4);
+}
+
+void FluidSolver::updateActiveBlocks()
+{
+    SIMFLUID_PROFILE_ZONE("active blocks");
+    FluidGrid& g = this->grid;
+    float scalar = this->sparseThreshold;
+    float velocity = this->sparseVelocityThreshold;
+    this->activeBlocks->update({{&g.u(), velocity}, {&g.v(), velocity}, {&g.density(), scalar}, {&g.temperature(), scalar}},
+                               {{&this->uSrc, 0.0f}, {&this->vSrc, 0.0f}, {&this->densitySrc, 0.0f},
+                                {&this->temperatureSrc, 0.0f}},
+                               this->pool);
+    for (ScalarField* field : {&g.u(), &g.v(), &g.density(), &g.temperature(), &this->scratch, &this->scratch2,
+                               &this->uPrev, &this->vPrev})
+    {
+        this->activeBlocks->clearRetired(*field);
+    }
+}
+
+void FluidSolver::forEachRegion(const std::function<void(int, int, int, int)>& body)
+{
+    if (this->activeBlocks)
+    {
+        this->activeBlocks->forEachActive(this->pool, body);
+        return;
+    }
+    int nx = this->grid.getNx();
+    parallelFor(this->pool, 0, this->grid.getNy(), [&](int j0, int j1) { body(0, nx, j0, j1); });
+}
+
+void FluidSolver::copyRegions(ScalarField& dst, const ScalarField& src)
+{
+    if (!this->activeBlocks)
+    {
+        dst.copyFrom(src);
+        return;
+    }
+    forEachRegion([&](int i0, int i1, int j0, int j1) {
+        for (int j = j0; j < j1; ++j)
+        {
+            std::copy(src.row(j) + i0, src.row(j) + i1, dst.row(j) + i0);
+        }
+    });
+    // the ghost frame, which advection reads
+    int nx = src.getNx();
+    int ny = src.getNy();
+    int g = src.getGhost();
+    for (int j = -g; j < ny + g; ++j)
+    {
+        if (j < 0 || j >= ny)
+        {
+            std::copy(src.row(j) - g, src.row(j) + nx + g, dst.row(j) - g);
+        }
+        else
+        {
+            std::copy(src.row(j) - g, src.row(j), dst.row(j) - g);
+            std::copy(src.row(j) + nx, src.row(j) + nx + g, dst.row(j) + nx);
+        }
+    }
+}
+
+void FluidSolver::clearRegions(ScalarField& field)
+{
+    if (!this->activeBlocks)
+    {
+        field.fill(0.0f);
+        return;
+    }
+    forEachRegion([&](int i0, int i1, int j0, int j1) {
+        for (int j = j0; j < j1; ++j)
+        {
+            std::fill(field.row(j) + i0, field.row(j) + i1, 0.0f);
+        }
+    });
+}
+
+//--------------------------------STEP---------------------------------------------
+void FluidSolver::step()
+{
+    SIMFLUID_PROFILE_ZONE("FluidSolver::step");
+    float dt = this->params.timeStep;
+
+    if (this->activeBlocks)
+    {
+        updateActiveBlocks();
+    }
+    velocityStep(dt);
+    scalarStep(this->grid.density(), this->densitySrc, dt);
+    scalarStep(this->grid.temperature(), this->temperatureSrc, dt);
+
+    // sources outside the active set were zero, or their blocks would be active
+    clearRegions(this->uSrc);
+    clearRegions(this->vSrc);
+    clearRegions(this->densitySrc);
+    clearRegions(this->temperatureSrc);
+}
+
+void FluidSolver::velocityStep(float dt)
+{
+    SIMFLUID_PROFILE_ZONE("velocity step");
+    ScalarField& u = this->grid.u();
+    ScalarField& v = this->grid.v();
+
+    addSource(u, this->uSrc, dt);
+    addSource(v, this->vSrc, dt);
+    if (this->params.buoyancy != 0.0f)
+    {
+        addSource(v, this->grid.temperature(), dt*this->params.buoyancy);
+    }
+
+    if (this->params.viscosity > 0.0f)
+    {
+        copyRegions(this->scratch, u);
+        diffuse(u, this->scratch, this->params.viscosity, dt, BoundaryKind::VelocityU);
+        copyRegions(this->scratch, v);
+        diffuse(v, this->scratch, this->params.viscosity, dt, BoundaryKind::VelocityV);
+    }
+    applyBoundary(u, BoundaryKind::VelocityU);
+    applyBoundary(v, BoundaryKind::VelocityV);
+    project();
+
+    copyRegions(this->uPrev, u);
+    copyRegions(this->vPrev, v);
+    advect(u, this->uPrev, this->uPrev, this->vPrev, dt, BoundaryKind::VelocityU);
+    advect(v, this->vPrev, this->uPrev, this->vPrev, dt, BoundaryKind::VelocityV);
+    project();
+}
+
+void FluidSolver::scalarStep(ScalarField& field, ScalarField& source, float dt)
+{
+    SIMFLUID_PROFILE_ZONE("scalar step");
+    addSource(field, source, dt);
+    if (this->params.diffusion > 0.0f)
+    {
+        copyRegions(this->scratch, field);
+        diffuse(field, this->scratch, this->params.diffusion, dt, BoundaryKind::Scalar);
+    }
+    applyBoundary(field, BoundaryKind::Scalar);
+    copyRegions(this->scratch, field);
+    advect(field, this->scratch, this->grid.u(), this->grid.v(), dt, BoundaryKind::Scalar);
+}
+
+//--------------------------------STAGES-------------------------------------------
+void FluidSolver::addSource(ScalarField& field, const ScalarField& source, float dt)
+{
+    SIMFLUID_PROFILE_ZONE("add source");
+    forEachRegion([&](int i0, int i1, int j0, int j1) {
+        for (int j = j0; j < j1; ++j)
+        {
+            float* x = field.row(j);
+            const float* s = source.row(j);
+            for (int i = i0; i < i1; ++i)
+            {
+                x[i] += dt*s[i];
+            }
+        }
+    });
+}
+
+void FluidSolver::diffuse(ScalarField& dst, const ScalarField& src, float rate, float dt, BoundaryKind kind)
+{
+    SIMFLUID_PROFILE_ZONE("diffuse");
+    float h = this->grid.getCellSize();
+    float a = dt*rate/(h*h);
+    const ScalarField& obstacle = this->grid.obstacle();
+
+    copyRegions(dst, src);
+    applyBoundary(dst, kind);
+    if (a == 0.0f)
+    {
+        return;
+    }
+
+    float inverseDiag = 1.0f / (1.0f + 4.0f*a);
+    for (int iteration = 0; iteration < this->params.diffusionIterations; ++iteration)
+    {
+        forEachRegion([&](int i0, int i1, int j0, int j1) {
+            for (int j = j0; j < j1; ++j)
+            {
+                const float* xc = dst.row(j);
+                const float* xd = dst.row(j - 1);
+                const float* xu = dst.row(j + 1);
+                const float* x0 = src.row(j);
+                const float* solid = obstacle.row(j);
+                float* out = this->scratch2.row(j);
+                for (int i = i0; i < i1; ++i)
+                {
+                    float value = (x0[i] + a*(xc[i - 1] + xc[i + 1] + xd[i] + xu[i])) * inverseDiag;
+                    out[i] = (1.0f - solid[i]) * value;
+                }
+            }
+        });
+        dst.swap(this->scratch2);
+        applyBoundary(dst, kind);
+    }
+}
+
+void FluidSolver::advect(ScalarField& dst, const ScalarField& src, const ScalarField& u, const ScalarField& v,
+                         float dt, BoundaryKind kind)
+{
+    SIMFLUID_PROFILE_ZONE("advect");
+    int nx = dst.getNx();
+    int ny = dst.getNy();
+    float dt0 = dt / this->grid.getCellSize();
+    float maxX = nx - 0.5f;
+    float maxY = ny - 0.5f;
+    const ScalarField& obstacle = this->grid.obstacle();
+    AdvectionRowKernel kernel = activeKernels().advectRow;
+
+    forEachRegion([&](int i0, int i1, int j0, int j1) {
+        AdvectionRowArgs args;
+        args.src = src.row(0);
+        args.srcStride = src.getStride();
+        args.begin = i0;
+        args.nx = i1;
+        args.dt0 = dt0;
+        args.maxX = maxX;
+        args.maxY = maxY;
+        for (int j = j0; j < j1; ++j)
+        {
+            args.u = u.row(j);
+            args.v = v.row(j);
+            args.solid = obstacle.row(j);
+            args.out = dst.row(j);
+            args.j = j;
+            kernel(args);
+        }
+    });
+    applyBoundary(dst, kind);
+}
+
+void FluidSolver::computeDivergence(ScalarField& dst)
+{
+    SIMFLUID_PROFILE_ZONE("divergence");
+    const ScalarField& u = this->grid.u();
+    const ScalarField& v = this->grid.v();
+    const ScalarField& obstacle = this->grid.obstacle();
+    float h = this->grid.getCellSize();
+
+    if (this->activeBlocks)
+    {
+        // still air has no divergence; dst may hold anything outside the active set
+        dst.fillInterior(0.0f);
+    }
+    forEachRegion([&](int i0, int i1, int j0, int j1) {
+        for (int j = j0; j < j1; ++j)
+        {
+            const float* uc = u.row(j);
+            const float* vd = v.row(j - 1);
+            const float* vu = v.row(j + 1);
+            const float* solid = obstacle.row(j);
+            float* b = dst.row(j);
+            for (int i = i0; i < i1; ++i)
+            {
+                b[i] = (1.0f - solid[i]) * (-0.5f*h*(uc[i + 1] - uc[i - 1] + vu[i] - vd[i]));
+            }
+        }
+    });
+}
+
+void FluidSolver::project()
+{
+    SIMFLUID_PROFILE_ZONE("project");
+    ScalarField& u = this->grid.u();
+    ScalarField& v = this->grid.v();
+    ScalarField& p = this->grid.pressure();
+    const ScalarField& obstacle = this->grid.obstacle();
+    float h = this->grid.getCellSize();
+
+    computeDivergence(this->rhs);
+    removeFluidMean(this->rhs, obstacle);
+
+    {
+        SIMFLUID_PROFILE_ZONE("pressure solve");
+        this->pressureSolver->adaptTo(this->grid);
+        this->lastPressureStats = this->pressureSolver->solve(p, this->rhs, obstacle);
+    }
+
+    // subtract the gradient; solid neighbours mirror the centre value
+    SIMFLUID_PROFILE_ZONE("subtract gradient");
+    float scale = 0.5f / h;
+    forEachRegion([&](int i0, int i1, int j0, int j1) {
+        for (int j = j0; j < j1; ++j)
+        {
+            const float* pc = p.row(j);
+            const float* pd = p.row(j - 1);
+            const float* pu = p.row(j + 1);
+            const float* sc = obstacle.row(j);
+            const float* sd = obstacle.row(j - 1);
+            const float* su = obstacle.row(j + 1);
+            float* ur = u.row(j);
+            float* vr = v.row(j);
+            for (int i = i0; i < i1; ++i)
+            {
+                float pl = sc[i - 1] > 0.5f ? pc[i] : pc[i - 1];
+                float pr = sc[i + 1] > 0.5f ? pc[i] : pc[i + 1];
+                float pdn = sd[i] > 0.5f ? pc[i] : pd[i];
+                float pup = su[i] > 0.5f ? pc[i] : pu[i];
+                float fluid = 1.0f - sc[i];
+                ur[i] = fluid * (ur[i] - scale*(pr - pl));
+                vr[i] = fluid * (vr[i] - scale*(pup - pdn));
+            }
+        }
+    });
+    applyBoundary(u, BoundaryKind::VelocityU);
+    applyBoundary(v, BoundaryKind::VelocityV);
+}
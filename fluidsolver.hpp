@@ -0,0 +1,128 @@
+#ifndef FLUIDSOLVER_HPP
+#define FLUIDSOLVER_HPP
+
+#include "fluidgrid.hpp"
+#include "pressuresolver.hpp"
+#include "sparsegrid.hpp"
+#include <functional>
+#include <memory>
+
+class ThreadPool;
+
+enum class PressureSolverKind
+{
+    Jacobi,
+    Multigrid,
+    ConjugateGradient,
+    PipelinedConjugateGradient,
+    Spectral,
+    Quadtree
+};
+
+struct FluidParameters
+{
+    float timeStep{0.1f};
+    float viscosity{0.0f};       // kinematic viscosity, length^2 / time
+    float diffusion{0.0f};       // scalar diffusivity for density and temperature
+    float buoyancy{0.0f};        // upward acceleration per unit temperature
+    int diffusionIterations{20};
+};
+
+// Stam-style stable fluids stepper on a collocated FluidGrid:
+//   add sources -> diffuse -> project -> advect -> project
+// followed by add/diffuse/advect for the scalars. Every stage is split by
+// rows across a ThreadPool that is created once with the solver.
+//
+// In sparse mode (setSparse) an ActiveBlockSet is refreshed at the start of
+// every step from the velocity, density, temperature and source fields, and
+// every stage except the pressure solve visits only the active blocks; the
+// rest of the domain is treated as still, empty air and kept at zero. The
+// pressure solve stays dense because its answer depends on the whole domain.
+// Sparse mode saves work, not memory: every field stays a dense ScalarField
+// (SparseBlockField is a separate container the solver does not use).
+class FluidSolver
+{
+public:
+    explicit FluidSolver(FluidGrid& grid, int numThreads = 0);
+    // runs on a pool owned by the caller, which must outlive the solver; several
+    // solvers can share one pool and step from inside its tasks
+    FluidSolver(FluidGrid& grid, ThreadPool& sharedPool);
+    ~FluidSolver();
+
+    FluidGrid& getGrid() { return this->grid; }
+    ThreadPool& getThreadPool() { return *this->pool; }
+    FluidParameters& parameters() { return this->params; }
+
+    void setPressureSolver(std::unique_ptr<PressureSolver> solver);
+    // replaces the pressure solver with a default-configured one sharing the solver's pool
+    void usePressureSolver(PressureSolverKind kind);
+    PressureSolver& getPressureSolver() { return *this->pressureSolver; }
+    const PressureSolveStats& getLastPressureStats() const { return this->lastPressureStats; }
+
+    // sources are added at the start of the next step and then cleared
+    ScalarField& densitySource() { return this->densitySrc; }
+    ScalarField& temperatureSource() { return this->temperatureSrc; }
+    ScalarField& uSource() { return this->uSrc; }
+    ScalarField& vSource() { return this->vSrc; }
+
+    void step();
+
+    // Blocks where density and temperature stay below `threshold` and the
+    // velocity below `velocityThreshold` (cells per unit time) are skipped and
+    // zeroed. The incompressible far field of any flow reaches everywhere, so
+    // the velocity threshold has to be much coarser than the scalar one.
+    void setSparse(bool enabled, float threshold = 1e-4f, float velocityThreshold = 3e-2f);
+    bool isSparse() const { return this->activeBlocks != nullptr; }
+    // nullptr unless sparse
+    const ActiveBlockSet* getActiveBlocks() const { return this->activeBlocks.get(); }
+    // u, v, density and temperature, plus the active set when sparse
+    SparseMemoryUsage getSparseMemoryUsage() const;
+
+    //--------------individual stages, public for benchmarking---------------
+    void addSource(ScalarField& field, const ScalarField& source, float dt);
+    // solves (I - dt*rate*Laplacian) dst = src with Jacobi sweeps
+    void diffuse(ScalarField& dst, const ScalarField& src, float rate, float dt, BoundaryKind kind);
+    // semi-Lagrangian backtrace of src through (u, v); src ghosts must be valid.
+    // Rows go through the advection kernel of the active ISA level.
+    void advect(ScalarField& dst, const ScalarField& src, const ScalarField& u, const ScalarField& v,
+                float dt, BoundaryKind kind);
+    // central-difference divergence of the grid velocity in the units of the
+    // pressure system (-h div u, zero in solids): the right-hand side of project()
+    void computeDivergence(ScalarField& dst);
+    // makes (u, v) discretely divergence free and stores the pressure in the grid
+    void project();
+
+private:
+    FluidSolver(FluidGrid& grid, ThreadPool* sharedPool, std::unique_ptr<ThreadPool> ownPool);
+
+    void velocityStep(float dt);
+    void scalarStep(ScalarField& field, ScalarField& source, float dt);
+    // body(i0, i1, j0, j1) over bands of whole rows, or over the active blocks when sparse
+    void forEachRegion(const std::function<void(int, int, int, int)>& body);
+    // copyFrom / fill(0) restricted to the active blocks (plus ghosts) when sparse
+    void copyRegions(ScalarField& dst, const ScalarField& src);
+    void clearRegions(ScalarField& field);
+    void updateActiveBlocks();
+
+    FluidGrid& grid;
+    FluidParameters params;
+    std::unique_ptr<ThreadPool> ownedPool;
+    ThreadPool* pool{nullptr};
+    std::unique_ptr<PressureSolver> pressureSolver;
+    PressureSolveStats lastPressureStats;
+    std::unique_ptr<ActiveBlockSet> activeBlocks;
+    float sparseThreshold{1e-4f};
+    float sparseVelocityThreshold{3e-2f};
+
+    ScalarField densitySrc;
+    ScalarField temperatureSrc;
+    ScalarField uSrc;
+    ScalarField vSrc;
+    ScalarField scratch;
+    ScalarField scratch2;
+    ScalarField uPrev;
+    ScalarField vPrev;
+    ScalarField rhs;
+};
+
+#endif // FLUIDSOLVER_HPP
@@ -0,0 +1,108 @@
+#include "gridgeometry.hpp"
+#include <stdexcept>
+
+std::vector<float> buildGridVertices(int n)
+{
+    std::vector<float> vertices;
+    vertices.reserve(3*static_cast<std::size_t>(n + 1)*(n + 1));
+    for (int i = 0; i <= n; ++i)
+    {
+        for (int j = 0; j <= n; ++j)
+        {
+            vertices.push_back(static_cast<float>(i));
+            vertices.push_back(static_cast<float>(j));
+            vertices.push_back(0.0f);
+        }
+    }
+    return vertices;
+}
+
+std::vector<int> buildGridIndices(int n)
+{
+    std::vector<int> indices;
+    indices.reserve(6*static_cast<std::size_t>(n)*n);
+    for (int i = 0; i < n; ++i)
+    {
+        for (int j = 0; j < n; ++j)
+        {
+            int BL = i*(n+1) + j;
+            int TL = BL + 1;
+            int BR = BL + n + 1;
+            int TR = BR + 1;
+
+            indices.push_back(BL);
+            indices.push_back(TL);
+            indices.push_back(BR);
+            //
+            indices.push_back(TL);
+            indices.push_back(TR);
+            indices.push_back(BR);
+        }
+    }
+    return indices;
+}
+
+std::size_t gridGeometryBytes(int n)
+{
+    std::size_t vertexCount = static_cast<std::size_t>(n + 1)*(n + 1);
+    std::size_t indexCount = 6*static_cast<std::size_t>(n)*n;
+    return vertexCount*3*sizeof(float) + indexCount*sizeof(int);
+}
+
+void proceduralQuadCorner(int vertexId, float& x, float& y)
+{
+    // same winding as the buffer path: (BL, TL, BR), (TL, TR, BR)
+    static const float corners[ProceduralQuadVertexCount][2] = {
+        {0.0f, 0.0f}, {0.0f, 1.0f}, {1.0f, 0.0f}, {0.0f, 1.0f}, {1.0f, 1.0f}, {1.0f, 0.0f}};
+    x = corners[vertexId][0];
+    y = corners[vertexId][1];
+}
+
+std::string insertProceduralQuadCorners(const std::string& shaderSource)
+{
+    std::size_t marker = shaderSource.find(ProceduralQuadMarker);
+    if (marker == std::string::npos)
+    {
+        throw std::invalid_argument("insertProceduralQuadCorners: shader has no quad corner marker");
+    }
+    std::size_t lineEnd = shaderSource.find('\n', marker);
+    if (lineEnd == std::string::npos)
+    {
+        lineEnd = shaderSource.size();
+    }
+
+    std::string table = "const vec2 quadCorners[" + std::to_string(ProceduralQuadVertexCount) + "] = vec2[" +
+                        std::to_string(ProceduralQuadVertexCount) + "](";
+    for (int k = 0; k < ProceduralQuadVertexCount; ++k)
+    {
+        float x, y;
+        proceduralQuadCorner(k, x, y);
+        table += (k > 0 ? ", vec2(" : "vec2(") + std::to_string(x) + ", " + std::to_string(y) + ")";
+    }
+    table += ");";
+    return shaderSource.substr(0, marker) + table + shaderSource.substr(lineEnd);
+}
+
+std::vector<float> buildQuadtreeLeafLines(const std::vector<QuadtreeLeaf>& leaves)
+{
+    std::vector<float> lines;
+    lines.reserve(leaves.size()*8*3);
+    for (const QuadtreeLeaf& leaf : leaves)
+    {
+        float x0 = static_cast<float>(leaf.i0);
+        float y0 = static_cast<float>(leaf.j0);
+        float x1 = x0 + leaf.size;
+        float y1 = y0 + leaf.size;
+        const float corners[5][2] = {{x0, y0}, {x1, y0}, {x1, y1}, {x0, y1}, {x0, y0}};
+        for (int e = 0; e < 4; ++e)
+        {
+            for (int c = e; c <= e + 1; ++c)
+            {
+                lines.push_back(corners[c][0]);
+                lines.push_back(corners[c][1]);
+                lines.push_back(0.0f);
+            }
+        }
+    }
+    return lines;
+}
@@ -0,0 +1,35 @@
+#ifndef GRIDGEOMETRY_HPP
+#define GRIDGEOMETRY_HPP
+
+#include "quadtree.hpp"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Qt-free generation of the n x n display grid used by SceneView's buffer
+// path: (n+1)^2 vertices (x, y, 0) at integer positions, x-major, and two
+// triangles per cell. The procedural path needs none of this; the vertex
+// shader expands gl_VertexID 0..5 into one quad covering [0, n]^2.
+
+constexpr int ProceduralQuadVertexCount = 6;
+
+std::vector<float> buildGridVertices(int n);
+std::vector<int> buildGridIndices(int n);
+
+// vertex plus index buffer bytes of the buffer path, what the procedural path saves
+std::size_t gridGeometryBytes(int n);
+
+// corner of the procedural quad for a gl_VertexID in [0, 6), in units of n
+void proceduralQuadCorner(int vertexId, float& x, float& y);
+
+// pass_through.vert has no corner table of its own: SceneView replaces the
+// line holding this marker with the GLSL declaration of the table above
+// (const vec2 quadCorners[6]). Throws std::invalid_argument without a marker.
+constexpr const char* ProceduralQuadMarker = "// @quadCorners";
+std::string insertProceduralQuadCorners(const std::string& shaderSource);
+
+// outlines of quadtree leaves as GL_LINES vertices (x, y, 0) in grid units,
+// four edges per leaf; edges shared by two leaves are drawn twice
+std::vector<float> buildQuadtreeLeafLines(const std::vector<QuadtreeLeaf>& leaves);
+
+#endif // GRIDGEOMETRY_HPP
@@ -0,0 +1,82 @@
+#include "gridlayout.hpp"
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+namespace
+{
+const int TimedSweeps = 4;
+
+template <class Layout>
+double secondsPerSweep(int nx, int ny, ThreadPool* pool)
+{
+    LayoutField<Layout> p(nx, ny);
+    LayoutField<Layout> out(nx, ny);
+    LayoutField<Layout> rhs(nx, ny);
+    LayoutField<Layout> obstacle(nx, ny);
+    for (int j = -1; j <= ny; ++j)
+    {
+        for (int i = -1; i <= nx; ++i)
+        {
+            bool wall = i < 0 || j < 0 || i >= nx || j >= ny;
+            obstacle.at(i, j) = wall ? 1.0f : 0.0f;
+            rhs.at(i, j) = wall ? 0.0f : static_cast<float>((i*7 + j*3) % 5) - 2.0f;
+        }
+    }
+
+    // one untimed sweep faults the pages in
+    layoutJacobiSweep(p, rhs, obstacle, out, pool);
+    double best = 0.0;
+    for (int sweep = 0; sweep < TimedSweeps; ++sweep)
+    {
+        auto start = std::chrono::steady_clock::now();
+        layoutJacobiSweep(p, rhs, obstacle, out, pool);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = sweep == 0 ? seconds : std::min(best, seconds);
+        p.swap(out);
+    }
+    return best;
+}
+}
+
+const char* gridLayoutName(GridLayoutKind kind)
+{
+    return visitGridLayout(kind, [](auto tag) { return decltype(tag)::type::Name; });
+}
+
+GridLayoutKind chooseGridLayout(int nx, int ny, ThreadPool* pool)
+{
+    static std::mutex mutex;
+    static std::map<std::tuple<int, int, int>, GridLayoutKind> chosen;
+    std::tuple<int, int, int> key(nx, ny, pool ? pool->getNumThreads() : 1);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = chosen.find(key);
+        if (found != chosen.end())
+        {
+            return found->second;
+        }
+    }
+
+    // no lock while measuring: the sweeps wait on the pool, whose workers may
+    // themselves be waiting for the lock
+    GridLayoutKind best = GridLayoutKind::RowMajor;
+    double bestSeconds = 0.0;
+    for (GridLayoutKind kind : {GridLayoutKind::RowMajor, GridLayoutKind::Tiled8, GridLayoutKind::Tiled16,
+                                GridLayoutKind::Morton})
+    {
+        double seconds = visitGridLayout(kind, [&](auto tag) {
+            return secondsPerSweep<typename decltype(tag)::type>(nx, ny, pool);
+        });
+        if (kind == GridLayoutKind::RowMajor || seconds < bestSeconds)
+        {
+            best = kind;
+            bestSeconds = seconds;
+        }
+    }
+    // a concurrent caller may have measured the same size first; keep its answer
+    std::lock_guard<std::mutex> lock(mutex);
+    return chosen.emplace(key, best).first->second;
+}
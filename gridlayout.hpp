@@ -0,0 +1,441 @@
+#ifndef GRIDLAYOUT_HPP
+#define GRIDLAYOUT_HPP
+
+#include "cpudispatch.hpp"
+#include "fluidgrid.hpp"
+#include "threadpool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+
+// Storage policies for a 2D field. Row-major keeps the vertical neighbours of
+// a cell a full row apart, so a 5-point stencil on a wide grid touches three
+// distant cache lines and pages per cell. The tiled layouts store square
+// tiles contiguously (row-major inside each tile), so both neighbours of most
+// cells sit in the same few lines; the Morton layout orders the cells inside
+// each 32x32 tile along a Z curve instead. Tiles themselves are row-major, so
+// no dimension is padded to a power of two.
+//
+// A layout maps interior coordinates (ghost layers included, i in
+// [-ghost, nx+ghost)) to an offset and describes the blocks of cells that are
+// contiguous in memory, which is the traversal order kernels should follow.
+
+class RowMajorLayout
+{
+public:
+    static constexpr const char* Name = "row-major";
+    // a block row [i0, i1) is contiguous, and so are its neighbours i0-1 and i1
+    static constexpr bool ContiguousRows = true;
+    static constexpr bool RowsIncludeNeighbours = true;
+
+    RowMajorLayout() = default;
+    RowMajorLayout(int nx, int ny, int ghost)
+        : columnOffset(roundUpTo(ghost, ScalarField::AlignmentFloats)), ghost(ghost),
+          stride(roundUpTo(columnOffset + nx + ghost, ScalarField::AlignmentFloats)), nx(nx), ny(ny)
+    {
+    }
+
+    std::size_t index(int i, int j) const
+    {
+        return static_cast<std::size_t>(j + this->ghost)*this->stride + this->columnOffset + i;
+    }
+    std::size_t getStorageSize() const { return static_cast<std::size_t>(this->stride)*(this->ny + 2*this->ghost); }
+
+    // bands of whole rows
+    int getBlockWidth() const { return this->nx; }
+    int getBlockHeight() const { return 8; }
+    int getBlockOrigin() const { return 0; }
+
+private:
+    static int roundUpTo(int value, int multiple) { return ((value + multiple - 1) / multiple) * multiple; }
+
+    int columnOffset{0};
+    int ghost{0};
+    int stride{0};
+    int nx{0};
+    int ny{0};
+};
+
+template <int TileSize, bool ZOrder = false>
+class TiledLayout
+{
+    static_assert(TileSize >= 8 && (TileSize & (TileSize - 1)) == 0, "tiles are a power of two of at least 8 cells");
+
+public:
+    static constexpr const char* Name = ZOrder ? "morton" : (TileSize == 8 ? "tiled-8" : "tiled-16");
+    // inside a tile a block row is contiguous, but its left and right neighbours live in other tiles
+    static constexpr bool ContiguousRows = !ZOrder;
+    static constexpr bool RowsIncludeNeighbours = false;
+    static constexpr int MaxBlockWidth = TileSize;
+
+    TiledLayout() = default;
+    TiledLayout(int nx, int ny, int ghost)
+        // the ghost margin is rounded to 8 so interior tiles start on a tile (or 8x8 block) boundary
+        : offset(((ghost + 7) / 8) * 8),
+          tilesX((offset + nx + ghost + TileSize - 1) / TileSize),
+          tilesY((offset + ny + ghost + TileSize - 1) / TileSize)
+    {
+    }
+
+    std::size_t index(int i, int j) const
+    {
+        unsigned x = static_cast<unsigned>(i + this->offset);
+        unsigned y = static_cast<unsigned>(j + this->offset);
+        std::size_t tile = static_cast<std::size_t>(y / TileSize)*this->tilesX + x / TileSize;
+        unsigned within = ZOrder ? spreadBits(x % TileSize) | (spreadBits(y % TileSize) << 1)
+                                 : (y % TileSize)*TileSize + x % TileSize;
+        return tile*TileSize*TileSize + within;
+    }
+    std::size_t getStorageSize() const
+    {
+        return static_cast<std::size_t>(this->tilesX)*this->tilesY*TileSize*TileSize;
+    }
+
+    int getBlockWidth() const { return TileSize; }
+    int getBlockHeight() const { return TileSize; }
+    int getBlockOrigin() const { return -this->offset; }
+
+    // abcde -> 0a0b0c0d0e: a Z-order cell of a tile is spreadBits(x) | spreadBits(y) << 1
+    static unsigned spreadBits(unsigned v)
+    {
+        v = (v | (v << 4)) & 0x0F0Fu;
+        v = (v | (v << 2)) & 0x3333u;
+        v = (v | (v << 1)) & 0x5555u;
+        return v;
+    }
+
+private:
+
+    int offset{0};
+    int tilesX{0};
+    int tilesY{0};
+};
+
+using Tiled8Layout = TiledLayout<8>;
+using Tiled16Layout = TiledLayout<16>;
+using MortonLayout = TiledLayout<32, true>;
+
+// a float field stored with one of the layouts above; 64-byte aligned and zero-filled like ScalarField
+template <class Layout>
+class LayoutField
+{
+public:
+    LayoutField(int nx, int ny, int ghost = 1)
+        : nx(nx), ny(ny), ghost(ghost), layout(nx, ny, ghost)
+    {
+        if (nx <= 0 || ny <= 0 || ghost < 0)
+        {
+            throw std::invalid_argument("LayoutField: dimensions must be positive");
+        }
+        std::size_t size = this->layout.getStorageSize();
+        this->storage.reset(static_cast<float*>(
+            ::operator new[](size*sizeof(float), std::align_val_t(ScalarField::AlignmentBytes))));
+        std::fill(this->storage.get(), this->storage.get() + size, 0.0f);
+    }
+
+    int getNx() const { return this->nx; }
+    int getNy() const { return this->ny; }
+    int getGhost() const { return this->ghost; }
+    const Layout& getLayout() const { return this->layout; }
+    std::size_t getAllocatedBytes() const { return this->layout.getStorageSize()*sizeof(float); }
+
+    float& at(int i, int j) { return this->storage[this->layout.index(i, j)]; }
+    float at(int i, int j) const { return this->storage[this->layout.index(i, j)]; }
+    // &at(i, j); with Layout::ContiguousRows, cells (i..end of its block, j) follow it in memory
+    float* rowSegment(int i, int j) { return &this->storage[this->layout.index(i, j)]; }
+    const float* rowSegment(int i, int j) const { return &this->storage[this->layout.index(i, j)]; }
+    float* data() { return this->storage.get(); }
+    const float* data() const { return this->storage.get(); }
+
+    void fill(float value)
+    {
+        std::fill(this->storage.get(), this->storage.get() + this->layout.getStorageSize(), value);
+    }
+
+    // interior and ghost cells; the shapes must match
+    void copyFrom(const ScalarField& field)
+    {
+        checkShape(field);
+        for (int j = -this->ghost; j < this->ny + this->ghost; ++j)
+        {
+            const float* row = field.row(j);
+            for (int i = -this->ghost; i < this->nx + this->ghost; ++i)
+            {
+                at(i, j) = row[i];
+            }
+        }
+    }
+    void copyTo(ScalarField& field) const
+    {
+        checkShape(field);
+        for (int j = -this->ghost; j < this->ny + this->ghost; ++j)
+        {
+            float* row = field.row(j);
+            for (int i = -this->ghost; i < this->nx + this->ghost; ++i)
+            {
+                row[i] = at(i, j);
+            }
+        }
+    }
+
+    void swap(LayoutField& other) noexcept
+    {
+        std::swap(this->nx, other.nx);
+        std::swap(this->ny, other.ny);
+        std::swap(this->ghost, other.ghost);
+        std::swap(this->layout, other.layout);
+        std::swap(this->storage, other.storage);
+    }
+
+    // body(i0, i1, j0, j1) once per block of interior cells that is contiguous
+    // in memory. The pool gets bands of block rows and each band visits its
+    // blocks in storage order, so a task covers many tiles (serially without a pool).
+    template <class Body>
+    void parallelForBlocks(ThreadPool* pool, const Body& body) const
+    {
+        int origin = this->layout.getBlockOrigin();
+        int width = this->layout.getBlockWidth();
+        int height = this->layout.getBlockHeight();
+        int bands = (this->ny - origin + height - 1) / height;
+        parallelFor(pool, 0, bands, [&](int b0, int b1) {
+            for (int band = b0; band < b1; ++band)
+            {
+                int y0 = std::max(origin + band*height, 0);
+                int y1 = std::min(origin + (band + 1)*height, this->ny);
+                for (int x0 = origin; x0 < this->nx; x0 += width)
+                {
+                    int x1 = std::min(x0 + width, this->nx);
+                    int clipped = std::max(x0, 0);
+                    if (clipped < x1 && y0 < y1)
+                    {
+                        body(clipped, x1, y0, y1);
+                    }
+                }
+            }
+        });
+    }
+
+private:
+    struct AlignedDeleter
+    {
+        void operator()(float* p) const { ::operator delete[](p, std::align_val_t(ScalarField::AlignmentBytes)); }
+    };
+
+    void checkShape(const ScalarField& field) const
+    {
+        if (field.getNx() != this->nx || field.getNy() != this->ny || field.getGhost() < this->ghost)
+        {
+            throw std::invalid_argument("LayoutField: shape does not match the ScalarField");
+        }
+    }
+
+    int nx{0};
+    int ny{0};
+    int ghost{0};
+    Layout layout;
+    std::unique_ptr<float[], AlignedDeleter> storage;
+};
+
+//--------------------------------STENCILS-----------------------------------------
+// the Jacobi update of one cell of the pressure system (pressuresolver.hpp),
+// in the same order of operations as the dispatched row kernels
+inline float jacobiCell(float pl, float pr, float pd, float pu, float sl, float sr, float sd, float su, float sc,
+                        float b)
+{
+    float fl = 1.0f - sl;
+    float fr = 1.0f - sr;
+    float fd = 1.0f - sd;
+    float fu = 1.0f - su;
+    float diag = fl + fr + fd + fu;
+    diag = diag < 1.0f ? 1.0f : diag;
+    float value = (b + fl*pl + fr*pr + fd*pd + fu*pu) / diag;
+    return (1.0f - sc) * value;
+}
+
+// One Jacobi sweep of the pressure system, for every layout. Row-major rows
+// go through the dispatched row kernel like JacobiPressureSolver. Tiled
+// layouts hand the dispatched tile kernel a whole tile per call: each tile
+// row, and the rows above and below it (the edge rows of the neighbouring
+// tiles at the tile's border), are contiguous, so only the two cells left and
+// right of each row come from other tiles.
+// Morton tiles are swept row by row, with every neighbour found from the
+// spread coordinates in its own tile or the adjacent one.
+template <class Layout>
+void layoutJacobiSweep(const LayoutField<Layout>& p, const LayoutField<Layout>& rhs,
+                       const LayoutField<Layout>& obstacle, LayoutField<Layout>& out, ThreadPool* pool)
+{
+    if constexpr (Layout::RowsIncludeNeighbours)
+    {
+        JacobiRowKernel kernel = activeKernels().jacobiRow;
+        p.parallelForBlocks(pool, [&](int i0, int i1, int j0, int j1) {
+            JacobiRowArgs args;
+            args.nx = i1 - i0;
+            for (int j = j0; j < j1; ++j)
+            {
+                args.centre = p.rowSegment(i0, j);
+                args.down = p.rowSegment(i0, j - 1);
+                args.up = p.rowSegment(i0, j + 1);
+                args.solid = obstacle.rowSegment(i0, j);
+                args.solidDown = obstacle.rowSegment(i0, j - 1);
+                args.solidUp = obstacle.rowSegment(i0, j + 1);
+                args.rhs = rhs.rowSegment(i0, j);
+                args.out = out.rowSegment(i0, j);
+                kernel(args);
+            }
+        });
+    }
+    else if constexpr (Layout::ContiguousRows)
+    {
+        // the four fields share the layout, so one set of offsets serves all of them
+        constexpr int Size = Layout::MaxBlockWidth;
+        JacobiTileKernel kernel = activeKernels().jacobiTile;
+        const Layout& layout = p.getLayout();
+        const float* pp = p.data();
+        const float* ss = obstacle.data();
+        const float* bb = rhs.data();
+        float* oo = out.data();
+        p.parallelForBlocks(pool, [&](int i0, int i1, int j0, int j1) {
+            // the block is (part of) one tile: its rows are Size apart and every row
+            // has its left and right neighbours at the same distance
+            auto offset = [&](int i, int j) { return static_cast<std::ptrdiff_t>(layout.index(i, j)); };
+            std::ptrdiff_t first = offset(i0, j0);
+            std::ptrdiff_t below = offset(i0, j0 - 1);
+            std::ptrdiff_t above = offset(i0, j1);
+            JacobiTileArgs args;
+            args.centre = pp + first;
+            args.solid = ss + first;
+            args.rhs = bb + first;
+            args.out = oo + first;
+            args.down = pp + below;
+            args.up = pp + above;
+            args.solidDown = ss + below;
+            args.solidUp = ss + above;
+            args.left = static_cast<int>(offset(i0 - 1, j0) - first);
+            args.right = static_cast<int>(offset(i1, j0) - first);
+            args.stride = Size;
+            args.nx = i1 - i0;
+            args.rows = j1 - j0;
+            kernel(args);
+        });
+    }
+    else
+    {
+        constexpr int Size = Layout::MaxBlockWidth;
+        const Layout& layout = p.getLayout();
+        int origin = layout.getBlockOrigin();
+        unsigned spreadX[Size];
+        unsigned spreadY[Size];
+        for (int k = 0; k < Size; ++k)
+        {
+            spreadX[k] = Layout::spreadBits(static_cast<unsigned>(k));
+            spreadY[k] = spreadX[k] << 1;
+        }
+        const float* pp = p.data();
+        const float* ss = obstacle.data();
+        const float* bb = rhs.data();
+        float* oo = out.data();
+        // tiles are stored row-major, so the neighbouring tiles are fixed distances away
+        const std::size_t tileCells = static_cast<std::size_t>(Size)*Size;
+        const std::size_t tileRow = layout.index(origin, origin + Size) - layout.index(origin, origin);
+        p.parallelForBlocks(pool, [&](int i0, int i1, int j0, int j1) {
+            // the block is one tile, clipped to the interior
+            int tileX = i0 - (i0 - origin) % Size;
+            int tileY = j0 - (j0 - origin) % Size;
+            std::size_t tile = layout.index(tileX, tileY);
+            for (int y = j0 - tileY; y < j1 - tileY; ++y)
+            {
+                std::size_t row = tile + spreadY[y];
+                std::size_t rowDown = y == 0 ? tile - tileRow + spreadY[Size - 1] : tile + spreadY[y - 1];
+                std::size_t rowUp = y == Size - 1 ? tile + tileRow + spreadY[0] : tile + spreadY[y + 1];
+                for (int x = i0 - tileX; x < i1 - tileX; ++x)
+                {
+                    std::size_t c = row + spreadX[x];
+                    std::size_t l = x == 0 ? row - tileCells + spreadX[Size - 1] : row + spreadX[x - 1];
+                    std::size_t r = x == Size - 1 ? row + tileCells + spreadX[0] : row + spreadX[x + 1];
+                    std::size_t d = rowDown + spreadX[x];
+                    std::size_t u = rowUp + spreadX[x];
+                    oo[c] = jacobiCell(pp[l], pp[r], pp[d], pp[u], ss[l], ss[r], ss[d], ss[u], ss[c], bb[c]);
+                }
+            }
+        });
+    }
+}
+
+// ||b - Ap||_2 over the fluid cells, as computePoissonResidualNorm
+template <class Layout>
+double layoutPoissonResidualNorm(const LayoutField<Layout>& p, const LayoutField<Layout>& rhs,
+                                 const LayoutField<Layout>& obstacle, ThreadPool* pool)
+{
+    int nx = p.getNx();
+    double sum = parallelSum(pool, 0, p.getNy(), [&](int j0, int j1) {
+        double local = 0.0;
+        for (int j = j0; j < j1; ++j)
+        {
+            for (int i = 0; i < nx; ++i)
+            {
+                float sc = obstacle.at(i, j);
+                if (sc > 0.5f)
+                {
+                    continue;
+                }
+                float fl = 1.0f - obstacle.at(i - 1, j);
+                float fr = 1.0f - obstacle.at(i + 1, j);
+                float fd = 1.0f - obstacle.at(i, j - 1);
+                float fu = 1.0f - obstacle.at(i, j + 1);
+                float ap = (fl + fr + fd + fu)*p.at(i, j) - fl*p.at(i - 1, j) - fr*p.at(i + 1, j) -
+                           fd*p.at(i, j - 1) - fu*p.at(i, j + 1);
+                double r = rhs.at(i, j) - ap;
+                local += r*r;
+            }
+        }
+        return local;
+    });
+    return std::sqrt(sum);
+}
+
+//--------------------------------RUNTIME CHOICE-----------------------------------
+enum class GridLayoutKind
+{
+    RowMajor,
+    Tiled8,
+    Tiled16,
+    Morton
+};
+
+const char* gridLayoutName(GridLayoutKind kind);
+
+template <class Layout>
+struct LayoutTag
+{
+    using type = Layout;
+};
+
+// calls f(LayoutTag<Layout>{}) with the layout type named by `kind`
+template <class F>
+auto visitGridLayout(GridLayoutKind kind, F&& f)
+{
+    switch (kind)
+    {
+    case GridLayoutKind::Tiled8:
+        return f(LayoutTag<Tiled8Layout>{});
+    case GridLayoutKind::Tiled16:
+        return f(LayoutTag<Tiled16Layout>{});
+    case GridLayoutKind::Morton:
+        return f(LayoutTag<MortonLayout>{});
+    case GridLayoutKind::RowMajor:
+        break;
+    }
+    return f(LayoutTag<RowMajorLayout>{});
+}
+
+// Times a few layoutJacobiSweep calls with every layout at this size and
+// returns the fastest, for JacobiPressureSolver::setLayout(). Measured once per
+// size and thread count, then cached. The timing runs on the pool, so call it
+// from outside the pool's tasks; the answer may differ between runs.
+GridLayoutKind chooseGridLayout(int nx, int ny, ThreadPool* pool = nullptr);
+
+#endif // GRIDLAYOUT_HPP
@@ -0,0 +1,267 @@
+// SimFluidHeadless: runs a scenario file without a window or a GL context.
+//
+//   SimFluidHeadless scenario.txt [--steps N] [--threads N] [--output DIR] [--trace FILE] [--perf] [--sparse] [--quiet]
+//
+// Writes metrics.csv (one row per step) and field snapshots into the output
+// directory. Command-line values override the scenario file. --trace records
+// the solver stages and writes a Chrome trace (open it in Perfetto). --perf
+// reads the perf_event counters of the solver's threads per stage and prints
+// bytes per cell and bandwidth against a STREAM triad measured up front.
+// --sparse runs the solver on active blocks only and reports the active
+// fraction and the memory the state holds (still dense, plus the active set).
+#include "scenario.hpp"
+#include "fieldio.hpp"
+#include "fluidsolver.hpp"
+#include "pressuresolver.hpp"
+#include "threadpool.hpp"
+#include "cpudispatch.hpp"
+#include "profiler.hpp"
+#include "perfcounters.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+void printUsage(const char* program)
+{
+    std::fprintf(stderr, "usage: %s scenario.txt [--steps N] [--threads N] [--output DIR] [--trace FILE] [--perf] [--sparse] "
+                         "[--quiet]\n", program);
+}
+
+// a whole non-negative int and nothing else; atoi would read "12x" as 12 and "x" as 0
+bool parseCount(const char* text, int& value)
+{
+    errno = 0;
+    char* end = nullptr;
+    long parsed = std::strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE || parsed < 0 || parsed > INT_MAX)
+    {
+        return false;
+    }
+    value = static_cast<int>(parsed);
+    return true;
+}
+
+double totalOf(const ScalarField& field)
+{
+    double sum = 0.0;
+    for (int j = 0; j < field.getNy(); ++j)
+    {
+        const float* r = field.row(j);
+        for (int i = 0; i < field.getNx(); ++i)
+        {
+            sum += r[i];
+        }
+    }
+    return sum;
+}
+
+double maxSpeedOf(const FluidGrid& grid)
+{
+    double maxSquared = 0.0;
+    for (int j = 0; j < grid.getNy(); ++j)
+    {
+        const float* u = grid.u().row(j);
+        const float* v = grid.v().row(j);
+        for (int i = 0; i < grid.getNx(); ++i)
+        {
+            maxSquared = std::max(maxSquared, static_cast<double>(u[i])*u[i] + static_cast<double>(v[i])*v[i]);
+        }
+    }
+    return std::sqrt(maxSquared);
+}
+
+void writeSnapshots(const Scenario& scenario, const FluidGrid& grid, int step, const std::filesystem::path& directory)
+{
+    const char* extension = (scenario.snapshotFormat == SnapshotFormat::Pfm) ? ".pfm" : ".pgm";
+    for (FluidField f : scenario.snapshotFields)
+    {
+        char name[64];
+        std::snprintf(name, sizeof(name), "%s_%06d%s", fluidFieldName(f), step, extension);
+        std::string path = (directory / name).string();
+        if (scenario.snapshotFormat == SnapshotFormat::Pfm)
+        {
+            writeFieldPfm(grid.field(f), path);
+        }
+        else
+        {
+            writeFieldPgm(grid.field(f), FieldRange{scenario.snapshotMin, scenario.snapshotMax}, path);
+        }
+    }
+}
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+    try
+    {
+        Scenario scenario = loadScenario(argv[1]);
+        bool quiet = false;
+        bool perf = false;
+        bool sparse = false;
+        std::string tracePath;
+        for (int a = 2; a < argc; ++a)
+        {
+            std::string option = argv[a];
+            bool hasValue = a + 1 < argc;
+            if ((option == "--steps" || option == "--threads") && hasValue)
+            {
+                int& count = (option == "--steps") ? scenario.steps : scenario.threads;
+                if (!parseCount(argv[++a], count))
+                {
+                    std::fprintf(stderr, "%s: %s needs a non-negative integer, got '%s'\n", argv[0], option.c_str(),
+                                 argv[a]);
+                    return 2;
+                }
+            }
+            else if (option == "--output" && hasValue)
+            {
+                scenario.outputDirectory = argv[++a];
+            }
+            else if (option == "--trace" && hasValue)
+            {
+                tracePath = argv[++a];
+            }
+            else if (option == "--perf")
+            {
+                perf = true;
+            }
+            else if (option == "--sparse")
+            {
+                sparse = true;
+            }
+            else if (option == "--quiet")
+            {
+                quiet = true;
+            }
+            else
+            {
+                printUsage(argv[0]);
+                return 2;
+            }
+        }
+
+        std::filesystem::path directory(scenario.outputDirectory);
+        std::filesystem::create_directories(directory);
+
+        FluidGrid grid(scenario.nx, scenario.ny);
+        FluidSolver solver(grid, scenario.threads);
+        solver.parameters() = scenario.parameters;
+        solver.usePressureSolver(scenario.pressureSolver);
+        solver.setSparse(sparse);
+        applyScenarioObstacles(scenario, grid);
+
+        if (!quiet)
+        {
+            std::printf("%dx%d, %d steps, %d threads, %s pressure, %s kernels -> %s\n", scenario.nx, scenario.ny,
+                        scenario.steps, solver.getThreadPool().getNumThreads(), pressureSolverName(scenario.pressureSolver),
+                        isaLevelName(getIsaLevel()), directory.string().c_str());
+        }
+
+        std::ofstream metrics(directory / "metrics.csv");
+        if (!metrics)
+        {
+            throw std::runtime_error("cannot write metrics.csv in '" + directory.string() + "'");
+        }
+        metrics << "step,time,step_ms,pressure_iterations,pressure_residual,total_density,max_speed\n";
+
+        if (!tracePath.empty())
+        {
+            Profiler::setThreadName("main");
+            Profiler::instance().setEnabled(true);
+        }
+        std::unique_ptr<StagePerfCollector> perfCollector;
+        double streamPeak = 0.0;
+        if (perf)
+        {
+            streamPeak = measureStreamTriadBandwidth(&solver.getThreadPool());
+            perfCollector.reset(new StagePerfCollector(&solver.getThreadPool(),
+                                                       static_cast<std::int64_t>(scenario.nx)*scenario.ny));
+            perfCollector->attach();
+        }
+
+        using Clock = std::chrono::steady_clock;
+        Clock::time_point runStart = Clock::now();
+        for (int step = 1; step <= scenario.steps; ++step)
+        {
+            applyScenarioSources(scenario, solver);
+            Clock::time_point begin = Clock::now();
+            solver.step();
+            double milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+
+            const PressureSolveStats& pressure = solver.getLastPressureStats();
+            double residual = pressure.residualHistory.empty() ? 0.0 : pressure.residualHistory.back();
+            metrics << step << "," << step*scenario.parameters.timeStep << "," << milliseconds << ","
+                    << pressure.iterations << "," << residual << "," << totalOf(grid.density()) << ","
+                    << maxSpeedOf(grid) << "\n";
+
+            bool last = step == scenario.steps;
+            if (last || (scenario.snapshotInterval > 0 && step % scenario.snapshotInterval == 0))
+            {
+                writeSnapshots(scenario, grid, step, directory);
+            }
+            if (!quiet && (last || step % 100 == 0))
+            {
+                std::printf("step %d/%d  %.2f ms\n", step, scenario.steps, milliseconds);
+            }
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - runStart).count();
+        if (perfCollector)
+        {
+            perfCollector->detach();
+#if !defined(SIMFLUID_PROFILING)
+            std::printf("built without SIMFLUID_PROFILING: no stages to attribute counters to\n");
+#endif
+            std::ostringstream report;
+            perfCollector->writeReport(report, streamPeak);
+            std::fputs(report.str().c_str(), stdout);
+        }
+        if (!tracePath.empty() || perfCollector)
+        {
+            Profiler::instance().setEnabled(false);
+        }
+        if (!tracePath.empty())
+        {
+            Profiler::instance().writeChromeTrace(tracePath);
+            if (!quiet)
+            {
+                std::printf("trace written to %s\n", tracePath.c_str());
+            }
+        }
+        if (sparse && !quiet)
+        {
+            SparseMemoryUsage memory = solver.getSparseMemoryUsage();
+            std::printf("sparse: %d of %d blocks active (%.1f%%); state %.2f MiB dense plus %.1f KiB of active set\n",
+                        memory.activeBlocks, memory.totalBlocks, 100.0*memory.getActiveFraction(),
+                        memory.denseBytes / 1048576.0, memory.activeSetBytes / 1024.0);
+        }
+        if (!quiet)
+        {
+            std::printf("%d steps in %.2f s (%.1f steps/s)\n", scenario.steps, seconds,
+                        seconds > 0.0 ? scenario.steps / seconds : 0.0);
+        }
+    }
+    catch (const std::exception& error)
+    {
+        std::fprintf(stderr, "%s\n", error.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,354 @@
+#include "lbmsolver.hpp"
+#include "threadpool.hpp"
+#include <chrono>
+#include <stdexcept>
+
+namespace
+{
+// D2Q9 directions: rest, E, N, W, S, NE, NW, SW, SE
+const int Cx[9] = {0, 1, 0, -1, 0, 1, -1, -1, 1};
+const int Cy[9] = {0, 0, 1, 0, -1, 1, 1, -1, -1};
+const int Opposite[9] = {0, 3, 4, 1, 2, 7, 8, 5, 6};
+const float Weight[9] = {4.0f/9.0f, 1.0f/9.0f, 1.0f/9.0f, 1.0f/9.0f, 1.0f/9.0f,
+                         1.0f/36.0f, 1.0f/36.0f, 1.0f/36.0f, 1.0f/36.0f};
+
+// orthogonal moment basis: rho, e, eps, jx, qx, jy, qy, pxx, pxy
+const float MrtBasis[9][9] = {
+    { 1,  1,  1,  1,  1,  1,  1,  1,  1},
+    {-4, -1, -1, -1, -1,  2,  2,  2,  2},
+    { 4, -2, -2, -2, -2,  1,  1,  1,  1},
+    { 0,  1,  0, -1,  0,  1, -1, -1,  1},
+    { 0, -2,  0,  2,  0,  1, -1, -1,  1},
+    { 0,  0,  1,  0, -1,  1,  1, -1, -1},
+    { 0,  0, -2,  0,  2,  1,  1, -1, -1},
+    { 0,  1, -1,  1, -1,  0,  0,  0,  0},
+    { 0,  0,  0,  0,  0,  1, -1,  1, -1}};
+// squared row norms, so the inverse basis is transpose(M) / norm
+const float MrtNorm[9] = {9, 36, 36, 6, 12, 6, 12, 4, 4};
+
+float equilibrium(int k, float rho, float ux, float uy)
+{
+    float cu = Cx[k]*ux + Cy[k]*uy;
+    float uu = ux*ux + uy*uy;
+    return Weight[k]*rho*(1.0f + 3.0f*cu + 4.5f*cu*cu - 1.5f*uu);
+}
+}
+
+LatticeBoltzmannSolver::LatticeBoltzmannSolver(int nx, int ny, int numThreads)
+    : nx(nx), ny(ny), pool(new ThreadPool(numThreads)), obstacle(nx, ny, 1)
+{
+    if (nx <= 0 || ny <= 0)
+    {
+        throw std::invalid_argument("LatticeBoltzmannSolver: dimensions must be positive");
+    }
+    for (ScalarField& f : this->populations)
+    {
+        f = ScalarField(nx, ny, 1);
+    }
+    markWallsSolid(this->obstacle);
+    this->fluidNodes = static_cast<long long>(nx)*ny;
+    initialize(1.0f, 0.0f, 0.0f);
+}
+
+LatticeBoltzmannSolver::~LatticeBoltzmannSolver()
+{
+}
+
+//--------------------------------SETUP--------------------------------------------
+void LatticeBoltzmannSolver::setSolid(int i, int j, bool solid)
+{
+    bool wasSolid = this->obstacle.at(i, j) > 0.5f;
+    this->obstacle.at(i, j) = solid ? 1.0f : 0.0f;
+    this->fluidNodes += (wasSolid ? 1 : 0) - (solid ? 1 : 0);
+}
+
+void LatticeBoltzmannSolver::setObstaclesFrom(const FluidGrid& grid)
+{
+    if (grid.getNx() != this->nx || grid.getNy() != this->ny)
+    {
+        throw std::invalid_argument("LatticeBoltzmannSolver::setObstaclesFrom: size mismatch");
+    }
+    for (int j = 0; j < this->ny; ++j)
+    {
+        for (int i = 0; i < this->nx; ++i)
+        {
+            setSolid(i, j, grid.isSolid(i, j));
+        }
+    }
+}
+
+void LatticeBoltzmannSolver::initialize(float density, float velocityX, float velocityY)
+{
+    for (int j = 0; j < this->ny; ++j)
+    {
+        for (int i = 0; i < this->nx; ++i)
+        {
+            for (int k = 0; k < Q; ++k)
+            {
+                this->populations[k].at(i, j) = equilibrium(k, density, velocityX, velocityY);
+            }
+        }
+    }
+    this->oddParity = false;
+}
+
+//--------------------------------COLLISION----------------------------------------
+void LatticeBoltzmannSolver::collide(float* f) const
+{
+    float rho = 0.0f;
+    float jx = 0.0f;
+    float jy = 0.0f;
+    for (int k = 0; k < Q; ++k)
+    {
+        rho += f[k];
+        jx += Cx[k]*f[k];
+        jy += Cy[k]*f[k];
+    }
+    float ux = jx / rho;
+    float uy = jy / rho;
+    float omega = 1.0f / this->params.tau;
+
+    if (this->params.collision == LbmCollision::Bgk)
+    {
+        for (int k = 0; k < Q; ++k)
+        {
+            f[k] -= omega*(f[k] - equilibrium(k, rho, ux, uy));
+        }
+    }
+    else
+    {
+        float m[9];
+        for (int r = 0; r < Q; ++r)
+        {
+            float sum = 0.0f;
+            for (int k = 0; k < Q; ++k)
+            {
+                sum += MrtBasis[r][k]*f[k];
+            }
+            m[r] = sum;
+        }
+        float jj = (jx*jx + jy*jy) / rho;
+        const float equilibriumMoments[9] = {rho, -2.0f*rho + 3.0f*jj, rho - 3.0f*jj, jx, -jx, jy, -jy,
+                                             (jx*jx - jy*jy)/rho, jx*jy/rho};
+        // conserved moments relax at rate 0, the stress moments at 1/tau
+        const float rates[9] = {0.0f, 1.4f, 1.4f, 0.0f, 1.2f, 0.0f, 1.2f, omega, omega};
+        float delta[9];
+        for (int r = 0; r < Q; ++r)
+        {
+            delta[r] = rates[r]*(m[r] - equilibriumMoments[r]) / MrtNorm[r];
+        }
+        for (int k = 0; k < Q; ++k)
+        {
+            float sum = 0.0f;
+            for (int r = 0; r < Q; ++r)
+            {
+                sum += MrtBasis[r][k]*delta[r];
+            }
+            f[k] -= sum;
+        }
+    }
+
+    if (this->params.forceX != 0.0f || this->params.forceY != 0.0f)
+    {
+        for (int k = 0; k < Q; ++k)
+        {
+            f[k] += 3.0f*Weight[k]*rho*(Cx[k]*this->params.forceX + Cy[k]*this->params.forceY);
+        }
+    }
+}
+
+//--------------------------------AA STEPS-----------------------------------------
+void LatticeBoltzmannSolver::step()
+{
+    auto start = std::chrono::steady_clock::now();
+    if (this->oddParity)
+    {
+        oddStep();
+    }
+    else
+    {
+        evenStep();
+    }
+    this->oddParity = !this->oddParity;
+    ++this->stepCount;
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    this->timedSeconds += elapsed.count();
+    this->timedUpdates += this->fluidNodes;
+}
+
+void LatticeBoltzmannSolver::run(int numSteps)
+{
+    for (int s = 0; s < numSteps; ++s)
+    {
+        step();
+    }
+}
+
+void LatticeBoltzmannSolver::evenStep()
+{
+    // local: read the natural slots, write each result to the opposite slot
+    parallelFor(this->pool.get(), 0, this->ny, [&](int j0, int j1) {
+        float f[9];
+        float* slot[9];
+        for (int j = j0; j < j1; ++j)
+        {
+            for (int k = 0; k < Q; ++k)
+            {
+                slot[k] = this->populations[k].row(j);
+            }
+            const float* solid = this->obstacle.row(j);
+            for (int i = 0; i < this->nx; ++i)
+            {
+                if (solid[i] > 0.5f)
+                {
+                    continue;
+                }
+                for (int k = 0; k < Q; ++k)
+                {
+                    f[k] = slot[k][i];
+                }
+                collide(f);
+                for (int k = 0; k < Q; ++k)
+                {
+                    slot[Opposite[k]][i] = f[k];
+                }
+            }
+        }
+    });
+}
+
+void LatticeBoltzmannSolver::oddStep()
+{
+    // gather from the neighbours' opposite slots, collide, scatter to the
+    // neighbours' natural slots; every slot is touched by exactly one node
+    float lid = this->params.lidVelocity;
+    int topWall = this->ny;
+    parallelFor(this->pool.get(), 0, this->ny, [&](int j0, int j1) {
+        float f[9];
+        for (int j = j0; j < j1; ++j)
+        {
+            for (int i = 0; i < this->nx; ++i)
+            {
+                if (this->obstacle.at(i, j) > 0.5f)
+                {
+                    continue;
+                }
+                for (int k = 0; k < Q; ++k)
+                {
+                    int si = i - Cx[k];
+                    int sj = j - Cy[k];
+                    if (this->obstacle.at(si, sj) > 0.5f)
+                    {
+                        float wall = (sj == topWall) ? lid : 0.0f;
+                        f[k] = this->populations[k].at(i, j) + 6.0f*Weight[k]*Cx[k]*wall;
+                    }
+                    else
+                    {
+                        f[k] = this->populations[Opposite[k]].at(si, sj);
+                    }
+                }
+                collide(f);
+                for (int k = 0; k < Q; ++k)
+                {
+                    int ti = i + Cx[k];
+                    int tj = j + Cy[k];
+                    if (this->obstacle.at(ti, tj) > 0.5f)
+                    {
+                        float wall = (tj == topWall) ? lid : 0.0f;
+                        this->populations[Opposite[k]].at(i, j) = f[k] - 6.0f*Weight[k]*Cx[k]*wall;
+                    }
+                    else
+                    {
+                        this->populations[k].at(ti, tj) = f[k];
+                    }
+                }
+            }
+        }
+    });
+}
+
+//--------------------------------OUTPUT-------------------------------------------
+void LatticeBoltzmannSolver::moments(int i, int j, float& rho, float& jx, float& jy) const
+{
+    rho = 0.0f;
+    jx = 0.0f;
+    jy = 0.0f;
+    for (int k = 0; k < Q; ++k)
+    {
+        float value = this->populations[k].at(i, j);
+        rho += value;
+        jx += Cx[k]*value;
+        jy += Cy[k]*value;
+    }
+    // after an even step slot k holds direction opposite(k)
+    if (this->oddParity)
+    {
+        jx = -jx;
+        jy = -jy;
+    }
+}
+
+float LatticeBoltzmannSolver::density(int i, int j) const
+{
+    float rho, jx, jy;
+    moments(i, j, rho, jx, jy);
+    return rho;
+}
+
+void LatticeBoltzmannSolver::velocity(int i, int j, float& ux, float& uy) const
+{
+    float rho, jx, jy;
+    moments(i, j, rho, jx, jy);
+    ux = (rho > 0.0f) ? jx / rho : 0.0f;
+    uy = (rho > 0.0f) ? jy / rho : 0.0f;
+}
+
+void LatticeBoltzmannSolver::exportTo(FluidGrid& grid) const
+{
+    if (grid.getNx() != this->nx || grid.getNy() != this->ny)
+    {
+        throw std::invalid_argument("LatticeBoltzmannSolver::exportTo: size mismatch");
+    }
+    for (int j = 0; j < this->ny; ++j)
+    {
+        for (int i = 0; i < this->nx; ++i)
+        {
+            bool solid = this->obstacle.at(i, j) > 0.5f;
+            grid.setSolid(i, j, solid);
+            if (solid)
+            {
+                grid.density().at(i, j) = 0.0f;
+                grid.u().at(i, j) = 0.0f;
+                grid.v().at(i, j) = 0.0f;
+                continue;
+            }
+            float rho, jx, jy;
+            moments(i, j, rho, jx, jy);
+            grid.density().at(i, j) = rho;
+            grid.u().at(i, j) = jx / rho;
+            grid.v().at(i, j) = jy / rho;
+        }
+    }
+}
+
+double LatticeBoltzmannSolver::getMlups() const
+{
+    return (this->timedSeconds > 0.0) ? this->timedUpdates / this->timedSeconds / 1.0e6 : 0.0;
+}
+
+void LatticeBoltzmannSolver::resetTiming()
+{
+    this->timedUpdates = 0;
+    this->timedSeconds = 0.0;
+}
+
+std::size_t LatticeBoltzmannSolver::getPopulationBytes() const
+{
+    std::size_t total = 0;
+    for (const ScalarField& f : this->populations)
+    {
+        total += f.getAllocatedBytes();
+    }
+    return total;
+}
@@ -0,0 +1,84 @@
+#ifndef LBMSOLVER_HPP
+#define LBMSOLVER_HPP
+
+#include "fluidgrid.hpp"
+#include <array>
+#include <memory>
+
+class ThreadPool;
+
+enum class LbmCollision
+{
+    Bgk,   // single relaxation time
+    Mrt    // multiple relaxation times (Lallemand & Luo moment basis)
+};
+
+struct LbmParameters
+{
+    float tau{0.6f};            // relaxation time of the shear moments; viscosity = (tau - 0.5)/3
+    LbmCollision collision{LbmCollision::Bgk};
+    float lidVelocity{0.0f};    // x-velocity of the top wall, lattice units
+    float forceX{0.0f};         // body force per unit density, lattice units
+    float forceY{0.0f};
+};
+
+// D2Q9 lattice Boltzmann backend. Populations are stored structure-of-arrays
+// (one ScalarField per direction) and advanced with the AA access pattern:
+// even steps collide in place and store each result in the slot of the
+// opposite direction, odd steps gather from the neighbours, collide and
+// scatter back. Streaming and collision happen in the same pass and only one
+// population buffer exists, half the memory of a ping-pong layout. Walls and
+// obstacles use half-way bounce-back; the top wall may move (lid-driven cavity).
+class LatticeBoltzmannSolver
+{
+public:
+    static constexpr int Q = 9;
+
+    LatticeBoltzmannSolver(int nx, int ny, int numThreads = 0);
+    ~LatticeBoltzmannSolver();
+
+    int getNx() const { return this->nx; }
+    int getNy() const { return this->ny; }
+    LbmParameters& parameters() { return this->params; }
+
+    void setSolid(int i, int j, bool solid);
+    // copies the obstacle mask of a FluidGrid with the same interior size
+    void setObstaclesFrom(const FluidGrid& grid);
+    // resets every fluid node to equilibrium at the given density and velocity
+    void initialize(float density, float velocityX, float velocityY);
+
+    void step();
+    void run(int numSteps);
+
+    float density(int i, int j) const;
+    void velocity(int i, int j, float& ux, float& uy) const;
+    // writes density and velocity (lattice units) so the result can be drawn
+    // through the same path as the projection solver
+    void exportTo(FluidGrid& grid) const;
+
+    // million lattice (fluid node) updates per second since the last reset
+    double getMlups() const;
+    void resetTiming();
+    long long getStepCount() const { return this->stepCount; }
+    std::size_t getPopulationBytes() const;
+
+private:
+    void evenStep();
+    void oddStep();
+    void collide(float* f) const;
+    void moments(int i, int j, float& rho, float& jx, float& jy) const;
+
+    int nx{0};
+    int ny{0};
+    LbmParameters params;
+    std::unique_ptr<ThreadPool> pool;
+    std::array<ScalarField, Q> populations;
+    ScalarField obstacle;
+    bool oddParity{false};
+    long long stepCount{0};
+    long long fluidNodes{0};
+    long long timedUpdates{0};
+    double timedSeconds{0.0};
+};
+
+#endif // LBMSOLVER_HPP
@@ -0,0 +1,256 @@
+#include "macgrid.hpp"
+#include "profiler.hpp"
+#include "threadpool.hpp"
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+template <MacComponent C>
+void sampleMacBatch(const ScalarField& field, const float* x, const float* y, float* out, int count)
+{
+    const float maxX = static_cast<float>(field.getNx() - 1);
+    const float maxY = static_cast<float>(field.getNy() - 1);
+    const int lastI = std::max(field.getNx() - 2, 0);
+    const int lastJ = std::max(field.getNy() - 2, 0);
+    const int stride = field.getStride();
+    const float* base = field.row(0);
+#pragma omp simd
+    for (int k = 0; k < count; ++k)
+    {
+        float fx = std::min(std::max(x[k] - MacTraits<C>::OffsetX, 0.0f), maxX);
+        float fy = std::min(std::max(y[k] - MacTraits<C>::OffsetY, 0.0f), maxY);
+        int i0 = std::min(static_cast<int>(fx), lastI);
+        int j0 = std::min(static_cast<int>(fy), lastJ);
+        float s = fx - i0;
+        float t = fy - j0;
+        const float* p = base + j0*stride + i0;
+        out[k] = (1.0f - t)*((1.0f - s)*p[0] + s*p[1]) + t*((1.0f - s)*p[stride] + s*p[stride + 1]);
+    }
+}
+
+template void sampleMacBatch<MacComponent::U>(const ScalarField&, const float*, const float*, float*, int);
+template void sampleMacBatch<MacComponent::V>(const ScalarField&, const float*, const float*, float*, int);
+template void sampleMacBatch<MacComponent::Center>(const ScalarField&, const float*, const float*, float*, int);
+
+MacGrid::MacGrid(int nx, int ny, float cellSize)
+    : nx(nx), ny(ny), cellSize(cellSize)
+{
+    if (nx < 2 || ny < 2)
+    {
+        throw std::invalid_argument("MacGrid: grid must be at least 2x2");
+    }
+    this->uFaces = ScalarField(nx + 1, ny, 1);
+    this->vFaces = ScalarField(nx, ny + 1, 1);
+    this->pressureField = ScalarField(nx, ny, 1);
+    this->densityField = ScalarField(nx, ny, 1);
+    this->obstacleField = ScalarField(nx, ny, 1);
+    markWallsSolid(this->obstacleField);
+}
+
+void MacGrid::setSolid(int i, int j, bool solid)
+{
+    this->obstacleField.at(i, j) = solid ? 1.0f : 0.0f;
+}
+
+void MacGrid::enforceSolidFaces()
+{
+    for (int j = 0; j < this->ny; ++j)
+    {
+        float* ur = this->uFaces.row(j);
+        for (int i = 0; i <= this->nx; ++i)
+        {
+            if (isSolid(i - 1, j) || isSolid(i, j))
+            {
+                ur[i] = 0.0f;
+            }
+        }
+    }
+    for (int j = 0; j <= this->ny; ++j)
+    {
+        float* vr = this->vFaces.row(j);
+        for (int i = 0; i < this->nx; ++i)
+        {
+            if (isSolid(i, j - 1) || isSolid(i, j))
+            {
+                vr[i] = 0.0f;
+            }
+        }
+    }
+}
+
+double MacGrid::divergenceNorm() const
+{
+    double sum = 0.0;
+    for (int j = 0; j < this->ny; ++j)
+    {
+        const float* ur = this->uFaces.row(j);
+        const float* vd = this->vFaces.row(j);
+        const float* vu = this->vFaces.row(j + 1);
+        for (int i = 0; i < this->nx; ++i)
+        {
+            if (!isSolid(i, j))
+            {
+                double d = ur[i + 1] - ur[i] + vu[i] - vd[i];
+                sum += d*d;
+            }
+        }
+    }
+    return std::sqrt(sum);
+}
+
+std::size_t MacGrid::getMemoryBytes() const
+{
+    return this->uFaces.getAllocatedBytes() + this->vFaces.getAllocatedBytes() +
+           this->pressureField.getAllocatedBytes() + this->densityField.getAllocatedBytes() +
+           this->obstacleField.getAllocatedBytes();
+}
+
+//--------------------------------ADVECTION----------------------------------------
+void advectMacVelocity(const MacGrid& grid, ScalarField& uOut, ScalarField& vOut, float dt, ThreadPool* pool)
+{
+    SIMFLUID_PROFILE_ZONE("advect MAC velocity");
+    const ScalarField& u = grid.u();
+    const ScalarField& v = grid.v();
+    float dt0 = dt / grid.getCellSize();
+
+    // u faces: own component direct, v sampled at (i, j + 0.5)
+    int uWidth = u.getNx();
+    parallelFor(pool, 0, u.getNy(), [&](int j0, int j1) {
+        std::vector<float> px(uWidth), py(uWidth), other(uWidth);
+        for (int j = j0; j < j1; ++j)
+        {
+            const float* ur = u.row(j);
+            for (int i = 0; i < uWidth; ++i)
+            {
+                px[i] = static_cast<float>(i);
+                py[i] = j + 0.5f;
+            }
+            sampleMacBatch<MacComponent::V>(v, px.data(), py.data(), other.data(), uWidth);
+            for (int i = 0; i < uWidth; ++i)
+            {
+                px[i] -= dt0*ur[i];
+                py[i] -= dt0*other[i];
+            }
+            sampleMacBatch<MacComponent::U>(u, px.data(), py.data(), uOut.row(j), uWidth);
+        }
+    });
+
+    // v faces: u sampled at (i + 0.5, j), own component direct
+    int vWidth = v.getNx();
+    parallelFor(pool, 0, v.getNy(), [&](int j0, int j1) {
+        std::vector<float> px(vWidth), py(vWidth), other(vWidth);
+        for (int j = j0; j < j1; ++j)
+        {
+            const float* vr = v.row(j);
+            for (int i = 0; i < vWidth; ++i)
+            {
+                px[i] = i + 0.5f;
+                py[i] = static_cast<float>(j);
+            }
+            sampleMacBatch<MacComponent::U>(u, px.data(), py.data(), other.data(), vWidth);
+            for (int i = 0; i < vWidth; ++i)
+            {
+                px[i] -= dt0*other[i];
+                py[i] -= dt0*vr[i];
+            }
+            sampleMacBatch<MacComponent::V>(v, px.data(), py.data(), vOut.row(j), vWidth);
+        }
+    });
+}
+
+void advectMacScalar(const MacGrid& grid, ScalarField& dst, const ScalarField& src, float dt, ThreadPool* pool)
+{
+    SIMFLUID_PROFILE_ZONE("advect MAC scalar");
+    const ScalarField& u = grid.u();
+    const ScalarField& v = grid.v();
+    float dt0 = dt / grid.getCellSize();
+    int nx = grid.getNx();
+
+    parallelFor(pool, 0, grid.getNy(), [&](int j0, int j1) {
+        std::vector<float> px(nx), py(nx);
+        for (int j = j0; j < j1; ++j)
+        {
+            const float* ur = u.row(j);
+            const float* vd = v.row(j);
+            const float* vu = v.row(j + 1);
+            const float* solid = grid.obstacle().row(j);
+            for (int i = 0; i < nx; ++i)
+            {
+                // centre velocity is the mean of the two faces on each axis
+                px[i] = i + 0.5f - dt0*0.5f*(ur[i] + ur[i + 1]);
+                py[i] = j + 0.5f - dt0*0.5f*(vd[i] + vu[i]);
+            }
+            float* out = dst.row(j);
+            sampleMacBatch<MacComponent::Center>(src, px.data(), py.data(), out, nx);
+            for (int i = 0; i < nx; ++i)
+            {
+                out[i] *= 1.0f - solid[i];
+            }
+        }
+    });
+}
+
+//--------------------------------PROJECTION---------------------------------------
+PressureSolveStats projectMac(MacGrid& grid, PressureSolver& solver, ScalarField& rhs, ThreadPool* pool)
+{
+    SIMFLUID_PROFILE_ZONE("project MAC");
+    ScalarField& u = grid.u();
+    ScalarField& v = grid.v();
+    ScalarField& p = grid.pressure();
+    const ScalarField& obstacle = grid.obstacle();
+    int nx = grid.getNx();
+    int ny = grid.getNy();
+    float h = grid.getCellSize();
+
+    grid.enforceSolidFaces();
+    // n_c p_c - sum p_nb = -h (face divergence), which makes u - grad(p)/h divergence free
+    parallelFor(pool, 0, ny, [&](int j0, int j1) {
+        for (int j = j0; j < j1; ++j)
+        {
+            const float* ur = u.row(j);
+            const float* vd = v.row(j);
+            const float* vu = v.row(j + 1);
+            const float* solid = obstacle.row(j);
+            float* b = rhs.row(j);
+            for (int i = 0; i < nx; ++i)
+            {
+                b[i] = (1.0f - solid[i]) * (-h*(ur[i + 1] - ur[i] + vu[i] - vd[i]));
+            }
+        }
+    });
+    removeFluidMean(rhs, obstacle);
+
+    PressureSolveStats stats = solver.solve(p, rhs, obstacle);
+
+    // only faces between two fluid cells move; the rest stay zero
+    float inverseH = 1.0f / h;
+    parallelFor(pool, 0, ny, [&](int j0, int j1) {
+        for (int j = j0; j < j1; ++j)
+        {
+            const float* pc = p.row(j);
+            const float* sc = obstacle.row(j);
+            float* ur = u.row(j);
+            for (int i = 1; i < nx; ++i)
+            {
+                float open = (1.0f - sc[i - 1])*(1.0f - sc[i]);
+                ur[i] = open*(ur[i] - inverseH*(pc[i] - pc[i - 1]));
+            }
+        }
+    });
+    parallelFor(pool, 1, ny, [&](int j0, int j1) {
+        for (int j = j0; j < j1; ++j)
+        {
+            const float* pc = p.row(j);
+            const float* pd = p.row(j - 1);
+            const float* sc = obstacle.row(j);
+            const float* sd = obstacle.row(j - 1);
+            float* vr = v.row(j);
+            for (int i = 0; i < nx; ++i)
+            {
+                float open = (1.0f - sd[i])*(1.0f - sc[i]);
+                vr[i] = open*(vr[i] - inverseH*(pc[i] - pd[i]));
+            }
+        }
+    });
+    return stats;
+}
@@ -5,7 +5,16 @@
 #include <QPushButton>
 #include <QCheckBox>
 #include <QLabel>
+#include <QTimer>
+#include <QDir>
+#include <QDebug>
 #include "sceneview.hpp"
+#include "fluidgrid.hpp"
+#include "fluidsolver.hpp"
+#include "quadtree.hpp"
+#include "simulationthread.hpp"
+#include "profiler.hpp"
+#include <stdexcept>
 
 MainWindow::MainWindow(QWidget* parent)
   : QMainWindow(parent)
@@ -19,20 +28,121 @@ MainWindow::MainWindow(QWidget* parent)
     //layout->setContentsMargins(0, 0, 0, 0);
     //layout->setSpacing(0);
 
-    QPushButton* button_1 = new QPushButton("Button1");
+    QPushButton* button_1 = new QPushButton("Start trace");
+    connect(button_1, &QPushButton::clicked, this, [this, button_1]() { toggleTrace(button_1); });
     QPushButton* button_2 = new QPushButton("Button2");
 
-    QCheckBox* box_1 = new QCheckBox();
+    QCheckBox* box_1 = new QCheckBox("Quadtree pressure");
+    connect(box_1, &QCheckBox::toggled, this, [this](bool checked) { quadtreeRequested = checked; });
     QLabel* label_1 = new QLabel("label1");
+    stepLabel = label_1;
 
 
     layout->addRow(button_1, button_2);
     layout->addRow(scene);
     layout->addRow(label_1, box_1);
     ui->frame->setLayout(layout);
+
+    Profiler::setThreadName("gui");
+    setupSimulation();
 }
 
 MainWindow::~MainWindow()
 {
+  // the simulation publishes into the scene's upload buffers; stop it before the scene goes away
+  simulation.reset();
   delete ui;
 }
+
+void MainWindow::setupSimulation()
+{
+    const int gridSize = 128;
+    grid.reset(new FluidGrid(gridSize, gridSize));
+    solver.reset(new FluidSolver(*grid));
+    solver->usePressureSolver(PressureSolverKind::Multigrid);
+    solver->parameters().buoyancy = 2.0f;
+
+    // each step is packed into a mapped upload buffer; paintGL never reads the grid
+    scene->enableStreaming(gridSize, gridSize);
+    scene->setFieldRange(FieldRange{0.0f, 1.0f});
+
+    // the solver runs on its own thread; every finished step hands its density to the scene
+    simulation.reset(new SimulationThread([this]() { stepSimulation(); },
+                                          [this](const SimulationFrameInfo&) { scene->publishField(grid->density()); }));
+    simulation->start();
+
+    // the GUI thread only repaints, at display rate, whatever frame is newest
+    timer = new QTimer(this);
+    connect(timer, &QTimer::timeout, this, [this]() { refreshView(); });
+    timer->start(16);
+}
+
+// runs on the simulation thread; touches nothing but the grid, the solver and the scene's published buffers
+void MainWindow::stepSimulation()
+{
+    // a warm plume rising from a small source near the bottom
+    int n = grid->getNx();
+    for (int j = 4; j < 8; ++j)
+    {
+        for (int i = n/2 - 4; i < n/2 + 4; ++i)
+        {
+            solver->densitySource().at(i, j) = 10.0f;
+            solver->temperatureSource().at(i, j) = 5.0f;
+        }
+    }
+    bool useQuadtree = quadtreeRequested;
+    if (useQuadtree != quadtreeActive)
+    {
+        solver->usePressureSolver(useQuadtree ? PressureSolverKind::Quadtree : PressureSolverKind::Multigrid);
+        quadtreeActive = useQuadtree;
+        if (!useQuadtree)
+        {
+            scene->publishQuadtreeLeaves({});
+        }
+    }
+    solver->step();
+    if (quadtreeActive)
+    {
+        // the tree the step just solved on
+        const auto& quadtree = static_cast<const QuadtreePressureSolver&>(solver->getPressureSolver());
+        scene->publishQuadtreeLeaves(quadtree.getTree().getLeaves());
+    }
+}
+
+void MainWindow::refreshView()
+{
+    SimulationFrameInfo info;
+    if (simulation->latestFrame(info))
+    {
+        stepLabel->setText(QString("step %1  %2 ms  %3 steps/s")
+                               .arg(info.step)
+                               .arg(info.stepSeconds*1000.0, 0, 'f', 2)
+                               .arg(info.stepsPerSecond, 0, 'f', 1));
+    }
+    scene->update();
+}
+
+// first click starts recording, the second writes a Chrome trace into the working directory
+void MainWindow::toggleTrace(QPushButton* button)
+{
+    Profiler& profiler = Profiler::instance();
+    if (!profiler.isEnabled())
+    {
+        profiler.clear();
+        profiler.setEnabled(true);
+        button->setText("Save trace");
+        return;
+    }
+    profiler.setEnabled(false);
+    button->setText("Start trace");
+    QString path = QDir::current().absoluteFilePath("simfluid_trace.json");
+    try
+    {
+        profiler.writeChromeTrace(path.toStdString());
+        qDebug() << "trace written to" << path;
+    }
+    catch (const std::runtime_error& error)
+    {
+        qWarning() << error.what();
+    }
+}
@@ -2,7 +2,15 @@
 #define MAINWINDOW_HPP
 
 #include <QMainWindow>
+#include <atomic>
+#include <memory>
 class SceneView;
+class QTimer;
+class QLabel;
+class QPushButton;
+class FluidGrid;
+class FluidSolver;
+class SimulationThread;
 
 QT_BEGIN_NAMESPACE
 namespace Ui
@@ -20,7 +28,21 @@ public:
   ~MainWindow();
 
 private:
+  void setupSimulation();
+  void stepSimulation();
+  void refreshView();
+  void toggleTrace(QPushButton* button);
+
   Ui::MainWindow* ui;
   SceneView* scene;
+  QLabel* stepLabel{nullptr};
+  std::unique_ptr<FluidGrid> grid;
+  std::unique_ptr<FluidSolver> solver;
+  // declared after the grid and solver it steps, so it is stopped before they go
+  std::unique_ptr<SimulationThread> simulation;
+  QTimer* timer{nullptr};
+  // set by the GUI, applied by the simulation thread between steps
+  std::atomic<bool> quadtreeRequested{false};
+  bool quadtreeActive{false};
 };
 #endif // MAINWINDOW_HPP
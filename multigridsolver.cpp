@@ -0,0 +1,260 @@
+#include "multigridsolver.hpp"
+#include "threadpool.hpp"
+#include <algorithm>
+
+namespace
+{
+// below this many cells a level is cheaper to sweep on the calling thread than to hand out
+const int MinParallelCells = 64*64;
+}
+
+MultigridPressureSolver::MultigridPressureSolver(ThreadPool* pool)
+    : pool(pool)
+{
+    this->maxIterations = 20;
+    this->tolerance = 1e-5;
+}
+
+void MultigridPressureSolver::setSmoothingSteps(int preSmooth, int postSmooth)
+{
+    this->preSmoothing = std::max(preSmooth, 0);
+    this->postSmoothing = std::max(postSmooth, 0);
+}
+
+void MultigridPressureSolver::setSmoother(SmootherKind kind, int sweepsPerTile)
+{
+    this->smootherKind = kind;
+    this->smootherSweepsPerTile = std::max(sweepsPerTile, 1);
+}
+
+ThreadPool* MultigridPressureSolver::poolFor(int nx, int ny) const
+{
+    return nx*ny >= MinParallelCells ? this->pool : nullptr;
+}
+
+//--------------------------------HIERARCHY----------------------------------------
+void MultigridPressureSolver::buildHierarchy(ScalarField& p, const ScalarField& rhs, const ScalarField& obstacle)
+{
+    int nx = p.getNx();
+    int ny = p.getNy();
+    if (this->levels.empty() || this->levels[0].nx != nx || this->levels[0].ny != ny)
+    {
+        this->levels.clear();
+        this->levels.emplace_back();
+        this->levels[0].nx = nx;
+        this->levels[0].ny = ny;
+        this->levels[0].residual = ScalarField(nx, ny, 1);
+        this->levels[0].smoother = PoissonSmoother(poolFor(nx, ny));
+        while (nx > this->coarsestSize && ny > this->coarsestSize)
+        {
+            nx = (nx + 1) / 2;
+            ny = (ny + 1) / 2;
+            Level coarse;
+            coarse.nx = nx;
+            coarse.ny = ny;
+            coarse.residual = ScalarField(nx, ny, 1);
+            coarse.smoother = PoissonSmoother(poolFor(nx, ny));
+            coarse.ownedP = ScalarField(nx, ny, 1);
+            coarse.ownedRhs = ScalarField(nx, ny, 1);
+            coarse.ownedObstacle = ScalarField(nx, ny, 1);
+            markWallsSolid(coarse.ownedObstacle);
+            this->levels.push_back(std::move(coarse));
+        }
+    }
+
+    this->levels[0].p = &p;
+    this->levels[0].rhs = &rhs;
+    this->levels[0].obstacle = &obstacle;
+    for (std::size_t l = 1; l < this->levels.size(); ++l)
+    {
+        Level& fine = this->levels[l - 1];
+        Level& coarse = this->levels[l];
+        coarse.p = &coarse.ownedP;
+        coarse.rhs = &coarse.ownedRhs;
+        coarse.obstacle = &coarse.ownedObstacle;
+
+        // a coarse cell stays fluid while any child is fluid; out-of-range
+        // children read the solid ghost layer
+        for (int J = 0; J < coarse.ny; ++J)
+        {
+            for (int I = 0; I < coarse.nx; ++I)
+            {
+                const ScalarField& s = *fine.obstacle;
+                float solid = std::min(std::min(s.at(2*I, 2*J), s.at(2*I + 1, 2*J)),
+                                       std::min(s.at(2*I, 2*J + 1), s.at(2*I + 1, 2*J + 1)));
+                coarse.ownedObstacle.at(I, J) = solid;
+            }
+        }
+    }
+}
+
+//--------------------------------SOLVE--------------------------------------------
+PressureSolveStats MultigridPressureSolver::solve(ScalarField& p, const ScalarField& rhs, const ScalarField& obstacle)
+{
+    PressureSolveStats stats;
+    buildHierarchy(p, rhs, obstacle);
+
+    double rhsNorm = computeFluidNorm(rhs, obstacle, this->pool);
+    if (rhsNorm == 0.0)
+    {
+        p.fill(0.0f);
+        stats.converged = true;
+        return stats;
+    }
+
+    int numLevels = static_cast<int>(this->levels.size());
+    int cycle = 0;
+    if (this->useFullMultigrid)
+    {
+        for (int l = 1; l < numLevels; ++l)
+        {
+            restrictField(*this->levels[l - 1].rhs, this->levels[l].ownedRhs, this->levels[l].nx, this->levels[l].ny);
+        }
+        this->levels[numLevels - 1].p->fill(0.0f);
+        solveCoarsest(this->levels[numLevels - 1]);
+        for (int l = numLevels - 2; l >= 0; --l)
+        {
+            this->levels[l].p->fill(0.0f);
+            prolongAndCorrect(this->levels[l + 1], this->levels[l]);
+            vCycle(l);
+        }
+        ++cycle;
+        double relative = computePoissonResidualNorm(p, rhs, obstacle, this->pool) / rhsNorm;
+        stats.residualHistory.push_back(relative);
+        stats.converged = relative < this->tolerance;
+    }
+
+    while (!stats.converged && cycle < this->maxIterations)
+    {
+        vCycle(0);
+        ++cycle;
+        double relative = computePoissonResidualNorm(p, rhs, obstacle, this->pool) / rhsNorm;
+        stats.residualHistory.push_back(relative);
+        stats.converged = relative < this->tolerance;
+    }
+    stats.iterations = cycle;
+
+    // the all-Neumann solution is only defined up to a constant
+    removeFluidMean(p, obstacle);
+    return stats;
+}
+
+void MultigridPressureSolver::vCycle(int level)
+{
+    Level& fine = this->levels[level];
+    if (level == static_cast<int>(this->levels.size()) - 1)
+    {
+        solveCoarsest(fine);
+        return;
+    }
+
+    Level& coarse = this->levels[level + 1];
+    smooth(fine, this->preSmoothing);
+    computeResidual(fine);
+    restrictResidual(fine, coarse);
+    coarse.p->fill(0.0f);
+    vCycle(level + 1);
+    prolongAndCorrect(coarse, fine);
+    smooth(fine, this->postSmoothing);
+}
+
+//--------------------------------LEVEL OPERATIONS---------------------------------
+void MultigridPressureSolver::smooth(Level& level, int sweeps)
+{
+    level.smoother.setKind(this->smootherKind);
+    level.smoother.setSweepsPerTile(this->smootherSweepsPerTile);
+    level.smoother.smooth(*level.p, *level.rhs, *level.obstacle, sweeps);
+}
+
+void MultigridPressureSolver::computeResidual(Level& level)
+{
+    const ScalarField& p = *level.p;
+    const ScalarField& b = *level.rhs;
+    const ScalarField& s = *level.obstacle;
+    int nx = level.nx;
+
+    parallelFor(poolFor(level.nx, level.ny), 0, level.ny, [&](int j0, int j1) {
+        for (int j = j0; j < j1; ++j)
+        {
+            const float* pc = p.row(j);
+            const float* pd = p.row(j - 1);
+            const float* pu = p.row(j + 1);
+            const float* sc = s.row(j);
+            const float* sd = s.row(j - 1);
+            const float* su = s.row(j + 1);
+            const float* br = b.row(j);
+            float* r = level.residual.row(j);
+            for (int i = 0; i < nx; ++i)
+            {
+                float fl = 1.0f - sc[i - 1];
+                float fr = 1.0f - sc[i + 1];
+                float fd = 1.0f - sd[i];
+                float fu = 1.0f - su[i];
+                float ap = (fl + fr + fd + fu)*pc[i] - fl*pc[i - 1] - fr*pc[i + 1] - fd*pd[i] - fu*pu[i];
+                r[i] = (1.0f - sc[i]) * (br[i] - ap);
+            }
+        }
+    });
+}
+
+void MultigridPressureSolver::restrictResidual(const Level& fine, Level& coarse)
+{
+    restrictField(fine.residual, coarse.ownedRhs, coarse.nx, coarse.ny);
+}
+
+void MultigridPressureSolver::restrictField(const ScalarField& fine, ScalarField& coarse, int coarseNx, int coarseNy)
+{
+    // summing the children is averaging times 4 = (2h)^2 / h^2
+    parallelFor(poolFor(coarseNx, coarseNy), 0, coarseNy, [&](int J0, int J1) {
+        for (int J = J0; J < J1; ++J)
+        {
+            const float* f0 = fine.row(2*J);
+            const float* f1 = fine.row(2*J + 1);
+            float* c = coarse.row(J);
+            for (int I = 0; I < coarseNx; ++I)
+            {
+                c[I] = f0[2*I] + f0[2*I + 1] + f1[2*I] + f1[2*I + 1];
+            }
+        }
+    });
+}
+
+void MultigridPressureSolver::prolongAndCorrect(const Level& coarse, Level& fine)
+{
+    const ScalarField& e = *coarse.p;
+    const ScalarField& cs = *coarse.obstacle;
+    const ScalarField& fs = *fine.obstacle;
+    ScalarField& p = *fine.p;
+    int nx = fine.nx;
+
+    parallelFor(poolFor(fine.nx, fine.ny), 0, fine.ny, [&](int j0, int j1) {
+        for (int j = j0; j < j1; ++j)
+        {
+            int J = j / 2;
+            int dj = (j & 1) ? 1 : -1;
+            const float* fsr = fs.row(j);
+            float* pr = p.row(j);
+            for (int i = 0; i < nx; ++i)
+            {
+                if (fsr[i] > 0.5f)
+                {
+                    continue;
+                }
+                int I = i / 2;
+                int di = (i & 1) ? 1 : -1;
+                // bilinear weights 9/16, 3/16, 3/16, 1/16 with solid neighbours
+                // replaced by the parent value
+                float centre = e.at(I, J);
+                float side = cs.at(I + di, J) > 0.5f ? centre : e.at(I + di, J);
+                float vert = cs.at(I, J + dj) > 0.5f ? centre : e.at(I, J + dj);
+                float diag = cs.at(I + di, J + dj) > 0.5f ? centre : e.at(I + di, J + dj);
+                pr[i] += 0.5625f*centre + 0.1875f*(side + vert) + 0.0625f*diag;
+            }
+        }
+    });
+}
+
+void MultigridPressureSolver::solveCoarsest(Level& level)
+{
+    smooth(level, this->coarsestSweeps);
+}
@@ -0,0 +1,72 @@
+#ifndef MULTIGRIDSOLVER_HPP
+#define MULTIGRIDSOLVER_HPP
+
+#include "fluidgrid.hpp"
+#include "pressuresolver.hpp"
+#include "smoothers.hpp"
+#include <vector>
+
+class ThreadPool;
+
+// Cell-centred geometric multigrid for the projection system described in
+// pressuresolver.hpp. Each level halves the resolution; a coarse cell is
+// fluid if any of its children is. Restriction sums the four children (which
+// also carries the h^2 scaling of the operator), prolongation is bilinear,
+// and smoothing is red-black Gauss-Seidel (or weighted Jacobi, see
+// smoothers.hpp). One V-cycle costs O(N), and the
+// number of cycles needed for a given tolerance does not grow with N.
+class MultigridPressureSolver : public PressureSolver
+{
+public:
+    explicit MultigridPressureSolver(ThreadPool* pool = nullptr);
+
+    PressureSolveStats solve(ScalarField& p, const ScalarField& rhs, const ScalarField& obstacle) override;
+
+    // start from a full-multigrid pass instead of the incoming guess
+    void setUseFullMultigrid(bool enabled) { this->useFullMultigrid = enabled; }
+    void setSmoothingSteps(int preSmooth, int postSmooth);
+    void setCoarsestSize(int size) { this->coarsestSize = size; }
+    // sweepsPerTile > 1 temporally blocks the pre- and post-smoothing sweeps
+    void setSmoother(SmootherKind kind, int sweepsPerTile = 1);
+
+    int getNumLevels() const { return static_cast<int>(this->levels.size()); }
+
+private:
+    struct Level
+    {
+        int nx{0};
+        int ny{0};
+        ScalarField* p{nullptr};
+        const ScalarField* rhs{nullptr};
+        const ScalarField* obstacle{nullptr};
+        ScalarField residual;
+        PoissonSmoother smoother;
+        // owned storage on the coarse levels
+        ScalarField ownedP;
+        ScalarField ownedRhs;
+        ScalarField ownedObstacle;
+    };
+
+    void buildHierarchy(ScalarField& p, const ScalarField& rhs, const ScalarField& obstacle);
+    void vCycle(int level);
+    void smooth(Level& level, int sweeps);
+    void computeResidual(Level& level);
+    void restrictResidual(const Level& fine, Level& coarse);
+    void restrictField(const ScalarField& fine, ScalarField& coarse, int coarseNx, int coarseNy);
+    void prolongAndCorrect(const Level& coarse, Level& fine);
+    void solveCoarsest(Level& level);
+    // the pool for a level, or nullptr when the level is too small to be worth splitting
+    ThreadPool* poolFor(int nx, int ny) const;
+
+    ThreadPool* pool{nullptr};
+    std::vector<Level> levels;
+    bool useFullMultigrid{false};
+    int preSmoothing{2};
+    int postSmoothing{2};
+    int coarsestSize{4};
+    int coarsestSweeps{60};
+    SmootherKind smootherKind{SmootherKind::RedBlackGaussSeidel};
+    int smootherSweepsPerTile{1};
+};
+
+#endif // MULTIGRIDSOLVER_HPP
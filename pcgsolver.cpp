@@ -0,0 +1,459 @@
+#include "pcgsolver.hpp"
+#include "threadpool.hpp"
+#include <algorithm>
+#include <cmath>
+
+PcgPressureSolver::PcgPressureSolver(ThreadPool* pool)
+    : pool(pool)
+{
+    this->maxIterations = 500;
+    this->tolerance = 1e-5;
+}
+
+//--------------------------------SETUP--------------------------------------------
+void PcgPressureSolver::prepare(const ScalarField& p, const ScalarField& obstacle)
+{
+    if (!this->diag.sameShape(p))
+    {
+        int nx = p.getNx();
+        int ny = p.getNy();
+        int g = p.getGhost();
+        for (ScalarField* f : {&this->diag, &this->couplingRight, &this->couplingUp, &this->precon,
+                               &this->r, &this->z, &this->d, &this->dPrev, &this->s,
+                               &this->u, &this->w, &this->m, &this->n, &this->q, &this->zz, &this->pp, &this->ss})
+        {
+            *f = ScalarField(nx, ny, g);
+        }
+    }
+
+    // coefficients are rebuilt every solve because obstacles can move
+    int nx = p.getNx();
+    parallelFor(this->pool, 0, p.getNy(), [&](int j0, int j1) {
+        for (int j = j0; j < j1; ++j)
+        {
+            const float* sc = obstacle.row(j);
+            const float* sd = obstacle.row(j - 1);
+            const float* su = obstacle.row(j + 1);
+            float* dg = this->diag.row(j);
+            float* cr = this->couplingRight.row(j);
+            float* cu = this->couplingUp.row(j);
+            for (int i = 0; i < nx; ++i)
+            {
+                float fluid = 1.0f - sc[i];
+                dg[i] = fluid * ((1.0f - sc[i - 1]) + (1.0f - sc[i + 1]) + (1.0f - sd[i]) + (1.0f - su[i]));
+                cr[i] = fluid * (1.0f - sc[i + 1]);
+                cu[i] = fluid * (1.0f - su[i]);
+            }
+        }
+    });
+
+    if (this->preconditioner == PcgPreconditioner::ModifiedIncompleteCholesky)
+    {
+        buildPreconditioner();
+    }
+}
+
+void PcgPressureSolver::buildPreconditioner()
+{
+    // MIC(0) factorization in lexicographic order; inherently sequential
+    int nx = this->diag.getNx();
+    int ny = this->diag.getNy();
+    for (int j = 0; j < ny; ++j)
+    {
+        const float* dg = this->diag.row(j);
+        const float* crc = this->couplingRight.row(j);
+        const float* cuc = this->couplingUp.row(j);
+        const float* cud = this->couplingUp.row(j - 1);
+        const float* crd = this->couplingRight.row(j - 1);
+        const float* pd = this->precon.row(j - 1);
+        float* pc = this->precon.row(j);
+        for (int i = 0; i < nx; ++i)
+        {
+            if (dg[i] == 0.0f)
+            {
+                pc[i] = 0.0f;
+                continue;
+            }
+            float left = crc[i - 1]*pc[i - 1];
+            float down = cud[i]*pd[i];
+            float e = dg[i] - left*left - down*down
+                      - this->micTau*(crc[i - 1]*cuc[i - 1]*pc[i - 1]*pc[i - 1]
+                                      + cud[i]*crd[i]*pd[i]*pd[i]);
+            if (e < this->micSafety*dg[i])
+            {
+                e = dg[i];
+            }
+            pc[i] = 1.0f / std::sqrt(e);
+        }
+    }
+}
+
+//--------------------------------KERNELS------------------------------------------
+double PcgPressureSolver::applyPreconditioner(const ScalarField& in, ScalarField& out, const ScalarField* dotWith)
+{
+    int nx = in.getNx();
+    int ny = in.getNy();
+
+    if (this->preconditioner == PcgPreconditioner::None)
+    {
+        return parallelSum(this->pool, 0, ny, [&](int j0, int j1) {
+            double local = 0.0;
+            for (int j = j0; j < j1; ++j)
+            {
+                const float* a = in.row(j);
+                float* o = out.row(j);
+                const float* b = dotWith ? dotWith->row(j) : nullptr;
+                for (int i = 0; i < nx; ++i)
+                {
+                    o[i] = a[i];
+                }
+                if (b)
+                {
+                    for (int i = 0; i < nx; ++i)
+                    {
+                        local += static_cast<double>(a[i])*b[i];
+                    }
+                }
+            }
+            return local;
+        });
+    }
+
+    // forward substitution L q = in, stored in out
+    for (int j = 0; j < ny; ++j)
+    {
+        const float* a = in.row(j);
+        const float* pc = this->precon.row(j);
+        const float* pd = this->precon.row(j - 1);
+        const float* cr = this->couplingRight.row(j);
+        const float* cud = this->couplingUp.row(j - 1);
+        const float* qd = out.row(j - 1);
+        float* qc = out.row(j);
+        for (int i = 0; i < nx; ++i)
+        {
+            float t = a[i] + cr[i - 1]*pc[i - 1]*qc[i - 1] + cud[i]*pd[i]*qd[i];
+            qc[i] = t*pc[i];
+        }
+    }
+
+    // back substitution L^T z = q in place, accumulating z.dotWith on the way
+    double dot = 0.0;
+    for (int j = ny - 1; j >= 0; --j)
+    {
+        const float* pc = this->precon.row(j);
+        const float* cr = this->couplingRight.row(j);
+        const float* cu = this->couplingUp.row(j);
+        const float* zu = out.row(j + 1);
+        const float* b = dotWith ? dotWith->row(j) : nullptr;
+        float* zc = out.row(j);
+        for (int i = nx - 1; i >= 0; --i)
+        {
+            float t = zc[i] + cr[i]*pc[i]*zc[i + 1] + cu[i]*pc[i]*zu[i];
+            zc[i] = t*pc[i];
+            if (b)
+            {
+                dot += static_cast<double>(zc[i])*b[i];
+            }
+        }
+    }
+    return dot;
+}
+
+void PcgPressureSolver::applyOperator(const ScalarField& in, ScalarField& out)
+{
+    int nx = in.getNx();
+    parallelFor(this->pool, 0, in.getNy(), [&](int j0, int j1) {
+        for (int j = j0; j < j1; ++j)
+        {
+            const float* __restrict xc = in.row(j);
+            const float* __restrict xd = in.row(j - 1);
+            const float* __restrict xu = in.row(j + 1);
+            const float* __restrict dg = this->diag.row(j);
+            const float* __restrict cr = this->couplingRight.row(j);
+            const float* __restrict cu = this->couplingUp.row(j);
+            const float* __restrict cud = this->couplingUp.row(j - 1);
+            float* __restrict o = out.row(j);
+            for (int i = 0; i < nx; ++i)
+            {
+                o[i] = dg[i]*xc[i] - cr[i]*xc[i + 1] - cr[i - 1]*xc[i - 1] - cu[i]*xu[i] - cud[i]*xd[i];
+            }
+        }
+    });
+}
+
+double PcgPressureSolver::computeInitialResidual(const ScalarField& x, const ScalarField& b, ScalarField& res)
+{
+    applyOperator(x, res);
+    int nx = x.getNx();
+    return parallelSum(this->pool, 0, x.getNy(), [&](int j0, int j1) {
+        double local = 0.0;
+        for (int j = j0; j < j1; ++j)
+        {
+            const float* br = b.row(j);
+            const float* dg = this->diag.row(j);
+            float* rr = res.row(j);
+            for (int i = 0; i < nx; ++i)
+            {
+                float fluid = dg[i] > 0.0f ? 1.0f : 0.0f;
+                rr[i] = fluid*(br[i] - rr[i]);
+                local += static_cast<double>(rr[i])*rr[i];
+            }
+        }
+        return local;
+    });
+}
+
+//--------------------------------SOLVE--------------------------------------------
+PressureSolveStats PcgPressureSolver::solve(ScalarField& p, const ScalarField& rhs, const ScalarField& obstacle)
+{
+    prepare(p, obstacle);
+
+    // solid cells and ghosts carry no unknowns
+    int nx = p.getNx();
+    for (int j = -p.getGhost(); j < p.getNy() + p.getGhost(); ++j)
+    {
+        for (int i = -p.getGhost(); i < nx + p.getGhost(); ++i)
+        {
+            bool interior = i >= 0 && i < nx && j >= 0 && j < p.getNy();
+            if (!interior || this->diag.at(i, j) == 0.0f)
+            {
+                p.at(i, j) = 0.0f;
+            }
+        }
+    }
+
+    double rhsNorm = computeFluidNorm(rhs, obstacle, this->pool);
+    if (rhsNorm == 0.0)
+    {
+        p.fill(0.0f);
+        PressureSolveStats stats;
+        stats.converged = true;
+        return stats;
+    }
+
+    double rr = computeInitialResidual(p, rhs, this->r);
+    if (std::sqrt(rr)/rhsNorm < this->tolerance)
+    {
+        PressureSolveStats stats;
+        stats.converged = true;
+        return stats;
+    }
+    return this->pipelined ? solvePipelined(p, rhs, rhsNorm) : solveStandard(p, rhsNorm);
+}
+
+PressureSolveStats PcgPressureSolver::solveStandard(ScalarField& x, double rhsNorm)
+{
+    PressureSolveStats stats;
+    int nx = x.getNx();
+    int ny = x.getNy();
+
+    double rho = applyPreconditioner(this->r, this->z, &this->r);
+    double beta = 0.0;
+    this->dPrev.fill(0.0f);
+
+    for (int iteration = 1; iteration <= this->maxIterations; ++iteration)
+    {
+        // d = z + beta*dPrev, s = A d and sigma = d.s in one sweep
+        float b = static_cast<float>(beta);
+        double sigma = parallelSum(this->pool, 0, ny, [&](int j0, int j1) {
+            double local = 0.0;
+            for (int j = j0; j < j1; ++j)
+            {
+                const float* __restrict zc = this->z.row(j);
+                const float* __restrict zd = this->z.row(j - 1);
+                const float* __restrict zu = this->z.row(j + 1);
+                const float* __restrict ec = this->dPrev.row(j);
+                const float* __restrict ed = this->dPrev.row(j - 1);
+                const float* __restrict eu = this->dPrev.row(j + 1);
+                const float* __restrict dg = this->diag.row(j);
+                const float* __restrict cr = this->couplingRight.row(j);
+                const float* __restrict cu = this->couplingUp.row(j);
+                const float* __restrict cud = this->couplingUp.row(j - 1);
+                float* __restrict dc = this->d.row(j);
+                float* __restrict sc = this->s.row(j);
+                float partial = 0.0f;
+#pragma omp simd reduction(+:partial)
+                for (int i = 0; i < nx; ++i)
+                {
+                    float centre = zc[i] + b*ec[i];
+                    float left = zc[i - 1] + b*ec[i - 1];
+                    float right = zc[i + 1] + b*ec[i + 1];
+                    float down = zd[i] + b*ed[i];
+                    float up = zu[i] + b*eu[i];
+                    float as = dg[i]*centre - cr[i]*right - cr[i - 1]*left - cu[i]*up - cud[i]*down;
+                    dc[i] = centre;
+                    sc[i] = as;
+                    partial += centre*as;
+                }
+                local += partial;
+            }
+            return local;
+        });
+        if (sigma == 0.0)
+        {
+            break;
+        }
+        float alpha = static_cast<float>(rho / sigma);
+
+        // x += alpha d, r -= alpha s and |r|^2 in one sweep
+        double rr = parallelSum(this->pool, 0, ny, [&](int j0, int j1) {
+            double local = 0.0;
+            for (int j = j0; j < j1; ++j)
+            {
+                const float* __restrict dc = this->d.row(j);
+                const float* __restrict sc = this->s.row(j);
+                float* __restrict xc = x.row(j);
+                float* __restrict rc = this->r.row(j);
+                float partial = 0.0f;
+#pragma omp simd reduction(+:partial)
+                for (int i = 0; i < nx; ++i)
+                {
+                    xc[i] += alpha*dc[i];
+                    rc[i] -= alpha*sc[i];
+                    partial += rc[i]*rc[i];
+                }
+                local += partial;
+            }
+            return local;
+        });
+
+        stats.iterations = iteration;
+        double relative = std::sqrt(rr) / rhsNorm;
+        stats.residualHistory.push_back(relative);
+        if (relative < this->tolerance)
+        {
+            stats.converged = true;
+            break;
+        }
+
+        double rhoNew = applyPreconditioner(this->r, this->z, &this->r);
+        beta = rhoNew / rho;
+        rho = rhoNew;
+        this->d.swap(this->dPrev);
+    }
+    return stats;
+}
+
+PressureSolveStats PcgPressureSolver::solvePipelined(ScalarField& x, const ScalarField& rhs, double rhsNorm)
+{
+    PressureSolveStats stats;
+    int nx = x.getNx();
+    int ny = x.getNy();
+
+    // u = M r, w = A u, gamma = r.u, delta = w.u; also used to replace the
+    // recursively updated residual when it drifts from the true one
+    double gamma = 0.0;
+    double delta = 0.0;
+    auto startRecurrences = [&]() {
+        gamma = applyPreconditioner(this->r, this->u, &this->r);
+        applyOperator(this->u, this->w);
+        delta = parallelSum(this->pool, 0, ny, [&](int j0, int j1) {
+            double local = 0.0;
+            for (int j = j0; j < j1; ++j)
+            {
+                const float* wc = this->w.row(j);
+                const float* uc = this->u.row(j);
+                for (int i = 0; i < nx; ++i)
+                {
+                    local += static_cast<double>(wc[i])*uc[i];
+                }
+            }
+            return local;
+        });
+        for (ScalarField* f : {&this->zz, &this->q, &this->ss, &this->pp})
+        {
+            f->fill(0.0f);
+        }
+    };
+    startRecurrences();
+
+    double gammaOld = 0.0;
+    double alphaOld = 0.0;
+    bool firstStep = true;
+    for (int iteration = 1; iteration <= this->maxIterations; ++iteration)
+    {
+        // m = M w, n = A m
+        applyPreconditioner(this->w, this->m, nullptr);
+        applyOperator(this->m, this->n);
+
+        double beta = 0.0;
+        double alphaD = gamma / delta;
+        if (!firstStep)
+        {
+            beta = gamma / gammaOld;
+            alphaD = gamma / (delta - beta*gamma/alphaOld);
+        }
+        if (!std::isfinite(alphaD))
+        {
+            break;
+        }
+        float alpha = static_cast<float>(alphaD);
+        float b = static_cast<float>(beta);
+
+        // all recurrences plus the next iteration's dot products in one sweep
+        std::array<double, 3> sums = parallelSums<3>(this->pool, 0, ny, [&](int j0, int j1) {
+            std::array<double, 3> local{};
+            for (int j = j0; j < j1; ++j)
+            {
+                const float* __restrict nr = this->n.row(j);
+                const float* __restrict mr = this->m.row(j);
+                float* __restrict zr = this->zz.row(j);
+                float* __restrict qr = this->q.row(j);
+                float* __restrict sr = this->ss.row(j);
+                float* __restrict pr = this->pp.row(j);
+                float* __restrict xr = x.row(j);
+                float* __restrict rr = this->r.row(j);
+                float* __restrict ur = this->u.row(j);
+                float* __restrict wr = this->w.row(j);
+                float ru = 0.0f;
+                float wu = 0.0f;
+                float r2 = 0.0f;
+#pragma omp simd reduction(+:ru, wu, r2)
+                for (int i = 0; i < nx; ++i)
+                {
+                    zr[i] = nr[i] + b*zr[i];
+                    qr[i] = mr[i] + b*qr[i];
+                    sr[i] = wr[i] + b*sr[i];
+                    pr[i] = ur[i] + b*pr[i];
+                    xr[i] += alpha*pr[i];
+                    rr[i] -= alpha*sr[i];
+                    ur[i] -= alpha*qr[i];
+                    wr[i] -= alpha*zr[i];
+                    ru += rr[i]*ur[i];
+                    wu += wr[i]*ur[i];
+                    r2 += rr[i]*rr[i];
+                }
+                local[0] += ru;
+                local[1] += wu;
+                local[2] += r2;
+            }
+            return local;
+        });
+
+        stats.iterations = iteration;
+        double relative = std::sqrt(sums[2]) / rhsNorm;
+        firstStep = false;
+        if (relative < this->tolerance)
+        {
+            // the recurrences accumulate rounding; confirm against b - A x
+            relative = std::sqrt(computeInitialResidual(x, rhs, this->r)) / rhsNorm;
+            if (relative < this->tolerance)
+            {
+                stats.residualHistory.push_back(relative);
+                stats.converged = true;
+                break;
+            }
+            startRecurrences();
+            firstStep = true;
+            stats.residualHistory.push_back(relative);
+            continue;
+        }
+        stats.residualHistory.push_back(relative);
+
+        gammaOld = gamma;
+        alphaOld = alphaD;
+        gamma = sums[0];
+        delta = sums[1];
+    }
+    return stats;
+}
@@ -0,0 +1,369 @@
+#include "perfcounters.hpp"
+#include "threadpool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+const std::size_t CacheLineBytes = 64;
+
+#if defined(__linux__)
+int openEvent(PerfEvent event, long threadId)
+{
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    switch (event)
+    {
+    case PerfEvent::Cycles:
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case PerfEvent::Instructions:
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case PerfEvent::CacheReferences:
+        attr.config = PERF_COUNT_HW_CACHE_REFERENCES;
+        break;
+    case PerfEvent::CacheMisses:
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    case PerfEvent::TaskClock:
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = PERF_COUNT_SW_TASK_CLOCK;
+        break;
+    case PerfEvent::Count:
+        return -1;
+    }
+    // user space only: allowed at perf_event_paranoid 2, and the solver never runs in the kernel
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, threadId, -1, -1, 0));
+}
+#endif
+}
+
+const char* perfEventName(PerfEvent event)
+{
+    switch (event)
+    {
+    case PerfEvent::Cycles:
+        return "cycles";
+    case PerfEvent::Instructions:
+        return "instructions";
+    case PerfEvent::CacheReferences:
+        return "cache-references";
+    case PerfEvent::CacheMisses:
+        return "cache-misses";
+    case PerfEvent::TaskClock:
+        return "task-clock";
+    case PerfEvent::Count:
+        break;
+    }
+    return "unknown";
+}
+
+//--------------------------------SAMPLES------------------------------------------
+PerfSample& PerfSample::operator+=(const PerfSample& other)
+{
+    for (int e = 0; e < NumPerfEvents; ++e)
+    {
+        this->values[e] += other.values[e];
+        this->valid[e] = this->valid[e] && other.valid[e];
+    }
+    return *this;
+}
+
+PerfSample PerfSample::operator-(const PerfSample& other) const
+{
+    PerfSample difference;
+    for (int e = 0; e < NumPerfEvents; ++e)
+    {
+        difference.valid[e] = this->valid[e] && other.valid[e];
+        difference.values[e] = difference.valid[e] ? this->values[e] - other.values[e] : 0;
+    }
+    return difference;
+}
+
+//--------------------------------THREAD COUNTERS----------------------------------
+ThreadPerfCounters::ThreadPerfCounters(long threadId)
+{
+    for (int e = 0; e < NumPerfEvents; ++e)
+    {
+#if defined(__linux__)
+        this->fds[e] = openEvent(static_cast<PerfEvent>(e), threadId);
+#else
+        (void)threadId;
+        this->fds[e] = -1;
+#endif
+    }
+}
+
+ThreadPerfCounters::~ThreadPerfCounters()
+{
+#if defined(__linux__)
+    for (int fd : this->fds)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+#endif
+}
+
+PerfSample ThreadPerfCounters::read() const
+{
+    PerfSample sample;
+#if defined(__linux__)
+    for (int e = 0; e < NumPerfEvents; ++e)
+    {
+        std::uint64_t data[3];   // value, time enabled, time running
+        if (this->fds[e] < 0 || ::read(this->fds[e], data, sizeof(data)) != static_cast<ssize_t>(sizeof(data)))
+        {
+            continue;
+        }
+        double scale = (data[2] > 0 && data[2] < data[1]) ? static_cast<double>(data[1]) / data[2] : 1.0;
+        sample.values[e] = static_cast<std::uint64_t>(static_cast<double>(data[0]) * scale);
+        sample.valid[e] = true;
+    }
+#endif
+    return sample;
+}
+
+//--------------------------------STREAM TRIAD-------------------------------------
+double measureStreamTriadBandwidth(ThreadPool* pool, std::size_t elements, int repetitions)
+{
+    std::unique_ptr<double[]> a(new double[elements]);
+    std::unique_ptr<double[]> b(new double[elements]);
+    std::unique_ptr<double[]> c(new double[elements]);
+    const int numBlocks = 4096;
+    auto blockRange = [&](int block, std::size_t& begin, std::size_t& end) {
+        begin = elements * static_cast<std::size_t>(block) / numBlocks;
+        end = elements * static_cast<std::size_t>(block + 1) / numBlocks;
+    };
+    // first touch with the same split as the timed loop, so pages land near their thread
+    parallelFor(pool, 0, numBlocks, [&](int b0, int b1) {
+        std::size_t begin, end, last;
+        blockRange(b0, begin, last);
+        blockRange(b1 - 1, last, end);
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            a[i] = 0.0;
+            b[i] = 1.0;
+            c[i] = 2.0;
+        }
+    });
+
+    const double scalar = 3.0;
+    double best = 0.0;
+    for (int r = 0; r < repetitions; ++r)
+    {
+        auto start = std::chrono::steady_clock::now();
+        parallelFor(pool, 0, numBlocks, [&](int b0, int b1) {
+            std::size_t begin, end, last;
+            blockRange(b0, begin, last);
+            blockRange(b1 - 1, last, end);
+            double* __restrict out = a.get();
+            const double* __restrict x = b.get();
+            const double* __restrict y = c.get();
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                out[i] = x[i] + scalar*y[i];
+            }
+        });
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (seconds > 0.0)
+        {
+            best = std::max(best, 3.0 * sizeof(double) * static_cast<double>(elements) / seconds);
+        }
+    }
+    return best;
+}
+
+//--------------------------------STAGE STATS--------------------------------------
+double StagePerfStats::instructionsPerCycle() const
+{
+    if (!this->counters.has(PerfEvent::Instructions) || !this->counters.has(PerfEvent::Cycles) ||
+        this->counters.get(PerfEvent::Cycles) == 0)
+    {
+        return 0.0;
+    }
+    return static_cast<double>(this->counters.get(PerfEvent::Instructions)) / this->counters.get(PerfEvent::Cycles);
+}
+
+double StagePerfStats::memoryBytes() const
+{
+    if (!this->counters.has(PerfEvent::CacheMisses))
+    {
+        return 0.0;
+    }
+    return static_cast<double>(this->counters.get(PerfEvent::CacheMisses)) * CacheLineBytes;
+}
+
+//--------------------------------COLLECTOR----------------------------------------
+StagePerfCollector::StagePerfCollector(ThreadPool* pool, std::int64_t cellsPerStage)
+    : owner(std::this_thread::get_id()), cellsPerStage(cellsPerStage)
+{
+    this->threads.emplace_back(new ThreadPerfCounters(0));
+    if (pool)
+    {
+        for (long id : pool->getWorkerThreadIds())
+        {
+            this->threads.emplace_back(new ThreadPerfCounters(id));
+        }
+    }
+}
+
+StagePerfCollector::~StagePerfCollector()
+{
+    detach();
+}
+
+void StagePerfCollector::attach()
+{
+    this->owner = std::this_thread::get_id();
+    Profiler::instance().setObserver(this);
+    Profiler::instance().setEnabled(true);
+    this->attached = true;
+}
+
+void StagePerfCollector::detach()
+{
+    if (!this->attached)
+    {
+        return;
+    }
+    Profiler& profiler = Profiler::instance();
+    if (profiler.getObserver() == this)
+    {
+        profiler.setObserver(nullptr);
+    }
+    this->attached = false;
+}
+
+bool StagePerfCollector::hasEvent(PerfEvent event) const
+{
+    return !this->threads.empty() && this->threads.front()->isOpen(event);
+}
+
+PerfSample StagePerfCollector::readAll() const
+{
+    PerfSample total;
+    total.valid.fill(true);
+    for (const std::unique_ptr<ThreadPerfCounters>& counters : this->threads)
+    {
+        total += counters->read();
+    }
+    return total;
+}
+
+StagePerfStats& StagePerfCollector::statsFor(const char* name)
+{
+    for (StagePerfStats& entry : this->stats)
+    {
+        if (entry.name == name)
+        {
+            return entry;
+        }
+    }
+    this->stats.emplace_back();
+    this->stats.back().name = name;
+    this->stats.back().counters.valid.fill(true);
+    return this->stats.back();
+}
+
+void StagePerfCollector::zoneBegin(const char* name)
+{
+    if (std::this_thread::get_id() != this->owner)
+    {
+        return;
+    }
+    this->openZones.push_back(OpenZone{name, readAll(), std::chrono::steady_clock::now()});
+}
+
+void StagePerfCollector::zoneEnd(const char* name)
+{
+    if (std::this_thread::get_id() != this->owner || this->openZones.empty())
+    {
+        return;
+    }
+    PerfSample end = readAll();
+    auto endTime = std::chrono::steady_clock::now();
+    OpenZone zone = this->openZones.back();
+    this->openZones.pop_back();
+
+    StagePerfStats& entry = statsFor(name);
+    entry.calls += 1;
+    entry.seconds += std::chrono::duration<double>(endTime - zone.startTime).count();
+    entry.counters += end - zone.start;
+}
+
+void StagePerfCollector::writeReport(std::ostream& out, double peakBytesPerSecond) const
+{
+    bool hasMisses = hasEvent(PerfEvent::CacheMisses);
+    bool hasIpc = hasEvent(PerfEvent::Instructions) && hasEvent(PerfEvent::Cycles);
+    bool hasCpu = hasEvent(PerfEvent::TaskClock);
+    char line[256];
+    std::snprintf(line, sizeof(line), "%-20s %8s %10s %10s %6s %9s %10s %9s %8s\n", "stage", "calls", "ms/call",
+                  "cpu ms", "ipc", "llc miss", "bytes/cell", "GB/s", "of peak");
+    out << line;
+    for (const StagePerfStats& entry : this->stats)
+    {
+        double milliseconds = 1000.0 * entry.seconds / std::max<std::uint64_t>(entry.calls, 1);
+        char cpu[16] = "n/a";
+        char ipc[16] = "n/a";
+        char missRate[16] = "n/a";
+        char bytesPerCell[16] = "n/a";
+        char bandwidth[16] = "n/a";
+        char ofPeak[16] = "-";
+        if (hasCpu)
+        {
+            std::snprintf(cpu, sizeof(cpu), "%.2f", entry.counters.get(PerfEvent::TaskClock) * 1e-6);
+        }
+        if (hasIpc)
+        {
+            std::snprintf(ipc, sizeof(ipc), "%.2f", entry.instructionsPerCycle());
+        }
+        if (hasMisses)
+        {
+            std::uint64_t references = entry.counters.get(PerfEvent::CacheReferences);
+            if (hasEvent(PerfEvent::CacheReferences) && references > 0)
+            {
+                std::snprintf(missRate, sizeof(missRate), "%.1f%%",
+                              100.0 * entry.counters.get(PerfEvent::CacheMisses) / references);
+            }
+            double cells = static_cast<double>(entry.calls) * static_cast<double>(this->cellsPerStage);
+            double gigabytesPerSecond = entry.seconds > 0.0 ? entry.memoryBytes() / entry.seconds * 1e-9 : 0.0;
+            std::snprintf(bytesPerCell, sizeof(bytesPerCell), "%.1f", cells > 0.0 ? entry.memoryBytes() / cells : 0.0);
+            std::snprintf(bandwidth, sizeof(bandwidth), "%.2f", gigabytesPerSecond);
+            if (peakBytesPerSecond > 0.0)
+            {
+                std::snprintf(ofPeak, sizeof(ofPeak), "%.0f%%", 100.0 * gigabytesPerSecond * 1e9 / peakBytesPerSecond);
+            }
+        }
+        std::snprintf(line, sizeof(line), "%-20s %8llu %10.3f %10s %6s %9s %10s %9s %8s\n", entry.name.c_str(),
+                      static_cast<unsigned long long>(entry.calls), milliseconds, cpu, ipc, missRate, bytesPerCell,
+                      bandwidth, ofPeak);
+        out << line;
+    }
+    if (peakBytesPerSecond > 0.0)
+    {
+        std::snprintf(line, sizeof(line), "STREAM triad peak: %.2f GB/s\n", peakBytesPerSecond * 1e-9);
+        out << line;
+    }
+    if (!hasMisses)
+    {
+        out << "no last-level cache miss counter (no PMU, or perf_event_paranoid too strict): bandwidth columns are n/a\n";
+    }
+}
@@ -0,0 +1,130 @@
+#ifndef PERFCOUNTERS_HPP
+#define PERFCOUNTERS_HPP
+
+#include "profiler.hpp"
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ThreadPool;
+
+// Hardware and OS counters read through Linux perf_event_open. Every event is
+// opened on its own, so a machine without a PMU (most VMs) or with a strict
+// perf_event_paranoid still gets whatever it allows, typically the task clock.
+// Off Linux nothing opens and every sample is empty.
+
+enum class PerfEvent
+{
+    Cycles,
+    Instructions,
+    CacheReferences,   // last-level cache accesses
+    CacheMisses,       // last-level cache misses, each one a line from memory
+    TaskClock,         // CPU time in nanoseconds (software event)
+    Count
+};
+
+constexpr int NumPerfEvents = static_cast<int>(PerfEvent::Count);
+const char* perfEventName(PerfEvent event);
+
+struct PerfSample
+{
+    std::array<std::uint64_t, NumPerfEvents> values{};
+    std::array<bool, NumPerfEvents> valid{};
+
+    bool has(PerfEvent event) const { return this->valid[static_cast<int>(event)]; }
+    std::uint64_t get(PerfEvent event) const { return this->values[static_cast<int>(event)]; }
+
+    // an event stays valid only if it is valid on both sides
+    PerfSample& operator+=(const PerfSample& other);
+    PerfSample operator-(const PerfSample& other) const;
+};
+
+// counters of one thread of this process; threadId 0 means the calling thread
+class ThreadPerfCounters
+{
+public:
+    explicit ThreadPerfCounters(long threadId = 0);
+    ~ThreadPerfCounters();
+    ThreadPerfCounters(const ThreadPerfCounters&) = delete;
+    ThreadPerfCounters& operator=(const ThreadPerfCounters&) = delete;
+
+    bool isOpen(PerfEvent event) const { return this->fds[static_cast<int>(event)] >= 0; }
+    // running totals, scaled up when the kernel multiplexed the counters
+    PerfSample read() const;
+
+private:
+    std::array<int, NumPerfEvents> fds;
+};
+
+// STREAM triad a[i] = b[i] + s*c[i] over three arrays of doubles, in parallel
+// on the pool; best of `repetitions` runs in bytes per second, counting the
+// 24 bytes per element STREAM counts (no write-allocate traffic).
+double measureStreamTriadBandwidth(ThreadPool* pool, std::size_t elements = std::size_t(1) << 23,
+                                   int repetitions = 5);
+
+struct StagePerfStats
+{
+    std::string name;
+    std::uint64_t calls{0};
+    double seconds{0.0};      // wall time, inclusive of nested zones
+    PerfSample counters;      // summed over the calling thread and the pool workers
+
+    double instructionsPerCycle() const;
+    // bytes fetched from memory, estimated as one cache line per LLC miss; 0 without the counter
+    double memoryBytes() const;
+};
+
+// Attributes the counters of a solver's calling thread and of its pool's
+// workers to the profiler zones opened on the calling thread. attach()
+// installs it as the profiler's observer and enables the profiler; stats are
+// inclusive (a zone also counts the zones nested in it). Each zone boundary
+// reads every counter of every thread, so attach it for measurement runs only.
+class StagePerfCollector : public ProfileZoneObserver
+{
+public:
+    // cellsPerStage: grid cells one call of a stage sweeps, for bytes per cell
+    StagePerfCollector(ThreadPool* pool, std::int64_t cellsPerStage);
+    ~StagePerfCollector() override;
+
+    void attach();
+    void detach();
+
+    bool hasEvent(PerfEvent event) const;
+    std::int64_t getCellsPerStage() const { return this->cellsPerStage; }
+    // in the order the stages were first seen
+    const std::vector<StagePerfStats>& getStats() const { return this->stats; }
+
+    // table of time, IPC, LLC miss rate, bytes per cell and bandwidth as a
+    // fraction of peakBytesPerSecond (the stage's position under the
+    // bandwidth roof); peak <= 0 leaves that column out
+    void writeReport(std::ostream& out, double peakBytesPerSecond) const;
+
+    void zoneBegin(const char* name) override;
+    void zoneEnd(const char* name) override;
+
+private:
+    struct OpenZone
+    {
+        const char* name;
+        PerfSample start;
+        std::chrono::steady_clock::time_point startTime;
+    };
+
+    PerfSample readAll() const;
+    StagePerfStats& statsFor(const char* name);
+
+    std::vector<std::unique_ptr<ThreadPerfCounters>> threads;
+    std::thread::id owner;
+    std::int64_t cellsPerStage;
+    std::vector<OpenZone> openZones;
+    std::vector<StagePerfStats> stats;
+    bool attached{false};
+};
+
+#endif // PERFCOUNTERS_HPP
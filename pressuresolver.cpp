@@ -0,0 +1,230 @@
+#include "pressuresolver.hpp"
+#include "cpudispatch.hpp"
+#include "fluidgrid.hpp"
+#include "gridlayout.hpp"
+#include "threadpool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <tuple>
+
+//--------------------------------NORMS AND RESIDUALS------------------------------
+double computePoissonResidualNorm(const ScalarField& p, const ScalarField& rhs, const ScalarField& obstacle,
+                                  ThreadPool* pool)
+{
+    int nx = p.getNx();
+    double sum = parallelSum(pool, 0, p.getNy(), [&](int j0, int j1) {
+        double local = 0.0;
+        for (int j = j0; j < j1; ++j)
+        {
+            const float* pc = p.row(j);
+            const float* pd = p.row(j - 1);
+            const float* pu = p.row(j + 1);
+            const float* sc = obstacle.row(j);
+            const float* sd = obstacle.row(j - 1);
+            const float* su = obstacle.row(j + 1);
+            const float* b = rhs.row(j);
+            for (int i = 0; i < nx; ++i)
+            {
+                if (sc[i] > 0.5f)
+                {
+                    continue;
+                }
+                float fl = 1.0f - sc[i - 1];
+                float fr = 1.0f - sc[i + 1];
+                float fd = 1.0f - sd[i];
+                float fu = 1.0f - su[i];
+                float ap = (fl + fr + fd + fu)*pc[i] - fl*pc[i - 1] - fr*pc[i + 1] - fd*pd[i] - fu*pu[i];
+                double r = b[i] - ap;
+                local += r*r;
+            }
+        }
+        return local;
+    });
+    return std::sqrt(sum);
+}
+
+double computeFluidNorm(const ScalarField& values, const ScalarField& obstacle, ThreadPool* pool)
+{
+    int nx = values.getNx();
+    FluidSumSquaresKernel kernel = activeKernels().fluidSumSquares;
+    double sum = parallelSum(pool, 0, values.getNy(), [&](int j0, int j1) {
+        double local = 0.0;
+        for (int j = j0; j < j1; ++j)
+        {
+            local += kernel(values.row(j), obstacle.row(j), nx);
+        }
+        return local;
+    });
+    return std::sqrt(sum);
+}
+
+void removeFluidMean(ScalarField& rhs, const ScalarField& obstacle)
+{
+    double total = 0.0;
+    long long count = 0;
+    for (int j = 0; j < rhs.getNy(); ++j)
+    {
+        for (int i = 0; i < rhs.getNx(); ++i)
+        {
+            if (obstacle.at(i, j) < 0.5f)
+            {
+                total += rhs.at(i, j);
+                ++count;
+            }
+        }
+    }
+    if (count == 0)
+    {
+        return;
+    }
+    float mean = static_cast<float>(total / count);
+    for (int j = 0; j < rhs.getNy(); ++j)
+    {
+        for (int i = 0; i < rhs.getNx(); ++i)
+        {
+            rhs.at(i, j) = (obstacle.at(i, j) < 0.5f) ? rhs.at(i, j) - mean : 0.0f;
+        }
+    }
+}
+
+//--------------------------------JACOBI SOLVER------------------------------------
+namespace
+{
+// sweeps until the residual, checked every checkInterval sweeps, is small enough
+template <class Sweep, class Residual>
+void iterateJacobi(int maxIterations, int checkInterval, double tolerance, double rhsNorm, const Sweep& sweep,
+                   const Residual& residual, PressureSolveStats& stats)
+{
+    for (int iteration = 1; iteration <= maxIterations; ++iteration)
+    {
+        sweep();
+        stats.iterations = iteration;
+
+        if (iteration % checkInterval == 0 || iteration == maxIterations)
+        {
+            double relative = residual() / rhsNorm;
+            stats.residualHistory.push_back(relative);
+            if (relative < tolerance)
+            {
+                stats.converged = true;
+                break;
+            }
+        }
+    }
+}
+}
+
+// the iterate, its successor, b and the obstacle mask in one layout per kind,
+// kept between solves and reallocated only when the grid size changes
+struct JacobiPressureSolver::LayoutFields
+{
+    template <class Layout>
+    struct Set
+    {
+        Set(int nx, int ny)
+            : current(nx, ny), next(nx, ny), b(nx, ny), solid(nx, ny)
+        {
+        }
+
+        LayoutField<Layout> current;
+        LayoutField<Layout> next;
+        LayoutField<Layout> b;
+        LayoutField<Layout> solid;
+    };
+
+    template <class Layout>
+    Set<Layout>& get(int nx, int ny)
+    {
+        std::unique_ptr<Set<Layout>>& set = std::get<std::unique_ptr<Set<Layout>>>(this->sets);
+        if (!set || set->current.getNx() != nx || set->current.getNy() != ny)
+        {
+            set.reset(new Set<Layout>(nx, ny));
+        }
+        return *set;
+    }
+
+    std::tuple<std::unique_ptr<Set<RowMajorLayout>>, std::unique_ptr<Set<Tiled8Layout>>,
+               std::unique_ptr<Set<Tiled16Layout>>, std::unique_ptr<Set<MortonLayout>>> sets;
+};
+
+JacobiPressureSolver::JacobiPressureSolver(ThreadPool* pool)
+    : pool(pool), layoutFields(new LayoutFields)
+{
+}
+
+JacobiPressureSolver::~JacobiPressureSolver() = default;
+
+void JacobiPressureSolver::setCheckInterval(int interval)
+{
+    if (interval < 1)
+    {
+        throw std::invalid_argument("JacobiPressureSolver: check interval must be at least 1");
+    }
+    this->checkInterval = interval;
+}
+
+PressureSolveStats JacobiPressureSolver::solve(ScalarField& p, const ScalarField& rhs, const ScalarField& obstacle)
+{
+    PressureSolveStats stats;
+    int nx = p.getNx();
+    int ny = p.getNy();
+
+    double rhsNorm = computeFluidNorm(rhs, obstacle, this->pool);
+    if (rhsNorm == 0.0)
+    {
+        p.fill(0.0f);
+        stats.converged = true;
+        return stats;
+    }
+
+    if (this->layout != GridLayoutKind::RowMajor)
+    {
+        // the sweeps run on copies in the chosen layout; the conversion is two passes per solve
+        visitGridLayout(this->layout, [&](auto tag) {
+            using Layout = typename decltype(tag)::type;
+            LayoutFields::Set<Layout>& fields = this->layoutFields->get<Layout>(nx, ny);
+            LayoutField<Layout>& current = fields.current;
+            LayoutField<Layout>& next = fields.next;
+            LayoutField<Layout>& b = fields.b;
+            LayoutField<Layout>& solid = fields.solid;
+            current.copyFrom(p);
+            next.copyFrom(p);
+            b.copyFrom(rhs);
+            solid.copyFrom(obstacle);
+            iterateJacobi(this->maxIterations, this->checkInterval, this->tolerance, rhsNorm,
+                          [&]() {
+                              layoutJacobiSweep(current, b, solid, next, this->pool);
+                              current.swap(next);
+                          },
+                          [&]() { return layoutPoissonResidualNorm(current, b, solid, this->pool); }, stats);
+            current.copyTo(p);
+        });
+        return stats;
+    }
+
+    ScalarField next(p);
+    JacobiRowKernel kernel = activeKernels().jacobiRow;
+    iterateJacobi(this->maxIterations, this->checkInterval, this->tolerance, rhsNorm,
+                  [&]() {
+                      parallelFor(this->pool, 0, ny, [&](int j0, int j1) {
+                          JacobiRowArgs args;
+                          args.nx = nx;
+                          for (int j = j0; j < j1; ++j)
+                          {
+                              args.centre = p.row(j);
+                              args.down = p.row(j - 1);
+                              args.up = p.row(j + 1);
+                              args.solid = obstacle.row(j);
+                              args.solidDown = obstacle.row(j - 1);
+                              args.solidUp = obstacle.row(j + 1);
+                              args.rhs = rhs.row(j);
+                              args.out = next.row(j);
+                              kernel(args);
+                          }
+                      });
+                      p.swap(next);
+                  },
+                  [&]() { return computePoissonResidualNorm(p, rhs, obstacle, this->pool); }, stats);
+    return stats;
+}
@@ -0,0 +1,80 @@
+#ifndef PRESSURESOLVER_HPP
+#define PRESSURESOLVER_HPP
+
+#include <memory>
+#include <vector>
+
+class FluidGrid;
+class ScalarField;
+class ThreadPool;
+enum class GridLayoutKind;
+
+struct PressureSolveStats
+{
+    int iterations{0};
+    bool converged{false};
+    // relative residual ||b - Ap|| / ||b|| after every iteration (or cycle)
+    std::vector<double> residualHistory;
+};
+
+// Solves A p = b for the projection step. A is the 5-point Poisson matrix in
+// units of the cell size: for every fluid cell
+//     n_c p_c - sum over fluid neighbours p_nb = b_c
+// where n_c counts the non-solid neighbours, so walls and obstacles act as
+// zero-gradient boundaries. Solid cells carry p = 0. `p` holds the initial
+// guess on entry.
+class PressureSolver
+{
+public:
+    virtual ~PressureSolver() = default;
+
+    virtual PressureSolveStats solve(ScalarField& p, const ScalarField& rhs, const ScalarField& obstacle) = 0;
+    // called by FluidSolver with the state about to be projected; solvers whose
+    // discretisation follows the flow rebuild it here
+    virtual void adaptTo(const FluidGrid& grid) { (void)grid; }
+
+    void setTolerance(double tolerance) { this->tolerance = tolerance; }
+    double getTolerance() const { return this->tolerance; }
+    void setMaxIterations(int maxIterations) { this->maxIterations = maxIterations; }
+    int getMaxIterations() const { return this->maxIterations; }
+
+protected:
+    double tolerance{1e-4};
+    int maxIterations{100};
+};
+
+// Plain Jacobi sweeps, parallel over rows or tiles. The sweeps run on the
+// row-major fields unless setLayout() picks another storage layout
+// (gridlayout.hpp), e.g. the one chooseGridLayout() measured as fastest; the
+// solver then keeps copies in that layout between solves.
+class JacobiPressureSolver : public PressureSolver
+{
+public:
+    explicit JacobiPressureSolver(ThreadPool* pool = nullptr);
+    ~JacobiPressureSolver() override;
+
+    PressureSolveStats solve(ScalarField& p, const ScalarField& rhs, const ScalarField& obstacle) override;
+
+    // how many sweeps between residual evaluations; throws std::invalid_argument below 1
+    void setCheckInterval(int interval);
+    void setLayout(GridLayoutKind kind) { this->layout = kind; }
+    GridLayoutKind getLayout() const { return this->layout; }
+
+private:
+    struct LayoutFields;
+
+    ThreadPool* pool{nullptr};
+    int checkInterval{10};
+    GridLayoutKind layout{};
+    std::unique_ptr<LayoutFields> layoutFields;
+};
+
+// ||b - Ap||_2 over the fluid cells
+double computePoissonResidualNorm(const ScalarField& p, const ScalarField& rhs, const ScalarField& obstacle,
+                                  ThreadPool* pool = nullptr);
+double computeFluidNorm(const ScalarField& values, const ScalarField& obstacle, ThreadPool* pool = nullptr);
+
+// subtracts the fluid-cell mean so the all-Neumann system is consistent
+void removeFluidMean(ScalarField& rhs, const ScalarField& obstacle);
+
+#endif // PRESSURESOLVER_HPP
@@ -0,0 +1,295 @@
+#include "profiler.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#if defined(SIMFLUID_PROFILER_TSC)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace
+{
+struct Record
+{
+    std::atomic<const char*> name{nullptr};
+    std::atomic<std::uint64_t> begin{0};
+    std::atomic<std::uint64_t> end{0};
+};
+
+// Written only by its thread. Fields are relaxed atomics so a concurrent dump
+// is well defined; `head` publishes them.
+struct ThreadRing
+{
+    // allocated on the first record, so naming a thread that never records costs nothing
+    std::atomic<Record*> records{nullptr};
+    std::atomic<std::uint64_t> head{0};
+    std::atomic<std::uint64_t> clearedAt{0};
+    std::string threadName;   // guarded by the registry mutex
+    int threadId{0};
+
+    ThreadRing() = default;
+    ThreadRing(const ThreadRing&) = delete;
+    ThreadRing& operator=(const ThreadRing&) = delete;
+    ~ThreadRing() { delete[] this->records.load(std::memory_order_relaxed); }
+};
+
+#if defined(SIMFLUID_PROFILER_TSC)
+// an invariant TSC ticks at a constant rate in every P- and C-state
+bool hasInvariantTsc()
+{
+#if defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 0x80000000);
+    if (static_cast<unsigned>(regs[0]) < 0x80000007u)
+    {
+        return false;
+    }
+    __cpuid(regs, 0x80000007);
+    return (regs[3] >> 8) & 1;
+#else
+    unsigned eax, ebx, ecx, edx;
+    if (__get_cpuid(0x80000000u, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007u)
+    {
+        return false;
+    }
+    __get_cpuid(0x80000007u, &eax, &ebx, &ecx, &edx);
+    return (edx >> 8) & 1u;
+#endif
+}
+#endif
+
+std::uint64_t steadyNanoseconds()
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                          std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void writeJsonString(std::ostream& out, const std::string& text)
+{
+    out << '"';
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out << '\\' << c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            out << ' ';
+        }
+        else
+        {
+            out << c;
+        }
+    }
+    out << '"';
+}
+}
+
+struct Profiler::Registry
+{
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadRing>> rings;   // kept after their threads exit
+
+    ThreadRing& local()
+    {
+        thread_local std::shared_ptr<ThreadRing> ring;
+        if (!ring)
+        {
+            ring = std::make_shared<ThreadRing>();
+            std::lock_guard<std::mutex> lock(this->mutex);
+            ring->threadId = static_cast<int>(this->rings.size()) + 1;
+            ring->threadName = "thread " + std::to_string(ring->threadId);
+            this->rings.push_back(ring);
+        }
+        return *ring;
+    }
+};
+
+Profiler::Profiler() : registry(new Registry)
+{
+#if defined(SIMFLUID_PROFILER_TSC)
+    this->usesTsc = hasInvariantTsc();
+#endif
+    this->originTicks = timestamp();
+    this->originNanoseconds = steadyNanoseconds();
+}
+
+Profiler& Profiler::instance()
+{
+    // never destroyed: zones may close on threads that outlive static destruction
+    static Profiler* profiler = new Profiler();
+    return *profiler;
+}
+
+void Profiler::setEnabled(bool enabled)
+{
+    this->enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void Profiler::setThreadName(const std::string& name)
+{
+    Registry& registry = *instance().registry;
+    ThreadRing& ring = registry.local();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    ring.threadName = name;
+}
+
+void Profiler::record(const char* name, std::uint64_t begin, std::uint64_t end)
+{
+    ThreadRing& ring = this->registry->local();
+    Record* records = ring.records.load(std::memory_order_relaxed);
+    if (!records)
+    {
+        records = new Record[RingCapacity];
+        ring.records.store(records, std::memory_order_release);
+    }
+    std::uint64_t h = ring.head.load(std::memory_order_relaxed);
+    Record& slot = records[h & (RingCapacity - 1)];
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.begin.store(begin, std::memory_order_relaxed);
+    slot.end.store(end, std::memory_order_relaxed);
+    ring.head.store(h + 1, std::memory_order_release);
+}
+
+void Profiler::clear()
+{
+    std::lock_guard<std::mutex> lock(this->registry->mutex);
+    for (const std::shared_ptr<ThreadRing>& ring : this->registry->rings)
+    {
+        ring->clearedAt.store(ring->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+std::size_t Profiler::getEventCount() const
+{
+    std::lock_guard<std::mutex> lock(this->registry->mutex);
+    std::size_t count = 0;
+    for (const std::shared_ptr<ThreadRing>& ring : this->registry->rings)
+    {
+        std::uint64_t h = ring->head.load(std::memory_order_acquire);
+        std::uint64_t first = std::max(ring->clearedAt.load(std::memory_order_relaxed),
+                                       h > RingCapacity ? h - RingCapacity : 0);
+        count += static_cast<std::size_t>(h - first);
+    }
+    return count;
+}
+
+//--------------------------------CHROME TRACE-------------------------------------
+void Profiler::writeChromeTrace(std::ostream& out)
+{
+    struct Event
+    {
+        const char* name;
+        std::uint64_t begin;
+        std::uint64_t end;
+        int threadId;
+    };
+    std::vector<Event> events;
+    std::vector<std::pair<int, std::string>> threads;
+    {
+        std::lock_guard<std::mutex> lock(this->registry->mutex);
+        for (const std::shared_ptr<ThreadRing>& ring : this->registry->rings)
+        {
+            threads.emplace_back(ring->threadId, ring->threadName);
+            std::uint64_t h = ring->head.load(std::memory_order_acquire);
+            std::uint64_t first = std::max(ring->clearedAt.load(std::memory_order_relaxed),
+                                           h > RingCapacity ? h - RingCapacity : 0);
+            const Record* records = ring->records.load(std::memory_order_acquire);
+            if (!records)
+            {
+                continue;
+            }
+            std::size_t start = events.size();
+            for (std::uint64_t k = first; k < h; ++k)
+            {
+                const Record& slot = records[k & (RingCapacity - 1)];
+                events.push_back(Event{slot.name.load(std::memory_order_relaxed),
+                                       slot.begin.load(std::memory_order_relaxed),
+                                       slot.end.load(std::memory_order_relaxed), ring->threadId});
+            }
+            // the owner kept recording while we copied: drop what it may have overwritten
+            std::uint64_t after = ring->head.load(std::memory_order_acquire);
+            std::uint64_t overwritten = (after > RingCapacity) ? after - RingCapacity : 0;
+            if (overwritten > first)
+            {
+                std::size_t lost = static_cast<std::size_t>(std::min(overwritten, h) - first);
+                events.erase(events.begin() + static_cast<std::ptrdiff_t>(start),
+                             events.begin() + static_cast<std::ptrdiff_t>(start + lost));
+            }
+        }
+    }
+
+    // ticks per microsecond, measured against steady_clock over the profiler's lifetime
+    double ticksPerMicrosecond = 1000.0;
+    if (this->usesTsc)
+    {
+        std::uint64_t nanoseconds = steadyNanoseconds() - this->originNanoseconds;
+        if (nanoseconds < 2000000)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            nanoseconds = steadyNanoseconds() - this->originNanoseconds;
+        }
+        std::uint64_t ticks = timestamp() - this->originTicks;
+        ticksPerMicrosecond = 1000.0 * static_cast<double>(ticks) / static_cast<double>(nanoseconds);
+    }
+    std::uint64_t base = this->originTicks;
+    for (const Event& event : events)
+    {
+        base = std::min(base, event.begin);
+    }
+
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    for (const std::pair<int, std::string>& thread : threads)
+    {
+        out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread.first
+            << ",\"args\":{\"name\":";
+        writeJsonString(out, thread.second);
+        out << "}}";
+        first = false;
+    }
+    for (const Event& event : events)
+    {
+        if (!event.name)
+        {
+            continue;
+        }
+        double ts = static_cast<double>(event.begin - base) / ticksPerMicrosecond;
+        double dur = static_cast<double>(event.end - event.begin) / ticksPerMicrosecond;
+        out << (first ? "" : ",\n") << "{\"name\":";
+        writeJsonString(out, event.name);
+        out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.threadId << ",\"ts\":" << ts << ",\"dur\":" << dur << "}";
+        first = false;
+    }
+    out << "\n]}\n";
+    out.flags(flags);
+    out.precision(precision);
+}
+
+void Profiler::writeChromeTrace(const std::string& path)
+{
+    std::ofstream out(path);
+    if (!out)
+    {
+        throw std::runtime_error("Profiler: cannot write '" + path + "'");
+    }
+    writeChromeTrace(out);
+    if (!out)
+    {
+        throw std::runtime_error("Profiler: cannot write '" + path + "'");
+    }
+}
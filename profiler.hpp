@@ -0,0 +1,142 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMFLUID_PROFILER_TSC 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+// Gets every zone boundary while the profiler is enabled, on the thread that
+// opened the zone, e.g. to read hardware counters per stage.
+class ProfileZoneObserver
+{
+public:
+    virtual ~ProfileZoneObserver() = default;
+    virtual void zoneBegin(const char* name) = 0;
+    virtual void zoneEnd(const char* name) = 0;
+};
+
+// Scoped-zone profiler. Each thread appends (name, begin, end) records to its
+// own fixed-size ring, so recording takes no locks and never allocates after
+// the thread's first zone; when a ring is full the oldest records are
+// overwritten. Timestamps are raw TSC ticks where the CPU has an invariant TSC
+// and steady_clock nanoseconds otherwise; both are converted to microseconds
+// only when a trace is written.
+//
+// Recording is off until setEnabled(true); a disabled zone costs one relaxed
+// load. Building without SIMFLUID_PROFILING compiles SIMFLUID_PROFILE_ZONE out.
+//
+// Zone names must outlive the profiler (string literals).
+class Profiler
+{
+public:
+    static constexpr std::size_t RingCapacity = std::size_t(1) << 15;   // records per thread
+
+    static Profiler& instance();
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return this->enabled.load(std::memory_order_relaxed); }
+
+    // label of the calling thread in the trace
+    static void setThreadName(const std::string& name);
+
+    std::uint64_t timestamp() const
+    {
+#if defined(SIMFLUID_PROFILER_TSC)
+        if (this->usesTsc)
+        {
+            return __rdtsc();
+        }
+#endif
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                              std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+    bool usesTimestampCounter() const { return this->usesTsc; }
+
+    // at most one observer; the caller keeps it alive until it is replaced by nullptr
+    void setObserver(ProfileZoneObserver* observer) { this->observer.store(observer, std::memory_order_release); }
+    ProfileZoneObserver* getObserver() const { return this->observer.load(std::memory_order_acquire); }
+
+    void record(const char* name, std::uint64_t begin, std::uint64_t end);
+
+    // drops everything recorded so far, on every thread
+    void clear();
+    // records currently held across all threads
+    std::size_t getEventCount() const;
+
+    // Chrome trace_event JSON ("X" complete events plus thread names), which
+    // Perfetto and chrome://tracing open directly. Safe while other threads
+    // record; records overwritten during the dump are left out.
+    void writeChromeTrace(std::ostream& out);
+    // throws std::runtime_error when the file cannot be written
+    void writeChromeTrace(const std::string& path);
+
+private:
+    Profiler();
+    struct Registry;
+
+    std::atomic<bool> enabled{false};
+    std::atomic<ProfileZoneObserver*> observer{nullptr};
+    bool usesTsc{false};
+    std::uint64_t originTicks{0};
+    std::uint64_t originNanoseconds{0};
+    Registry* registry;
+};
+
+class ProfileZone
+{
+public:
+    explicit ProfileZone(const char* name)
+        : profiler(Profiler::instance()), name(profiler.isEnabled() ? name : nullptr)
+    {
+        if (this->name)
+        {
+            this->observer = this->profiler.getObserver();
+            if (this->observer)
+            {
+                this->observer->zoneBegin(this->name);
+            }
+            this->begin = this->profiler.timestamp();
+        }
+    }
+    ~ProfileZone()
+    {
+        if (this->name)
+        {
+            this->profiler.record(this->name, this->begin, this->profiler.timestamp());
+            if (this->observer)
+            {
+                this->observer->zoneEnd(this->name);
+            }
+        }
+    }
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    Profiler& profiler;
+    const char* name;
+    ProfileZoneObserver* observer{nullptr};
+    std::uint64_t begin{0};
+};
+
+#define SIMFLUID_PROFILE_JOIN_IMPL(a, b) a##b
+#define SIMFLUID_PROFILE_JOIN(a, b) SIMFLUID_PROFILE_JOIN_IMPL(a, b)
+#if defined(SIMFLUID_PROFILING)
+#define SIMFLUID_PROFILE_ZONE(name) ProfileZone SIMFLUID_PROFILE_JOIN(simfluidProfileZone, __LINE__)(name)
+#else
+#define SIMFLUID_PROFILE_ZONE(name) ((void)0)
+#endif
+
+#endif // PROFILER_HPP
@@ -0,0 +1,590 @@
+#include "quadtree.hpp"
+#include "threadpool.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+
+namespace
+{
+bool isPowerOfTwo(int value)
+{
+    return value > 0 && (value & (value - 1)) == 0;
+}
+
+int log2Of(int powerOfTwo)
+{
+    int level = 0;
+    while ((1 << level) < powerOfTwo)
+    {
+        ++level;
+    }
+    return level;
+}
+
+// per-cell refinement indicators reduced by max over aligned 2^k blocks
+struct IndicatorLevel
+{
+    int width{0};
+    int height{0};
+    std::vector<float> vorticity;
+    std::vector<float> gradient;
+    std::vector<unsigned char> anySolid;
+    std::vector<unsigned char> anyFluid;
+};
+}
+
+//--------------------------------TREE---------------------------------------------
+QuadtreeGrid::QuadtreeGrid(int nx, int ny)
+    : nx(nx), ny(ny)
+{
+    if (nx <= 0 || ny <= 0)
+    {
+        throw std::invalid_argument("QuadtreeGrid: dimensions must be positive");
+    }
+    buildUniform(1);
+}
+
+void QuadtreeGrid::refine(int minLeafSize, int maxLeafSize, const std::function<bool(int, int, int)>& shouldSplit)
+{
+    if (!isPowerOfTwo(minLeafSize) || !isPowerOfTwo(maxLeafSize) || minLeafSize > maxLeafSize)
+    {
+        throw std::invalid_argument("QuadtreeGrid: leaf sizes must be powers of two with min <= max");
+    }
+    this->nodes.clear();
+    int rootsX = (this->nx + maxLeafSize - 1) / maxLeafSize;
+    int rootsY = (this->ny + maxLeafSize - 1) / maxLeafSize;
+    for (int rj = 0; rj < rootsY; ++rj)
+    {
+        for (int ri = 0; ri < rootsX; ++ri)
+        {
+            Node root;
+            root.i0 = ri*maxLeafSize;
+            root.j0 = rj*maxLeafSize;
+            root.size = maxLeafSize;
+            this->nodes.push_back(root);
+        }
+    }
+    this->rootCount = static_cast<int>(this->nodes.size());
+
+    // children are appended behind their parent, so one forward pass visits every node
+    for (std::size_t k = 0; k < this->nodes.size(); ++k)
+    {
+        Node node = this->nodes[k];
+        if (node.i0 >= this->nx || node.j0 >= this->ny)
+        {
+            this->nodes[k].outside = true;
+            continue;
+        }
+        bool straddlesEdge = node.i0 + node.size > this->nx || node.j0 + node.size > this->ny;
+        if (node.size > 1 && (straddlesEdge || (node.size > minLeafSize && shouldSplit(node.i0, node.j0, node.size))))
+        {
+            split(static_cast<int>(k));
+        }
+    }
+    collectLeaves();
+    balance();
+}
+
+void QuadtreeGrid::split(int node)
+{
+    int half = this->nodes[node].size / 2;
+    int i0 = this->nodes[node].i0;
+    int j0 = this->nodes[node].j0;
+    this->nodes[node].firstChild = static_cast<int>(this->nodes.size());
+    for (int c = 0; c < 4; ++c)
+    {
+        Node child;
+        child.i0 = i0 + (c & 1)*half;
+        child.j0 = j0 + (c >> 1)*half;
+        child.size = half;
+        this->nodes.push_back(child);
+    }
+}
+
+void QuadtreeGrid::collectLeaves()
+{
+    this->leafNodes.clear();
+    this->leaves.clear();
+    std::vector<int> stack;
+    for (int root = 0; root < this->rootCount; ++root)
+    {
+        stack.push_back(root);
+        while (!stack.empty())
+        {
+            int k = stack.back();
+            stack.pop_back();
+            const Node& node = this->nodes[k];
+            if (node.outside)
+            {
+                continue;
+            }
+            if (node.firstChild >= 0)
+            {
+                // pushed in reverse so the children come out in Z order
+                for (int c = 3; c >= 0; --c)
+                {
+                    stack.push_back(node.firstChild + c);
+                }
+                continue;
+            }
+            QuadtreeLeaf leaf;
+            leaf.i0 = node.i0;
+            leaf.j0 = node.j0;
+            leaf.size = node.size;
+            this->leafNodes.push_back(k);
+            this->leaves.push_back(leaf);
+        }
+    }
+    this->cellLeaf.assign(static_cast<std::size_t>(this->nx)*this->ny, -1);
+    for (int l = 0; l < getLeafCount(); ++l)
+    {
+        const QuadtreeLeaf& leaf = this->leaves[l];
+        for (int j = leaf.j0; j < leaf.j0 + leaf.size; ++j)
+        {
+            std::fill(this->cellLeaf.begin() + static_cast<std::size_t>(j)*this->nx + leaf.i0,
+                      this->cellLeaf.begin() + static_cast<std::size_t>(j)*this->nx + leaf.i0 + leaf.size, l);
+        }
+    }
+}
+
+// A neighbour larger than a leaf is aligned to a block that contains the
+// leaf's whole edge, so the cell just past the edge's first cell finds it.
+void QuadtreeGrid::balance()
+{
+    for (;;)
+    {
+        std::vector<int> toSplit;
+        for (int l = 0; l < getLeafCount(); ++l)
+        {
+            const QuadtreeLeaf& leaf = this->leaves[l];
+            const std::array<std::array<int, 2>, 4> outside{{{leaf.i0 - 1, leaf.j0},
+                                                             {leaf.i0 + leaf.size, leaf.j0},
+                                                             {leaf.i0, leaf.j0 - 1},
+                                                             {leaf.i0, leaf.j0 + leaf.size}}};
+            for (const std::array<int, 2>& cell : outside)
+            {
+                if (cell[0] < 0 || cell[1] < 0 || cell[0] >= this->nx || cell[1] >= this->ny)
+                {
+                    continue;
+                }
+                int neighbour = leafAt(cell[0], cell[1]);
+                if (this->leaves[neighbour].size > 2*leaf.size)
+                {
+                    toSplit.push_back(this->leafNodes[neighbour]);
+                }
+            }
+        }
+        if (toSplit.empty())
+        {
+            return;
+        }
+        std::sort(toSplit.begin(), toSplit.end());
+        toSplit.erase(std::unique(toSplit.begin(), toSplit.end()), toSplit.end());
+        for (int node : toSplit)
+        {
+            split(node);
+        }
+        collectLeaves();
+    }
+}
+
+bool QuadtreeGrid::isBalanced() const
+{
+    for (int j = 0; j < this->ny; ++j)
+    {
+        for (int i = 0; i < this->nx; ++i)
+        {
+            int size = this->leaves[leafAt(i, j)].size;
+            if (i + 1 < this->nx)
+            {
+                int other = this->leaves[leafAt(i + 1, j)].size;
+                if (size > 2*other || other > 2*size)
+                {
+                    return false;
+                }
+            }
+            if (j + 1 < this->ny)
+            {
+                int other = this->leaves[leafAt(i, j + 1)].size;
+                if (size > 2*other || other > 2*size)
+                {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void QuadtreeGrid::buildFaces(const ScalarField* obstacle)
+{
+    for (QuadtreeLeaf& leaf : this->leaves)
+    {
+        leaf.solid = false;
+        if (!obstacle)
+        {
+            continue;
+        }
+        bool allSolid = true;
+        for (int j = leaf.j0; j < leaf.j0 + leaf.size && allSolid; ++j)
+        {
+            for (int i = leaf.i0; i < leaf.i0 + leaf.size; ++i)
+            {
+                allSolid = allSolid && obstacle->at(i, j) > 0.5f;
+            }
+        }
+        leaf.solid = allSolid;
+    }
+
+    // every face is the right or top edge of exactly one leaf; walk those edges
+    // and merge runs of cells that belong to the same neighbour
+    this->faces.clear();
+    for (int a = 0; a < getLeafCount(); ++a)
+    {
+        const QuadtreeLeaf& leaf = this->leaves[a];
+        for (int axis = 0; axis < 2; ++axis)
+        {
+            int beyond = axis == 0 ? leaf.i0 + leaf.size : leaf.j0 + leaf.size;
+            if (beyond >= (axis == 0 ? this->nx : this->ny))
+            {
+                continue;
+            }
+            int k = 0;
+            while (k < leaf.size)
+            {
+                int b = axis == 0 ? leafAt(beyond, leaf.j0 + k) : leafAt(leaf.i0 + k, beyond);
+                int run = std::min(this->leaves[b].size, leaf.size);
+                if (!leaf.solid && !this->leaves[b].solid)
+                {
+                    QuadtreeFace face;
+                    face.a = a;
+                    face.b = b;
+                    face.axis = axis;
+                    face.length = static_cast<float>(run);
+                    face.distance = 0.5f*(leaf.size + this->leaves[b].size);
+                    this->faces.push_back(face);
+                }
+                k += run;
+            }
+        }
+    }
+}
+
+void QuadtreeGrid::buildUniform(int leafSize, const ScalarField* obstacle)
+{
+    refine(1, leafSize, [](int, int, int) { return false; });
+    buildFaces(obstacle);
+}
+
+void QuadtreeGrid::build(const FluidGrid& grid, const QuadtreeCriteria& criteria)
+{
+    if (grid.getNx() != this->nx || grid.getNy() != this->ny)
+    {
+        throw std::invalid_argument("QuadtreeGrid::build: grid shape mismatch");
+    }
+    if (!isPowerOfTwo(criteria.maxLeafSize))
+    {
+        throw std::invalid_argument("QuadtreeGrid: leaf sizes must be powers of two with min <= max");
+    }
+
+    const ScalarField& u = grid.u();
+    const ScalarField& v = grid.v();
+    const ScalarField& density = grid.density();
+    const ScalarField& obstacle = grid.obstacle();
+
+    std::vector<IndicatorLevel> levels(log2Of(criteria.maxLeafSize) + 1);
+    IndicatorLevel& finest = levels[0];
+    finest.width = this->nx;
+    finest.height = this->ny;
+    std::size_t cells = static_cast<std::size_t>(this->nx)*this->ny;
+    finest.vorticity.resize(cells);
+    finest.gradient.resize(cells);
+    finest.anySolid.resize(cells);
+    finest.anyFluid.resize(cells);
+    for (int j = 0; j < this->ny; ++j)
+    {
+        for (int i = 0; i < this->nx; ++i)
+        {
+            std::size_t c = static_cast<std::size_t>(j)*this->nx + i;
+            float curl = 0.5f*((v.at(i + 1, j) - v.at(i - 1, j)) - (u.at(i, j + 1) - u.at(i, j - 1)));
+            float gx = 0.5f*(density.at(i + 1, j) - density.at(i - 1, j));
+            float gy = 0.5f*(density.at(i, j + 1) - density.at(i, j - 1));
+            bool solid = obstacle.at(i, j) > 0.5f;
+            finest.vorticity[c] = solid ? 0.0f : std::fabs(curl);
+            finest.gradient[c] = solid ? 0.0f : std::sqrt(gx*gx + gy*gy);
+            finest.anySolid[c] = solid;
+            finest.anyFluid[c] = !solid;
+        }
+    }
+    for (std::size_t k = 1; k < levels.size(); ++k)
+    {
+        const IndicatorLevel& fine = levels[k - 1];
+        IndicatorLevel& coarse = levels[k];
+        coarse.width = (fine.width + 1) / 2;
+        coarse.height = (fine.height + 1) / 2;
+        std::size_t count = static_cast<std::size_t>(coarse.width)*coarse.height;
+        coarse.vorticity.assign(count, 0.0f);
+        coarse.gradient.assign(count, 0.0f);
+        coarse.anySolid.assign(count, 0);
+        coarse.anyFluid.assign(count, 0);
+        for (int j = 0; j < fine.height; ++j)
+        {
+            for (int i = 0; i < fine.width; ++i)
+            {
+                std::size_t f = static_cast<std::size_t>(j)*fine.width + i;
+                std::size_t c = static_cast<std::size_t>(j/2)*coarse.width + i/2;
+                coarse.vorticity[c] = std::max(coarse.vorticity[c], fine.vorticity[f]);
+                coarse.gradient[c] = std::max(coarse.gradient[c], fine.gradient[f]);
+                coarse.anySolid[c] |= fine.anySolid[f];
+                coarse.anyFluid[c] |= fine.anyFluid[f];
+            }
+        }
+    }
+
+    refine(criteria.minLeafSize, criteria.maxLeafSize, [&](int i0, int j0, int size) {
+        const IndicatorLevel& level = levels[log2Of(size)];
+        std::size_t c = static_cast<std::size_t>(j0/size)*level.width + i0/size;
+        return level.vorticity[c]*size > criteria.vorticityThreshold ||
+               level.gradient[c]*size > criteria.gradientThreshold ||
+               (criteria.refineObstacles && level.anySolid[c] && level.anyFluid[c]);
+    });
+    buildFaces(&obstacle);
+}
+
+//--------------------------------PRESSURE SOLVER----------------------------------
+QuadtreePressureSolver::QuadtreePressureSolver(ThreadPool* pool)
+    : pool(pool)
+{
+    this->maxIterations = 500;
+    this->tolerance = 1e-5;
+}
+
+void QuadtreePressureSolver::adaptTo(const FluidGrid& grid)
+{
+    if (this->tree.getNx() != grid.getNx() || this->tree.getNy() != grid.getNy())
+    {
+        this->tree = QuadtreeGrid(grid.getNx(), grid.getNy());
+    }
+    this->tree.build(grid, this->criteria);
+    this->assembled = false;
+}
+
+void QuadtreePressureSolver::assemble()
+{
+    const std::vector<QuadtreeLeaf>& leaves = this->tree.getLeaves();
+    const std::vector<QuadtreeFace>& faces = this->tree.getFaces();
+    int leafCount = this->tree.getLeafCount();
+
+    this->leafRow.assign(leafCount, -1);
+    int rows = 0;
+    for (int l = 0; l < leafCount; ++l)
+    {
+        if (!leaves[l].solid)
+        {
+            this->leafRow[l] = rows++;
+        }
+    }
+
+    std::vector<int> counts(rows + 1, 0);
+    for (const QuadtreeFace& face : faces)
+    {
+        ++counts[this->leafRow[face.a] + 1];
+        ++counts[this->leafRow[face.b] + 1];
+    }
+    this->rowStart.assign(rows + 1, 0);
+    for (int row = 0; row < rows; ++row)
+    {
+        this->rowStart[row + 1] = this->rowStart[row] + counts[row + 1];
+    }
+    this->columns.assign(this->rowStart[rows], 0);
+    this->weights.assign(this->rowStart[rows], 0.0);
+    this->diagonal.assign(rows, 0.0);
+    std::vector<int> fill(this->rowStart.begin(), this->rowStart.end() - 1);
+    for (const QuadtreeFace& face : faces)
+    {
+        int a = this->leafRow[face.a];
+        int b = this->leafRow[face.b];
+        double w = face.getWeight();
+        this->columns[fill[a]] = b;
+        this->weights[fill[a]++] = w;
+        this->columns[fill[b]] = a;
+        this->weights[fill[b]++] = w;
+        this->diagonal[a] += w;
+        this->diagonal[b] += w;
+    }
+    this->x.assign(rows, 0.0);
+    this->r.assign(rows, 0.0);
+    this->z.assign(rows, 0.0);
+    this->d.assign(rows, 0.0);
+    this->q.assign(rows, 0.0);
+    this->assembled = true;
+}
+
+void QuadtreePressureSolver::applyOperator(const std::vector<double>& in, std::vector<double>& out)
+{
+    parallelFor(this->pool, 0, static_cast<int>(in.size()), [&](int r0, int r1) {
+        for (int row = r0; row < r1; ++row)
+        {
+            double sum = this->diagonal[row]*in[row];
+            for (int k = this->rowStart[row]; k < this->rowStart[row + 1]; ++k)
+            {
+                sum -= this->weights[k]*in[this->columns[k]];
+            }
+            out[row] = sum;
+        }
+    });
+}
+
+PressureSolveStats QuadtreePressureSolver::solve(ScalarField& p, const ScalarField& rhs, const ScalarField& obstacle)
+{
+    PressureSolveStats stats;
+    if (this->tree.getNx() != p.getNx() || this->tree.getNy() != p.getNy())
+    {
+        this->tree = QuadtreeGrid(p.getNx(), p.getNy());
+        this->tree.buildUniform(1, &obstacle);
+        this->assembled = false;
+    }
+    if (!this->assembled)
+    {
+        assemble();
+    }
+    const std::vector<QuadtreeLeaf>& leaves = this->tree.getLeaves();
+    int leafCount = this->tree.getLeafCount();
+    int rows = static_cast<int>(this->diagonal.size());
+
+    // restrict: summed right-hand side, averaged initial guess
+    std::vector<double> b(rows, 0.0);
+    parallelFor(this->pool, 0, leafCount, [&](int l0, int l1) {
+        for (int l = l0; l < l1; ++l)
+        {
+            int row = this->leafRow[l];
+            if (row < 0)
+            {
+                continue;
+            }
+            const QuadtreeLeaf& leaf = leaves[l];
+            double sum = 0.0, guess = 0.0;
+            int fluidCells = 0;
+            for (int j = leaf.j0; j < leaf.j0 + leaf.size; ++j)
+            {
+                for (int i = leaf.i0; i < leaf.i0 + leaf.size; ++i)
+                {
+                    if (obstacle.at(i, j) < 0.5f)
+                    {
+                        sum += rhs.at(i, j);
+                        guess += p.at(i, j);
+                        ++fluidCells;
+                    }
+                }
+            }
+            b[row] = sum;
+            this->x[row] = fluidCells > 0 ? guess / fluidCells : 0.0;
+        }
+    });
+
+    // Jacobi-preconditioned CG; a leaf with no fluid neighbour has an empty row and stays put
+    auto precondition = [this](int row, double value) {
+        return this->diagonal[row] > 0.0 ? value / this->diagonal[row] : 0.0;
+    };
+    applyOperator(this->x, this->q);
+    std::array<double, 3> initial = parallelSums<3>(this->pool, 0, rows, [&](int r0, int r1) {
+        std::array<double, 3> sums{};
+        for (int row = r0; row < r1; ++row)
+        {
+            this->r[row] = b[row] - this->q[row];
+            this->z[row] = precondition(row, this->r[row]);
+            this->d[row] = this->z[row];
+            sums[0] += b[row]*b[row];
+            sums[1] += this->r[row]*this->z[row];
+            sums[2] += this->r[row]*this->r[row];
+        }
+        return sums;
+    });
+    double rhsNorm = std::sqrt(initial[0]);
+    double rz = initial[1];
+    if (rhsNorm == 0.0 || std::sqrt(initial[2]) <= this->tolerance*rhsNorm)
+    {
+        stats.converged = true;
+        stats.residualHistory.push_back(rhsNorm == 0.0 ? 0.0 : std::sqrt(initial[2]) / rhsNorm);
+    }
+    while (!stats.converged && stats.iterations < this->maxIterations)
+    {
+        applyOperator(this->d, this->q);
+        double dq = parallelSum(this->pool, 0, rows, [&](int r0, int r1) {
+            double sum = 0.0;
+            for (int row = r0; row < r1; ++row)
+            {
+                sum += this->d[row]*this->q[row];
+            }
+            return sum;
+        });
+        if (dq <= 0.0)
+        {
+            break;
+        }
+        double alpha = rz / dq;
+        std::array<double, 2> sums = parallelSums<2>(this->pool, 0, rows, [&](int r0, int r1) {
+            std::array<double, 2> partial{};
+            for (int row = r0; row < r1; ++row)
+            {
+                this->x[row] += alpha*this->d[row];
+                this->r[row] -= alpha*this->q[row];
+                this->z[row] = precondition(row, this->r[row]);
+                partial[0] += this->r[row]*this->r[row];
+                partial[1] += this->r[row]*this->z[row];
+            }
+            return partial;
+        });
+        ++stats.iterations;
+        double residual = std::sqrt(sums[0]) / rhsNorm;
+        stats.residualHistory.push_back(residual);
+        if (residual <= this->tolerance)
+        {
+            stats.converged = true;
+            break;
+        }
+        double beta = sums[1] / rz;
+        rz = sums[1];
+        parallelFor(this->pool, 0, rows, [&](int r0, int r1) {
+            for (int row = r0; row < r1; ++row)
+            {
+                this->d[row] = this->z[row] + beta*this->d[row];
+            }
+        });
+    }
+
+    // prolong: leaf value plus the face-averaged gradient times the offset from the leaf centre
+    const std::vector<QuadtreeFace>& faces = this->tree.getFaces();
+    std::vector<std::array<double, 4>> slopes(leafCount, std::array<double, 4>{});   // sum gx, len x, sum gy, len y
+    for (const QuadtreeFace& face : faces)
+    {
+        double difference = (this->x[this->leafRow[face.b]] - this->x[this->leafRow[face.a]]) / face.distance;
+        for (int leaf : {face.a, face.b})
+        {
+            slopes[leaf][2*face.axis] += face.length*difference;
+            slopes[leaf][2*face.axis + 1] += face.length;
+        }
+    }
+    parallelFor(this->pool, 0, leafCount, [&](int l0, int l1) {
+        for (int l = l0; l < l1; ++l)
+        {
+            const QuadtreeLeaf& leaf = leaves[l];
+            int row = this->leafRow[l];
+            double value = row >= 0 ? this->x[row] : 0.0;
+            double gx = slopes[l][1] > 0.0 ? slopes[l][0] / slopes[l][1] : 0.0;
+            double gy = slopes[l][3] > 0.0 ? slopes[l][2] / slopes[l][3] : 0.0;
+            double centre = 0.5*(leaf.size - 1);
+            for (int j = leaf.j0; j < leaf.j0 + leaf.size; ++j)
+            {
+                float* pr = p.row(j);
+                for (int i = leaf.i0; i < leaf.i0 + leaf.size; ++i)
+                {
+                    double cell = value + gx*(i - leaf.i0 - centre) + gy*(j - leaf.j0 - centre);
+                    pr[i] = obstacle.at(i, j) > 0.5f ? 0.0f : static_cast<float>(cell);
+                }
+            }
+        }
+    });
+    return stats;
+}
@@ -0,0 +1,142 @@
+#ifndef QUADTREE_HPP
+#define QUADTREE_HPP
+
+#include "fluidgrid.hpp"
+#include "pressuresolver.hpp"
+#include <functional>
+#include <vector>
+
+class ThreadPool;
+
+struct QuadtreeLeaf
+{
+    int i0{0};           // lower-left cell of the FluidGrid
+    int j0{0};
+    int size{1};         // side in cells, a power of two
+    bool solid{false};   // every cell of the leaf is solid
+};
+
+// Edge shared by two leaves; b lies to the right of (axis 0) or above (axis 1) a.
+struct QuadtreeFace
+{
+    int a{0};
+    int b{0};
+    int axis{0};
+    float length{0.0f};     // shared edge, in cells
+    float distance{0.0f};   // between the leaf centres along the axis
+
+    float getWeight() const { return this->length / this->distance; }
+};
+
+struct QuadtreeCriteria
+{
+    // leaf sides in cells, powers of two
+    int minLeafSize{1};
+    int maxLeafSize{16};
+    // a leaf is split while max |curl u| * size or max |grad density| * size
+    // over its cells exceeds these, i.e. while the velocity or density changes
+    // by more than that across it
+    float vorticityThreshold{0.05f};
+    float gradientThreshold{0.05f};
+    // leaves holding both solid and fluid cells go down to minLeafSize
+    bool refineObstacles{true};
+};
+
+// Adaptive quadtree over the cells of a FluidGrid. The domain is tiled with
+// roots of maxLeafSize cells, each refined by halving down to minLeafSize;
+// nodes reaching past the domain edge are always split, so every leaf lies
+// inside. Nodes are kept in one flat array with the four children of a node
+// stored next to each other.
+//
+// After refinement the tree is 2:1 balanced: leaves sharing an edge differ at
+// most by a factor of two in size, so every edge of a leaf meets one larger,
+// one equal or two smaller neighbours.
+class QuadtreeGrid
+{
+public:
+    // throws std::invalid_argument for an empty domain
+    QuadtreeGrid(int nx, int ny);
+
+    // refines on the vorticity, density gradient and obstacles of `grid`;
+    // throws std::invalid_argument for sizes that are not powers of two or a grid of another shape
+    void build(const FluidGrid& grid, const QuadtreeCriteria& criteria);
+    // every leaf `leafSize` cells where the domain allows
+    void buildUniform(int leafSize, const ScalarField* obstacle = nullptr);
+
+    int getNx() const { return this->nx; }
+    int getNy() const { return this->ny; }
+    const std::vector<QuadtreeLeaf>& getLeaves() const { return this->leaves; }
+    const std::vector<QuadtreeFace>& getFaces() const { return this->faces; }
+    int getLeafCount() const { return static_cast<int>(this->leaves.size()); }
+    // leaf holding cell (i, j) of the domain
+    int leafAt(int i, int j) const { return this->cellLeaf[static_cast<std::size_t>(j)*this->nx + i]; }
+    // true when every pair of leaves sharing an edge differs at most by a factor of two
+    bool isBalanced() const;
+
+private:
+    struct Node
+    {
+        int i0{0};
+        int j0{0};
+        int size{1};
+        int firstChild{-1};
+        bool outside{false};
+    };
+
+    // shouldSplit(i0, j0, size) decides every node larger than minLeafSize
+    void refine(int minLeafSize, int maxLeafSize, const std::function<bool(int, int, int)>& shouldSplit);
+    void split(int node);
+    void balance();
+    void collectLeaves();
+    void buildFaces(const ScalarField* obstacle);
+
+    int nx{0};
+    int ny{0};
+    int rootCount{0};               // the roots are nodes [0, rootCount)
+    std::vector<Node> nodes;
+    std::vector<int> leafNodes;     // node of every leaf
+    std::vector<QuadtreeLeaf> leaves;
+    std::vector<int> cellLeaf;
+    std::vector<QuadtreeFace> faces;
+};
+
+// Pressure solve on the leaves of a QuadtreeGrid that is re-adapted to the
+// flow before every projection (adaptTo). For every fluid leaf
+//     sum over fluid face neighbours w_f (p_leaf - p_nb) = b_leaf
+// with w_f the shared edge over the centre distance and b_leaf the sum of the
+// cell right-hand sides in the leaf. Where all leaves are single cells this is
+// exactly the 5-point system of PressureSolver. The leaf system is solved with
+// Jacobi-preconditioned CG, and each leaf's cells get its pressure plus a
+// linear term from the gradient to its face neighbours.
+class QuadtreePressureSolver : public PressureSolver
+{
+public:
+    explicit QuadtreePressureSolver(ThreadPool* pool = nullptr);
+
+    void setCriteria(const QuadtreeCriteria& criteria) { this->criteria = criteria; }
+    const QuadtreeCriteria& getCriteria() const { return this->criteria; }
+    const QuadtreeGrid& getTree() const { return this->tree; }
+
+    void adaptTo(const FluidGrid& grid) override;
+    // without a tree of the right shape, solves on single-cell leaves
+    PressureSolveStats solve(ScalarField& p, const ScalarField& rhs, const ScalarField& obstacle) override;
+
+private:
+    void assemble();
+    void applyOperator(const std::vector<double>& in, std::vector<double>& out);
+
+    ThreadPool* pool{nullptr};
+    QuadtreeCriteria criteria;
+    QuadtreeGrid tree{1, 1};
+    bool assembled{false};
+    std::vector<int> leafRow;        // row of every fluid leaf, -1 for solid ones
+
+    // leaf operator in compressed rows, solid leaves left out
+    std::vector<int> rowStart;
+    std::vector<int> columns;
+    std::vector<double> weights;
+    std::vector<double> diagonal;
+    std::vector<double> x, r, z, d, q;
+};
+
+#endif // QUADTREE_HPP
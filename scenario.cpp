@@ -0,0 +1,339 @@
+#include "scenario.hpp"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+std::string trim(const std::string& text)
+{
+    std::size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string::npos)
+    {
+        return std::string();
+    }
+    std::size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+[[noreturn]] void fail(int line, const std::string& message)
+{
+    throw std::invalid_argument("Scenario: line " + std::to_string(line) + ": " + message);
+}
+
+// reads exactly the values the key expects; anything left over is an error
+template <typename... Values>
+void readValues(std::istringstream& in, int line, const std::string& key, Values&... values)
+{
+    bool ok = static_cast<bool>((in >> ... >> values));
+    std::string extra;
+    if (!ok || (in >> extra))
+    {
+        fail(line, "malformed value for '" + key + "'");
+    }
+}
+
+ScenarioRegion readRegion(std::istringstream& in, int line, const std::string& key)
+{
+    ScenarioRegion region;
+    bool ok = static_cast<bool>(in >> region.i0 >> region.j0 >> region.i1 >> region.j1);
+    if (!ok || region.i1 < region.i0 || region.j1 < region.j0)
+    {
+        fail(line, "'" + key + "' needs i0 j0 i1 j1 with i0 <= i1 and j0 <= j1");
+    }
+    return region;
+}
+
+template <typename Visit>
+void forEachCell(const ScenarioRegion& region, int nx, int ny, Visit visit)
+{
+    int i0 = std::max(region.i0, 0);
+    int j0 = std::max(region.j0, 0);
+    int i1 = std::min(region.i1, nx);
+    int j1 = std::min(region.j1, ny);
+    for (int j = j0; j < j1; ++j)
+    {
+        for (int i = i0; i < i1; ++i)
+        {
+            visit(i, j);
+        }
+    }
+}
+}
+
+//--------------------------------NAMES--------------------------------------------
+const char* pressureSolverName(PressureSolverKind kind)
+{
+    switch (kind)
+    {
+    case PressureSolverKind::Jacobi:
+        return "jacobi";
+    case PressureSolverKind::Multigrid:
+        return "multigrid";
+    case PressureSolverKind::ConjugateGradient:
+        return "pcg";
+    case PressureSolverKind::PipelinedConjugateGradient:
+        return "pipelined-pcg";
+    case PressureSolverKind::Spectral:
+        return "spectral";
+    case PressureSolverKind::Quadtree:
+        return "quadtree";
+    }
+    return "unknown";
+}
+
+bool parsePressureSolverKind(const std::string& name, PressureSolverKind& kind)
+{
+    for (PressureSolverKind candidate : {PressureSolverKind::Jacobi, PressureSolverKind::Multigrid,
+                                         PressureSolverKind::ConjugateGradient,
+                                         PressureSolverKind::PipelinedConjugateGradient, PressureSolverKind::Spectral,
+                                         PressureSolverKind::Quadtree})
+    {
+        if (name == pressureSolverName(candidate))
+        {
+            kind = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* fluidFieldName(FluidField field)
+{
+    switch (field)
+    {
+    case FluidField::VelocityU:
+        return "u";
+    case FluidField::VelocityV:
+        return "v";
+    case FluidField::Pressure:
+        return "pressure";
+    case FluidField::Density:
+        return "density";
+    case FluidField::Temperature:
+        return "temperature";
+    case FluidField::Obstacle:
+        return "obstacle";
+    case FluidField::Count:
+        break;
+    }
+    return "unknown";
+}
+
+bool parseFluidField(const std::string& name, FluidField& field)
+{
+    for (int f = 0; f < FluidGrid::NumFields; ++f)
+    {
+        if (name == fluidFieldName(static_cast<FluidField>(f)))
+        {
+            field = static_cast<FluidField>(f);
+            return true;
+        }
+    }
+    return false;
+}
+
+//--------------------------------PARSER-------------------------------------------
+Scenario parseScenario(std::istream& in)
+{
+    Scenario scenario;
+    std::string text;
+    int line = 0;
+    while (std::getline(in, text))
+    {
+        ++line;
+        text = trim(text.substr(0, text.find('#')));
+        if (text.empty())
+        {
+            continue;
+        }
+        std::size_t equals = text.find('=');
+        if (equals == std::string::npos)
+        {
+            fail(line, "expected 'key = value'");
+        }
+        std::string key = trim(text.substr(0, equals));
+        std::istringstream value(text.substr(equals + 1));
+        FluidParameters& params = scenario.parameters;
+
+        if (key == "grid")
+        {
+            readValues(value, line, key, scenario.nx, scenario.ny);
+            if (scenario.nx < 2 || scenario.ny < 2)
+            {
+                fail(line, "grid must be at least 2x2");
+            }
+        }
+        else if (key == "steps")
+        {
+            readValues(value, line, key, scenario.steps);
+            if (scenario.steps < 0)
+            {
+                fail(line, "steps must not be negative");
+            }
+        }
+        else if (key == "threads")
+        {
+            readValues(value, line, key, scenario.threads);
+            if (scenario.threads < 0)
+            {
+                fail(line, "threads must not be negative");
+            }
+        }
+        else if (key == "solver")
+        {
+            std::string name;
+            readValues(value, line, key, name);
+            if (!parsePressureSolverKind(name, scenario.pressureSolver))
+            {
+                fail(line, "unknown solver '" + name + "'");
+            }
+        }
+        else if (key == "dt")
+        {
+            readValues(value, line, key, params.timeStep);
+        }
+        else if (key == "viscosity")
+        {
+            readValues(value, line, key, params.viscosity);
+        }
+        else if (key == "diffusion")
+        {
+            readValues(value, line, key, params.diffusion);
+        }
+        else if (key == "buoyancy")
+        {
+            readValues(value, line, key, params.buoyancy);
+        }
+        else if (key == "diffusion_iterations")
+        {
+            readValues(value, line, key, params.diffusionIterations);
+        }
+        else if (key == "snapshot_every")
+        {
+            readValues(value, line, key, scenario.snapshotInterval);
+            if (scenario.snapshotInterval < 0)
+            {
+                fail(line, "snapshot_every must not be negative");
+            }
+        }
+        else if (key == "snapshot_fields")
+        {
+            scenario.snapshotFields.clear();
+            std::string name;
+            while (value >> name)
+            {
+                FluidField field;
+                if (!parseFluidField(name, field))
+                {
+                    fail(line, "unknown field '" + name + "'");
+                }
+                scenario.snapshotFields.push_back(field);
+            }
+        }
+        else if (key == "snapshot_format")
+        {
+            std::string name;
+            readValues(value, line, key, name);
+            if (name == "pfm")
+            {
+                scenario.snapshotFormat = SnapshotFormat::Pfm;
+            }
+            else if (name == "pgm")
+            {
+                scenario.snapshotFormat = SnapshotFormat::Pgm;
+            }
+            else
+            {
+                fail(line, "unknown snapshot format '" + name + "'");
+            }
+        }
+        else if (key == "snapshot_range")
+        {
+            readValues(value, line, key, scenario.snapshotMin, scenario.snapshotMax);
+        }
+        else if (key == "output")
+        {
+            scenario.outputDirectory = trim(value.str());
+            if (scenario.outputDirectory.empty())
+            {
+                fail(line, "output needs a directory");
+            }
+        }
+        else if (key == "source")
+        {
+            ScenarioSource source;
+            std::string name;
+            if (!(value >> name) || !parseFluidField(name, source.field) ||
+                source.field == FluidField::Pressure || source.field == FluidField::Obstacle)
+            {
+                fail(line, "source field must be density, temperature, u or v");
+            }
+            source.region = readRegion(value, line, key);
+            readValues(value, line, key, source.value);
+            scenario.sources.push_back(source);
+        }
+        else if (key == "obstacle")
+        {
+            ScenarioRegion region = readRegion(value, line, key);
+            std::string extra;
+            if (value >> extra)
+            {
+                fail(line, "malformed value for 'obstacle'");
+            }
+            scenario.obstacles.push_back(region);
+        }
+        else
+        {
+            fail(line, "unknown key '" + key + "'");
+        }
+    }
+    return scenario;
+}
+
+Scenario loadScenario(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        throw std::invalid_argument("Scenario: cannot open '" + path + "'");
+    }
+    return parseScenario(file);
+}
+
+//--------------------------------SETUP--------------------------------------------
+void applyScenarioObstacles(const Scenario& scenario, FluidGrid& grid)
+{
+    for (const ScenarioRegion& region : scenario.obstacles)
+    {
+        forEachCell(region, grid.getNx(), grid.getNy(), [&](int i, int j) { grid.setSolid(i, j, true); });
+    }
+}
+
+void applyScenarioSources(const Scenario& scenario, FluidSolver& solver)
+{
+    for (const ScenarioSource& source : scenario.sources)
+    {
+        ScalarField* target = nullptr;
+        switch (source.field)
+        {
+        case FluidField::Density:
+            target = &solver.densitySource();
+            break;
+        case FluidField::Temperature:
+            target = &solver.temperatureSource();
+            break;
+        case FluidField::VelocityU:
+            target = &solver.uSource();
+            break;
+        case FluidField::VelocityV:
+            target = &solver.vSource();
+            break;
+        default:
+            continue;
+        }
+        forEachCell(source.region, target->getNx(), target->getNy(),
+                    [&](int i, int j) { target->at(i, j) = source.value; });
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef SCENARIO_HPP
+#define SCENARIO_HPP
+
+#include "fluidgrid.hpp"
+#include "fluidsolver.hpp"
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// A batch run described by a plain text file, one `key = value` per line and
+// `#` starting a comment:
+//
+//   grid = 256 256
+//   steps = 2000
+//   threads = 8                 # 0 picks the hardware thread count
+//   solver = multigrid          # jacobi, multigrid, pcg, pipelined-pcg, spectral, quadtree
+//   dt = 0.1
+//   viscosity = 0
+//   diffusion = 0
+//   buoyancy = 2
+//   diffusion_iterations = 20
+//   snapshot_every = 100        # 0 writes only the final step
+//   snapshot_fields = density pressure
+//   snapshot_format = pfm       # pfm (float) or pgm (8 bit, see snapshot_range)
+//   snapshot_range = 0 1
+//   output = runs/plume
+//   source = density 124 4 132 8 10      # field i0 j0 i1 j1 value, every step
+//   obstacle = 96 120 160 128            # i0 j0 i1 j1, solid at startup
+//
+// Rectangles are half-open cell ranges [i0, i1) x [j0, j1), clipped to the grid.
+
+enum class SnapshotFormat
+{
+    Pfm,    // portable float map, exact values
+    Pgm     // 8-bit greyscale over a fixed range
+};
+
+struct ScenarioRegion
+{
+    int i0{0};
+    int j0{0};
+    int i1{0};
+    int j1{0};
+};
+
+struct ScenarioSource
+{
+    FluidField field{FluidField::Density};   // Density, Temperature, VelocityU or VelocityV
+    ScenarioRegion region;
+    float value{0.0f};
+};
+
+struct Scenario
+{
+    int nx{128};
+    int ny{128};
+    int steps{100};
+    int threads{0};
+    PressureSolverKind pressureSolver{PressureSolverKind::Multigrid};
+    FluidParameters parameters;
+
+    int snapshotInterval{0};
+    std::vector<FluidField> snapshotFields{FluidField::Density};
+    SnapshotFormat snapshotFormat{SnapshotFormat::Pfm};
+    float snapshotMin{0.0f};
+    float snapshotMax{1.0f};
+    std::string outputDirectory{"."};
+
+    std::vector<ScenarioSource> sources;
+    std::vector<ScenarioRegion> obstacles;
+};
+
+// throw std::invalid_argument naming the offending line
+Scenario parseScenario(std::istream& in);
+Scenario loadScenario(const std::string& path);
+
+// names used by the scenario format; the parse functions return false for unknown names
+const char* pressureSolverName(PressureSolverKind kind);
+bool parsePressureSolverKind(const std::string& name, PressureSolverKind& kind);
+const char* fluidFieldName(FluidField field);
+bool parseFluidField(const std::string& name, FluidField& field);
+
+// marks the obstacles solid; call once on a fresh grid
+void applyScenarioObstacles(const Scenario& scenario, FluidGrid& grid);
+// writes the sources into the solver's source fields; call before every step
+void applyScenarioSources(const Scenario& scenario, FluidSolver& solver);
+
+#endif // SCENARIO_HPP
@@ -1,4 +1,7 @@
 #include "sceneview.hpp"
+#include "fluidgrid.hpp"
+#include "gridgeometry.hpp"
+#include "profiler.hpp"
 #include <QFile>
 #include <QDebug>
 #include <string>
@@ -49,7 +52,7 @@ QImage SceneView::read_texture_from_resource_file(QString filepath)
 //----------------------------VERTEX SHADER INIT------------------------------
 void SceneView::initVertexShader(){
 
-    vertexShaderCode = read_shader_code_from_resource_file(":/shaders/pass_through.vert");
+    vertexShaderCode = insertProceduralQuadCorners(read_shader_code_from_resource_file(":/shaders/pass_through.vert"));
     vertexShader = glCreateShader(GL_VERTEX_SHADER);
     const char* vertexShaderString = vertexShaderCode.c_str();
     glShaderSource(vertexShader, 1, &vertexShaderString, NULL);
@@ -151,38 +154,12 @@ int SceneView::calcNumTriangleCorners()
 
 void SceneView::populateVerticeArray()
 {
-    for (int i = 0; i <= (this->GridSize); ++i)
-    {
-        for (int j = 0; j <= (this->GridSize); ++j)
-        {
-            this->vertices.push_back(i);
-            this->vertices.push_back(j);
-            this->vertices.push_back(0.0f);
-        }
-    }
+    this->vertices = buildGridVertices(this->GridSize);
 }
 
 void SceneView::populateIndices()
 {
-    int n = this->GridSize;
-    for (int i = 0; i < n; ++i)
-    {
-        for (int j = 0; j < n; ++j)
-        {
-            int BL = i*(n+1) + j;
-            int TL = BL + 1;
-            int BR = BL + n + 1;
-            int TR = BR + 1;
-
-            this->indices.push_back(BL);
-            this->indices.push_back(TL);
-            this->indices.push_back(BR);
-            //
-            this->indices.push_back(TL);
-            this->indices.push_back(TR);
-            this->indices.push_back(BR);
-        }
-    }
+    this->indices = buildGridIndices(this->GridSize);
 }
 
 //--------------------------------COLOR STUFF------------------------------------
@@ -240,28 +217,191 @@ void SceneView::populateColors()
 
 }
 
-//------------------------------INITIALIZE GL--------------------------------------
-void SceneView::initializeGL()
-{   
-    initializeOpenGLFunctions();
-    printContextInformation();
+//------------------------------RENDER SETTINGS------------------------------------
+void SceneView::setRenderMode(RenderMode mode)
+{
+    this->renderMode = mode;
+    this->geometryDirty = true;
+    update();
+}
 
-    initVertexShader();
-    initFragmentShader();
-    linkShaders();
+void SceneView::setGeometryMode(GeometryMode mode)
+{
+    this->geometryMode = mode;
+    this->geometryDirty = true;
+    update();
+}
 
-    // set up vertex data (and buffer(s)) and configure vertex attributes
-    setGridSize(2);                                                                                     // VERY IMPORTANT!!!!!
+bool SceneView::useProceduralGeometry() const
+{
+    return this->geometryMode == GeometryMode::Procedural && this->renderMode == RenderMode::FieldTexture;
+}
+
+void SceneView::setField(const ScalarField* field)
+{
+    this->field = field;
+    update();
+}
+
+void SceneView::setColormap(Colormap map)
+{
+    this->colormap = map;
+    this->colormapDirty = true;
+    update();
+}
+
+void SceneView::setTextureFormat(FieldTextureFormat format)
+{
+    this->textureFormat = format;
+    update();
+}
+
+void SceneView::setFieldRange(FieldRange range)
+{
+    this->fieldRange = range;
+    this->autoRange = false;
+    update();
+}
+
+void SceneView::setAutoRange(bool enabled)
+{
+    this->autoRange = enabled;
+    update();
+}
+
+void SceneView::enableStreaming(int nx, int ny)
+{
+    this->streaming = true;
+    this->streamNx = nx;
+    this->streamNy = ny;
+}
+
+bool SceneView::publishField(const ScalarField& field)
+{
+    return this->streamer.publish(field);
+}
+
+void SceneView::publishQuadtreeLeaves(const std::vector<QuadtreeLeaf>& leaves)
+{
+    this->leafLines.writeBuffer() = buildQuadtreeLeafLines(leaves);
+    this->leafLines.publish();
+}
+
+void SceneView::uploadLeafLines()
+{
+    if (!this->leafLines.update())
+    {
+        return;
+    }
+    const std::vector<float>& lines = this->leafLines.readBuffer();
+    glBindVertexArray(LeafVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, LeafVBO);
+    glBufferData(GL_ARRAY_BUFFER, lines.size()*sizeof(float), lines.data(), GL_DYNAMIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    // one constant colour for every line
+    glDisableVertexAttribArray(1);
+    this->leafVertexCount = static_cast<int>(lines.size() / 3);
+}
+
+//------------------------------FIELD TEXTURES-------------------------------------
+void SceneView::initFieldTextures()
+{
+    glGenTextures(1, &fieldTexture);
+    glBindTexture(GL_TEXTURE_2D, fieldTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenTextures(1, &lutTexture);
+    glBindTexture(GL_TEXTURE_2D, lutTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    this->colormapDirty = true;
+}
+
+void SceneView::uploadColormap()
+{
+    // the LUT only changes with the colormap, never per frame
+    std::vector<float> lut = buildColormapLut(this->colormap);
+    glBindTexture(GL_TEXTURE_2D, lutTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, static_cast<int>(lut.size() / 4), 1, 0, GL_RGBA, GL_FLOAT, lut.data());
+    this->colormapDirty = false;
+}
+
+void SceneView::allocateFieldTexture(int nx, int ny, FieldTextureFormat format)
+{
+    glBindTexture(GL_TEXTURE_2D, fieldTexture);
+    // storage is allocated once per size/format; every frame only replaces the texels
+    if (nx != textureWidth || ny != textureHeight || format != allocatedFormat)
+    {
+        GLenum internalFormat = (format == FieldTextureFormat::R16F) ? GL_R16F : GL_R32F;
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, nx, ny, 0, GL_RED, GL_FLOAT, nullptr);
+        textureWidth = nx;
+        textureHeight = ny;
+        allocatedFormat = format;
+    }
+}
+
+void SceneView::uploadField()
+{
+    if (this->streaming)
+    {
+        // streamed frames are always R32F; without a new frame the texture keeps the last one
+        allocateFieldTexture(this->streamNx, this->streamNy, FieldTextureFormat::R32F);
+        this->streamer.uploadLatest(fieldTexture, this->streamedRange);
+        return;
+    }
+
+    const ScalarField& values = *this->field;
+    int nx = values.getNx();
+    int ny = values.getNy();
+    allocateFieldTexture(nx, ny, this->textureFormat);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (this->textureFormat == FieldTextureFormat::R16F)
+    {
+        packFieldAsHalf(values, this->halfStaging);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, nx, ny, GL_RED, GL_HALF_FLOAT, this->halfStaging.data());
+    }
+    else
+    {
+        // the rows are read in place; the row length skips the ghost and padding columns
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, values.getStride());
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, nx, ny, GL_RED, GL_FLOAT, values.row(0));
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+//------------------------------GEOMETRY UPLOAD------------------------------------
+void SceneView::uploadGeometry()
+{
+    this->vertices.clear();
+    this->indices.clear();
+    this->colors.clear();
+    if (useProceduralGeometry())
+    {
+        // release whatever the buffer path left behind; startup cost no longer depends on n
+        this->vertices.shrink_to_fit();
+        this->indices.shrink_to_fit();
+        this->colors.shrink_to_fit();
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, 0, nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, ColorVBO);
+        glBufferData(GL_ARRAY_BUFFER, 0, nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, 0, nullptr, GL_STATIC_DRAW);
+        this->geometryDirty = false;
+        return;
+    }
     populateVerticeArray();
-    populateColors();
     populateIndices();
 
-    // generate arrays and buffers
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &ColorVBO);
-    glGenBuffers(1, &EBO);
-
     // bind array before doing anything else
     glBindVertexArray(VAO);
 
@@ -272,24 +412,78 @@ void SceneView::initializeGL()
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
 
-    // setup vertex buffer for COLORS
-    glBindBuffer(GL_ARRAY_BUFFER, ColorVBO);
-    glBufferData(GL_ARRAY_BUFFER, this->colors.size()*sizeof(float), this->colors.data(), GL_DYNAMIC_DRAW);
-    // send color array to the vertex shader
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, (void*)0);
-    glEnableVertexAttribArray(1);
+    if (this->renderMode == RenderMode::VertexColors)
+    {
+        populateColors();
+        // setup vertex buffer for COLORS
+        glBindBuffer(GL_ARRAY_BUFFER, ColorVBO);
+        glBufferData(GL_ARRAY_BUFFER, this->colors.size()*sizeof(float), this->colors.data(), GL_DYNAMIC_DRAW);
+        // send color array to the vertex shader
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, (void*)0);
+        glEnableVertexAttribArray(1);
+    }
+    else
+    {
+        // colours come from the field texture; no per-vertex colour stream at all
+        glDisableVertexAttribArray(1);
+    }
 
     // setup Element Buffer Object
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size()*sizeof(float), this->indices.data(), GL_STATIC_DRAW);
+    this->geometryDirty = false;
+}
+
+//------------------------------INITIALIZE GL--------------------------------------
+void SceneView::initializeGL()
+{   
+    initializeOpenGLFunctions();
+    printContextInformation();
+
+    initVertexShader();
+    initFragmentShader();
+    linkShaders();
+
+    // set up vertex data (and buffer(s)) and configure vertex attributes
+    setGridSize(this->streaming ? this->streamNx : (this->field ? this->field->getNx() : 2));           // VERY IMPORTANT!!!!!
+
+    // generate arrays and buffers
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &ColorVBO);
+    glGenBuffers(1, &EBO);
+    glGenVertexArrays(1, &ProceduralVAO);
+    glGenVertexArrays(1, &LeafVAO);
+    glGenBuffers(1, &LeafVBO);
+
+    uploadGeometry();
+    initFieldTextures();
+    if (this->streaming)
+    {
+        this->streamer.initialize(this, this->streamNx, this->streamNy);
+        qDebug() << "field streaming:" << (this->streamer.isPersistent() ? "persistent-mapped" : "orphaned") << "buffers";
+    }
 }
 
 //-------------------------------PAINT GL-------------------------------------------
 void SceneView::paintGL()
 {
+    SIMFLUID_PROFILE_ZONE("paintGL");
     glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
 
+    bool drawField = (this->renderMode == RenderMode::FieldTexture) && (this->field || this->streaming);
+    int fieldSize = this->streaming ? this->streamNx : (this->field ? this->field->getNx() : 0);
+    if (drawField && fieldSize != this->GridSize)
+    {
+        setGridSize(fieldSize);
+        this->geometryDirty = true;
+    }
+    if (this->geometryDirty)
+    {
+        SIMFLUID_PROFILE_ZONE("paintGL: geometry upload");
+        uploadGeometry();
+    }
 
     // transform stuff
     glm::mat4 trans = glm::mat4(1.0f);
@@ -302,10 +496,60 @@ void SceneView::paintGL()
     // tie the uniform variable 'trans' to the vertex shader
     unsigned int transformLoc = glGetUniformLocation(shaderProgram, "transform");
     glUniformMatrix4fv(transformLoc, 1, GL_FALSE, glm::value_ptr(trans));
+    glUniform1f(glGetUniformLocation(shaderProgram, "gridExtent"), static_cast<float>(this->GridSize));
+    glUniform1i(glGetUniformLocation(shaderProgram, "renderMode"), drawField ? 1 : 0);
+    glUniform1i(glGetUniformLocation(shaderProgram, "proceduralQuad"), useProceduralGeometry() ? 1 : 0);
+
+    if (drawField)
+    {
+        if (this->colormapDirty)
+        {
+            SIMFLUID_PROFILE_ZONE("paintGL: colormap upload");
+            uploadColormap();
+        }
+        // one single-channel upload per frame; colormapping happens in simple.frag
+        glActiveTexture(GL_TEXTURE0);
+        {
+            SIMFLUID_PROFILE_ZONE("paintGL: field upload");
+            uploadField();
+        }
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, lutTexture);
+        glActiveTexture(GL_TEXTURE0);
+
+        FieldRange range = this->fieldRange;
+        if (this->autoRange)
+        {
+            range = this->streaming ? this->streamedRange : computeFieldRange(*this->field);
+        }
+        glUniform1i(glGetUniformLocation(shaderProgram, "fieldTexture"), 0);
+        glUniform1i(glGetUniformLocation(shaderProgram, "colormapLut"), 1);
+        glUniform2f(glGetUniformLocation(shaderProgram, "fieldRange"), range.min, range.max);
+    }
 
-    glBindVertexArray(VAO);
     // finally, draw the triangles
-    glDrawElements(GL_TRIANGLES, calcNumTriangleCorners(), GL_UNSIGNED_INT, 0);
+    SIMFLUID_PROFILE_ZONE("paintGL: draw");
+    if (useProceduralGeometry())
+    {
+        glBindVertexArray(ProceduralVAO);
+        glDrawArrays(GL_TRIANGLES, 0, ProceduralQuadVertexCount);
+    }
+    else
+    {
+        glBindVertexArray(VAO);
+        glDrawElements(GL_TRIANGLES, calcNumTriangleCorners(), GL_UNSIGNED_INT, 0);
+    }
+
+    // quadtree leaves on top, flat-coloured lines through the vertex-colour path
+    uploadLeafLines();
+    if (this->leafVertexCount > 0)
+    {
+        glUniform1i(glGetUniformLocation(shaderProgram, "renderMode"), 0);
+        glUniform1i(glGetUniformLocation(shaderProgram, "proceduralQuad"), 0);
+        glBindVertexArray(LeafVAO);
+        glVertexAttrib4f(1, 0.3f, 0.9f, 0.9f, 0.6f);
+        glDrawArrays(GL_LINES, 0, this->leafVertexCount);
+    }
     //glBindVertexArray(0);
 }
 
@@ -316,6 +560,18 @@ void SceneView::resizeGL(int width, int height)
 void SceneView::teardownGL()
 {
   makeCurrent();
+  this->streamer.destroy();
+  if (fieldTexture)
+  {
+    glDeleteTextures(1, &fieldTexture);
+    glDeleteTextures(1, &lutTexture);
+  }
+  if (LeafVAO)
+  {
+    glDeleteBuffers(1, &LeafVBO);
+    glDeleteVertexArrays(1, &LeafVAO);
+  }
+  doneCurrent();
 }
 
 void SceneView::printContextInformation()
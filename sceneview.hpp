@@ -3,7 +3,15 @@
 
 #include <QOpenGLWidget>
 #include <QOpenGLExtraFunctions>
+#include "fieldimage.hpp"
+#include "fieldstreamer.hpp"
+#include "quadtree.hpp"
+#include "triplebuffer.hpp"
+#include <cstdint>
 #include <string>
+#include <vector>
+
+class ScalarField;
 
 class SceneView : public QOpenGLWidget, protected QOpenGLExtraFunctions
 {
@@ -12,6 +20,37 @@ public:
     SceneView(QWidget* parent=nullptr);
     ~SceneView();
 
+    enum class RenderMode
+    {
+        VertexColors,   // per-vertex RGBA from the colors array
+        FieldTexture    // raw field uploaded as a texture, colormapped in simple.frag
+    };
+
+    enum class GeometryMode
+    {
+        IndexedBuffers,   // (n+1)^2 vertices and 6n^2 indices built on the CPU
+        Procedural        // one quad expanded from gl_VertexID, no vertex or index buffers
+    };
+
+    void setRenderMode(RenderMode mode);
+    // Procedural only applies to FieldTexture; vertex colours need the buffers
+    void setGeometryMode(GeometryMode mode);
+    // field drawn in FieldTexture mode; owned by the caller and read in paintGL
+    void setField(const ScalarField* field);
+    void setColormap(Colormap map);
+    void setTextureFormat(FieldTextureFormat format);
+    // a fixed value range turns auto-ranging off; setAutoRange(true) turns it back on
+    void setFieldRange(FieldRange range);
+    void setAutoRange(bool enabled);
+    // Draws frames handed over with publishField() instead of reading a field
+    // in paintGL. Call before the widget is first shown; the size is fixed.
+    void enableStreaming(int nx, int ny);
+    // callable from the simulation thread; false when the frame was dropped
+    bool publishField(const ScalarField& field);
+    // outlines drawn over the field; callable from one thread (the simulation
+    // thread), never waits on the renderer; an empty vector removes them
+    void publishQuadtreeLeaves(const std::vector<QuadtreeLeaf>& leaves);
+
 protected:
     void initializeGL() override;
     void paintGL() override;
@@ -33,6 +72,8 @@ private:
     void populateVerticeArray();
     void populateIndices();
     void populateColors();
+    void uploadGeometry();
+    bool useProceduralGeometry() const;
     //
     int getRedIndexAtPoint(int x, int y);
     int getGreenIndexAtPoint(int x, int y);
@@ -59,6 +100,45 @@ private:
     unsigned int ColorVBO{0};
     unsigned int VAO{0};
     unsigned int EBO{0};
+    unsigned int ProceduralVAO{0};   // empty; core profile still needs one bound to draw
+
+    //--------------field texture path------------------
+    void initFieldTextures();
+    void uploadField();
+    void uploadColormap();
+    void allocateFieldTexture(int nx, int ny, FieldTextureFormat format);
+
+    RenderMode renderMode{RenderMode::FieldTexture};
+    GeometryMode geometryMode{GeometryMode::Procedural};
+    const ScalarField* field{nullptr};
+    Colormap colormap{Colormap::Inferno};
+    bool colormapDirty{true};
+    bool geometryDirty{true};
+    FieldTextureFormat textureFormat{FieldTextureFormat::R32F};
+    FieldRange fieldRange;
+    bool autoRange{true};
+    std::vector<std::uint16_t> halfStaging;
+
+    unsigned int fieldTexture{0};
+    unsigned int lutTexture{0};
+    int textureWidth{0};
+    int textureHeight{0};
+    FieldTextureFormat allocatedFormat{FieldTextureFormat::R32F};
+
+    //--------------streamed uploads------------------
+    FieldStreamer streamer;
+    bool streaming{false};
+    int streamNx{0};
+    int streamNy{0};
+    FieldRange streamedRange;   // range of the frame currently in the texture
+
+    //--------------quadtree overlay------------------
+    void uploadLeafLines();
+
+    TripleBuffer<std::vector<float>> leafLines;   // line vertices, x y z per vertex
+    unsigned int LeafVAO{0};
+    unsigned int LeafVBO{0};
+    int leafVertexCount{0};
 
     QImage read_texture_from_resource_file(QString filepath);
     void printContextInformation();
@@ -7,10 +7,24 @@ layout (location = 0) in vec3 position;
 layout (location = 1) in vec4 inColor;
 
 out vec4 fragColor;
+out vec2 fieldCoord;
 
 uniform mat4 transform;
+uniform float gridExtent;   // cells per side; maps grid positions to [0, 1] texture space
+uniform int proceduralQuad; // 1: no vertex buffers, gl_VertexID 0..5 spans the whole grid
+
+// two triangles (BL, TL, BR), (TL, TR, BR), same winding as the index buffer;
+// SceneView replaces the next line with the table from gridgeometry.cpp
+// @quadCorners
 
 void main() {
-  gl_Position = transform * vec4(position, 1.0f);
-  fragColor = inColor;
+  vec3 gridPosition = position;
+  vec4 color = inColor;
+  if (proceduralQuad == 1) {
+    gridPosition = vec3(quadCorners[gl_VertexID] * gridExtent, 0.0);
+    color = vec4(1.0);
+  }
+  gl_Position = transform * vec4(gridPosition, 1.0f);
+  fragColor = color;
+  fieldCoord = gridPosition.xy / gridExtent;
 }
@@ -1,8 +1,21 @@
 #version 330 core
 
 in vec4 fragColor;
+in vec2 fieldCoord;
 out vec4 finalColor;  // output: final color value as rgba-value
 
+// 0: per-vertex colours, 1: scalar field texture looked up in the colormap LUT
+uniform int renderMode;
+uniform sampler2D fieldTexture;   // single channel, one texel per cell
+uniform sampler2D colormapLut;    // LUT as a 1-texel-high strip
+uniform vec2 fieldRange;          // value mapped to the start and end of the LUT
+
 void main() {
-  finalColor = fragColor;
+  if (renderMode == 1) {
+    float value = texture(fieldTexture, fieldCoord).r;
+    float t = clamp((value - fieldRange.x) / (fieldRange.y - fieldRange.x), 0.0, 1.0);
+    finalColor = texture(colormapLut, vec2(t, 0.5));
+  } else {
+    finalColor = fragColor;
+  }
 }
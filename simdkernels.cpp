@@ -0,0 +1,15 @@
+// Baseline build of the generic kernels; every other table falls back to
+// this one when its ISA is not compiled in.
+#include "simdkernels.hpp"
+
+namespace
+{
+#include "simdkernels_generic.inl"
+}
+
+const KernelTable& scalarKernelTable()
+{
+    static const KernelTable table{"scalar", &genericAdvectRow, &genericJacobiRow, &genericJacobiTile,
+                                   &genericFluidSumSquares};
+    return table;
+}
@@ -0,0 +1,88 @@
+#ifndef SIMDKERNELS_HPP
+#define SIMDKERNELS_HPP
+
+// Hot inner loops that are compiled once per ISA level. Each level lives in
+// its own translation unit built with that level's flags (see CMakeLists.txt);
+// cpudispatch.hpp picks the table to use at runtime.
+
+// One row of the collocated semi-Lagrangian backtrace used by
+// FluidSolver::advect: for every cell i in [begin, nx) of row j the departure point
+// (i - dt0*u, j - dt0*v) is clamped to [-0.5, n - 0.5] and src is sampled
+// bilinearly there. src must have at least one ghost layer.
+struct AdvectionRowArgs
+{
+    const float* src{nullptr};     // src.row(0)
+    int srcStride{0};
+    const float* u{nullptr};       // row j of the velocity and obstacle fields
+    const float* v{nullptr};
+    const float* solid{nullptr};
+    float* out{nullptr};           // row j of the destination
+    int j{0};
+    int begin{0};                  // first cell of the row to advect
+    int nx{0};                     // one past the last
+    float dt0{0.0f};               // dt / cellSize
+    float maxX{0.0f};
+    float maxY{0.0f};
+};
+
+// One row of a Jacobi sweep of the pressure system (Neumann at solids):
+// out = (b + sum of fluid neighbours) / (number of fluid neighbours).
+struct JacobiRowArgs
+{
+    const float* centre{nullptr};  // rows j, j-1, j+1 of the current iterate
+    const float* down{nullptr};
+    const float* up{nullptr};
+    const float* solid{nullptr};   // rows j, j-1, j+1 of the obstacle mask
+    const float* solidDown{nullptr};
+    const float* solidUp{nullptr};
+    const float* rhs{nullptr};
+    float* out{nullptr};
+    int nx{0};
+};
+
+// The same update over one block of a tiled field (gridlayout.hpp). The
+// block's rows are contiguous and stride apart; the rows below its first and
+// above its last row belong to the neighbouring tiles, and every row's left
+// and right neighbours sit at fixed offsets from its first cell. The cells
+// just before and after each row in memory are read (and discarded), so the
+// field needs a ghost layer.
+struct JacobiTileArgs
+{
+    const float* centre{nullptr};  // first cell of the block's first row
+    const float* solid{nullptr};
+    const float* rhs{nullptr};
+    float* out{nullptr};
+    const float* down{nullptr};    // the row below the first row and the row above the last
+    const float* up{nullptr};
+    const float* solidDown{nullptr};
+    const float* solidUp{nullptr};
+    int left{0};                   // from a row's first cell to the cell left of it
+    int right{0};                  // from a row's first cell to the cell right of its last
+    int stride{0};
+    int nx{0};
+    int rows{0};
+};
+
+using AdvectionRowKernel = void (*)(const AdvectionRowArgs& args);
+using JacobiRowKernel = void (*)(const JacobiRowArgs& args);
+using JacobiTileKernel = void (*)(const JacobiTileArgs& args);
+// sum over i < n of (1 - solid[i]) * x[i]^2, accumulated in double
+using FluidSumSquaresKernel = double (*)(const float* x, const float* solid, int n);
+
+struct KernelTable
+{
+    const char* name;
+    AdvectionRowKernel advectRow;
+    JacobiRowKernel jacobiRow;
+    JacobiTileKernel jacobiTile;
+    FluidSumSquaresKernel fluidSumSquares;
+};
+
+// Per-level tables. The non-scalar ones may only be called when the CPU
+// supports the level; off x86 they all alias the scalar table.
+const KernelTable& scalarKernelTable();
+const KernelTable& sse42KernelTable();
+const KernelTable& avx2KernelTable();
+const KernelTable& avx512KernelTable();
+
+#endif // SIMDKERNELS_HPP
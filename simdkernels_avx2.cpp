@@ -0,0 +1,72 @@
+// Compiled with AVX2 + FMA enabled (see CMakeLists.txt); only reached after a
+// runtime CPU check.
+#include "simdkernels.hpp"
+
+#ifdef SIMFLUID_X86_KERNELS
+#include <immintrin.h>
+
+namespace
+{
+#include "simdkernels_generic.inl"
+
+void advectRowAvx2(const AdvectionRowArgs& args)
+{
+    const __m256 lane = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    const __m256 lower = _mm256_set1_ps(-0.5f);
+    const __m256 upperX = _mm256_set1_ps(args.maxX);
+    const __m256 upperY = _mm256_set1_ps(args.maxY);
+    const __m256 dt0 = _mm256_set1_ps(args.dt0);
+    const __m256 row = _mm256_set1_ps(static_cast<float>(args.j));
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256i stride = _mm256_set1_epi32(args.srcStride);
+    const __m256i next = _mm256_set1_epi32(1);
+
+    int i = args.begin;
+    for (; i + 8 <= args.nx; i += 8)
+    {
+        __m256 cell = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(i)), lane);
+        __m256 x = _mm256_fnmadd_ps(dt0, _mm256_loadu_ps(args.u + i), cell);
+        __m256 y = _mm256_fnmadd_ps(dt0, _mm256_loadu_ps(args.v + i), row);
+        x = _mm256_min_ps(_mm256_max_ps(x, lower), upperX);
+        y = _mm256_min_ps(_mm256_max_ps(y, lower), upperY);
+        __m256 xFloor = _mm256_floor_ps(x);
+        __m256 yFloor = _mm256_floor_ps(y);
+        __m256 s1 = _mm256_sub_ps(x, xFloor);
+        __m256 t1 = _mm256_sub_ps(y, yFloor);
+        __m256 s0 = _mm256_sub_ps(one, s1);
+        __m256 t0 = _mm256_sub_ps(one, t1);
+
+        // floor is exact, so truncation gives the right index for -1 too
+        __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvttps_epi32(yFloor), stride),
+                                         _mm256_cvttps_epi32(xFloor));
+        __m256i indexUp = _mm256_add_epi32(index, stride);
+        __m256 a00 = _mm256_i32gather_ps(args.src, index, 4);
+        __m256 a10 = _mm256_i32gather_ps(args.src, _mm256_add_epi32(index, next), 4);
+        __m256 a01 = _mm256_i32gather_ps(args.src, indexUp, 4);
+        __m256 a11 = _mm256_i32gather_ps(args.src, _mm256_add_epi32(indexUp, next), 4);
+
+        __m256 left = _mm256_fmadd_ps(t0, a00, _mm256_mul_ps(t1, a01));
+        __m256 right = _mm256_fmadd_ps(t0, a10, _mm256_mul_ps(t1, a11));
+        __m256 value = _mm256_fmadd_ps(s0, left, _mm256_mul_ps(s1, right));
+        __m256 fluid = _mm256_sub_ps(one, _mm256_loadu_ps(args.solid + i));
+        _mm256_storeu_ps(args.out + i, _mm256_mul_ps(fluid, value));
+    }
+    genericAdvectRowRange(args, i, args.nx);
+}
+}
+
+const KernelTable& avx2KernelTable()
+{
+    static const KernelTable table{"avx2", &advectRowAvx2, &genericJacobiRow, &genericJacobiTile,
+                                   &genericFluidSumSquares};
+    return table;
+}
+
+#else
+
+const KernelTable& avx2KernelTable()
+{
+    return scalarKernelTable();
+}
+
+#endif
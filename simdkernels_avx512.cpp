@@ -0,0 +1,72 @@
+// Compiled with AVX-512F enabled (see CMakeLists.txt); only reached after a
+// runtime CPU check.
+#include "simdkernels.hpp"
+
+#ifdef SIMFLUID_X86_KERNELS
+#include <immintrin.h>
+
+namespace
+{
+#include "simdkernels_generic.inl"
+
+void advectRowAvx512(const AdvectionRowArgs& args)
+{
+    const __m512 lane = _mm512_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f,
+                                       8.0f, 9.0f, 10.0f, 11.0f, 12.0f, 13.0f, 14.0f, 15.0f);
+    const __m512 lower = _mm512_set1_ps(-0.5f);
+    const __m512 upperX = _mm512_set1_ps(args.maxX);
+    const __m512 upperY = _mm512_set1_ps(args.maxY);
+    const __m512 dt0 = _mm512_set1_ps(args.dt0);
+    const __m512 row = _mm512_set1_ps(static_cast<float>(args.j));
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512i stride = _mm512_set1_epi32(args.srcStride);
+    const __m512i next = _mm512_set1_epi32(1);
+
+    int i = args.begin;
+    for (; i + 16 <= args.nx; i += 16)
+    {
+        __m512 cell = _mm512_add_ps(_mm512_set1_ps(static_cast<float>(i)), lane);
+        __m512 x = _mm512_fnmadd_ps(dt0, _mm512_loadu_ps(args.u + i), cell);
+        __m512 y = _mm512_fnmadd_ps(dt0, _mm512_loadu_ps(args.v + i), row);
+        x = _mm512_min_ps(_mm512_max_ps(x, lower), upperX);
+        y = _mm512_min_ps(_mm512_max_ps(y, lower), upperY);
+        __m512 xFloor = _mm512_roundscale_ps(x, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        __m512 yFloor = _mm512_roundscale_ps(y, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        __m512 s1 = _mm512_sub_ps(x, xFloor);
+        __m512 t1 = _mm512_sub_ps(y, yFloor);
+        __m512 s0 = _mm512_sub_ps(one, s1);
+        __m512 t0 = _mm512_sub_ps(one, t1);
+
+        __m512i index = _mm512_add_epi32(_mm512_mullo_epi32(_mm512_cvttps_epi32(yFloor), stride),
+                                         _mm512_cvttps_epi32(xFloor));
+        __m512i indexUp = _mm512_add_epi32(index, stride);
+        __m512 a00 = _mm512_i32gather_ps(index, args.src, 4);
+        __m512 a10 = _mm512_i32gather_ps(_mm512_add_epi32(index, next), args.src, 4);
+        __m512 a01 = _mm512_i32gather_ps(indexUp, args.src, 4);
+        __m512 a11 = _mm512_i32gather_ps(_mm512_add_epi32(indexUp, next), args.src, 4);
+
+        __m512 left = _mm512_fmadd_ps(t0, a00, _mm512_mul_ps(t1, a01));
+        __m512 right = _mm512_fmadd_ps(t0, a10, _mm512_mul_ps(t1, a11));
+        __m512 value = _mm512_fmadd_ps(s0, left, _mm512_mul_ps(s1, right));
+        __m512 fluid = _mm512_sub_ps(one, _mm512_loadu_ps(args.solid + i));
+        _mm512_storeu_ps(args.out + i, _mm512_mul_ps(fluid, value));
+    }
+    genericAdvectRowRange(args, i, args.nx);
+}
+}
+
+const KernelTable& avx512KernelTable()
+{
+    static const KernelTable table{"avx512", &advectRowAvx512, &genericJacobiRow, &genericJacobiTile,
+                                   &genericFluidSumSquares};
+    return table;
+}
+
+#else
+
+const KernelTable& avx512KernelTable()
+{
+    return scalarKernelTable();
+}
+
+#endif
@@ -0,0 +1,132 @@
+// Portable kernel bodies, textually included by every simdkernels*.cpp inside
+// an anonymous namespace so each ISA level gets its own private copy compiled
+// with that file's flags. Deliberately calls nothing from the standard
+// library: inline library functions are shared between translation units and
+// the linker could otherwise hand the baseline build an AVX-compiled copy.
+
+void genericAdvectRowRange(const AdvectionRowArgs& args, int begin, int end)
+{
+    const float row = static_cast<float>(args.j);
+    const float* src = args.src;
+    const int stride = args.srcStride;
+#pragma omp simd
+    for (int i = begin; i < end; ++i)
+    {
+        float x = i - args.dt0*args.u[i];
+        float y = row - args.dt0*args.v[i];
+        x = x < -0.5f ? -0.5f : (x > args.maxX ? args.maxX : x);
+        y = y < -0.5f ? -0.5f : (y > args.maxY ? args.maxY : y);
+        // x, y >= -0.5, so truncating x + 1 is floor(x) + 1
+        int i0 = static_cast<int>(x + 1.0f) - 1;
+        int k0 = static_cast<int>(y + 1.0f) - 1;
+        float s1 = x - i0;
+        float t1 = y - k0;
+        float s0 = 1.0f - s1;
+        float t0 = 1.0f - t1;
+        const float* p = src + k0*stride + i0;
+        float value = s0*(t0*p[0] + t1*p[stride]) + s1*(t0*p[1] + t1*p[stride + 1]);
+        args.out[i] = (1.0f - args.solid[i]) * value;
+    }
+}
+
+// the AVX levels only use the range form for their tails
+[[maybe_unused]] void genericAdvectRow(const AdvectionRowArgs& args)
+{
+    genericAdvectRowRange(args, args.begin, args.nx);
+}
+
+void genericJacobiRow(const JacobiRowArgs& args)
+{
+    const float* pc = args.centre;
+    const float* pd = args.down;
+    const float* pu = args.up;
+    const float* sc = args.solid;
+    const float* sd = args.solidDown;
+    const float* su = args.solidUp;
+#pragma omp simd
+    for (int i = 0; i < args.nx; ++i)
+    {
+        float fl = 1.0f - sc[i - 1];
+        float fr = 1.0f - sc[i + 1];
+        float fd = 1.0f - sd[i];
+        float fu = 1.0f - su[i];
+        float diag = fl + fr + fd + fu;
+        diag = diag < 1.0f ? 1.0f : diag;
+        float value = (args.rhs[i] + fl*pc[i - 1] + fr*pc[i + 1] + fd*pd[i] + fu*pu[i]) / diag;
+        args.out[i] = (1.0f - sc[i]) * value;
+    }
+}
+
+// Width is the row length when it is known at compile time (a full tile row), else 0
+template <int Width>
+void genericJacobiTileRows(const JacobiTileArgs& args)
+{
+    const int nx = Width > 0 ? Width : args.nx;
+    const int last = nx - 1;
+    for (int r = 0; r < args.rows; ++r)
+    {
+        const int offset = r*args.stride;
+        const float* pc = args.centre + offset;
+        const float* sc = args.solid + offset;
+        const float* pd = r == 0 ? args.down : pc - args.stride;
+        const float* pu = r == args.rows - 1 ? args.up : pc + args.stride;
+        const float* sd = r == 0 ? args.solidDown : sc - args.stride;
+        const float* su = r == args.rows - 1 ? args.solidUp : sc + args.stride;
+        const float* b = args.rhs + offset;
+        float* out = args.out + offset;
+        const float leftP = pc[args.left];
+        const float leftS = sc[args.left];
+        const float rightP = pc[args.right];
+        const float rightS = sc[args.right];
+#pragma omp simd
+        for (int i = 0; i < nx; ++i)
+        {
+            // the loads are unconditional so the end cells become a select, not a branch
+            float pl = pc[i - 1];
+            float pr = pc[i + 1];
+            float sl = sc[i - 1];
+            float sr = sc[i + 1];
+            pl = i == 0 ? leftP : pl;
+            sl = i == 0 ? leftS : sl;
+            pr = i == last ? rightP : pr;
+            sr = i == last ? rightS : sr;
+            float fl = 1.0f - sl;
+            float fr = 1.0f - sr;
+            float fd = 1.0f - sd[i];
+            float fu = 1.0f - su[i];
+            float diag = fl + fr + fd + fu;
+            diag = diag < 1.0f ? 1.0f : diag;
+            float value = (b[i] + fl*pl + fr*pr + fd*pd[i] + fu*pu[i]) / diag;
+            out[i] = (1.0f - sc[i]) * value;
+        }
+    }
+}
+
+void genericJacobiTile(const JacobiTileArgs& args)
+{
+    // the tile widths of gridlayout.hpp
+    switch (args.nx)
+    {
+    case 8:
+        genericJacobiTileRows<8>(args);
+        break;
+    case 16:
+        genericJacobiTileRows<16>(args);
+        break;
+    default:
+        genericJacobiTileRows<0>(args);
+        break;
+    }
+}
+
+double genericFluidSumSquares(const float* x, const float* solid, int n)
+{
+    double sum = 0.0;
+#pragma omp simd reduction(+:sum)
+    for (int i = 0; i < n; ++i)
+    {
+        double fluid = 1.0 - solid[i];
+        sum += fluid*x[i]*x[i];
+    }
+    return sum;
+}
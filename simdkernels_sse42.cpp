@@ -0,0 +1,27 @@
+// Compiled with SSE4.2 enabled (see CMakeLists.txt). SSE has no gathers, so
+// the generic loops are enough: the compiler vectorises the arithmetic and
+// the floor, and keeps the bilinear corner loads scalar.
+#include "simdkernels.hpp"
+
+#ifdef SIMFLUID_X86_KERNELS
+
+namespace
+{
+#include "simdkernels_generic.inl"
+}
+
+const KernelTable& sse42KernelTable()
+{
+    static const KernelTable table{"sse42", &genericAdvectRow, &genericJacobiRow, &genericJacobiTile,
+                                   &genericFluidSumSquares};
+    return table;
+}
+
+#else
+
+const KernelTable& sse42KernelTable()
+{
+    return scalarKernelTable();
+}
+
+#endif
@@ -0,0 +1,93 @@
+#include "simulationthread.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <utility>
+
+SimulationThread::SimulationThread(StepFunction step, FrameCallback onFrame)
+    : stepFunction(std::move(step)), frameCallback(std::move(onFrame))
+{
+}
+
+SimulationThread::~SimulationThread()
+{
+    stop();
+}
+
+void SimulationThread::start()
+{
+    if (isRunning())
+    {
+        return;
+    }
+    this->stopRequested.store(false, std::memory_order_relaxed);
+    this->worker = std::thread([this]() { loop(); });
+}
+
+void SimulationThread::stop()
+{
+    if (!isRunning())
+    {
+        return;
+    }
+    this->stopRequested.store(true, std::memory_order_relaxed);
+    this->worker.join();
+}
+
+void SimulationThread::setStepInterval(std::chrono::microseconds interval)
+{
+    this->intervalMicroseconds.store(interval.count(), std::memory_order_relaxed);
+}
+
+bool SimulationThread::latestFrame(SimulationFrameInfo& info)
+{
+    bool fresh = this->frames.update();
+    info = this->frames.readBuffer();
+    return fresh;
+}
+
+void SimulationThread::loop()
+{
+    Profiler::setThreadName("simulation");
+    using Clock = std::chrono::steady_clock;
+    const auto idleWait = std::chrono::milliseconds(2);
+    double smoothedRate = 0.0;
+    Clock::time_point nextStart = Clock::now();
+
+    while (!this->stopRequested.load(std::memory_order_relaxed))
+    {
+        if (this->paused.load(std::memory_order_relaxed))
+        {
+            std::this_thread::sleep_for(idleWait);
+            nextStart = Clock::now();
+            continue;
+        }
+        auto interval = std::chrono::microseconds(this->intervalMicroseconds.load(std::memory_order_relaxed));
+        if (interval.count() > 0)
+        {
+            std::this_thread::sleep_until(nextStart);
+        }
+        Clock::time_point begin = Clock::now();
+        nextStart = begin + interval;
+
+        {
+            SIMFLUID_PROFILE_ZONE("simulation step");
+            this->stepFunction();
+        }
+
+        double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+        // rate from start to start, so pacing sleeps are included
+        double period = std::max(seconds, std::chrono::duration<double>(interval).count());
+        double rate = period > 0.0 ? 1.0 / period : 0.0;
+        smoothedRate = (smoothedRate == 0.0) ? rate : 0.9*smoothedRate + 0.1*rate;
+
+        SimulationFrameInfo& info = this->frames.writeBuffer();
+        info.step = this->completedSteps.fetch_add(1, std::memory_order_relaxed) + 1;
+        info.stepSeconds = seconds;
+        info.stepsPerSecond = smoothedRate;
+        if (this->frameCallback)
+        {
+            this->frameCallback(info);
+        }
+        this->frames.publish();
+    }
+}
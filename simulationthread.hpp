@@ -0,0 +1,64 @@
+#ifndef SIMULATIONTHREAD_HPP
+#define SIMULATIONTHREAD_HPP
+
+#include "triplebuffer.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+// what the simulation reports after every completed step
+struct SimulationFrameInfo
+{
+    std::uint64_t step{0};
+    double stepSeconds{0.0};        // wall time of the last step
+    double stepsPerSecond{0.0};     // smoothed over recent steps
+};
+
+// Runs a step function in a loop on its own thread, so the GUI thread only
+// renders. The step function owns everything it touches; results leave the
+// thread through lock-free handoffs (the frame callback, e.g. publishing a
+// field to SceneView, and latestFrame()), never through locks the renderer
+// could wait on.
+class SimulationThread
+{
+public:
+    using StepFunction = std::function<void()>;
+    // called on the simulation thread after each step
+    using FrameCallback = std::function<void(const SimulationFrameInfo&)>;
+
+    explicit SimulationThread(StepFunction step, FrameCallback onFrame = FrameCallback());
+    ~SimulationThread();
+
+    SimulationThread(const SimulationThread&) = delete;
+    SimulationThread& operator=(const SimulationThread&) = delete;
+
+    void start();
+    // waits for the step in progress to finish; the thread can be started again
+    void stop();
+    bool isRunning() const { return this->worker.joinable(); }
+
+    void setPaused(bool paused) { this->paused.store(paused, std::memory_order_relaxed); }
+    bool isPaused() const { return this->paused.load(std::memory_order_relaxed); }
+    // minimum time between step starts; zero runs flat out
+    void setStepInterval(std::chrono::microseconds interval);
+
+    // consumer side: newest frame info, true when it changed since the last call
+    bool latestFrame(SimulationFrameInfo& info);
+    std::uint64_t getCompletedSteps() const { return this->completedSteps.load(std::memory_order_relaxed); }
+
+private:
+    void loop();
+
+    StepFunction stepFunction;
+    FrameCallback frameCallback;
+    std::thread worker;
+    std::atomic<bool> stopRequested{false};
+    std::atomic<bool> paused{false};
+    std::atomic<long long> intervalMicroseconds{0};
+    std::atomic<std::uint64_t> completedSteps{0};
+    TripleBuffer<SimulationFrameInfo> frames;
+};
+
+#endif // SIMULATIONTHREAD_HPP
@@ -0,0 +1,257 @@
+#include "smoothers.hpp"
+#include "threadpool.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+namespace
+{
+// half the per-core L2, leaving room for whatever else is resident
+std::size_t tileWorkingSetBytes()
+{
+    static const std::size_t bytes = []() {
+        long l2 = 0;
+#if defined(__linux__) && defined(_SC_LEVEL2_CACHE_SIZE)
+        l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+        return l2 > 0 ? static_cast<std::size_t>(l2) / 2 : std::size_t(256) << 10;
+    }();
+    return bytes;
+}
+
+// the fluid cells of row j whose parity (i + j + color) is even; `row` is the
+// global row index, which fixes the colouring whatever buffer the rows live in
+void redBlackRow(float* pc, const float* pd, const float* pu, const float* sc, const float* sd, const float* su,
+                 const float* b, int nx, int row, int color)
+{
+    for (int i = (row + color) & 1; i < nx; i += 2)
+    {
+        if (sc[i] > 0.5f)
+        {
+            continue;
+        }
+        float fl = 1.0f - sc[i - 1];
+        float fr = 1.0f - sc[i + 1];
+        float fd = 1.0f - sd[i];
+        float fu = 1.0f - su[i];
+        float diag = fl + fr + fd + fu;
+        if (diag > 0.0f)
+        {
+            pc[i] = (b[i] + fl*pc[i - 1] + fr*pc[i + 1] + fd*pd[i] + fu*pu[i]) / diag;
+        }
+    }
+}
+
+void weightedJacobiRow(float* out, const float* pc, const float* pd, const float* pu, const float* sc,
+                       const float* sd, const float* su, const float* b, int nx, float weight)
+{
+#pragma omp simd
+    for (int i = 0; i < nx; ++i)
+    {
+        float fl = 1.0f - sc[i - 1];
+        float fr = 1.0f - sc[i + 1];
+        float fd = 1.0f - sd[i];
+        float fu = 1.0f - su[i];
+        float diag = fl + fr + fd + fu;
+        diag = diag < 1.0f ? 1.0f : diag;
+        float value = (b[i] + fl*pc[i - 1] + fr*pc[i + 1] + fd*pd[i] + fu*pu[i]) / diag;
+        out[i] = (1.0f - sc[i]) * (pc[i] + weight*(value - pc[i]));
+    }
+}
+
+// row j including one ghost column on each side
+void copyRow(float* dst, const float* src, int nx)
+{
+    std::memcpy(dst - 1, src - 1, static_cast<std::size_t>(nx + 2) * sizeof(float));
+}
+
+void runChunks(ThreadPool* pool, int numChunks, const std::function<void(int)>& task)
+{
+    if (pool && numChunks > 1)
+    {
+        pool->run(numChunks, task);
+        return;
+    }
+    for (int c = 0; c < numChunks; ++c)
+    {
+        task(c);
+    }
+}
+}
+
+PoissonSmoother::PoissonSmoother(ThreadPool* pool, SmootherKind kind)
+    : pool(pool), kind(kind)
+{
+}
+
+void PoissonSmoother::setSweepsPerTile(int sweeps)
+{
+    this->sweepsPerTile = std::max(sweeps, 1);
+}
+
+void PoissonSmoother::setTileRows(int rows)
+{
+    this->tileRows = std::max(rows, 0);
+}
+
+void PoissonSmoother::smooth(ScalarField& p, const ScalarField& rhs, const ScalarField& obstacle, int sweeps)
+{
+    if (this->sweepsPerTile <= 1)
+    {
+        for (int sweep = 0; sweep < sweeps; ++sweep)
+        {
+            sweepPlain(p, rhs, obstacle);
+        }
+        return;
+    }
+    for (int done = 0; done < sweeps; done += this->sweepsPerTile)
+    {
+        sweepBlocked(p, rhs, obstacle, std::min(this->sweepsPerTile, sweeps - done));
+    }
+}
+
+//--------------------------------PLAIN SWEEPS-------------------------------------
+void PoissonSmoother::sweepPlain(ScalarField& p, const ScalarField& rhs, const ScalarField& obstacle)
+{
+    int nx = p.getNx();
+    if (this->kind == SmootherKind::RedBlackGaussSeidel)
+    {
+        for (int color = 0; color < 2; ++color)
+        {
+            parallelFor(this->pool, 0, p.getNy(), [&](int j0, int j1) {
+                for (int j = j0; j < j1; ++j)
+                {
+                    redBlackRow(p.row(j), p.row(j - 1), p.row(j + 1), obstacle.row(j), obstacle.row(j - 1),
+                                obstacle.row(j + 1), rhs.row(j), nx, j, color);
+                }
+            });
+        }
+        return;
+    }
+
+    if (!this->next.sameShape(p))
+    {
+        this->next = ScalarField(p);
+    }
+    parallelFor(this->pool, 0, p.getNy(), [&](int j0, int j1) {
+        for (int j = j0; j < j1; ++j)
+        {
+            weightedJacobiRow(this->next.row(j), p.row(j), p.row(j - 1), p.row(j + 1), obstacle.row(j),
+                              obstacle.row(j - 1), obstacle.row(j + 1), rhs.row(j), nx, this->jacobiWeight);
+        }
+    });
+    p.swap(this->next);
+}
+
+//--------------------------------TEMPORAL BLOCKING--------------------------------
+int PoissonSmoother::chooseTileRows(int nx, int ny, int halo) const
+{
+    int rows = this->tileRows;
+    if (rows == 0)
+    {
+        // band buffers plus the rhs and obstacle rows they read
+        int arrays = (this->kind == SmootherKind::WeightedJacobi ? 2 : 1) + 2;
+        std::size_t rowBytes = static_cast<std::size_t>(nx + 2) * sizeof(float);
+        rows = static_cast<int>(tileWorkingSetBytes() / (arrays * rowBytes)) - 2*halo;
+        // below this the recomputed halo costs more than the saved traffic
+        rows = std::max(rows, 2*halo);
+    }
+    // every thread gets at least one band
+    int numThreads = this->pool ? this->pool->getNumThreads() : 1;
+    rows = std::min(rows, (ny + numThreads - 1) / numThreads);
+    return std::max(rows, 1);
+}
+
+void PoissonSmoother::sweepBlocked(ScalarField& p, const ScalarField& rhs, const ScalarField& obstacle, int sweeps)
+{
+    int nx = p.getNx();
+    int ny = p.getNy();
+    bool jacobi = this->kind == SmootherKind::WeightedJacobi;
+    // each red-black sweep is two half-sweeps, and every (half-)sweep reaches one row further
+    int steps = jacobi ? sweeps : 2*sweeps;
+    int rows = chooseTileRows(nx, ny, steps);
+    int numTiles = (ny + rows - 1) / rows;
+    int numChunks = std::min(this->pool ? this->pool->getNumThreads() : 1, numTiles);
+    int bufferRows = rows + 2*steps;
+
+    if (!this->next.sameShape(p))
+    {
+        this->next = ScalarField(p);
+    }
+    if (this->tileBuffers.size() < static_cast<std::size_t>(2*numChunks) || this->tileBuffers.front().getNx() != nx ||
+        this->tileBuffers.front().getNy() < bufferRows)
+    {
+        this->tileBuffers.assign(2*numChunks, ScalarField(nx, bufferRows, 1));
+    }
+
+    runChunks(this->pool, numChunks, [&](int c) {
+        int tileBegin, tileEnd;
+        ThreadPool::chunkRange(0, numTiles, numChunks, c, tileBegin, tileEnd);
+        for (int tile = tileBegin; tile < tileEnd; ++tile)
+        {
+            int j0 = tile*rows;
+            int j1 = std::min(ny, j0 + rows);
+            // rows [lo, hi) feed the first step; the wall ghost rows are never relaxed
+            int lo = std::max(j0 - steps, -1);
+            int hi = std::min(j1 + steps, ny + 1);
+            ScalarField* current = &this->tileBuffers[2*c];
+            ScalarField* other = &this->tileBuffers[2*c + 1];
+            for (int j = lo; j < hi; ++j)
+            {
+                copyRow(current->row(j - lo), p.row(j), nx);
+            }
+            if (jacobi)
+            {
+                // every other row the second buffer feeds to a step was written by the step before
+                for (int j : {-1, ny})
+                {
+                    if (j >= lo && j < hi)
+                    {
+                        copyRow(other->row(j - lo), p.row(j), nx);
+                    }
+                }
+            }
+
+            for (int step = 0; step < steps; ++step)
+            {
+                // the rows still needed by the remaining steps shrink by one per step
+                int reach = steps - 1 - step;
+                int u0 = std::max(0, j0 - reach);
+                int u1 = std::min(ny, j1 + reach);
+                bool last = step == steps - 1;
+                for (int j = u0; j < u1; ++j)
+                {
+                    int r = j - lo;
+                    if (jacobi)
+                    {
+                        float* out = last ? this->next.row(j) : other->row(r);
+                        weightedJacobiRow(out, current->row(r), current->row(r - 1), current->row(r + 1),
+                                          obstacle.row(j), obstacle.row(j - 1), obstacle.row(j + 1), rhs.row(j), nx,
+                                          this->jacobiWeight);
+                    }
+                    else
+                    {
+                        redBlackRow(current->row(r), current->row(r - 1), current->row(r + 1), obstacle.row(j),
+                                    obstacle.row(j - 1), obstacle.row(j + 1), rhs.row(j), nx, j, step & 1);
+                    }
+                }
+                if (jacobi)
+                {
+                    std::swap(current, other);
+                }
+            }
+
+            if (!jacobi)
+            {
+                for (int j = j0; j < j1; ++j)
+                {
+                    copyRow(this->next.row(j), current->row(j - lo), nx);
+                }
+            }
+        }
+    });
+    p.swap(this->next);
+}
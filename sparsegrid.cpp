@@ -0,0 +1,377 @@
+#include "sparsegrid.hpp"
+#include "threadpool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace
+{
+int blocksFor(int cells)
+{
+    return (cells + SparseBlockSize - 1) / SparseBlockSize;
+}
+}
+
+//--------------------------------SPARSE BLOCK FIELD-------------------------------
+SparseBlockField::SparseBlockField(int nx, int ny, float background)
+    : nx(nx), ny(ny), background(background)
+{
+    if (nx <= 0 || ny <= 0)
+    {
+        throw std::invalid_argument("SparseBlockField: dimensions must be positive");
+    }
+    this->blocksX = blocksFor(nx);
+    this->blocksY = blocksFor(ny);
+    this->table.assign(static_cast<std::size_t>(this->blocksX)*this->blocksY, -1);
+}
+
+float* SparseBlockField::block(int bx, int by)
+{
+    int slot = this->table[blockId(bx, by)];
+    return slot >= 0 ? this->blocks[slot]->values : nullptr;
+}
+
+const float* SparseBlockField::block(int bx, int by) const
+{
+    int slot = this->table[blockId(bx, by)];
+    return slot >= 0 ? this->blocks[slot]->values : nullptr;
+}
+
+float* SparseBlockField::activate(int bx, int by)
+{
+    int& slot = this->table[blockId(bx, by)];
+    if (slot >= 0)
+    {
+        return this->blocks[slot]->values;
+    }
+    if (this->freeSlots.empty())
+    {
+        slot = static_cast<int>(this->blocks.size());
+        this->blocks.emplace_back(new Block);
+    }
+    else
+    {
+        slot = this->freeSlots.back();
+        this->freeSlots.pop_back();
+        if (!this->blocks[slot])
+        {
+            this->blocks[slot].reset(new Block);
+        }
+    }
+    ++this->activeCount;
+    float* values = this->blocks[slot]->values;
+    std::fill(values, values + BlockCells, this->background);
+    return values;
+}
+
+void SparseBlockField::deactivate(int bx, int by)
+{
+    int& slot = this->table[blockId(bx, by)];
+    if (slot < 0)
+    {
+        return;
+    }
+    this->freeSlots.push_back(slot);
+    slot = -1;
+    --this->activeCount;
+}
+
+void SparseBlockField::clear()
+{
+    for (int by = 0; by < this->blocksY; ++by)
+    {
+        for (int bx = 0; bx < this->blocksX; ++bx)
+        {
+            deactivate(bx, by);
+        }
+    }
+}
+
+void SparseBlockField::releaseFreeBlocks()
+{
+    for (int slot : this->freeSlots)
+    {
+        this->blocks[slot].reset();
+    }
+}
+
+float SparseBlockField::value(int i, int j) const
+{
+    const float* values = block(i / SparseBlockSize, j / SparseBlockSize);
+    return values ? values[(j % SparseBlockSize)*SparseBlockSize + i % SparseBlockSize] : this->background;
+}
+
+void SparseBlockField::setValue(int i, int j, float value)
+{
+    float* values = activate(i / SparseBlockSize, j / SparseBlockSize);
+    values[(j % SparseBlockSize)*SparseBlockSize + i % SparseBlockSize] = value;
+}
+
+void SparseBlockField::fromDense(const ScalarField& field, float tolerance)
+{
+    if (field.getNx() != this->nx || field.getNy() != this->ny)
+    {
+        throw std::invalid_argument("SparseBlockField::fromDense: shape mismatch");
+    }
+    for (int by = 0; by < this->blocksY; ++by)
+    {
+        int j0 = by*SparseBlockSize;
+        int j1 = std::min(j0 + SparseBlockSize, this->ny);
+        for (int bx = 0; bx < this->blocksX; ++bx)
+        {
+            int i0 = bx*SparseBlockSize;
+            int i1 = std::min(i0 + SparseBlockSize, this->nx);
+            bool occupied = false;
+            for (int j = j0; j < j1 && !occupied; ++j)
+            {
+                const float* r = field.row(j);
+                for (int i = i0; i < i1; ++i)
+                {
+                    occupied |= std::fabs(r[i] - this->background) > tolerance;
+                }
+            }
+            if (!occupied)
+            {
+                deactivate(bx, by);
+                continue;
+            }
+            float* values = activate(bx, by);
+            for (int j = j0; j < j1; ++j)
+            {
+                std::copy(field.row(j) + i0, field.row(j) + i1, values + (j - j0)*SparseBlockSize);
+            }
+        }
+    }
+}
+
+void SparseBlockField::toDense(ScalarField& field) const
+{
+    if (field.getNx() != this->nx || field.getNy() != this->ny)
+    {
+        throw std::invalid_argument("SparseBlockField::toDense: shape mismatch");
+    }
+    for (int by = 0; by < this->blocksY; ++by)
+    {
+        int j0 = by*SparseBlockSize;
+        int j1 = std::min(j0 + SparseBlockSize, this->ny);
+        for (int bx = 0; bx < this->blocksX; ++bx)
+        {
+            int i0 = bx*SparseBlockSize;
+            int i1 = std::min(i0 + SparseBlockSize, this->nx);
+            const float* values = block(bx, by);
+            for (int j = j0; j < j1; ++j)
+            {
+                float* r = field.row(j);
+                if (values)
+                {
+                    std::copy(values + (j - j0)*SparseBlockSize, values + (j - j0)*SparseBlockSize + (i1 - i0), r + i0);
+                }
+                else
+                {
+                    std::fill(r + i0, r + i1, this->background);
+                }
+            }
+        }
+    }
+}
+
+std::size_t SparseBlockField::getAllocatedBytes() const
+{
+    std::size_t total = this->table.size()*sizeof(int);
+    for (const std::unique_ptr<Block>& b : this->blocks)
+    {
+        total += b ? sizeof(Block) : 0;
+    }
+    return total;
+}
+
+//--------------------------------ACTIVE BLOCK SET---------------------------------
+ActiveBlockSet::ActiveBlockSet(int nx, int ny)
+    : nx(nx), ny(ny)
+{
+    if (nx <= 0 || ny <= 0)
+    {
+        throw std::invalid_argument("ActiveBlockSet: dimensions must be positive");
+    }
+    this->blocksX = blocksFor(nx);
+    this->blocksY = blocksFor(ny);
+    this->occupied.assign(getTotalBlocks(), 0);
+    activateAll();
+}
+
+void ActiveBlockSet::setMargin(int blocks)
+{
+    if (blocks < 0)
+    {
+        throw std::invalid_argument("ActiveBlockSet: margin must not be negative");
+    }
+    this->margin = blocks;
+}
+
+void ActiveBlockSet::activateAll()
+{
+    this->active.assign(getTotalBlocks(), 1);
+    this->activeBlocks.resize(getTotalBlocks());
+    for (int id = 0; id < getTotalBlocks(); ++id)
+    {
+        this->activeBlocks[id] = id;
+    }
+    this->retiredBlocks.clear();
+    this->scanEverything = true;
+}
+
+void ActiveBlockSet::blockBounds(int id, int& i0, int& i1, int& j0, int& j1) const
+{
+    i0 = (id % this->blocksX)*SparseBlockSize;
+    j0 = (id / this->blocksX)*SparseBlockSize;
+    i1 = std::min(i0 + SparseBlockSize, this->nx);
+    j1 = std::min(j0 + SparseBlockSize, this->ny);
+}
+
+void ActiveBlockSet::update(const std::vector<ActivityField>& state, const std::vector<ActivityField>& sources,
+                            ThreadPool* pool)
+{
+    for (const std::vector<ActivityField>* fields : {&state, &sources})
+    {
+        for (const ActivityField& tracked : *fields)
+        {
+            if (tracked.field->getNx() != this->nx || tracked.field->getNy() != this->ny)
+            {
+                throw std::invalid_argument("ActiveBlockSet::update: shape mismatch");
+            }
+        }
+    }
+
+    auto exceeds = [this](const std::vector<ActivityField>& fields, int id) {
+        int i0, i1, j0, j1;
+        blockBounds(id, i0, i1, j0, j1);
+        for (const ActivityField& tracked : fields)
+        {
+            for (int j = j0; j < j1; ++j)
+            {
+                const float* r = tracked.field->row(j);
+                float largest = 0.0f;
+                for (int i = i0; i < i1; ++i)
+                {
+                    largest = std::max(largest, std::fabs(r[i]));
+                }
+                if (largest > tracked.threshold)
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    };
+
+    // every block is written by exactly one chunk, so the byte flags need no atomics
+    std::fill(this->occupied.begin(), this->occupied.end(), 0);
+    int total = getTotalBlocks();
+    if (this->scanEverything)
+    {
+        parallelFor(pool, 0, total, [&](int b0, int b1) {
+            for (int id = b0; id < b1; ++id)
+            {
+                this->occupied[id] = exceeds(state, id) || exceeds(sources, id);
+            }
+        });
+        this->scanEverything = false;
+    }
+    else
+    {
+        int count = static_cast<int>(this->activeBlocks.size());
+        parallelFor(pool, 0, count, [&](int a0, int a1) {
+            for (int a = a0; a < a1; ++a)
+            {
+                int id = this->activeBlocks[a];
+                this->occupied[id] = exceeds(state, id);
+            }
+        });
+        if (!sources.empty())
+        {
+            parallelFor(pool, 0, total, [&](int b0, int b1) {
+                for (int id = b0; id < b1; ++id)
+                {
+                    if (!this->occupied[id] && exceeds(sources, id))
+                    {
+                        this->occupied[id] = 1;
+                    }
+                }
+            });
+        }
+    }
+
+    // dilate by the margin, then diff against the previous set
+    std::vector<unsigned char> next(total, 0);
+    for (int by = 0; by < this->blocksY; ++by)
+    {
+        for (int bx = 0; bx < this->blocksX; ++bx)
+        {
+            if (!this->occupied[by*this->blocksX + bx])
+            {
+                continue;
+            }
+            int y0 = std::max(by - this->margin, 0), y1 = std::min(by + this->margin, this->blocksY - 1);
+            int x0 = std::max(bx - this->margin, 0), x1 = std::min(bx + this->margin, this->blocksX - 1);
+            for (int y = y0; y <= y1; ++y)
+            {
+                std::fill(next.begin() + y*this->blocksX + x0, next.begin() + y*this->blocksX + x1 + 1, 1);
+            }
+        }
+    }
+    this->activeBlocks.clear();
+    this->retiredBlocks.clear();
+    for (int id = 0; id < total; ++id)
+    {
+        if (next[id])
+        {
+            this->activeBlocks.push_back(id);
+        }
+        else if (this->active[id])
+        {
+            this->retiredBlocks.push_back(id);
+        }
+    }
+    this->active.swap(next);
+}
+
+void ActiveBlockSet::forEachActive(ThreadPool* pool, const std::function<void(int, int, int, int)>& body) const
+{
+    parallelFor(pool, 0, static_cast<int>(this->activeBlocks.size()), [&](int a0, int a1) {
+        for (int a = a0; a < a1; ++a)
+        {
+            int i0, i1, j0, j1;
+            blockBounds(this->activeBlocks[a], i0, i1, j0, j1);
+            body(i0, i1, j0, j1);
+        }
+    });
+}
+
+void ActiveBlockSet::clearRetired(ScalarField& field) const
+{
+    for (int id : this->retiredBlocks)
+    {
+        int i0, i1, j0, j1;
+        blockBounds(id, i0, i1, j0, j1);
+        for (int j = j0; j < j1; ++j)
+        {
+            std::fill(field.row(j) + i0, field.row(j) + i1, 0.0f);
+        }
+    }
+}
+
+std::size_t ActiveBlockSet::getAllocatedBytes() const
+{
+    return this->active.capacity() + this->occupied.capacity() +
+           (this->activeBlocks.capacity() + this->retiredBlocks.capacity())*sizeof(int);
+}
+
+SparseMemoryUsage ActiveBlockSet::getMemoryUsage(const FluidGrid& grid, int fields) const
+{
+    SparseMemoryUsage usage;
+    usage.activeBlocks = static_cast<int>(this->activeBlocks.size());
+    usage.totalBlocks = getTotalBlocks();
+    usage.denseBytes = static_cast<std::size_t>(fields) * grid.density().getAllocatedBytes();
+    usage.activeSetBytes = getAllocatedBytes();
+    return usage;
+}
@@ -0,0 +1,162 @@
+#ifndef SPARSEGRID_HPP
+#define SPARSEGRID_HPP
+
+#include "fluidgrid.hpp"
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class ThreadPool;
+
+// Side length of the blocks the sparse grid is made of; a 16x16 float block
+// is 1 KiB, sixteen cache lines.
+constexpr int SparseBlockSize = 16;
+
+// A 2D field in the spirit of OpenVDB: a dense table with one entry per
+// SparseBlockSize^2 block, and the values of only the blocks that are active.
+// Every other cell reads as the background value. Deactivated blocks go back
+// to a free list and are reused by the next activation, so toggling activity
+// every step does not hit the allocator; releaseFreeBlocks() hands them back.
+class SparseBlockField
+{
+public:
+    static constexpr int BlockCells = SparseBlockSize * SparseBlockSize;
+    static constexpr std::size_t BlockBytes = BlockCells * sizeof(float);
+
+    // throws std::invalid_argument for an empty domain
+    SparseBlockField(int nx, int ny, float background = 0.0f);
+
+    int getNx() const { return this->nx; }
+    int getNy() const { return this->ny; }
+    int getBlocksX() const { return this->blocksX; }
+    int getBlocksY() const { return this->blocksY; }
+    float getBackground() const { return this->background; }
+
+    bool isActive(int bx, int by) const { return this->table[blockId(bx, by)] >= 0; }
+    int getActiveBlockCount() const { return this->activeCount; }
+
+    // values of block (bx, by) row by row, nullptr while it is inactive
+    float* block(int bx, int by);
+    const float* block(int bx, int by) const;
+    // fills a newly activated block with the background value
+    float* activate(int bx, int by);
+    void deactivate(int bx, int by);
+    void clear();
+    void releaseFreeBlocks();
+
+    float value(int i, int j) const;
+    // activates the block holding (i, j)
+    void setValue(int i, int j, float value);
+
+    // activates the blocks holding a cell that differs from the background by
+    // more than `tolerance` and copies them; all other blocks are deactivated
+    void fromDense(const ScalarField& field, float tolerance);
+    // writes every interior cell of `field`, which must be nx x ny
+    void toDense(ScalarField& field) const;
+
+    // block table plus every block held, active or pooled
+    std::size_t getAllocatedBytes() const;
+
+private:
+    struct alignas(64) Block
+    {
+        float values[BlockCells];
+    };
+
+    int blockId(int bx, int by) const { return by*this->blocksX + bx; }
+
+    int nx{0};
+    int ny{0};
+    int blocksX{0};
+    int blocksY{0};
+    float background{0.0f};
+    int activeCount{0};
+    std::vector<int> table;                 // block id -> slot in `blocks`, -1 when inactive
+    std::vector<std::unique_ptr<Block>> blocks;
+    std::vector<int> freeSlots;
+};
+
+// Memory the simulation state takes while stepping on an active set: the
+// dense fields plus the ActiveBlockSet's own tables, all of it allocated.
+struct SparseMemoryUsage
+{
+    int activeBlocks{0};
+    int totalBlocks{0};
+    std::size_t denseBytes{0};
+    std::size_t activeSetBytes{0};
+
+    std::size_t getTotalBytes() const { return this->denseBytes + this->activeSetBytes; }
+
+    double getActiveFraction() const { return this->totalBlocks > 0 ? double(this->activeBlocks) / this->totalBlocks : 0.0; }
+};
+
+// A field whose magnitude above `threshold` makes its block worth simulating.
+struct ActivityField
+{
+    const ScalarField* field{nullptr};
+    float threshold{0.0f};
+};
+
+// Which blocks of a dense nx x ny grid hold anything worth simulating. A block
+// is occupied when some tracked field exceeds its threshold in magnitude there;
+// the active set is the occupied blocks dilated by `margin` blocks, so
+// whatever moves less than margin*SparseBlockSize cells per step stays inside.
+//
+// Solvers keep every field they own at zero outside the active set: stages
+// only write active blocks, and blocks that drop out are cleared with
+// clearRetired(). A stage may then read any cell, active or not.
+class ActiveBlockSet
+{
+public:
+    // throws std::invalid_argument for an empty domain
+    ActiveBlockSet(int nx, int ny);
+
+    // throws std::invalid_argument for a negative margin
+    void setMargin(int blocks);
+    int getMargin() const { return this->margin; }
+
+    // Recomputes the active set. `state` fields can only gain content next to
+    // blocks that are already active, so they are scanned in the active blocks
+    // alone; `sources` may be written anywhere and are scanned in full.
+    void update(const std::vector<ActivityField>& state, const std::vector<ActivityField>& sources, ThreadPool* pool);
+    // every block active; the next update() scans the state fields in full
+    void activateAll();
+
+    int getNx() const { return this->nx; }
+    int getNy() const { return this->ny; }
+    int getBlocksX() const { return this->blocksX; }
+    int getBlocksY() const { return this->blocksY; }
+    int getTotalBlocks() const { return this->blocksX * this->blocksY; }
+    bool isActive(int bx, int by) const { return this->active[by*this->blocksX + bx] != 0; }
+    // block ids (by*blocksX + bx) in storage order
+    const std::vector<int>& getActiveBlocks() const { return this->activeBlocks; }
+    // blocks the last update() deactivated
+    const std::vector<int>& getRetiredBlocks() const { return this->retiredBlocks; }
+
+    // body(i0, i1, j0, j1) once per active block, cells [i0, i1) x [j0, j1), across the pool
+    void forEachActive(ThreadPool* pool, const std::function<void(int, int, int, int)>& body) const;
+    // zeroes the interior cells of the retired blocks
+    void clearRetired(ScalarField& field) const;
+
+    // the tables above, as allocated
+    std::size_t getAllocatedBytes() const;
+    // `fields` dense fields of the grid's shape stepped on this set
+    SparseMemoryUsage getMemoryUsage(const FluidGrid& grid, int fields) const;
+
+private:
+    void blockBounds(int id, int& i0, int& i1, int& j0, int& j1) const;
+
+    int nx{0};
+    int ny{0};
+    int blocksX{0};
+    int blocksY{0};
+    int margin{1};
+    bool scanEverything{true};
+    std::vector<unsigned char> active;
+    std::vector<unsigned char> occupied;
+    std::vector<int> activeBlocks;
+    std::vector<int> retiredBlocks;
+};
+
+#endif // SPARSEGRID_HPP
@@ -0,0 +1,262 @@
+#include "spectralsolver.hpp"
+#include "fluidgrid.hpp"
+#include "multigridsolver.hpp"
+#include "threadpool.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+const double Pi = 3.14159265358979323846;
+const int TransposeBlock = 32;
+
+RealTransformKind forwardKind(SpectralBoundary boundary)
+{
+    switch (boundary)
+    {
+    case SpectralBoundary::Neumann:
+        return RealTransformKind::Dct2;
+    case SpectralBoundary::Dirichlet:
+        return RealTransformKind::Dst1;
+    case SpectralBoundary::Periodic:
+        return RealTransformKind::Hartley;
+    }
+    return RealTransformKind::Dct2;
+}
+
+RealTransformKind inverseKind(SpectralBoundary boundary)
+{
+    return (boundary == SpectralBoundary::Neumann) ? RealTransformKind::Dct3 : forwardKind(boundary);
+}
+}
+
+SpectralPressureSolver::SpectralPressureSolver(SpectralBoundary boundary, ThreadPool* pool)
+    : boundary(boundary), pool(pool), fallback(new MultigridPressureSolver(pool))
+{
+}
+
+SpectralPressureSolver::~SpectralPressureSolver()
+{
+}
+
+void SpectralPressureSolver::setFallback(std::unique_ptr<PressureSolver> solver)
+{
+    if (solver)
+    {
+        this->fallback = std::move(solver);
+    }
+}
+
+bool SpectralPressureSolver::hasInteriorObstacles(const ScalarField& obstacle)
+{
+    for (int j = 0; j < obstacle.getNy(); ++j)
+    {
+        const float* s = obstacle.row(j);
+        for (int i = 0; i < obstacle.getNx(); ++i)
+        {
+            if (s[i] > 0.5f)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+//--------------------------------PLANS AND PASSES---------------------------------
+const RealTransformPlan& SpectralPressureSolver::getPlan(RealTransformKind kind, int n)
+{
+    std::pair<int, int> key(static_cast<int>(kind), n);
+    auto found = this->plans.find(key);
+    if (found == this->plans.end())
+    {
+        found = this->plans.emplace(key, std::unique_ptr<RealTransformPlan>(new RealTransformPlan(kind, n))).first;
+    }
+    return *found->second;
+}
+
+void SpectralPressureSolver::transformRows(const RealTransformPlan& plan, std::vector<double>& data, int numRows)
+{
+    int n = plan.size();
+    parallelFor(this->pool, 0, numRows, [&](int r0, int r1) {
+        std::vector<std::complex<double>> scratch(plan.getScratchSize());
+        for (int r = r0; r < r1; ++r)
+        {
+            double* row = data.data() + static_cast<std::size_t>(r)*n;
+            plan.apply(row, row, scratch.data());
+        }
+    });
+}
+
+void SpectralPressureSolver::transpose(std::vector<double>& data, int rows, int cols)
+{
+    if (rows == cols)
+    {
+        // in place: swap the blocks above the diagonal with their mirror images
+        int n = rows;
+        int numBlocks = (n + TransposeBlock - 1) / TransposeBlock;
+        parallelFor(this->pool, 0, numBlocks, [&](int b0, int b1) {
+            for (int bi = b0; bi < b1; ++bi)
+            {
+                int iBegin = bi*TransposeBlock;
+                int iEnd = std::min(iBegin + TransposeBlock, n);
+                for (int jBegin = iBegin; jBegin < n; jBegin += TransposeBlock)
+                {
+                    int jEnd = std::min(jBegin + TransposeBlock, n);
+                    for (int i = iBegin; i < iEnd; ++i)
+                    {
+                        for (int j = std::max(jBegin, i + 1); j < jEnd; ++j)
+                        {
+                            std::swap(data[static_cast<std::size_t>(i)*n + j], data[static_cast<std::size_t>(j)*n + i]);
+                        }
+                    }
+                }
+            }
+        });
+        return;
+    }
+
+    this->transposeBuffer.resize(data.size());
+    int numBlocks = (rows + TransposeBlock - 1) / TransposeBlock;
+    parallelFor(this->pool, 0, numBlocks, [&](int b0, int b1) {
+        for (int bi = b0; bi < b1; ++bi)
+        {
+            int rBegin = bi*TransposeBlock;
+            int rEnd = std::min(rBegin + TransposeBlock, rows);
+            for (int cBegin = 0; cBegin < cols; cBegin += TransposeBlock)
+            {
+                int cEnd = std::min(cBegin + TransposeBlock, cols);
+                for (int r = rBegin; r < rEnd; ++r)
+                {
+                    for (int c = cBegin; c < cEnd; ++c)
+                    {
+                        this->transposeBuffer[static_cast<std::size_t>(c)*rows + r] = data[static_cast<std::size_t>(r)*cols + c];
+                    }
+                }
+            }
+        }
+    });
+    data.swap(this->transposeBuffer);
+}
+
+double SpectralPressureSolver::eigenvalue(int k, int n) const
+{
+    switch (this->boundary)
+    {
+    case SpectralBoundary::Neumann:
+        return 2.0 - 2.0*std::cos(Pi*k/n);
+    case SpectralBoundary::Dirichlet:
+        return 2.0 - 2.0*std::cos(Pi*(k + 1)/(n + 1));
+    case SpectralBoundary::Periodic:
+        return 2.0 - 2.0*std::cos(2.0*Pi*k/n);
+    }
+    return 0.0;
+}
+
+//--------------------------------SOLVE--------------------------------------------
+PressureSolveStats SpectralPressureSolver::solve(ScalarField& p, const ScalarField& rhs, const ScalarField& obstacle)
+{
+    if (hasInteriorObstacles(obstacle))
+    {
+        return this->fallback->solve(p, rhs, obstacle);
+    }
+
+    int nx = p.getNx();
+    int ny = p.getNy();
+    this->work.resize(static_cast<std::size_t>(nx)*ny);
+    for (int j = 0; j < ny; ++j)
+    {
+        const float* b = rhs.row(j);
+        double* w = this->work.data() + static_cast<std::size_t>(j)*nx;
+        for (int i = 0; i < nx; ++i)
+        {
+            w[i] = b[i];
+        }
+    }
+
+    const RealTransformPlan& forwardX = getPlan(forwardKind(this->boundary), nx);
+    const RealTransformPlan& forwardY = getPlan(forwardKind(this->boundary), ny);
+    const RealTransformPlan& inverseX = getPlan(inverseKind(this->boundary), nx);
+    const RealTransformPlan& inverseY = getPlan(inverseKind(this->boundary), ny);
+
+    transformRows(forwardX, this->work, ny);
+    transpose(this->work, ny, nx);
+    transformRows(forwardY, this->work, nx);
+
+    // rows are now indexed by kx, columns by ky
+    std::vector<double> eigenY(ny);
+    for (int ky = 0; ky < ny; ++ky)
+    {
+        eigenY[ky] = eigenvalue(ky, ny);
+    }
+    parallelFor(this->pool, 0, nx, [&](int k0, int k1) {
+        for (int kx = k0; kx < k1; ++kx)
+        {
+            double ex = eigenvalue(kx, nx);
+            double* w = this->work.data() + static_cast<std::size_t>(kx)*ny;
+            for (int ky = 0; ky < ny; ++ky)
+            {
+                double lambda = ex + eigenY[ky];
+                // the constant mode of the singular systems is fixed to zero
+                w[ky] = (lambda > 1e-12) ? w[ky] / lambda : 0.0;
+            }
+        }
+    });
+
+    transformRows(inverseY, this->work, nx);
+    transpose(this->work, nx, ny);
+    transformRows(inverseX, this->work, ny);
+
+    double scale = inverseX.getInverseScale() * inverseY.getInverseScale();
+    for (int j = 0; j < ny; ++j)
+    {
+        float* out = p.row(j);
+        const double* w = this->work.data() + static_cast<std::size_t>(j)*nx;
+        for (int i = 0; i < nx; ++i)
+        {
+            out[i] = static_cast<float>(scale*w[i]);
+        }
+    }
+
+    PressureSolveStats stats;
+    stats.iterations = 1;
+    stats.converged = true;
+    double rhsNorm = computeFluidNorm(rhs, obstacle, this->pool);
+    stats.residualHistory.push_back(rhsNorm > 0.0 ? computeResidualNorm(p, rhs) / rhsNorm : 0.0);
+    return stats;
+}
+
+double SpectralPressureSolver::computeResidualNorm(const ScalarField& p, const ScalarField& rhs) const
+{
+    int nx = p.getNx();
+    int ny = p.getNy();
+    auto neighbour = [&](int i, int j, int ci, int cj) -> double {
+        if (i >= 0 && i < nx && j >= 0 && j < ny)
+        {
+            return p.at(i, j);
+        }
+        switch (this->boundary)
+        {
+        case SpectralBoundary::Neumann:
+            return p.at(ci, cj);
+        case SpectralBoundary::Dirichlet:
+            return 0.0;
+        case SpectralBoundary::Periodic:
+            return p.at((i + nx) % nx, (j + ny) % ny);
+        }
+        return 0.0;
+    };
+
+    double sum = 0.0;
+    for (int j = 0; j < ny; ++j)
+    {
+        for (int i = 0; i < nx; ++i)
+        {
+            double ap = 4.0*p.at(i, j) - neighbour(i - 1, j, i, j) - neighbour(i + 1, j, i, j)
+                        - neighbour(i, j - 1, i, j) - neighbour(i, j + 1, i, j);
+            double r = rhs.at(i, j) - ap;
+            sum += r*r;
+        }
+    }
+    return std::sqrt(sum);
+}
@@ -0,0 +1,57 @@
+#ifndef SPECTRALSOLVER_HPP
+#define SPECTRALSOLVER_HPP
+
+#include "fft.hpp"
+#include "pressuresolver.hpp"
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+class ThreadPool;
+
+enum class SpectralBoundary
+{
+    Neumann,    // closed box, zero-gradient walls (DCT); same operator as the iterative solvers
+    Dirichlet,  // p = 0 just outside the domain (DST-I)
+    Periodic    // wrap-around in both directions (Hartley)
+};
+
+// Direct O(N log N) pressure solve for rectangles without interior obstacles.
+// The 5-point operator is diagonalised by a separable real-to-real transform,
+// so a solve is: transform rows, transpose, transform rows, divide by the
+// eigenvalues, and undo. Rows of each pass are transformed in parallel and the
+// transposes are cache-blocked (in place when the grid is square). Plans are
+// cached per (transform, length). When the obstacle mask has interior solid
+// cells the solve is handed to a fallback iterative solver instead.
+class SpectralPressureSolver : public PressureSolver
+{
+public:
+    explicit SpectralPressureSolver(SpectralBoundary boundary = SpectralBoundary::Neumann, ThreadPool* pool = nullptr);
+    ~SpectralPressureSolver() override;
+
+    PressureSolveStats solve(ScalarField& p, const ScalarField& rhs, const ScalarField& obstacle) override;
+
+    void setBoundary(SpectralBoundary boundary) { this->boundary = boundary; }
+    SpectralBoundary getBoundary() const { return this->boundary; }
+    void setFallback(std::unique_ptr<PressureSolver> solver);
+
+    static bool hasInteriorObstacles(const ScalarField& obstacle);
+    // ||b - Ap|| for this solver's boundary treatment
+    double computeResidualNorm(const ScalarField& p, const ScalarField& rhs) const;
+
+private:
+    const RealTransformPlan& getPlan(RealTransformKind kind, int n);
+    void transformRows(const RealTransformPlan& plan, std::vector<double>& data, int numRows);
+    void transpose(std::vector<double>& data, int rows, int cols);
+    double eigenvalue(int k, int n) const;
+
+    SpectralBoundary boundary;
+    ThreadPool* pool{nullptr};
+    std::unique_ptr<PressureSolver> fallback;
+    std::map<std::pair<int, int>, std::unique_ptr<RealTransformPlan>> plans;
+    std::vector<double> work;
+    std::vector<double> transposeBuffer;
+};
+
+#endif // SPECTRALSOLVER_HPP
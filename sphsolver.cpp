@@ -0,0 +1,380 @@
+#include "sphsolver.hpp"
+#include "fluidgrid.hpp"
+#include "threadpool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace
+{
+const float Pi = 3.14159265358979f;
+}
+
+SphSolver::SphSolver(const SphParameters& params, int numThreads)
+    : params(params), pool(new ThreadPool(numThreads))
+{
+    setupCells();
+}
+
+SphSolver::~SphSolver()
+{
+}
+
+std::uint32_t SphSolver::mortonCode(std::uint32_t cx, std::uint32_t cy)
+{
+    auto spread = [](std::uint32_t v) {
+        v &= 0x0000ffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    };
+    return spread(cx) | (spread(cy) << 1);
+}
+
+void SphSolver::setupCells()
+{
+    float h = this->params.smoothingLength;
+    this->cellsBuiltFor = {h, this->params.width, this->params.height};
+    this->cellsX = std::max(1, static_cast<int>(std::ceil(this->params.width / h)));
+    this->cellsY = std::max(1, static_cast<int>(std::ceil(this->params.height / h)));
+
+    // rank the cells by Morton code so the rank space stays dense for any domain shape
+    int numCells = this->cellsX*this->cellsY;
+    std::vector<int> linear(numCells);
+    std::iota(linear.begin(), linear.end(), 0);
+    std::sort(linear.begin(), linear.end(), [&](int a, int b) {
+        return mortonCode(a % this->cellsX, a / this->cellsX) < mortonCode(b % this->cellsX, b / this->cellsX);
+    });
+    this->cellRank.assign(numCells, 0);
+    for (int r = 0; r < numCells; ++r)
+    {
+        this->cellRank[linear[r]] = r;
+    }
+}
+
+int SphSolver::getCellRank(float px, float py) const
+{
+    float inverseH = 1.0f / this->params.smoothingLength;
+    int cx = std::min(std::max(static_cast<int>(px*inverseH), 0), this->cellsX - 1);
+    int cy = std::min(std::max(static_cast<int>(py*inverseH), 0), this->cellsY - 1);
+    return this->cellRank[cy*this->cellsX + cx];
+}
+
+//--------------------------------PARTICLES----------------------------------------
+void SphSolver::addParticle(float px, float py, float pvx, float pvy)
+{
+    this->x.push_back(px);
+    this->y.push_back(py);
+    this->vx.push_back(pvx);
+    this->vy.push_back(pvy);
+    this->rho.push_back(this->params.restDensity);
+    this->pressure.push_back(0.0f);
+    this->ax.push_back(0.0f);
+    this->ay.push_back(0.0f);
+}
+
+void SphSolver::addBlock(float x0, float y0, float x1, float y1, float spacing)
+{
+    // pick the mass so a particle inside the lattice sits exactly at rest density
+    float h = this->params.smoothingLength;
+    float poly6 = 4.0f / (Pi*std::pow(h, 8.0f));
+    int reach = static_cast<int>(h / spacing) + 1;
+    float kernelSum = 0.0f;
+    for (int dj = -reach; dj <= reach; ++dj)
+    {
+        for (int di = -reach; di <= reach; ++di)
+        {
+            float r2 = spacing*spacing*(di*di + dj*dj);
+            if (r2 < h*h)
+            {
+                kernelSum += std::pow(h*h - r2, 3.0f);
+            }
+        }
+    }
+    this->params.particleMass = this->params.restDensity / (poly6*kernelSum);
+    for (float py = y0 + 0.5f*spacing; py < y1; py += spacing)
+    {
+        for (float px = x0 + 0.5f*spacing; px < x1; px += spacing)
+        {
+            addParticle(px, py);
+        }
+    }
+}
+
+//--------------------------------CELL LIST----------------------------------------
+void SphSolver::buildCellList()
+{
+    int count = getNumParticles();
+    int numCells = this->cellsX*this->cellsY;
+    int numChunks = std::max(1, std::min(this->pool->getNumThreads(), count));
+    this->particleCell.resize(count);
+    this->cellParticles.resize(count);
+    this->cellStart.assign(numCells + 1, 0);
+    this->chunkCounts.resize(numChunks);
+
+    // 1. per-chunk histograms of cell ranks
+    this->pool->run(numChunks, [&](int c) {
+        int begin, end;
+        ThreadPool::chunkRange(0, count, numChunks, c, begin, end);
+        std::vector<int>& counts = this->chunkCounts[c];
+        counts.assign(numCells, 0);
+        for (int p = begin; p < end; ++p)
+        {
+            int rank = getCellRank(this->x[p], this->y[p]);
+            this->particleCell[p] = rank;
+            ++counts[rank];
+        }
+    });
+
+    // 2. exclusive scan over cells, then per-chunk write offsets
+    for (int r = 0; r < numCells; ++r)
+    {
+        int total = 0;
+        for (int c = 0; c < numChunks; ++c)
+        {
+            total += this->chunkCounts[c][r];
+        }
+        this->cellStart[r + 1] = this->cellStart[r] + total;
+    }
+    this->pool->parallelFor(0, numCells, [&](int r0, int r1) {
+        for (int r = r0; r < r1; ++r)
+        {
+            int offset = this->cellStart[r];
+            for (int c = 0; c < numChunks; ++c)
+            {
+                int n = this->chunkCounts[c][r];
+                this->chunkCounts[c][r] = offset;
+                offset += n;
+            }
+        }
+    });
+
+    // 3. stable scatter; each chunk owns disjoint slots
+    this->pool->run(numChunks, [&](int c) {
+        int begin, end;
+        ThreadPool::chunkRange(0, count, numChunks, c, begin, end);
+        std::vector<int>& offsets = this->chunkCounts[c];
+        for (int p = begin; p < end; ++p)
+        {
+            this->cellParticles[offsets[this->particleCell[p]]++] = p;
+        }
+    });
+}
+
+void SphSolver::sortParticles()
+{
+    buildCellList();
+    int count = getNumParticles();
+    std::vector<float> buffer(count);
+    for (std::vector<float>* field : {&this->x, &this->y, &this->vx, &this->vy, &this->rho,
+                                      &this->pressure, &this->ax, &this->ay})
+    {
+        std::vector<float>& values = *field;
+        this->pool->parallelFor(0, count, [&](int begin, int end) {
+            for (int k = begin; k < end; ++k)
+            {
+                buffer[k] = values[this->cellParticles[k]];
+            }
+        });
+        values.swap(buffer);
+    }
+    // the arrays are now in cell order, so the list is the identity
+    std::iota(this->cellParticles.begin(), this->cellParticles.end(), 0);
+    for (int k = 0; k < count; ++k)
+    {
+        this->particleCell[k] = getCellRank(this->x[k], this->y[k]);
+    }
+}
+
+//--------------------------------PASSES-------------------------------------------
+void SphSolver::computeDensities()
+{
+    buildCellList();
+    densityPass();
+}
+
+void SphSolver::densityPass()
+{
+    float h = this->params.smoothingLength;
+    float h2 = h*h;
+    float poly6 = 4.0f / (Pi*std::pow(h, 8.0f));
+    float mass = this->params.particleMass;
+    float inverseH = 1.0f / h;
+
+    this->pool->parallelFor(0, getNumParticles(), [&](int begin, int end) {
+        for (int p = begin; p < end; ++p)
+        {
+            float px = this->x[p];
+            float py = this->y[p];
+            int cx = std::min(std::max(static_cast<int>(px*inverseH), 0), this->cellsX - 1);
+            int cy = std::min(std::max(static_cast<int>(py*inverseH), 0), this->cellsY - 1);
+            float sum = 0.0f;
+            for (int ny = std::max(cy - 1, 0); ny <= std::min(cy + 1, this->cellsY - 1); ++ny)
+            {
+                for (int nx = std::max(cx - 1, 0); nx <= std::min(cx + 1, this->cellsX - 1); ++nx)
+                {
+                    int rank = this->cellRank[ny*this->cellsX + nx];
+                    for (int k = this->cellStart[rank]; k < this->cellStart[rank + 1]; ++k)
+                    {
+                        int q = this->cellParticles[k];
+                        float dx = px - this->x[q];
+                        float dy = py - this->y[q];
+                        float r2 = dx*dx + dy*dy;
+                        if (r2 < h2)
+                        {
+                            float diff = h2 - r2;
+                            sum += diff*diff*diff;
+                        }
+                    }
+                }
+            }
+            this->rho[p] = mass*poly6*sum;
+            // no tension: under-dense particles at the free surface would otherwise clump
+            this->pressure[p] = this->params.stiffness*std::max(this->rho[p] - this->params.restDensity, 0.0f);
+        }
+    });
+}
+
+void SphSolver::forcePass()
+{
+    float h = this->params.smoothingLength;
+    float h2 = h*h;
+    float spikyGradient = -30.0f / (Pi*std::pow(h, 5.0f));
+    float viscosityLaplacian = 40.0f / (Pi*std::pow(h, 5.0f));
+    float mass = this->params.particleMass;
+    float mu = this->params.viscosity;
+    float inverseH = 1.0f / h;
+
+    this->pool->parallelFor(0, getNumParticles(), [&](int begin, int end) {
+        for (int p = begin; p < end; ++p)
+        {
+            float px = this->x[p];
+            float py = this->y[p];
+            float pvx = this->vx[p];
+            float pvy = this->vy[p];
+            float pp = this->pressure[p];
+            int cx = std::min(std::max(static_cast<int>(px*inverseH), 0), this->cellsX - 1);
+            int cy = std::min(std::max(static_cast<int>(py*inverseH), 0), this->cellsY - 1);
+            float fx = 0.0f;
+            float fy = 0.0f;
+            for (int ny = std::max(cy - 1, 0); ny <= std::min(cy + 1, this->cellsY - 1); ++ny)
+            {
+                for (int nx = std::max(cx - 1, 0); nx <= std::min(cx + 1, this->cellsX - 1); ++nx)
+                {
+                    int rank = this->cellRank[ny*this->cellsX + nx];
+                    for (int k = this->cellStart[rank]; k < this->cellStart[rank + 1]; ++k)
+                    {
+                        int q = this->cellParticles[k];
+                        if (q == p)
+                        {
+                            continue;
+                        }
+                        float dx = px - this->x[q];
+                        float dy = py - this->y[q];
+                        float r2 = dx*dx + dy*dy;
+                        if (r2 >= h2 || r2 == 0.0f)
+                        {
+                            continue;
+                        }
+                        float r = std::sqrt(r2);
+                        float w = h - r;
+                        float inverseRhoQ = 1.0f / this->rho[q];
+                        // symmetric pressure force along the spiky gradient
+                        float pressureTerm = -mass*(pp + this->pressure[q])*0.5f*inverseRhoQ*spikyGradient*w*w / r;
+                        fx += pressureTerm*dx;
+                        fy += pressureTerm*dy;
+                        float viscousTerm = mu*mass*inverseRhoQ*viscosityLaplacian*w;
+                        fx += viscousTerm*(this->vx[q] - pvx);
+                        fy += viscousTerm*(this->vy[q] - pvy);
+                    }
+                }
+            }
+            float inverseRhoP = 1.0f / this->rho[p];
+            this->ax[p] = fx*inverseRhoP + this->params.gravityX;
+            this->ay[p] = fy*inverseRhoP + this->params.gravityY;
+        }
+    });
+}
+
+void SphSolver::integrate()
+{
+    float dt = this->params.timeStep;
+    float width = this->params.width;
+    float height = this->params.height;
+    float damping = this->params.wallDamping;
+    float margin = 1e-4f*this->params.smoothingLength;
+
+    this->pool->parallelFor(0, getNumParticles(), [&](int begin, int end) {
+        for (int p = begin; p < end; ++p)
+        {
+            this->vx[p] += dt*this->ax[p];
+            this->vy[p] += dt*this->ay[p];
+            this->x[p] += dt*this->vx[p];
+            this->y[p] += dt*this->vy[p];
+            if (this->x[p] < margin)
+            {
+                this->x[p] = margin;
+                this->vx[p] = -damping*this->vx[p];
+            }
+            else if (this->x[p] > width - margin)
+            {
+                this->x[p] = width - margin;
+                this->vx[p] = -damping*this->vx[p];
+            }
+            if (this->y[p] < margin)
+            {
+                this->y[p] = margin;
+                this->vy[p] = -damping*this->vy[p];
+            }
+            else if (this->y[p] > height - margin)
+            {
+                this->y[p] = height - margin;
+                this->vy[p] = -damping*this->vy[p];
+            }
+        }
+    });
+}
+
+void SphSolver::step()
+{
+    if (getNumParticles() == 0)
+    {
+        return;
+    }
+    // parameters() is mutable; a new kernel radius or domain needs a new cell grid
+    if (this->cellsBuiltFor != std::array<float, 3>{this->params.smoothingLength, this->params.width,
+                                                    this->params.height})
+    {
+        setupCells();
+    }
+    if (this->params.resortInterval > 0 && this->stepCount % this->params.resortInterval == 0)
+    {
+        sortParticles();
+    }
+    else
+    {
+        buildCellList();
+    }
+    densityPass();
+    forcePass();
+    integrate();
+    ++this->stepCount;
+}
+
+//--------------------------------OUTPUT-------------------------------------------
+void SphSolver::rasterizeTo(FluidGrid& grid) const
+{
+    ScalarField& density = grid.density();
+    density.fill(0.0f);
+    float cellW = this->params.width / grid.getNx();
+    float cellH = this->params.height / grid.getNy();
+    float scale = this->params.particleMass / (cellW*cellH);
+    for (int p = 0; p < getNumParticles(); ++p)
+    {
+        int i = std::min(std::max(static_cast<int>(this->x[p] / cellW), 0), grid.getNx() - 1);
+        int j = std::min(std::max(static_cast<int>(this->y[p] / cellH), 0), grid.getNy() - 1);
+        density.at(i, j) += scale;
+    }
+}
@@ -0,0 +1,600 @@
+#include "threadpool.hpp"
+#include <chrono>
+#include <stdexcept>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+// failed steal attempts before an idle thread goes to sleep
+const int SpinAttempts = 64;
+
+// the pool and slot of the current thread, if it is one of a pool's workers
+thread_local const ThreadPool* currentPool = nullptr;
+thread_local int currentPoolSlot = 0;
+
+long currentKernelThreadId()
+{
+#if defined(__linux__)
+    return static_cast<long>(syscall(SYS_gettid));
+#else
+    return -1;
+#endif
+}
+
+std::uint64_t nanosecondsBetween(Clock::time_point begin, Clock::time_point end)
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+}
+
+std::int64_t nowNanoseconds()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+struct GraphRun
+{
+    ThreadPool* pool;
+    TaskGraph* graph;
+    std::atomic<int>* remaining;
+};
+}
+
+//--------------------------------TASK GRAPH---------------------------------------
+TaskGraph::TaskId TaskGraph::add(std::function<void()> work, std::initializer_list<TaskId> dependsOn)
+{
+    TaskId id = size();
+    this->nodes.emplace_back();
+    this->nodes.back().work = std::move(work);
+    for (TaskId before : dependsOn)
+    {
+        precede(before, id);
+    }
+    return id;
+}
+
+void TaskGraph::precede(TaskId before, TaskId after)
+{
+    if (before < 0 || before >= size() || after < 0 || after >= size())
+    {
+        throw std::invalid_argument("TaskGraph: unknown task id");
+    }
+    if (before == after)
+    {
+        throw std::invalid_argument("TaskGraph: a task cannot depend on itself");
+    }
+    this->nodes[before].successors.push_back(after);
+    ++this->nodes[after].numPrerequisites;
+}
+
+void TaskGraph::checkAcyclic() const
+{
+    // Kahn's algorithm: every task is reached only if nothing loops back
+    std::vector<int> waiting(this->nodes.size());
+    std::vector<TaskId> ready;
+    for (TaskId id = 0; id < size(); ++id)
+    {
+        waiting[id] = this->nodes[id].numPrerequisites;
+        if (waiting[id] == 0)
+        {
+            ready.push_back(id);
+        }
+    }
+    int reached = 0;
+    while (!ready.empty())
+    {
+        TaskId id = ready.back();
+        ready.pop_back();
+        ++reached;
+        for (TaskId next : this->nodes[id].successors)
+        {
+            if (--waiting[next] == 0)
+            {
+                ready.push_back(next);
+            }
+        }
+    }
+    if (reached != size())
+    {
+        throw std::invalid_argument("TaskGraph: dependency cycle");
+    }
+}
+
+//--------------------------------POOL---------------------------------------------
+ThreadPool::ThreadPool(int numThreads)
+{
+    if (numThreads <= 0)
+    {
+        numThreads = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    this->numThreads = std::max(numThreads, 1);
+
+    this->slots.reset(new Slot[this->numThreads]);
+    this->workerThreadIds.reset(new std::atomic<long>[this->numThreads]);
+    for (int t = 0; t < this->numThreads; ++t)
+    {
+        this->workerThreadIds[t].store(0, std::memory_order_relaxed);
+    }
+    for (int t = 1; t < this->numThreads; ++t)
+    {
+        this->workers.emplace_back(&ThreadPool::workerLoop, this, t);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->sleepMutex);
+        this->stopping.store(true);
+    }
+    this->wakeUp.notify_all();
+    for (std::thread& worker : this->workers)
+    {
+        worker.join();
+    }
+}
+
+std::vector<long> ThreadPool::getWorkerThreadIds() const
+{
+    std::vector<long> ids;
+    for (std::size_t w = 0; w < this->workers.size(); ++w)
+    {
+        long id;
+        while ((id = this->workerThreadIds[w].load(std::memory_order_acquire)) == 0)
+        {
+            std::this_thread::yield();
+        }
+        if (id > 0)
+        {
+            ids.push_back(id);
+        }
+    }
+    return ids;
+}
+
+bool ThreadPool::pinWorkersToCores()
+{
+#if defined(__linux__)
+    unsigned cores = std::thread::hardware_concurrency();
+    if (cores == 0)
+    {
+        return false;
+    }
+    bool pinned = true;
+    for (std::size_t w = 0; w < this->workers.size(); ++w)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(static_cast<int>((w + 1) % cores), &set);
+        pinned = pthread_setaffinity_np(this->workers[w].native_handle(), sizeof(set), &set) == 0 && pinned;
+    }
+    return pinned;
+#else
+    return false;
+#endif
+}
+
+std::vector<ThreadPool::WorkerStats> ThreadPool::getWorkerStats() const
+{
+    std::vector<WorkerStats> stats(this->numThreads);
+    for (int s = 0; s < this->numThreads; ++s)
+    {
+        const Slot& slot = this->slots[s];
+        stats[s].tasksExecuted = slot.executed.load(std::memory_order_relaxed);
+        stats[s].tasksStolen = slot.stolen.load(std::memory_order_relaxed);
+        stats[s].busySeconds = slot.busyNanoseconds.load(std::memory_order_relaxed) * 1e-9;
+        std::uint64_t idle = slot.idleNanoseconds.load(std::memory_order_relaxed);
+        std::int64_t since = slot.idleSince.load(std::memory_order_relaxed);
+        if (since != 0)
+        {
+            idle += static_cast<std::uint64_t>(std::max<std::int64_t>(nowNanoseconds() - since, 0));
+        }
+        stats[s].idleSeconds = idle * 1e-9;
+    }
+    return stats;
+}
+
+void ThreadPool::resetWorkerStats()
+{
+    for (int s = 0; s < this->numThreads; ++s)
+    {
+        Slot& slot = this->slots[s];
+        slot.executed.store(0, std::memory_order_relaxed);
+        slot.stolen.store(0, std::memory_order_relaxed);
+        slot.busyNanoseconds.store(0, std::memory_order_relaxed);
+        slot.idleNanoseconds.store(0, std::memory_order_relaxed);
+        // an open idle period restarts now
+        std::int64_t since = slot.idleSince.load(std::memory_order_relaxed);
+        if (since != 0)
+        {
+            slot.idleSince.compare_exchange_strong(since, nowNanoseconds(), std::memory_order_relaxed);
+        }
+    }
+}
+
+//--------------------------------SCHEDULING---------------------------------------
+// an idle period runs from a thread's first failed attempt to find work until
+// it finds some; the open period counts towards getWorkerStats() too
+void ThreadPool::Slot::beginIdle()
+{
+    if (this->idleSince.load(std::memory_order_relaxed) == 0)
+    {
+        this->idleSince.store(nowNanoseconds(), std::memory_order_relaxed);
+    }
+}
+
+void ThreadPool::Slot::endIdle()
+{
+    std::int64_t since = this->idleSince.exchange(0, std::memory_order_relaxed);
+    if (since != 0)
+    {
+        this->idleNanoseconds.fetch_add(static_cast<std::uint64_t>(std::max<std::int64_t>(nowNanoseconds() - since, 0)),
+                                        std::memory_order_relaxed);
+    }
+}
+
+int ThreadPool::currentSlot() const
+{
+    return currentPool == this ? currentPoolSlot : 0;
+}
+
+void ThreadPool::push(int slot, const Job& job)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->slots[slot].mutex);
+        this->slots[slot].jobs.push_back(job);
+        this->queuedJobs.fetch_add(1);
+    }
+    wakeSleepers();
+}
+
+void ThreadPool::wakeSleepers()
+{
+    // pairs with the sleepers increment made under sleepMutex before a thread re-checks its wait condition
+    if (this->sleepers.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(this->sleepMutex);
+        this->wakeUp.notify_all();
+    }
+}
+
+bool ThreadPool::popOrSteal(int slot, Job& job)
+{
+    if (this->queuedJobs.load(std::memory_order_relaxed) <= 0)
+    {
+        return false;
+    }
+    {
+        Slot& own = this->slots[slot];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty())
+        {
+            job = own.jobs.back();
+            own.jobs.pop_back();
+            this->queuedJobs.fetch_sub(1);
+            return true;
+        }
+    }
+    for (int k = 1; k < this->numThreads; ++k)
+    {
+        Slot& victim = this->slots[(slot + k) % this->numThreads];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty())
+        {
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            this->queuedJobs.fetch_sub(1);
+            this->slots[slot].stolen.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::execute(const Job& job, int slot)
+{
+    Slot& own = this->slots[slot];
+    Clock::time_point begin = Clock::now();
+    job.invoke(job.context, job.index, slot);
+    own.busyNanoseconds.fetch_add(nanosecondsBetween(begin, Clock::now()), std::memory_order_relaxed);
+    own.executed.fetch_add(1, std::memory_order_relaxed);
+    if (job.remaining->fetch_sub(1) == 1)
+    {
+        // the submitting thread may be asleep waiting for exactly this
+        wakeSleepers();
+    }
+}
+
+void ThreadPool::workerLoop(int slot)
+{
+    currentPool = this;
+    currentPoolSlot = slot;
+    this->workerThreadIds[slot - 1].store(currentKernelThreadId(), std::memory_order_release);
+    Slot& own = this->slots[slot];
+    int failedAttempts = 0;
+    while (true)
+    {
+        Job job;
+        if (popOrSteal(slot, job))
+        {
+            own.endIdle();
+            failedAttempts = 0;
+            execute(job, slot);
+            continue;
+        }
+        own.beginIdle();
+        if (this->stopping.load())
+        {
+            return;
+        }
+        if (++failedAttempts < SpinAttempts)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(this->sleepMutex);
+        this->sleepers.fetch_add(1);
+        this->wakeUp.wait(lock, [&] { return this->stopping.load() || this->queuedJobs.load() > 0; });
+        this->sleepers.fetch_sub(1);
+        failedAttempts = 0;
+    }
+}
+
+void ThreadPool::helpUntilDone(std::atomic<int>& remaining, int slot)
+{
+    Slot& own = this->slots[slot];
+    int failedAttempts = 0;
+    while (remaining.load(std::memory_order_acquire) > 0)
+    {
+        Job job;
+        if (popOrSteal(slot, job))
+        {
+            own.endIdle();
+            failedAttempts = 0;
+            execute(job, slot);
+            continue;
+        }
+        own.beginIdle();
+        if (++failedAttempts < SpinAttempts)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(this->sleepMutex);
+        this->sleepers.fetch_add(1);
+        this->wakeUp.wait(lock, [&] { return remaining.load() == 0 || this->queuedJobs.load() > 0; });
+        this->sleepers.fetch_sub(1);
+        failedAttempts = 0;
+    }
+    own.endIdle();
+}
+
+void ThreadPool::invokeIndexed(void* context, int index, int)
+{
+    (*static_cast<const std::function<void(int)>*>(context))(index);
+}
+
+void ThreadPool::invokeGraphNode(void* context, int index, int slot)
+{
+    GraphRun& graphRun = *static_cast<GraphRun*>(context);
+    TaskGraph::Node& node = graphRun.graph->nodes[index];
+    node.work();
+    // the thread that finishes a task's last prerequisite queues it locally, where its inputs are warm
+    for (TaskGraph::TaskId next : node.successors)
+    {
+        TaskGraph::Node& successor = graphRun.graph->nodes[next];
+        if (successor.pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            graphRun.pool->push(slot, Job{&ThreadPool::invokeGraphNode, context, next, graphRun.remaining});
+        }
+    }
+}
+
+//--------------------------------SUBMISSION---------------------------------------
+void ThreadPool::run(int numTasks, const std::function<void(int)>& task)
+{
+    if (numTasks <= 0)
+    {
+        return;
+    }
+    if (this->workers.empty() || numTasks == 1)
+    {
+        for (int t = 0; t < numTasks; ++t)
+        {
+            task(t);
+        }
+        return;
+    }
+
+    // chunk c goes to the c-th slot counted from the caller's own, each
+    // stacked so its owner pops the chunk front to back
+    std::atomic<int> remaining(numTasks);
+    int self = currentSlot();
+    void* context = const_cast<void*>(static_cast<const void*>(&task));
+    for (int c = 0; c < this->numThreads; ++c)
+    {
+        int chunkBegin, chunkEnd;
+        chunkRange(0, numTasks, this->numThreads, c, chunkBegin, chunkEnd);
+        if (chunkBegin == chunkEnd)
+        {
+            continue;
+        }
+        Slot& slot = this->slots[(self + c) % this->numThreads];
+        std::lock_guard<std::mutex> lock(slot.mutex);
+        for (int t = chunkEnd - 1; t >= chunkBegin; --t)
+        {
+            slot.jobs.push_back(Job{&ThreadPool::invokeIndexed, context, t, &remaining});
+        }
+        this->queuedJobs.fetch_add(chunkEnd - chunkBegin);
+    }
+    wakeSleepers();
+    helpUntilDone(remaining, self);
+}
+
+void ThreadPool::run(TaskGraph& graph)
+{
+    int numTasks = graph.size();
+    if (numTasks == 0)
+    {
+        return;
+    }
+    graph.checkAcyclic();
+    for (TaskGraph::Node& node : graph.nodes)
+    {
+        node.pending.store(node.numPrerequisites, std::memory_order_relaxed);
+    }
+
+    if (this->workers.empty())
+    {
+        std::vector<TaskGraph::TaskId> ready;
+        for (TaskGraph::TaskId id = numTasks - 1; id >= 0; --id)
+        {
+            if (graph.nodes[id].numPrerequisites == 0)
+            {
+                ready.push_back(id);
+            }
+        }
+        while (!ready.empty())
+        {
+            TaskGraph::Node& node = graph.nodes[ready.back()];
+            ready.pop_back();
+            node.work();
+            for (TaskGraph::TaskId next : node.successors)
+            {
+                if (graph.nodes[next].pending.fetch_sub(1, std::memory_order_relaxed) == 1)
+                {
+                    ready.push_back(next);
+                }
+            }
+        }
+        return;
+    }
+
+    std::atomic<int> remaining(numTasks);
+    GraphRun graphRun{this, &graph, &remaining};
+    int self = currentSlot();
+    int seeded = 0;
+    for (TaskGraph::TaskId id = 0; id < numTasks; ++id)
+    {
+        if (graph.nodes[id].numPrerequisites == 0)
+        {
+            Slot& slot = this->slots[(self + seeded++) % this->numThreads];
+            std::lock_guard<std::mutex> lock(slot.mutex);
+            slot.jobs.push_back(Job{&ThreadPool::invokeGraphNode, &graphRun, id, &remaining});
+            this->queuedJobs.fetch_add(1);
+        }
+    }
+    wakeSleepers();
+    helpUntilDone(remaining, self);
+}
+
+void ThreadPool::chunkRange(int begin, int end, int numChunks, int c, int& chunkBegin, int& chunkEnd)
+{
+    long long count = end - begin;
+    chunkBegin = begin + static_cast<int>(count * c / numChunks);
+    chunkEnd = begin + static_cast<int>(count * (c + 1) / numChunks);
+}
+
+void ThreadPool::parallelFor(int begin, int end, const std::function<void(int, int)>& body)
+{
+    int count = end - begin;
+    if (count <= 0)
+    {
+        return;
+    }
+    int numChunks = std::min(this->numThreads, count);
+    run(numChunks, [&](int c) {
+        int chunkBegin, chunkEnd;
+        chunkRange(begin, end, numChunks, c, chunkBegin, chunkEnd);
+        body(chunkBegin, chunkEnd);
+    });
+}
+
+void ThreadPool::parallelFor2D(int xBegin, int xEnd, int yBegin, int yEnd, int tileWidth, int tileHeight,
+                               const std::function<void(int, int, int, int)>& body)
+{
+    if (xEnd <= xBegin || yEnd <= yBegin)
+    {
+        return;
+    }
+    tileWidth = tileWidth > 0 ? tileWidth : xEnd - xBegin;
+    tileHeight = tileHeight > 0 ? tileHeight : yEnd - yBegin;
+    int tilesX = (xEnd - xBegin + tileWidth - 1) / tileWidth;
+    int tilesY = (yEnd - yBegin + tileHeight - 1) / tileHeight;
+    // row-major tile order, so each thread's seeded share is a band of tile rows
+    run(tilesX*tilesY, [&](int t) {
+        int x0 = xBegin + (t % tilesX)*tileWidth;
+        int y0 = yBegin + (t / tilesX)*tileHeight;
+        body(x0, std::min(x0 + tileWidth, xEnd), y0, std::min(y0 + tileHeight, yEnd));
+    });
+}
+
+double ThreadPool::parallelSum(int begin, int end, const std::function<double(int, int)>& body)
+{
+    int count = end - begin;
+    if (count <= 0)
+    {
+        return 0.0;
+    }
+    int numChunks = std::min(this->numThreads, count);
+    std::vector<double> partials(numChunks, 0.0);
+    run(numChunks, [&](int c) {
+        int chunkBegin, chunkEnd;
+        chunkRange(begin, end, numChunks, c, chunkBegin, chunkEnd);
+        partials[c] = body(chunkBegin, chunkEnd);
+    });
+
+    double total = 0.0;
+    for (double p : partials)
+    {
+        total += p;
+    }
+    return total;
+}
+
+void parallelFor(ThreadPool* pool, int begin, int end, const std::function<void(int, int)>& body)
+{
+    if (pool)
+    {
+        pool->parallelFor(begin, end, body);
+    }
+    else if (end > begin)
+    {
+        body(begin, end);
+    }
+}
+
+void parallelFor2D(ThreadPool* pool, int xBegin, int xEnd, int yBegin, int yEnd, int tileWidth, int tileHeight,
+                   const std::function<void(int, int, int, int)>& body)
+{
+    if (pool)
+    {
+        pool->parallelFor2D(xBegin, xEnd, yBegin, yEnd, tileWidth, tileHeight, body);
+        return;
+    }
+    tileWidth = tileWidth > 0 ? tileWidth : xEnd - xBegin;
+    tileHeight = tileHeight > 0 ? tileHeight : yEnd - yBegin;
+    for (int y0 = yBegin; y0 < yEnd; y0 += tileHeight)
+    {
+        for (int x0 = xBegin; x0 < xEnd; x0 += tileWidth)
+        {
+            body(x0, std::min(x0 + tileWidth, xEnd), y0, std::min(y0 + tileHeight, yEnd));
+        }
+    }
+}
+
+double parallelSum(ThreadPool* pool, int begin, int end, const std::function<double(int, int)>& body)
+{
+    if (pool)
+    {
+        return pool->parallelSum(begin, end, body);
+    }
+    return (end > begin) ? body(begin, end) : 0.0;
+}
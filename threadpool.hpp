@@ -0,0 +1,201 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool;
+
+// A set of tasks with dependencies, run by ThreadPool::run(graph). A task
+// starts once every task it depends on has finished; tasks with nothing in
+// between run concurrently. The graph can be run any number of times.
+class TaskGraph
+{
+public:
+    using TaskId = int;
+
+    TaskId add(std::function<void()> work, std::initializer_list<TaskId> dependsOn = {});
+    // `after` waits for `before`
+    void precede(TaskId before, TaskId after);
+
+    int size() const { return static_cast<int>(this->nodes.size()); }
+    void clear() { this->nodes.clear(); }
+
+private:
+    friend class ThreadPool;
+
+    struct Node
+    {
+        std::function<void()> work;
+        std::vector<TaskId> successors;
+        int numPrerequisites{0};
+        std::atomic<int> pending{0};
+    };
+
+    // throws std::invalid_argument when the dependencies form a cycle
+    void checkAcyclic() const;
+
+    std::deque<Node> nodes;   // stable addresses; Node holds an atomic
+};
+
+// Fixed set of worker threads created once and reused for every stage. The
+// calling thread takes part in the work, so a pool of N threads spawns N-1
+// workers.
+//
+// Each thread (the caller counts as slot 0) owns a deque of jobs: it pops
+// its own from the back and, when it runs dry, steals from the front of the
+// others'. run() and parallelFor() seed slot c with chunk c, so in steady
+// state every thread streams through the same band of rows stage after
+// stage, and a thread that finishes early takes over a slow one's remaining
+// chunks. Idle workers spin briefly and then sleep until work arrives.
+// Jobs may themselves call run(); the calling job's thread helps out while
+// it waits.
+class ThreadPool
+{
+public:
+    struct WorkerStats
+    {
+        std::uint64_t tasksExecuted{0};
+        std::uint64_t tasksStolen{0};   // of tasksExecuted, taken from another thread's deque
+        double busySeconds{0.0};        // running jobs
+        double idleSeconds{0.0};        // spinning or asleep without work
+    };
+
+    // numThreads <= 0 picks std::thread::hardware_concurrency()
+    explicit ThreadPool(int numThreads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int getNumThreads() const { return this->numThreads; }
+
+    // calls task(t) for t in [0, numTasks) spread over the pool; blocks until done
+    void run(int numTasks, const std::function<void(int)>& task);
+    // runs every task of the graph in dependency order; blocks until all are done
+    void run(TaskGraph& graph);
+
+    // calls body(chunkBegin, chunkEnd) on disjoint contiguous sub-ranges of [begin, end)
+    void parallelFor(int begin, int end, const std::function<void(int, int)>& body);
+
+    // calls body(x0, x1, y0, y1) once per tile of [xBegin, xEnd) x [yBegin, yEnd);
+    // tiles are tileWidth x tileHeight (smaller at the far edges) and are
+    // balanced one by one, so uneven tiles do not leave threads waiting
+    void parallelFor2D(int xBegin, int xEnd, int yBegin, int yEnd, int tileWidth, int tileHeight,
+                       const std::function<void(int, int, int, int)>& body);
+
+    // sums body(chunkBegin, chunkEnd) over the chunks in a fixed order, so the
+    // result is reproducible for a given thread count
+    double parallelSum(int begin, int end, const std::function<double(int, int)>& body);
+
+    // the contiguous sub-range handed to chunk c when [begin, end) is split numChunks ways
+    static void chunkRange(int begin, int end, int numChunks, int c, int& chunkBegin, int& chunkEnd);
+
+    // kernel thread ids of the workers (Linux gettid), for tools that attach
+    // per-thread counters; empty elsewhere. Waits until every worker has started.
+    std::vector<long> getWorkerThreadIds() const;
+
+    // Pins worker w to core (w + 1) mod the core count, leaving core 0 to the
+    // calling thread, which stays wherever its owner put it. False where
+    // affinity is unsupported or refused.
+    bool pinWorkersToCores();
+
+    // one entry per slot: the calling thread(s) first, then the workers
+    std::vector<WorkerStats> getWorkerStats() const;
+    void resetWorkerStats();
+
+private:
+    struct Job
+    {
+        void (*invoke)(void* context, int index, int slot){nullptr};
+        void* context{nullptr};
+        int index{0};
+        std::atomic<int>* remaining{nullptr};   // jobs of the same submission not yet finished
+    };
+
+    struct alignas(64) Slot
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+        std::atomic<std::uint64_t> executed{0};
+        std::atomic<std::uint64_t> stolen{0};
+        std::atomic<std::uint64_t> busyNanoseconds{0};
+        std::atomic<std::uint64_t> idleNanoseconds{0};
+        std::atomic<std::int64_t> idleSince{0};   // steady_clock nanoseconds, 0 while working
+
+        void beginIdle();
+        void endIdle();
+    };
+
+    void workerLoop(int slot);
+    int currentSlot() const;
+    void push(int slot, const Job& job);
+    bool popOrSteal(int slot, Job& job);
+    void execute(const Job& job, int slot);
+    // runs jobs on this thread until `remaining` drops to zero
+    void helpUntilDone(std::atomic<int>& remaining, int slot);
+    void wakeSleepers();
+
+    static void invokeIndexed(void* context, int index, int slot);
+    static void invokeGraphNode(void* context, int index, int slot);
+
+    int numThreads{1};
+    std::vector<std::thread> workers;
+    std::unique_ptr<std::atomic<long>[]> workerThreadIds;
+    std::unique_ptr<Slot[]> slots;
+
+    std::atomic<int> queuedJobs{0};   // jobs sitting in any deque
+    std::atomic<int> sleepers{0};
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;   // new jobs, a finished submission, or shutdown
+    std::atomic<bool> stopping{false};
+};
+
+// helpers for code that may run without a pool (pool == nullptr runs serially)
+void parallelFor(ThreadPool* pool, int begin, int end, const std::function<void(int, int)>& body);
+void parallelFor2D(ThreadPool* pool, int xBegin, int xEnd, int yBegin, int yEnd, int tileWidth, int tileHeight,
+                   const std::function<void(int, int, int, int)>& body);
+double parallelSum(ThreadPool* pool, int begin, int end, const std::function<double(int, int)>& body);
+
+// several independent sums from a single pass, combined in chunk order
+template <std::size_t N>
+std::array<double, N> parallelSums(ThreadPool* pool, int begin, int end,
+                                   const std::function<std::array<double, N>(int, int)>& body)
+{
+    std::array<double, N> total{};
+    if (end <= begin)
+    {
+        return total;
+    }
+    if (!pool)
+    {
+        return body(begin, end);
+    }
+    int numChunks = std::min(pool->getNumThreads(), end - begin);
+    std::vector<std::array<double, N>> partials(numChunks);
+    pool->run(numChunks, [&](int c) {
+        int chunkBegin, chunkEnd;
+        ThreadPool::chunkRange(begin, end, numChunks, c, chunkBegin, chunkEnd);
+        partials[c] = body(chunkBegin, chunkEnd);
+    });
+    for (const std::array<double, N>& partial : partials)
+    {
+        for (std::size_t k = 0; k < N; ++k)
+        {
+            total[k] += partial[k];
+        }
+    }
+    return total;
+}
+
+#endif // THREADPOOL_HPP
@@ -0,0 +1,71 @@
+#ifndef TRIPLEBUFFER_HPP
+#define TRIPLEBUFFER_HPP
+
+#include <atomic>
+
+// Lock-free single-producer/single-consumer handoff of the latest value.
+// The producer fills writeBuffer() and publish()es it; the consumer calls
+// update() and reads readBuffer(). Neither side ever waits: publishing swaps
+// the written buffer with the shared middle one, so the consumer only ever
+// sees complete values, and values it did not pick up in time are overwritten
+// by newer ones. Each side must stay on one thread.
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() = default;
+    explicit TripleBuffer(const T& initial)
+    {
+        for (Slot& slot : this->slots)
+        {
+            slot.value = initial;
+        }
+    }
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    //--------------producer---------------
+    T& writeBuffer() { return this->slots[this->writeIndex].value; }
+    void publish()
+    {
+        unsigned previous = this->middle.exchange(this->writeIndex | FreshBit, std::memory_order_acq_rel);
+        this->writeIndex = previous & IndexMask;
+    }
+    void publish(const T& value)
+    {
+        writeBuffer() = value;
+        publish();
+    }
+
+    //--------------consumer---------------
+    // true when a value newer than readBuffer() was taken
+    bool update()
+    {
+        if (!hasFresh())
+        {
+            return false;
+        }
+        unsigned previous = this->middle.exchange(this->readIndex, std::memory_order_acq_rel);
+        this->readIndex = previous & IndexMask;
+        return true;
+    }
+    const T& readBuffer() const { return this->slots[this->readIndex].value; }
+    bool hasFresh() const { return (this->middle.load(std::memory_order_acquire) & FreshBit) != 0; }
+
+private:
+    static constexpr unsigned IndexMask = 3u;
+    static constexpr unsigned FreshBit = 4u;
+
+    // each buffer on its own cache line so the two sides never share one
+    struct alignas(64) Slot
+    {
+        T value{};
+    };
+
+    Slot slots[3];
+    alignas(64) std::atomic<unsigned> middle{1};
+    alignas(64) unsigned writeIndex{0};   // producer only
+    alignas(64) unsigned readIndex{2};    // consumer only
+};
+
+#endif // TRIPLEBUFFER_HPP
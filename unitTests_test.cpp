@@ -4,3 +4,1995 @@ TEST(Ball, dummyTest){
 
     EXPECT_EQ(1,1);
 }
+
+#include "fluidgrid.hpp"
+#include <cstdint>
+
+TEST(FluidGrid, rowsAndInteriorAreCacheLineAligned){
+
+    ScalarField field(37, 21, 2);
+    for (int j = -2; j < 23; ++j)
+    {
+        auto address = reinterpret_cast<std::uintptr_t>(field.row(j));
+        EXPECT_EQ(address % ScalarField::AlignmentBytes, 0u);
+    }
+    EXPECT_EQ(field.getStride() % ScalarField::AlignmentFloats, 0);
+    EXPECT_GE(field.getStride(), 37 + 2*2);
+}
+
+TEST(FluidGrid, fieldsAreSeparateArrays){
+
+    FluidGrid grid(16, 8);
+    grid.density().at(3, 4) = 2.0f;
+    grid.u().at(3, 4) = -1.0f;
+    EXPECT_EQ(grid.density().at(3, 4), 2.0f);
+    EXPECT_EQ(grid.pressure().at(3, 4), 0.0f);
+    EXPECT_NE(grid.density().data(), grid.u().data());
+    EXPECT_EQ(grid.getMemoryBytes(), FluidGrid::NumFields * grid.density().getAllocatedBytes());
+}
+
+TEST(FluidGrid, boundaryMirrorsInterior){
+
+    ScalarField u(4, 4, 2);
+    for (int j = 0; j < 4; ++j)
+        for (int i = 0; i < 4; ++i)
+            u.at(i, j) = static_cast<float>(1 + i + 10*j);
+
+    applyBoundary(u, BoundaryKind::VelocityU);
+    EXPECT_EQ(u.at(-1, 2), -u.at(0, 2));
+    EXPECT_EQ(u.at(-2, 2), -u.at(1, 2));
+    EXPECT_EQ(u.at(4, 1), -u.at(3, 1));
+    EXPECT_EQ(u.at(1, -1), u.at(1, 0));
+    EXPECT_EQ(u.at(1, 5), u.at(1, 2));
+}
+
+#include "threadpool.hpp"
+#include "fluidsolver.hpp"
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+TEST(ThreadPool, parallelForCoversRangeOnce){
+
+    ThreadPool pool(4);
+    std::vector<std::atomic<int>> hits(1000);
+    for (int repeat = 0; repeat < 5; ++repeat)
+    {
+        pool.parallelFor(0, 1000, [&](int begin, int end) {
+            for (int k = begin; k < end; ++k)
+                hits[k]++;
+        });
+    }
+    for (auto& h : hits)
+        EXPECT_EQ(h.load(), 5);
+
+    double sum = pool.parallelSum(0, 100, [](int begin, int end) {
+        double s = 0.0;
+        for (int k = begin; k < end; ++k)
+            s += k;
+        return s;
+    });
+    EXPECT_DOUBLE_EQ(sum, 4950.0);
+}
+
+namespace
+{
+double divergenceNorm(const FluidGrid& grid)
+{
+    double sum = 0.0;
+    for (int j = 0; j < grid.getNy(); ++j)
+        for (int i = 0; i < grid.getNx(); ++i)
+        {
+            double d = grid.u().at(i + 1, j) - grid.u().at(i - 1, j) + grid.v().at(i, j + 1) - grid.v().at(i, j - 1);
+            sum += d*d;
+        }
+    return std::sqrt(sum);
+}
+}
+
+TEST(FluidSolver, projectionRemovesDivergence){
+
+    FluidGrid grid(32, 32);
+    FluidSolver solver(grid, 2);
+    solver.getPressureSolver().setMaxIterations(2000);
+    solver.getPressureSolver().setTolerance(1e-6);
+    for (int j = 0; j < 32; ++j)
+        for (int i = 0; i < 32; ++i)
+        {
+            grid.u().at(i, j) = std::sin(0.1f*i) * std::cos(0.05f*j);
+            grid.v().at(i, j) = std::sin(0.08f*j) + 0.3f*std::cos(0.1f*i);
+        }
+    applyBoundary(grid.u(), BoundaryKind::VelocityU);
+    applyBoundary(grid.v(), BoundaryKind::VelocityV);
+
+    double before = divergenceNorm(grid);
+    solver.project();
+    EXPECT_LT(divergenceNorm(grid), 0.5*before);
+    EXPECT_FALSE(solver.getLastPressureStats().residualHistory.empty());
+}
+
+TEST(FluidSolver, stepAddsAndTransportsDensity){
+
+    FluidGrid grid(24, 24);
+    FluidSolver solver(grid, 3);
+    solver.densitySource().at(12, 4) = 10.0f;
+    solver.vSource().at(12, 4) = 20.0f;
+    solver.step();
+
+    double total = 0.0;
+    for (int j = 0; j < 24; ++j)
+        for (int i = 0; i < 24; ++i)
+            total += grid.density().at(i, j);
+    EXPECT_GT(total, 0.5);
+    EXPECT_EQ(solver.densitySource().at(12, 4), 0.0f);
+}
+
+#include "multigridsolver.hpp"
+
+namespace
+{
+void fillPoissonRhs(ScalarField& rhs, const ScalarField& obstacle)
+{
+    for (int j = 0; j < rhs.getNy(); ++j)
+        for (int i = 0; i < rhs.getNx(); ++i)
+            rhs.at(i, j) = std::sin(0.37f*i + 0.11f*j) + ((i*7 + j*3) % 5 == 0 ? 1.0f : 0.0f);
+    removeFluidMean(rhs, obstacle);
+}
+}
+
+TEST(MultigridPressureSolver, cycleCountIndependentOfGridSize){
+
+    std::vector<int> cycles;
+    for (int n : {32, 128})
+    {
+        FluidGrid grid(n, n);
+        ScalarField rhs = grid.makeScratchField();
+        fillPoissonRhs(rhs, grid.obstacle());
+        ThreadPool pool(2);
+        MultigridPressureSolver solver(&pool);
+        solver.setTolerance(1e-5);
+        PressureSolveStats stats = solver.solve(grid.pressure(), rhs, grid.obstacle());
+        EXPECT_TRUE(stats.converged);
+        EXPECT_EQ(stats.iterations, static_cast<int>(stats.residualHistory.size()));
+        EXPECT_LT(computePoissonResidualNorm(grid.pressure(), rhs, grid.obstacle()) / computeFluidNorm(rhs, grid.obstacle()), 1e-5);
+        cycles.push_back(stats.iterations);
+    }
+    EXPECT_LE(cycles[1], cycles[0] + 2);
+}
+
+TEST(MultigridPressureSolver, fullMultigridHandlesObstaclesAndOddSizes){
+
+    FluidGrid grid(45, 37);
+    for (int j = 10; j < 20; ++j)
+        for (int i = 15; i < 22; ++i)
+            grid.setSolid(i, j, true);
+    ScalarField rhs = grid.makeScratchField();
+    fillPoissonRhs(rhs, grid.obstacle());
+
+    MultigridPressureSolver solver;
+    solver.setUseFullMultigrid(true);
+    solver.setMaxIterations(40);
+    PressureSolveStats stats = solver.solve(grid.pressure(), rhs, grid.obstacle());
+    EXPECT_TRUE(stats.converged);
+    EXPECT_GT(solver.getNumLevels(), 2);
+    EXPECT_LT(stats.residualHistory.back(), stats.residualHistory.front());
+}
+
+#include "pcgsolver.hpp"
+
+TEST(PcgPressureSolver, micPreconditionerConvergesAroundObstacles){
+
+    FluidGrid grid(64, 48);
+    for (int j = 5; j < 40; ++j)
+        grid.setSolid(20, j, true);
+    for (int i = 30; i < 60; ++i)
+        grid.setSolid(i, 30, true);
+    ScalarField rhs = grid.makeScratchField();
+    fillPoissonRhs(rhs, grid.obstacle());
+
+    ThreadPool pool(3);
+    PcgPressureSolver plain(&pool);
+    plain.setPreconditioner(PcgPreconditioner::None);
+    ScalarField p0 = grid.makeScratchField();
+    PressureSolveStats plainStats = plain.solve(p0, rhs, grid.obstacle());
+
+    PcgPressureSolver mic(&pool);
+    PressureSolveStats micStats = mic.solve(grid.pressure(), rhs, grid.obstacle());
+
+    EXPECT_TRUE(plainStats.converged);
+    EXPECT_TRUE(micStats.converged);
+    EXPECT_LT(micStats.iterations, plainStats.iterations);
+    EXPECT_LT(computePoissonResidualNorm(grid.pressure(), rhs, grid.obstacle()) / computeFluidNorm(rhs, grid.obstacle()), 1e-4);
+}
+
+TEST(PcgPressureSolver, pipelinedMatchesStandard){
+
+    FluidGrid grid(40, 40);
+    for (int j = 12; j < 25; ++j)
+        for (int i = 8; i < 14; ++i)
+            grid.setSolid(i, j, true);
+    ScalarField rhs = grid.makeScratchField();
+    fillPoissonRhs(rhs, grid.obstacle());
+
+    ThreadPool pool(2);
+    PcgPressureSolver standard(&pool);
+    ScalarField a = grid.makeScratchField();
+    PressureSolveStats standardStats = standard.solve(a, rhs, grid.obstacle());
+
+    PcgPressureSolver pipelined(&pool);
+    pipelined.setPipelined(true);
+    ScalarField b = grid.makeScratchField();
+    PressureSolveStats pipelinedStats = pipelined.solve(b, rhs, grid.obstacle());
+
+    EXPECT_TRUE(pipelinedStats.converged);
+    EXPECT_LE(pipelinedStats.iterations, 2*standardStats.iterations);
+    EXPECT_LT(computePoissonResidualNorm(b, rhs, grid.obstacle()) / computeFluidNorm(rhs, grid.obstacle()), 1e-4);
+}
+
+#include "fft.hpp"
+#include "spectralsolver.hpp"
+#include <complex>
+
+TEST(FftPlan, matchesDirectDftForRadix2AndBluestein){
+
+    const double pi = 3.14159265358979323846;
+    for (int n : {8, 12, 7})
+    {
+        std::vector<std::complex<double>> x(n), reference(n);
+        for (int k = 0; k < n; ++k)
+            x[k] = std::complex<double>(std::sin(1.3*k), std::cos(0.4*k*k));
+        for (int k = 0; k < n; ++k)
+            for (int m = 0; m < n; ++m)
+                reference[k] += x[m] * std::polar(1.0, -2.0*pi*k*m/n);
+
+        FftPlan plan(n);
+        std::vector<std::complex<double>> scratch(plan.getScratchSize());
+        std::vector<std::complex<double>> y = x;
+        plan.forward(y.data(), scratch.data());
+        for (int k = 0; k < n; ++k)
+            EXPECT_NEAR(std::abs(y[k] - reference[k]), 0.0, 1e-9);
+
+        plan.inverse(y.data(), scratch.data());
+        for (int k = 0; k < n; ++k)
+            EXPECT_NEAR(std::abs(y[k]/static_cast<double>(n) - x[k]), 0.0, 1e-9);
+    }
+}
+
+TEST(RealTransformPlan, roundTripsEveryKind){
+
+    const int n = 10;
+    std::vector<double> x(n);
+    for (int k = 0; k < n; ++k)
+        x[k] = std::cos(0.7*k) + 0.1*k;
+
+    auto roundTrip = [&](RealTransformKind forward, RealTransformKind inverse) {
+        RealTransformPlan f(forward, n);
+        RealTransformPlan b(inverse, n);
+        std::vector<std::complex<double>> scratch(std::max(f.getScratchSize(), b.getScratchSize()));
+        std::vector<double> y(n);
+        f.apply(x.data(), y.data(), scratch.data());
+        b.apply(y.data(), y.data(), scratch.data());
+        for (int k = 0; k < n; ++k)
+            EXPECT_NEAR(y[k]*b.getInverseScale(), x[k], 1e-9);
+    };
+    roundTrip(RealTransformKind::Hartley, RealTransformKind::Hartley);
+    roundTrip(RealTransformKind::Dst1, RealTransformKind::Dst1);
+    roundTrip(RealTransformKind::Dct2, RealTransformKind::Dct3);
+}
+
+TEST(SpectralPressureSolver, solvesEachBoundaryDirectly){
+
+    ThreadPool pool(2);
+    for (SpectralBoundary boundary : {SpectralBoundary::Neumann, SpectralBoundary::Dirichlet, SpectralBoundary::Periodic})
+    {
+        for (int nx : {48, 30})
+        {
+            FluidGrid grid(nx, 48);
+            ScalarField rhs = grid.makeScratchField();
+            fillPoissonRhs(rhs, grid.obstacle());
+            SpectralPressureSolver solver(boundary, &pool);
+            PressureSolveStats stats = solver.solve(grid.pressure(), rhs, grid.obstacle());
+            EXPECT_EQ(stats.iterations, 1);
+            EXPECT_LT(stats.residualHistory.back(), 1e-5);
+        }
+    }
+
+    // the Neumann variant solves the same system as the iterative solvers
+    FluidGrid grid(32, 32);
+    ScalarField rhs = grid.makeScratchField();
+    fillPoissonRhs(rhs, grid.obstacle());
+    SpectralPressureSolver solver;
+    solver.solve(grid.pressure(), rhs, grid.obstacle());
+    EXPECT_LT(computePoissonResidualNorm(grid.pressure(), rhs, grid.obstacle()) / computeFluidNorm(rhs, grid.obstacle()), 1e-5);
+}
+
+TEST(SpectralPressureSolver, fallsBackWhenObstaclesPresent){
+
+    FluidGrid grid(32, 32);
+    grid.setSolid(10, 10, true);
+    ScalarField rhs = grid.makeScratchField();
+    fillPoissonRhs(rhs, grid.obstacle());
+    SpectralPressureSolver solver;
+    PressureSolveStats stats = solver.solve(grid.pressure(), rhs, grid.obstacle());
+    EXPECT_TRUE(stats.converged);
+    EXPECT_GT(stats.iterations, 1);
+}
+
+#include "lbmsolver.hpp"
+
+TEST(LatticeBoltzmannSolver, conservesMassInClosedBox){
+
+    for (LbmCollision collision : {LbmCollision::Bgk, LbmCollision::Mrt})
+    {
+        LatticeBoltzmannSolver lbm(24, 20, 2);
+        lbm.parameters().collision = collision;
+        lbm.setSolid(10, 10, true);
+        lbm.initialize(1.0f, 0.05f, -0.02f);
+
+        auto totalMass = [&]() {
+            double mass = 0.0;
+            for (int j = 0; j < 20; ++j)
+                for (int i = 0; i < 24; ++i)
+                    if (!(i == 10 && j == 10))
+                        mass += lbm.density(i, j);
+            return mass;
+        };
+        double before = totalMass();
+        lbm.run(7);
+        EXPECT_NEAR(totalMass(), before, 1e-3);
+        lbm.run(8);
+        EXPECT_NEAR(totalMass(), before, 1e-3);
+        EXPECT_GT(lbm.getMlups(), 0.0);
+    }
+}
+
+TEST(LatticeBoltzmannSolver, lidDrivesCavityFlow){
+
+    LatticeBoltzmannSolver lbm(32, 32, 2);
+    lbm.parameters().lidVelocity = 0.1f;
+    lbm.parameters().collision = LbmCollision::Mrt;
+    lbm.run(400);
+
+    float ux, uy;
+    lbm.velocity(16, 31, ux, uy);
+    EXPECT_GT(ux, 0.02f);
+    lbm.velocity(16, 8, ux, uy);
+    EXPECT_LT(ux, 0.0f);
+
+    FluidGrid grid(32, 32);
+    lbm.exportTo(grid);
+    EXPECT_NEAR(grid.density().at(5, 5), 1.0f, 0.05f);
+    EXPECT_EQ(lbm.getPopulationBytes(), 9 * grid.density().getAllocatedBytes());
+}
+
+#include "sphsolver.hpp"
+
+TEST(SphSolver, cellListDensityMatchesBruteForce){
+
+    SphParameters params;
+    params.width = 0.5f;
+    params.height = 0.4f;
+    SphSolver sph(params, 3);
+    for (int k = 0; k < 400; ++k)
+        sph.addParticle(0.5f*std::fmod(0.618034f*k, 1.0f), 0.4f*std::fmod(0.414214f*k + 0.1f, 1.0f));
+    sph.computeDensities();
+
+    const float pi = 3.14159265358979f;
+    float h = params.smoothingLength;
+    float poly6 = 4.0f / (pi*std::pow(h, 8.0f));
+    const std::vector<float>& x = sph.positionsX();
+    const std::vector<float>& y = sph.positionsY();
+    for (int p = 0; p < sph.getNumParticles(); p += 37)
+    {
+        float sum = 0.0f;
+        for (int q = 0; q < sph.getNumParticles(); ++q)
+        {
+            float r2 = (x[p] - x[q])*(x[p] - x[q]) + (y[p] - y[q])*(y[p] - y[q]);
+            if (r2 < h*h)
+                sum += std::pow(h*h - r2, 3.0f);
+        }
+        EXPECT_NEAR(sph.densities()[p], params.particleMass*poly6*sum, 1e-3f*sph.densities()[p]);
+    }
+}
+
+TEST(SphSolver, sortPutsParticlesInZOrder){
+
+    SphParameters params;
+    SphSolver sph(params, 2);
+    for (int k = 0; k < 300; ++k)
+        sph.addParticle(std::fmod(0.754877f*k, 1.0f), std::fmod(0.569840f*k, 1.0f));
+    sph.sortParticles();
+    for (int p = 1; p < sph.getNumParticles(); ++p)
+        EXPECT_LE(sph.getCellRank(sph.positionsX()[p - 1], sph.positionsY()[p - 1]),
+                  sph.getCellRank(sph.positionsX()[p], sph.positionsY()[p]));
+    EXPECT_EQ(SphSolver::mortonCode(3, 5), 39u);
+}
+
+TEST(SphSolver, damBreakStaysInDomainAndFalls){
+
+    SphParameters params;
+    params.width = 0.6f;
+    params.height = 0.6f;
+    SphSolver sph(params, 2);
+    sph.addBlock(0.0f, 0.1f, 0.2f, 0.4f, 0.02f);
+    auto meanHeight = [&]() {
+        double sum = 0.0;
+        for (float py : sph.positionsY())
+            sum += py;
+        return sum / sph.getNumParticles();
+    };
+    double start = meanHeight();
+    for (int s = 0; s < 100; ++s)
+        sph.step();
+    EXPECT_LT(meanHeight(), start);
+    for (int p = 0; p < sph.getNumParticles(); ++p)
+    {
+        EXPECT_GE(sph.positionsX()[p], 0.0f);
+        EXPECT_LE(sph.positionsX()[p], params.width);
+        EXPECT_TRUE(std::isfinite(sph.velocitiesY()[p]));
+    }
+
+    FluidGrid grid(12, 12);
+    sph.rasterizeTo(grid);
+    EXPECT_GT(grid.density().at(1, 3), 0.0f);
+}
+
+TEST(SphSolver, stepResizesCellsAfterParameterChange){
+
+    SphParameters params;
+    SphSolver sph(params, 1);
+    sph.addParticle(0.5f, 0.5f);
+    // a wider domain is clamped into the old last column until the next step
+    sph.parameters().width = 2.0f;
+    EXPECT_EQ(sph.getCellRank(1.9f, 0.5f), sph.getCellRank(0.99f, 0.5f));
+    sph.step();
+    EXPECT_NE(sph.getCellRank(1.9f, 0.5f), sph.getCellRank(0.99f, 0.5f));
+
+    // and a smaller kernel radius splits the old cells
+    sph.parameters().smoothingLength = 0.01f;
+    sph.step();
+    EXPECT_NE(sph.getCellRank(0.505f, 0.5f), sph.getCellRank(0.515f, 0.5f));
+    EXPECT_NE(sph.getCellRank(1.985f, 0.995f), sph.getCellRank(1.965f, 0.995f));
+}
+
+#include "flipsolver.hpp"
+
+TEST(FlipSolver, sortGroupsParticlesByTile){
+
+    FluidGrid grid(40, 24);
+    FluidSolver solver(grid, 3);
+    FlipSolver flip(solver);
+    flip.parameters().tileSize = 6;
+    for (int k = 0; k < 2000; ++k)
+        flip.addParticle(std::fmod(0.754877f*k, 1.0f)*39.0f, std::fmod(0.569840f*k, 1.0f)*23.0f);
+    flip.sortParticles();
+    const std::vector<int>& start = flip.getTileStart();
+    ASSERT_EQ(static_cast<int>(start.size()), flip.getNumTilesX()*flip.getNumTilesY() + 1);
+    EXPECT_EQ(start.back(), flip.getNumParticles());
+    for (int t = 0; t + 1 < static_cast<int>(start.size()); ++t)
+        for (int p = start[t]; p < start[t + 1]; ++p)
+        {
+            int ci = static_cast<int>(flip.positionsX()[p] + 0.5f);
+            int cj = static_cast<int>(flip.positionsY()[p] + 0.5f);
+            EXPECT_EQ((cj / 6)*flip.getNumTilesX() + ci / 6, t);
+        }
+}
+
+TEST(FlipSolver, colouredScatterMatchesSerialAndIsAffineExact){
+
+    auto transfer = [](int numThreads, FluidGrid& grid) {
+        FluidSolver solver(grid, numThreads);
+        FlipSolver flip(solver);
+        for (int k = 0; k < 4*grid.getNx()*grid.getNy(); ++k)
+        {
+            float x = std::fmod(0.754877f*k, 1.0f)*(grid.getNx() - 1);
+            float y = std::fmod(0.569840f*k, 1.0f)*(grid.getNy() - 1);
+            flip.addParticle(x, y, 0.1f*x - 0.2f*y + 1.0f, 0.3f*x + 0.05f*y);
+        }
+        flip.sortParticles();
+        flip.particlesToGrid();
+    };
+    FluidGrid serial(33, 29);
+    FluidGrid parallel(33, 29);
+    transfer(1, serial);
+    transfer(4, parallel);
+    for (int j = 0; j < 29; ++j)
+        for (int i = 0; i < 33; ++i)
+        {
+            ASSERT_EQ(serial.u().at(i, j), parallel.u().at(i, j));
+            ASSERT_EQ(serial.v().at(i, j), parallel.v().at(i, j));
+        }
+    // away from the walls a linear particle field lands on the nodes almost unchanged
+    EXPECT_NEAR(serial.u().at(16, 14), 0.1f*16 - 0.2f*14 + 1.0f, 0.05f);
+    EXPECT_NEAR(serial.v().at(16, 14), 0.3f*16 + 0.05f*14, 0.05f);
+}
+
+TEST(FlipSolver, stepProducesDivergenceFreeParticleFlow){
+
+    FluidGrid grid(32, 32);
+    FluidSolver solver(grid, 2);
+    solver.usePressureSolver(PressureSolverKind::Multigrid);
+    FlipSolver flip(solver);
+    flip.seedRectangle(0, 0, 31, 31, 2);
+    for (int j = 0; j < 32; ++j)
+        for (int i = 0; i < 32; ++i)
+            grid.u().at(i, j) = std::sin(0.1f*i)*std::cos(0.05f*j);
+    double unprojected = divergenceNorm(grid);
+    for (int j = 0; j < 32; ++j)
+        for (int i = 0; i < 32; ++i)
+            solver.uSource().at(i, j) = grid.u().at(i, j) / solver.parameters().timeStep;
+    int count = flip.getNumParticles();
+    for (TransferMode mode : {TransferMode::Apic, TransferMode::Flip, TransferMode::Pic})
+    {
+        flip.parameters().mode = mode;
+        flip.step();
+        EXPECT_EQ(flip.getNumParticles(), count);
+        EXPECT_LT(divergenceNorm(grid), 0.5*unprojected);
+        for (int p = 0; p < count; ++p)
+        {
+            ASSERT_GE(flip.positionsX()[p], 0.0f);
+            ASSERT_LE(flip.positionsX()[p], 31.0f);
+        }
+    }
+    double momentum = 0.0;
+    for (float value : flip.velocitiesX())
+        momentum += std::fabs(value);
+    EXPECT_GT(momentum, 0.0);
+}
+
+#include "macgrid.hpp"
+
+TEST(MacGrid, samplersReproduceLinearFieldsPerComponent){
+
+    MacGrid grid(9, 7);
+    for (int j = 0; j < 7; ++j)
+        for (int i = 0; i <= 9; ++i)
+            grid.u().at(i, j) = 2.0f*i - 0.5f*(j + 0.5f);
+    for (int j = 0; j <= 7; ++j)
+        for (int i = 0; i < 9; ++i)
+            grid.v().at(i, j) = 0.25f*(i + 0.5f) + 3.0f*j;
+    for (int j = 0; j < 7; ++j)
+        for (int i = 0; i < 9; ++i)
+            grid.density().at(i, j) = (i + 0.5f) + (j + 0.5f);
+
+    float xs[5] = {0.7f, 2.25f, 4.5f, 6.1f, 8.3f};
+    float ys[5] = {1.1f, 3.5f, 2.9f, 5.75f, 4.2f};
+    float out[5];
+    sampleMacBatch<MacComponent::U>(grid.u(), xs, ys, out, 5);
+    for (int k = 0; k < 5; ++k)
+    {
+        EXPECT_NEAR(out[k], 2.0f*xs[k] - 0.5f*ys[k], 1e-4f);
+        EXPECT_FLOAT_EQ(out[k], sampleMac<MacComponent::U>(grid.u(), xs[k], ys[k]));
+    }
+    sampleMacBatch<MacComponent::V>(grid.v(), xs, ys, out, 5);
+    for (int k = 0; k < 5; ++k)
+        EXPECT_NEAR(out[k], 0.25f*xs[k] + 3.0f*ys[k], 1e-4f);
+    sampleMacBatch<MacComponent::Center>(grid.density(), xs, ys, out, 5);
+    for (int k = 0; k < 5; ++k)
+        EXPECT_NEAR(out[k], xs[k] + ys[k], 1e-4f);
+}
+
+TEST(MacGrid, projectionIsDivergenceFree){
+
+    MacGrid grid(24, 20);
+    grid.setSolid(10, 8, true);
+    grid.setSolid(11, 8, true);
+    for (int j = 0; j < 20; ++j)
+        for (int i = 0; i <= 24; ++i)
+            grid.u().at(i, j) = std::sin(0.7f*i)*std::cos(0.3f*j) + 1.0f;
+    for (int j = 0; j <= 20; ++j)
+        for (int i = 0; i < 24; ++i)
+            grid.v().at(i, j) = std::cos(1.3f*i + 0.4f*j);
+    grid.enforceSolidFaces();
+    double before = grid.divergenceNorm();
+
+    PcgPressureSolver solver;
+    solver.setTolerance(1e-6);
+    ScalarField rhs(24, 20, 1);
+    ThreadPool pool(2);
+    projectMac(grid, solver, rhs, &pool);
+    // the staggered stencil has no checkerboard modes, so the whole divergence goes away
+    EXPECT_LT(grid.divergenceNorm(), 1e-3*before);
+    EXPECT_EQ(grid.u().at(10, 8), 0.0f);
+    EXPECT_EQ(grid.v().at(11, 9), 0.0f);
+}
+
+TEST(MacGrid, uniformFlowTranslatesScalar){
+
+    MacGrid grid(32, 16);
+    grid.u().fill(1.0f);
+    grid.v().fill(0.0f);
+    ScalarField uOut(33, 16, 1), vOut(32, 17, 1);
+    advectMacVelocity(grid, uOut, vOut, 0.5f);
+    EXPECT_FLOAT_EQ(uOut.at(12, 7), 1.0f);
+    EXPECT_FLOAT_EQ(vOut.at(12, 7), 0.0f);
+
+    ScalarField blob(32, 16, 1), moved(32, 16, 1);
+    for (int j = 0; j < 16; ++j)
+        for (int i = 0; i < 32; ++i)
+            blob.at(i, j) = static_cast<float>(i);
+    advectMacScalar(grid, moved, blob, 2.0f);
+    EXPECT_FLOAT_EQ(moved.at(10, 5), 8.0f);
+}
+
+#include "cpudispatch.hpp"
+
+namespace
+{
+std::vector<IsaLevel> supportedIsaLevels()
+{
+    std::vector<IsaLevel> levels;
+    for (IsaLevel level : {IsaLevel::Scalar, IsaLevel::Sse42, IsaLevel::Avx2, IsaLevel::Avx512})
+        if (static_cast<int>(level) <= static_cast<int>(detectIsaLevel()))
+            levels.push_back(level);
+    return levels;
+}
+}
+
+TEST(CpuDispatch, everyLevelMatchesScalarKernels){
+
+    // odd width so every vector kernel also runs its scalar tail
+    const int nx = 45, ny = 9;
+    ScalarField src(nx, ny), u(nx, ny), v(nx, ny), solid(nx, ny), expected(nx, ny), actual(nx, ny);
+    for (int j = -1; j <= ny; ++j)
+        for (int i = -1; i <= nx; ++i)
+        {
+            src.at(i, j) = std::sin(0.37f*i) + std::cos(0.21f*j*i);
+            u.at(i, j) = 7.0f*std::sin(0.5f*i + j);
+            v.at(i, j) = 5.0f*std::cos(0.3f*i - j);
+        }
+    solid.at(12, 4) = 1.0f;
+    markWallsSolid(solid);
+
+    const KernelTable& reference = kernelsFor(IsaLevel::Scalar);
+    for (IsaLevel level : supportedIsaLevels())
+    {
+        const KernelTable& table = kernelsFor(level);
+        EXPECT_STREQ(table.name, isaLevelName(level));
+        for (int j = 0; j < ny; ++j)
+        {
+            AdvectionRowArgs args;
+            args.src = src.row(0);
+            args.srcStride = src.getStride();
+            args.u = u.row(j);
+            args.v = v.row(j);
+            args.solid = solid.row(j);
+            args.j = j;
+            args.nx = nx;
+            args.dt0 = 0.8f;
+            args.maxX = nx - 0.5f;
+            args.maxY = ny - 0.5f;
+            args.out = expected.row(j);
+            reference.advectRow(args);
+            args.out = actual.row(j);
+            table.advectRow(args);
+        }
+        for (int j = 0; j < ny; ++j)
+            for (int i = 0; i < nx; ++i)
+                EXPECT_NEAR(actual.at(i, j), expected.at(i, j), 1e-5f) << table.name << " at " << i << "," << j;
+        EXPECT_EQ(actual.at(12, 4), 0.0f);
+
+        for (int j = 0; j < ny; ++j)
+        {
+            JacobiRowArgs args;
+            args.centre = src.row(j);
+            args.down = src.row(j - 1);
+            args.up = src.row(j + 1);
+            args.solid = solid.row(j);
+            args.solidDown = solid.row(j - 1);
+            args.solidUp = solid.row(j + 1);
+            args.rhs = u.row(j);
+            args.nx = nx;
+            args.out = expected.row(j);
+            reference.jacobiRow(args);
+            args.out = actual.row(j);
+            table.jacobiRow(args);
+            for (int i = 0; i < nx; ++i)
+                EXPECT_FLOAT_EQ(actual.at(i, j), expected.at(i, j));
+            EXPECT_NEAR(table.fluidSumSquares(src.row(j), solid.row(j), nx),
+                        reference.fluidSumSquares(src.row(j), solid.row(j), nx), 1e-9);
+        }
+
+        // a row-major field is a valid tile: columns [i0, i1) of every row, one stride apart
+        actual.fill(0.0f);
+        for (int i0 : {0, 8, 24, 40})
+        {
+            int i1 = std::min(i0 == 0 ? 8 : i0 + 16, nx);
+            JacobiTileArgs args;
+            args.centre = src.row(0) + i0;
+            args.solid = solid.row(0) + i0;
+            args.rhs = u.row(0) + i0;
+            args.out = actual.row(0) + i0;
+            args.down = src.row(-1) + i0;
+            args.up = src.row(ny) + i0;
+            args.solidDown = solid.row(-1) + i0;
+            args.solidUp = solid.row(ny) + i0;
+            args.left = -1;
+            args.right = i1 - i0;
+            args.stride = src.getStride();
+            args.nx = i1 - i0;
+            args.rows = ny;
+            table.jacobiTile(args);
+        }
+        for (int j = 0; j < ny; ++j)
+            for (int i = 0; i < nx; ++i)
+                EXPECT_FLOAT_EQ(actual.at(i, j), expected.at(i, j)) << table.name << " tile at " << i << "," << j;
+    }
+}
+
+TEST(CpuDispatch, forcedLevelIsClampedAndParsed){
+
+    IsaLevel original = getIsaLevel();
+    IsaLevel parsed;
+    ASSERT_TRUE(parseIsaLevel("avx2", parsed));
+    EXPECT_EQ(parsed, IsaLevel::Avx2);
+    EXPECT_FALSE(parseIsaLevel("neon", parsed));
+
+    forceIsaLevel(IsaLevel::Scalar);
+    EXPECT_EQ(getIsaLevel(), IsaLevel::Scalar);
+    EXPECT_STREQ(activeKernels().name, "scalar");
+    forceIsaLevel(IsaLevel::Avx512);
+    EXPECT_LE(static_cast<int>(getIsaLevel()), static_cast<int>(detectIsaLevel()));
+    forceIsaLevel(original);
+}
+
+#include "fieldimage.hpp"
+
+TEST(FieldImage, halfConversionRoundsToNearestEven){
+
+    EXPECT_EQ(floatToHalf(0.0f), 0x0000);
+    EXPECT_EQ(floatToHalf(-0.0f), 0x8000);
+    EXPECT_EQ(floatToHalf(1.0f), 0x3c00);
+    EXPECT_EQ(floatToHalf(-2.0f), 0xc000);
+    EXPECT_EQ(floatToHalf(65504.0f), 0x7bff);
+    EXPECT_EQ(floatToHalf(70000.0f), 0x7c00);
+    EXPECT_EQ(floatToHalf(std::ldexp(1.0f, -24)), 0x0001);
+    EXPECT_EQ(floatToHalf(std::ldexp(1.0f, -25)), 0x0000);
+    // 1 + 2^-11 is halfway between two halves and rounds to the even one
+    EXPECT_EQ(floatToHalf(1.0f + std::ldexp(1.0f, -11)), 0x3c00);
+    EXPECT_EQ(floatToHalf(1.0f + 3.0f*std::ldexp(1.0f, -11)), 0x3c02);
+    for (float value : {0.1f, -3.75f, 1234.5f, 6.1e-5f, 3.0e-6f})
+        EXPECT_NEAR(halfToFloat(floatToHalf(value)), value, std::fabs(value)*1e-3f + 6e-8f);
+
+    ScalarField field(5, 3);
+    field.at(4, 2) = 0.5f;
+    std::vector<std::uint16_t> packed;
+    packFieldAsHalf(field, packed);
+    ASSERT_EQ(packed.size(), 15u);
+    EXPECT_EQ(packed[14], 0x3800);
+    EXPECT_EQ(fieldUploadBytes(field, FieldTextureFormat::R16F), 30u);
+    EXPECT_EQ(fieldUploadBytes(field, FieldTextureFormat::R32F), 60u);
+}
+
+TEST(FieldImage, colormapLookupMatchesLutEnds){
+
+    std::vector<float> lut = buildColormapLut(Colormap::Grayscale, 64);
+    ASSERT_EQ(lut.size(), 256u);
+    float rgba[4];
+    FieldRange range{-2.0f, 2.0f};
+    mapToRgba(lut, range, -5.0f, rgba);
+    EXPECT_FLOAT_EQ(rgba[0], 0.0f);
+    mapToRgba(lut, range, 5.0f, rgba);
+    EXPECT_FLOAT_EQ(rgba[0], 1.0f);
+    mapToRgba(lut, range, 0.0f, rgba);
+    EXPECT_NEAR(rgba[1], 0.5f, 1e-3f);
+    EXPECT_FLOAT_EQ(rgba[3], 1.0f);
+
+    ScalarField field(4, 4);
+    field.at(1, 2) = -3.0f;
+    field.at(3, 0) = 7.0f;
+    FieldRange computed = computeFieldRange(field);
+    EXPECT_FLOAT_EQ(computed.min, -3.0f);
+    EXPECT_FLOAT_EQ(computed.max, 7.0f);
+
+    std::vector<float> packed(16, -1.0f);
+    FieldRange fused = packFieldRows(field, packed.data());
+    EXPECT_FLOAT_EQ(fused.min, computed.min);
+    EXPECT_FLOAT_EQ(fused.max, computed.max);
+    EXPECT_FLOAT_EQ(packed[2*4 + 1], -3.0f);
+    EXPECT_FLOAT_EQ(packed[3], 7.0f);
+}
+
+#include "gridgeometry.hpp"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+TEST(GridGeometry, bufferAndProceduralPathsCoverTheSameGrid){
+
+    const int n = 5;
+    std::vector<float> vertices = buildGridVertices(n);
+    std::vector<int> indices = buildGridIndices(n);
+    ASSERT_EQ(vertices.size(), 3u*(n + 1)*(n + 1));
+    ASSERT_EQ(indices.size(), 6u*n*n);
+
+    // both paths use the same winding, and the buffer triangles add up to n^2 quads
+    auto signedArea = [](float ax, float ay, float bx, float by, float cx, float cy) {
+        return 0.5f*((bx - ax)*(cy - ay) - (cx - ax)*(by - ay));
+    };
+    float total = 0.0f;
+    for (std::size_t t = 0; t < indices.size(); t += 3)
+    {
+        const float* a = &vertices[3*indices[t]];
+        const float* b = &vertices[3*indices[t + 1]];
+        const float* c = &vertices[3*indices[t + 2]];
+        total += signedArea(a[0], a[1], b[0], b[1], c[0], c[1]);
+    }
+    float quad = 0.0f;
+    for (int k = 0; k < ProceduralQuadVertexCount; k += 3)
+    {
+        float x[3], y[3];
+        for (int c = 0; c < 3; ++c)
+            proceduralQuadCorner(k + c, x[c], y[c]);
+        quad += signedArea(x[0], y[0], x[1], y[1], x[2], y[2]);
+    }
+    EXPECT_FLOAT_EQ(total, quad*n*n);
+    EXPECT_FLOAT_EQ(std::fabs(quad), 1.0f);
+
+    // the buffers the procedural path avoids at n = 4096
+    EXPECT_GT(gridGeometryBytes(4096), 550u*1000u*1000u);
+}
+
+TEST(GridGeometry, vertexShaderGetsTheCornerTableFromCpp){
+
+    std::ifstream file(SIMFLUID_SOURCE_DIR "/shaders/pass_through.vert");
+    ASSERT_TRUE(file.good());
+    std::stringstream shipped;
+    shipped << file.rdbuf();
+    // the shader only holds the marker; the table is spliced in once, where the marker was
+    ASSERT_EQ(shipped.str().find("vec2 quadCorners"), std::string::npos);
+    std::string source = insertProceduralQuadCorners(shipped.str());
+    std::size_t table = source.find("const vec2 quadCorners[6] = vec2[6](");
+    ASSERT_NE(table, std::string::npos);
+    EXPECT_EQ(source.find("const vec2 quadCorners", table + 1), std::string::npos);
+    EXPECT_EQ(source.find(ProceduralQuadMarker), std::string::npos);
+    EXPECT_NE(source.find("quadCorners[gl_VertexID]"), std::string::npos);
+
+    // the spliced GLSL lists exactly the corners proceduralQuadCorner() hands out
+    std::size_t at = source.find("](", table) + 2;
+    for (int k = 0; k < ProceduralQuadVertexCount; ++k)
+    {
+        at = source.find("vec2(", at);
+        ASSERT_NE(at, std::string::npos);
+        float glslX = 0.0f, glslY = 0.0f, x = 0.0f, y = 0.0f;
+        ASSERT_EQ(std::sscanf(source.c_str() + at, "vec2(%f, %f)", &glslX, &glslY), 2);
+        proceduralQuadCorner(k, x, y);
+        EXPECT_EQ(glslX, x) << k;
+        EXPECT_EQ(glslY, y) << k;
+        at += 5;
+    }
+
+    EXPECT_THROW(insertProceduralQuadCorners("void main() {}"), std::invalid_argument);
+}
+
+TEST(GridGeometry, quadtreeLeafLinesOutlineEveryLeaf){
+
+    QuadtreeGrid tree(8, 4);
+    tree.buildUniform(4);
+    std::vector<float> lines = buildQuadtreeLeafLines(tree.getLeaves());
+    ASSERT_EQ(lines.size(), 2u*8u*3u);
+
+    // every segment is axis-aligned and as long as its leaf's side
+    float length = 0.0f;
+    for (std::size_t v = 0; v < lines.size(); v += 6)
+    {
+        float dx = lines[v + 3] - lines[v];
+        float dy = lines[v + 4] - lines[v + 1];
+        EXPECT_TRUE(dx == 0.0f || dy == 0.0f);
+        length += std::fabs(dx) + std::fabs(dy);
+    }
+    EXPECT_FLOAT_EQ(length, 2.0f*4.0f*4.0f);
+}
+
+
+#include "uploadslotring.hpp"
+#include <thread>
+
+TEST(UploadSlotRing, consumerTakesNewestAndProducerNeverWaits){
+
+    UploadSlotRing ring;
+    using State = UploadSlotRing::SlotState;
+    EXPECT_EQ(ring.acquireLatestForUpload(), -1);
+
+    int a = ring.acquireForWrite();
+    ring.publish(a);
+    int b = ring.acquireForWrite();
+    ring.publish(b);
+    // the older frame is recycled, the newer one uploaded
+    EXPECT_EQ(ring.acquireLatestForUpload(), b);
+    EXPECT_EQ(ring.getState(a), State::Free);
+    EXPECT_EQ(ring.getDroppedFrames(), 1u);
+    ring.markInFlight(b);
+
+    // with one slot in flight and one being written, a third is still free
+    int c = ring.acquireForWrite();
+    int d = ring.acquireForWrite();
+    ASSERT_GE(c, 0);
+    ASSERT_GE(d, 0);
+    EXPECT_EQ(ring.acquireForWrite(), -1);
+    EXPECT_EQ(ring.getDroppedFrames(), 2u);
+    ring.cancel(c);
+    ring.publish(d);
+    EXPECT_EQ(ring.acquireLatestForUpload(), d);
+    ring.release(b);
+    ring.release(d);
+    for (int k = 0; k < UploadSlotRing::NumSlots; ++k)
+        EXPECT_EQ(ring.getState(k), State::Free);
+}
+
+TEST(UploadSlotRing, concurrentFramesArriveInOrderAndIntact){
+
+    // payloads stand in for the mapped buffers: a frame must never be torn or go backwards
+    UploadSlotRing ring;
+    const int frames = 20000;
+    const int words = 64;
+    std::vector<std::vector<int>> payload(UploadSlotRing::NumSlots, std::vector<int>(words, 0));
+    std::atomic<bool> done{false};
+
+    std::thread producer([&]() {
+        for (int frame = 1; frame <= frames; ++frame)
+        {
+            int slot = ring.acquireForWrite();
+            if (slot < 0)
+                continue;
+            for (int& w : payload[slot])
+                w = frame;
+            ring.publish(slot);
+        }
+        done = true;
+    });
+
+    int last = 0;
+    int received = 0;
+    bool torn = false;
+    int inFlight = -1;
+    for (;;)
+    {
+        // models one frame of GPU latency: the previous upload retires on the next pass
+        if (inFlight >= 0)
+        {
+            ring.release(inFlight);
+            inFlight = -1;
+        }
+        // read before polling, so the producer's last frame is never missed
+        bool finished = done;
+        int slot = ring.acquireLatestForUpload();
+        if (slot < 0)
+        {
+            if (finished)
+                break;
+            continue;
+        }
+        int frame = payload[slot][0];
+        for (int w : payload[slot])
+            torn = torn || (w != frame);
+        EXPECT_GT(frame, last);
+        last = frame;
+        ++received;
+        ring.markInFlight(slot);
+        inFlight = slot;
+    }
+    producer.join();
+    EXPECT_FALSE(torn);
+    EXPECT_GT(received, 0);
+}
+
+
+#include "triplebuffer.hpp"
+#include "simulationthread.hpp"
+#include <array>
+#include <chrono>
+
+TEST(TripleBuffer, consumerSeesLatestCompleteValue){
+
+    TripleBuffer<int> single(-1);
+    EXPECT_FALSE(single.update());
+    EXPECT_EQ(single.readBuffer(), -1);
+    single.publish(1);
+    single.publish(2);
+    EXPECT_TRUE(single.update());
+    EXPECT_EQ(single.readBuffer(), 2);
+    EXPECT_FALSE(single.update());
+    EXPECT_EQ(single.readBuffer(), 2);
+
+    // every array is written with one value; a torn read would mix two of them
+    TripleBuffer<std::array<int, 32>> buffer;
+    const int frames = 50000;
+    std::thread producer([&]() {
+        for (int frame = 1; frame <= frames; ++frame)
+        {
+            buffer.writeBuffer().fill(frame);
+            buffer.publish();
+        }
+    });
+    int last = 0;
+    bool torn = false;
+    bool backwards = false;
+    while (last < frames)
+    {
+        if (!buffer.update())
+            continue;
+        const std::array<int, 32>& value = buffer.readBuffer();
+        for (int v : value)
+            torn = torn || (v != value[0]);
+        backwards = backwards || (value[0] <= last);
+        last = value[0];
+    }
+    producer.join();
+    EXPECT_FALSE(torn);
+    EXPECT_FALSE(backwards);
+}
+
+TEST(SimulationThread, stepsOffTheCallerThreadAndStopsCleanly){
+
+    FluidGrid grid(32, 32);
+    FluidSolver solver(grid);
+    std::atomic<int> published{0};
+    std::thread::id caller = std::this_thread::get_id();
+    std::atomic<bool> sameThread{false};
+
+    SimulationThread simulation(
+        [&]() {
+            sameThread = sameThread || (std::this_thread::get_id() == caller);
+            grid.density().at(16, 4) = 1.0f;
+            solver.step();
+        },
+        [&](const SimulationFrameInfo& info) { published = static_cast<int>(info.step); });
+    simulation.start();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (simulation.getCompletedSteps() < 5 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    simulation.stop();
+
+    std::uint64_t steps = simulation.getCompletedSteps();
+    EXPECT_GE(steps, 5u);
+    EXPECT_FALSE(sameThread);
+    EXPECT_EQ(published, static_cast<int>(steps));
+    SimulationFrameInfo info;
+    EXPECT_TRUE(simulation.latestFrame(info));
+    EXPECT_EQ(info.step, steps);
+    EXPECT_GT(info.stepsPerSecond, 0.0);
+
+    // paused: the thread idles without stepping, and a stopped thread restarts
+    simulation.setPaused(true);
+    simulation.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    simulation.stop();
+    EXPECT_EQ(simulation.getCompletedSteps(), steps);
+    EXPECT_FALSE(simulation.isRunning());
+}
+
+
+#include "scenario.hpp"
+#include "fieldio.hpp"
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+
+TEST(Scenario, parsesKeysSourcesAndReportsBadLines){
+
+    std::istringstream text(
+        "# comment line\n"
+        "grid = 64 32\n"
+        "steps = 10   # trailing comment\n"
+        "threads = 3\n"
+        "solver = pipelined-pcg\n"
+        "dt = 0.05\n"
+        "buoyancy = 1.5\n"
+        "snapshot_every = 5\n"
+        "snapshot_fields = density u\n"
+        "snapshot_format = pgm\n"
+        "output = out dir\n"
+        "source = temperature 10 0 20 4 2.5\n"
+        "obstacle = 30 10 34 60\n");
+    Scenario scenario = parseScenario(text);
+    EXPECT_EQ(scenario.nx, 64);
+    EXPECT_EQ(scenario.ny, 32);
+    EXPECT_EQ(scenario.steps, 10);
+    EXPECT_EQ(scenario.threads, 3);
+    EXPECT_EQ(scenario.pressureSolver, PressureSolverKind::PipelinedConjugateGradient);
+    EXPECT_FLOAT_EQ(scenario.parameters.timeStep, 0.05f);
+    EXPECT_FLOAT_EQ(scenario.parameters.buoyancy, 1.5f);
+    ASSERT_EQ(scenario.snapshotFields.size(), 2u);
+    EXPECT_EQ(scenario.snapshotFields[1], FluidField::VelocityU);
+    EXPECT_EQ(scenario.snapshotFormat, SnapshotFormat::Pgm);
+    EXPECT_EQ(scenario.outputDirectory, "out dir");
+    ASSERT_EQ(scenario.sources.size(), 1u);
+    EXPECT_EQ(scenario.sources[0].field, FluidField::Temperature);
+    EXPECT_FLOAT_EQ(scenario.sources[0].value, 2.5f);
+
+    // obstacles clip to the grid, sources land in the solver's source fields
+    FluidGrid grid(scenario.nx, scenario.ny);
+    FluidSolver solver(grid, 1);
+    applyScenarioObstacles(scenario, grid);
+    applyScenarioSources(scenario, solver);
+    EXPECT_TRUE(grid.isSolid(30, 31));
+    EXPECT_FALSE(grid.isSolid(34, 31));
+    EXPECT_FLOAT_EQ(solver.temperatureSource().at(19, 3), 2.5f);
+    EXPECT_FLOAT_EQ(solver.temperatureSource().at(20, 3), 0.0f);
+
+    for (const char* bad : {"grid = 64\n", "steps = 10 extra\n", "solver = sor\n", "colour = red\n",
+                            "source = pressure 0 0 1 1 1\n", "obstacle = 4 4 2 8\n", "just text\n",
+                            "threads = -2\n", "snapshot_every = -1\n"})
+    {
+        std::istringstream in(std::string("steps = 1\n") + bad);
+        try
+        {
+            parseScenario(in);
+            ADD_FAILURE() << "accepted: " << bad;
+        }
+        catch (const std::invalid_argument& error)
+        {
+            EXPECT_NE(std::string(error.what()).find("line 2"), std::string::npos) << error.what();
+        }
+    }
+}
+
+TEST(Scenario, floatMapSnapshotsRoundTrip){
+
+    ScalarField field(7, 5);
+    for (int j = 0; j < 5; ++j)
+        for (int i = 0; i < 7; ++i)
+            field.at(i, j) = 0.25f*i - 1.5f*j + 1e-3f*i*j;
+    std::string path = ::testing::TempDir() + "simfluid_roundtrip.pfm";
+    writeFieldPfm(field, path);
+    ScalarField loaded = readFieldPfm(path);
+    ASSERT_EQ(loaded.getNx(), 7);
+    ASSERT_EQ(loaded.getNy(), 5);
+    for (int j = 0; j < 5; ++j)
+        for (int i = 0; i < 7; ++i)
+            EXPECT_EQ(loaded.at(i, j), field.at(i, j));
+    std::remove(path.c_str());
+    EXPECT_THROW(readFieldPfm(path), std::runtime_error);
+}
+
+
+#include "profiler.hpp"
+
+TEST(Profiler, recordsNestedZonesPerThreadAsChromeTrace){
+
+    Profiler& profiler = Profiler::instance();
+    profiler.setEnabled(false);
+    profiler.clear();
+    {
+        ProfileZone ignored("disabled zone");
+    }
+    EXPECT_EQ(profiler.getEventCount(), 0u);
+
+    profiler.setEnabled(true);
+    {
+        ProfileZone outer("outer zone");
+        ProfileZone inner("inner zone");
+    }
+    std::thread worker([]() {
+        Profiler::setThreadName("test \"worker\"");
+        ProfileZone zone("worker zone");
+    });
+    worker.join();
+    // rings outlive their threads, so the worker's zone is still there
+    EXPECT_EQ(profiler.getEventCount(), 3u);
+
+    // a full solver step goes through the instrumented stages
+    FluidGrid grid(16, 16);
+    FluidSolver solver(grid, 2);
+    solver.step();
+    profiler.setEnabled(false);
+
+    std::ostringstream trace;
+    profiler.writeChromeTrace(trace);
+    std::string json = trace.str();
+    EXPECT_EQ(json.find("disabled zone"), std::string::npos);
+    for (const char* expected : {"\"outer zone\"", "\"inner zone\"", "\"worker zone\"", "test \\\"worker\\\"",
+                                 "\"pressure solve\"", "\"advect\"", "\"ph\":\"X\"", "\"thread_name\""})
+        EXPECT_NE(json.find(expected), std::string::npos) << expected;
+    EXPECT_EQ(json.find("e+"), std::string::npos);
+
+    // the outer zone encloses the inner one
+    auto field = [&](const std::string& name, const char* key) {
+        std::size_t at = json.find("\"" + name + "\"");
+        std::size_t k = json.find(key, at) + std::string(key).size();
+        return std::stod(json.substr(k));
+    };
+    double outerTs = field("outer zone", "\"ts\":");
+    double innerTs = field("inner zone", "\"ts\":");
+    EXPECT_LE(outerTs, innerTs);
+    EXPECT_GE(outerTs + field("outer zone", "\"dur\":"), innerTs + field("inner zone", "\"dur\":"));
+
+    profiler.clear();
+    EXPECT_EQ(profiler.getEventCount(), 0u);
+}
+
+TEST(Profiler, fullRingKeepsTheNewestRecords){
+
+    Profiler& profiler = Profiler::instance();
+    profiler.clear();
+    profiler.setEnabled(true);
+    std::thread worker([&]() {
+        for (std::size_t k = 0; k < Profiler::RingCapacity + 100; ++k)
+            profiler.record(k < 100 ? "old record" : "new record", k, k + 1);
+    });
+    worker.join();
+    profiler.setEnabled(false);
+    EXPECT_EQ(profiler.getEventCount(), Profiler::RingCapacity);
+    std::ostringstream trace;
+    profiler.writeChromeTrace(trace);
+    EXPECT_EQ(trace.str().find("old record"), std::string::npos);
+    profiler.clear();
+}
+
+#include "perfcounters.hpp"
+#include "threadpool.hpp"
+
+TEST(PerfCounters, openWhatTheMachineAllowsAndMeasureStream){
+
+    ThreadPool pool(3);
+    std::vector<long> ids = pool.getWorkerThreadIds();
+#if defined(__linux__)
+    ASSERT_EQ(ids.size(), 2u);
+    EXPECT_NE(ids[0], ids[1]);
+    for (long id : ids)
+        EXPECT_GT(id, 0);
+#endif
+
+    // unavailable events (no PMU, strict paranoid level) are skipped, not fatal
+    ThreadPerfCounters counters;
+    PerfSample before = counters.read();
+    volatile double sink = 0.0;
+    for (int k = 0; k < 2000000; ++k)
+        sink = sink + k*0.5;
+    PerfSample after = counters.read();
+    for (int e = 0; e < NumPerfEvents; ++e)
+    {
+        PerfEvent event = static_cast<PerfEvent>(e);
+        EXPECT_EQ(before.has(event), counters.isOpen(event)) << perfEventName(event);
+        if (counters.isOpen(event) && event != PerfEvent::CacheMisses)
+        {
+            EXPECT_GT((after - before).get(event), 0u) << perfEventName(event);
+        }
+    }
+
+    EXPECT_GT(measureStreamTriadBandwidth(&pool, 1 << 16, 2), 0.0);
+    EXPECT_GT(measureStreamTriadBandwidth(nullptr, 1 << 16, 1), 0.0);
+}
+
+TEST(PerfCounters, collectorAttributesCountersToZones){
+
+    ThreadPool pool(2);
+    StagePerfCollector collector(&pool, 64*64);
+    collector.attach();
+    EXPECT_EQ(Profiler::instance().getObserver(), &collector);
+    std::atomic<long long> sink{0};
+    for (int call = 0; call < 3; ++call)
+    {
+        ProfileZone outer("collector outer");
+        {
+            ProfileZone inner("collector inner");
+            parallelFor(&pool, 0, 64, [&](int, int) {
+                double local = 0.0;
+                for (int k = 0; k < 200000; ++k)
+                    local += k*0.25;
+                sink += static_cast<long long>(local);
+            });
+        }
+    }
+    // zones on other threads are not attributed
+    std::thread([]() { ProfileZone other("collector other thread"); }).join();
+    collector.detach();
+    Profiler::instance().setEnabled(false);
+    Profiler::instance().clear();
+    EXPECT_EQ(Profiler::instance().getObserver(), nullptr);
+
+    const std::vector<StagePerfStats>& stats = collector.getStats();
+    ASSERT_EQ(stats.size(), 2u);
+    EXPECT_EQ(stats[0].name, "collector inner");
+    EXPECT_EQ(stats[1].name, "collector outer");
+    for (const StagePerfStats& stage : stats)
+    {
+        EXPECT_EQ(stage.calls, 3u);
+        EXPECT_GT(stage.seconds, 0.0);
+        if (collector.hasEvent(PerfEvent::TaskClock))
+        {
+            EXPECT_GT(stage.counters.get(PerfEvent::TaskClock), 0u);
+        }
+    }
+    EXPECT_GE(stats[1].seconds, stats[0].seconds);
+
+    std::ostringstream report;
+    collector.writeReport(report, 10e9);
+    EXPECT_NE(report.str().find("collector outer"), std::string::npos);
+    EXPECT_NE(report.str().find("bytes/cell"), std::string::npos);
+}
+
+#include "smoothers.hpp"
+
+TEST(PoissonSmoother, temporalBlockingMatchesPlainSweepsExactly){
+
+    FluidGrid grid(53, 71);
+    for (int j = 20; j < 31; ++j)
+        for (int i = 10; i < 18; ++i)
+            grid.setSolid(i, j, true);
+    ScalarField rhs = grid.makeScratchField();
+    fillPoissonRhs(rhs, grid.obstacle());
+    ThreadPool pool(3);
+
+    for (SmootherKind kind : {SmootherKind::RedBlackGaussSeidel, SmootherKind::WeightedJacobi})
+    {
+        ScalarField plain = grid.makeScratchField();
+        PoissonSmoother reference(&pool, kind);
+        reference.smooth(plain, rhs, grid.obstacle(), 7);
+
+        // odd band heights, a last pass shorter than the others, and the automatic size
+        for (int tileRows : {5, 16, 0})
+        {
+            ScalarField blocked = grid.makeScratchField();
+            PoissonSmoother smoother(&pool, kind);
+            smoother.setSweepsPerTile(3);
+            smoother.setTileRows(tileRows);
+            smoother.smooth(blocked, rhs, grid.obstacle(), 7);
+            for (int j = 0; j < grid.getNy(); ++j)
+                for (int i = 0; i < grid.getNx(); ++i)
+                    ASSERT_EQ(blocked.at(i, j), plain.at(i, j)) << i << "," << j << " rows " << tileRows;
+        }
+    }
+}
+
+TEST(PoissonSmoother, drivesMultigridWithEitherKind){
+
+    FluidGrid grid(96, 96);
+    ScalarField rhs = grid.makeScratchField();
+    fillPoissonRhs(rhs, grid.obstacle());
+    ThreadPool pool(2);
+    for (SmootherKind kind : {SmootherKind::RedBlackGaussSeidel, SmootherKind::WeightedJacobi})
+    {
+        grid.pressure().fill(0.0f);
+        MultigridPressureSolver solver(&pool);
+        solver.setSmoother(kind, 2);
+        solver.setMaxIterations(40);
+        PressureSolveStats stats = solver.solve(grid.pressure(), rhs, grid.obstacle());
+        EXPECT_TRUE(stats.converged);
+        EXPECT_LT(computePoissonResidualNorm(grid.pressure(), rhs, grid.obstacle()) / computeFluidNorm(rhs, grid.obstacle()), 1e-5);
+    }
+}
+
+#include "threadpool.hpp"
+#include <chrono>
+#include <stdexcept>
+
+TEST(ThreadPool, tiledRangesAndNestedRunsCoverEverythingOnce){
+
+    ThreadPool pool(4);
+    std::vector<std::atomic<int>> hits(37*23);
+    pool.parallelFor2D(0, 37, 0, 23, 8, 5, [&](int x0, int x1, int y0, int y1) {
+        EXPECT_LE(x1 - x0, 8);
+        EXPECT_LE(y1 - y0, 5);
+        for (int y = y0; y < y1; ++y)
+            for (int x = x0; x < x1; ++x)
+                hits[y*37 + x]++;
+    });
+    parallelFor2D(nullptr, 0, 37, 0, 23, 0, 0, [&](int x0, int x1, int y0, int y1) {
+        EXPECT_EQ(x1 - x0, 37);
+        EXPECT_EQ(y1 - y0, 23);
+        for (int y = y0; y < y1; ++y)
+            for (int x = x0; x < x1; ++x)
+                hits[y*37 + x]++;
+    });
+    for (auto& h : hits)
+        EXPECT_EQ(h.load(), 2);
+
+    // jobs that submit their own work must not deadlock the pool
+    std::atomic<int> inner{0};
+    pool.run(8, [&](int) {
+        pool.parallelFor(0, 100, [&](int begin, int end) { inner += end - begin; });
+    });
+    EXPECT_EQ(inner.load(), 800);
+}
+
+TEST(ThreadPool, taskGraphRespectsDependencies){
+
+    ThreadPool pool(3);
+    // a diamond fanning out to many leaves: order[] records completion order
+    std::atomic<int> clock{0};
+    std::vector<int> finished(20, -1);
+    auto stamp = [&](int id) { return [&, id]() { finished[id] = clock++; }; };
+    TaskGraph graph;
+    TaskGraph::TaskId root = graph.add(stamp(0));
+    TaskGraph::TaskId left = graph.add(stamp(1), {root});
+    TaskGraph::TaskId right = graph.add(stamp(2), {root});
+    TaskGraph::TaskId join = graph.add(stamp(3), {left, right});
+    for (int leaf = 4; leaf < 20; ++leaf)
+        graph.add(stamp(leaf), {join});
+
+    for (int repeat = 0; repeat < 3; ++repeat)
+    {
+        clock = 0;
+        pool.run(graph);
+        EXPECT_EQ(clock.load(), 20);
+        EXPECT_LT(finished[0], finished[1]);
+        EXPECT_LT(finished[0], finished[2]);
+        EXPECT_LT(std::max(finished[1], finished[2]), finished[3]);
+        for (int leaf = 4; leaf < 20; ++leaf)
+            EXPECT_LT(finished[3], finished[leaf]);
+    }
+
+    ThreadPool serial(1);
+    clock = 0;
+    serial.run(graph);
+    EXPECT_EQ(clock.load(), 20);
+    EXPECT_LT(finished[3], finished[19]);
+
+    TaskGraph cyclic;
+    TaskGraph::TaskId a = cyclic.add([]() {});
+    TaskGraph::TaskId b = cyclic.add([]() {}, {a});
+    cyclic.precede(b, a);
+    EXPECT_THROW(pool.run(cyclic), std::invalid_argument);
+    EXPECT_THROW(cyclic.precede(a, 7), std::invalid_argument);
+}
+
+TEST(ThreadPool, reportsPerWorkerBusyAndIdleTime){
+
+    ThreadPool pool(3);
+    pool.pinWorkersToCores();   // may be refused; must not disturb scheduling
+    pool.resetWorkerStats();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    pool.run(12, [](int) {
+        volatile double sink = 0.0;
+        for (int k = 0; k < 20000; ++k)
+            sink = sink + k;
+    });
+
+    std::vector<ThreadPool::WorkerStats> stats = pool.getWorkerStats();
+    ASSERT_EQ(stats.size(), 3u);
+    std::uint64_t executed = 0;
+    double busy = 0.0;
+    for (const ThreadPool::WorkerStats& worker : stats)
+    {
+        executed += worker.tasksExecuted;
+        busy += worker.busySeconds;
+        EXPECT_LE(worker.tasksStolen, worker.tasksExecuted);
+    }
+    EXPECT_EQ(executed, 12u);
+    EXPECT_GT(busy, 0.0);
+    // the workers slept through the pause before the job
+    EXPECT_GT(stats[1].idleSeconds + stats[2].idleSeconds, 0.01);
+
+    pool.resetWorkerStats();
+    EXPECT_EQ(pool.getWorkerStats()[1].tasksExecuted, 0u);
+}
+
+#include "gridlayout.hpp"
+#include <set>
+
+TEST(GridLayout, everyLayoutMapsCellsOneToOneAndRoundTrips){
+
+    const int nx = 45, ny = 29;
+    for (GridLayoutKind kind : {GridLayoutKind::RowMajor, GridLayoutKind::Tiled8, GridLayoutKind::Tiled16,
+                                GridLayoutKind::Morton})
+    {
+        visitGridLayout(kind, [&](auto tag) {
+            using Layout = typename decltype(tag)::type;
+            LayoutField<Layout> field(nx, ny);
+            std::set<std::size_t> offsets;
+            for (int j = -1; j <= ny; ++j)
+                for (int i = -1; i <= nx; ++i)
+                {
+                    std::size_t offset = field.getLayout().index(i, j);
+                    EXPECT_LT(offset, field.getLayout().getStorageSize());
+                    offsets.insert(offset);
+                }
+            EXPECT_EQ(offsets.size(), static_cast<std::size_t>((nx + 2)*(ny + 2))) << gridLayoutName(kind);
+
+            ScalarField source(nx, ny);
+            for (int j = -1; j <= ny; ++j)
+                for (int i = -1; i <= nx; ++i)
+                    source.at(i, j) = i*100.0f + j;
+            field.copyFrom(source);
+            ScalarField back(nx, ny);
+            field.copyTo(back);
+            for (int j = -1; j <= ny; ++j)
+                for (int i = -1; i <= nx; ++i)
+                    ASSERT_EQ(back.at(i, j), source.at(i, j)) << gridLayoutName(kind);
+
+            // the blocks tile the interior exactly once
+            ThreadPool pool(3);
+            std::vector<std::atomic<int>> hits(nx*ny);
+            field.parallelForBlocks(&pool, [&](int i0, int i1, int j0, int j1) {
+                for (int j = j0; j < j1; ++j)
+                    for (int i = i0; i < i1; ++i)
+                        hits[j*nx + i]++;
+            });
+            for (auto& h : hits)
+                EXPECT_EQ(h.load(), 1);
+        });
+    }
+    EXPECT_THROW(LayoutField<MortonLayout>(nx, ny).copyFrom(ScalarField(nx + 1, ny)), std::invalid_argument);
+    EXPECT_STREQ(gridLayoutName(GridLayoutKind::Tiled16), "tiled-16");
+}
+
+TEST(GridLayout, jacobiSweepMatchesAcrossLayouts){
+
+    FluidGrid grid(40, 33);
+    for (int j = 8; j < 15; ++j)
+        for (int i = 20; i < 26; ++i)
+            grid.setSolid(i, j, true);
+    ScalarField rhs = grid.makeScratchField();
+    fillPoissonRhs(rhs, grid.obstacle());
+
+    // reference: the same arithmetic on the ScalarField rows
+    ScalarField reference = grid.makeScratchField();
+    ScalarField next = grid.makeScratchField();
+    const ScalarField& s = grid.obstacle();
+    for (int sweep = 0; sweep < 5; ++sweep)
+    {
+        for (int j = 0; j < grid.getNy(); ++j)
+            for (int i = 0; i < grid.getNx(); ++i)
+            {
+                float fl = 1.0f - s.at(i - 1, j), fr = 1.0f - s.at(i + 1, j);
+                float fd = 1.0f - s.at(i, j - 1), fu = 1.0f - s.at(i, j + 1);
+                float diag = std::max(fl + fr + fd + fu, 1.0f);
+                float value = (rhs.at(i, j) + fl*reference.at(i - 1, j) + fr*reference.at(i + 1, j) +
+                               fd*reference.at(i, j - 1) + fu*reference.at(i, j + 1)) / diag;
+                next.at(i, j) = (1.0f - s.at(i, j)) * value;
+            }
+        reference.swap(next);
+    }
+
+    ThreadPool pool(2);
+    for (GridLayoutKind kind : {GridLayoutKind::RowMajor, GridLayoutKind::Tiled8, GridLayoutKind::Tiled16,
+                                GridLayoutKind::Morton})
+    {
+        visitGridLayout(kind, [&](auto tag) {
+            using Layout = typename decltype(tag)::type;
+            LayoutField<Layout> p(40, 33), out(40, 33), b(40, 33), solid(40, 33);
+            b.copyFrom(rhs);
+            solid.copyFrom(grid.obstacle());
+            for (int sweep = 0; sweep < 5; ++sweep)
+            {
+                layoutJacobiSweep(p, b, solid, out, &pool);
+                p.swap(out);
+            }
+            for (int j = 0; j < 33; ++j)
+                for (int i = 0; i < 40; ++i)
+                    ASSERT_FLOAT_EQ(p.at(i, j), reference.at(i, j)) << gridLayoutName(kind) << " " << i << "," << j;
+        });
+    }
+
+    GridLayoutKind chosen = chooseGridLayout(64, 64, &pool);
+    EXPECT_EQ(chooseGridLayout(64, 64, &pool), chosen);
+}
+
+TEST(GridLayout, jacobiSolverRunsOnEveryLayout){
+
+    FluidGrid grid(40, 33);
+    for (int j = 8; j < 15; ++j)
+        for (int i = 20; i < 26; ++i)
+            grid.setSolid(i, j, true);
+    ScalarField rhs = grid.makeScratchField();
+    fillPoissonRhs(rhs, grid.obstacle());
+
+    ThreadPool pool(2);
+    JacobiPressureSolver rowMajor(&pool);
+    EXPECT_EQ(rowMajor.getLayout(), GridLayoutKind::RowMajor);
+    EXPECT_THROW(rowMajor.setCheckInterval(0), std::invalid_argument);
+    EXPECT_THROW(rowMajor.setCheckInterval(-3), std::invalid_argument);
+    rowMajor.setMaxIterations(60);
+    ScalarField expected = grid.makeScratchField();
+    PressureSolveStats expectedStats = rowMajor.solve(expected, rhs, grid.obstacle());
+
+    for (GridLayoutKind kind : {GridLayoutKind::Tiled8, GridLayoutKind::Tiled16, GridLayoutKind::Morton})
+    {
+        JacobiPressureSolver solver(&pool);
+        solver.setLayout(kind);
+        solver.setMaxIterations(60);
+        ScalarField p = grid.makeScratchField();
+        PressureSolveStats stats = solver.solve(p, rhs, grid.obstacle());
+        EXPECT_EQ(solver.getLayout(), kind);
+        EXPECT_EQ(stats.iterations, expectedStats.iterations);
+        ASSERT_EQ(stats.residualHistory.size(), expectedStats.residualHistory.size());
+        EXPECT_NEAR(stats.residualHistory.back(), expectedStats.residualHistory.back(), 1e-6);
+        for (int j = 0; j < 33; ++j)
+            for (int i = 0; i < 40; ++i)
+                ASSERT_NEAR(p.at(i, j), expected.at(i, j), 1e-5f) << gridLayoutName(kind) << " " << i << "," << j;
+
+        // the layout copies are reused, and nothing of the last solve leaks into the next
+        ScalarField again = grid.makeScratchField();
+        solver.solve(again, rhs, grid.obstacle());
+        for (int j = 0; j < 33; ++j)
+            for (int i = 0; i < 40; ++i)
+                ASSERT_EQ(again.at(i, j), p.at(i, j)) << gridLayoutName(kind) << " " << i << "," << j;
+    }
+}
+
+TEST(GridLayout, choosingALayoutFromPoolTasksDoesNotDeadlock){
+
+    // every task measures on the pool it runs on while the others wait for the cache
+    ThreadPool pool(4);
+    std::vector<GridLayoutKind> chosen(16);
+    pool.run(16, [&](int k) { chosen[k] = chooseGridLayout(24 + k, 24 + k, &pool); });
+    for (int k = 0; k < 16; ++k)
+        EXPECT_EQ(chooseGridLayout(24 + k, 24 + k, &pool), chosen[k]);
+}
+
+#include "sparsegrid.hpp"
+
+TEST(SparseGrid, blocksActivateOnWriteAndRoundTripThroughDense){
+
+    SparseBlockField sparse(40, 33, 0.5f);
+    EXPECT_EQ(sparse.getBlocksX(), 3);
+    EXPECT_EQ(sparse.getBlocksY(), 3);
+    EXPECT_EQ(sparse.getActiveBlockCount(), 0);
+    EXPECT_EQ(sparse.value(39, 32), 0.5f);
+
+    sparse.setValue(39, 32, 2.0f);
+    EXPECT_TRUE(sparse.isActive(2, 2));
+    EXPECT_EQ(sparse.getActiveBlockCount(), 1);
+    EXPECT_EQ(sparse.value(39, 32), 2.0f);
+    EXPECT_EQ(sparse.value(38, 32), 0.5f);
+
+    ScalarField dense(40, 33);
+    dense.fill(0.5f);
+    for (int j = 3; j < 20; ++j)
+        for (int i = 20; i < 23; ++i)
+            dense.at(i, j) = 0.1f*i + j;
+    sparse.fromDense(dense, 1e-6f);
+    EXPECT_EQ(sparse.getActiveBlockCount(), 2);
+    EXPECT_TRUE(sparse.isActive(1, 0) && sparse.isActive(1, 1));
+    EXPECT_FALSE(sparse.isActive(2, 2));
+
+    ScalarField back(40, 33);
+    sparse.toDense(back);
+    for (int j = 0; j < 33; ++j)
+        for (int i = 0; i < 40; ++i)
+            ASSERT_EQ(back.at(i, j), dense.at(i, j)) << i << "," << j;
+
+    // deactivated blocks are pooled for the next activation until released
+    std::size_t held = sparse.getAllocatedBytes();
+    sparse.clear();
+    EXPECT_EQ(sparse.getAllocatedBytes(), held);
+    sparse.setValue(0, 0, 1.0f);
+    EXPECT_EQ(sparse.getAllocatedBytes(), held);
+    sparse.releaseFreeBlocks();
+    EXPECT_EQ(sparse.getAllocatedBytes(), 9*sizeof(int) + SparseBlockField::BlockBytes);
+    EXPECT_THROW(SparseBlockField(0, 4), std::invalid_argument);
+}
+
+TEST(SparseGrid, sparseSolverFollowsADensePlumeInASmallActiveSet){
+
+    auto run = [](bool sparse, SparseMemoryUsage& usage) {
+        FluidGrid grid(128, 128);
+        FluidSolver solver(grid, 2);
+        solver.parameters().buoyancy = 2.0f;
+        solver.usePressureSolver(PressureSolverKind::Multigrid);
+        solver.setSparse(sparse, 1e-4f, 0.1f);
+        for (int step = 0; step < 30; ++step)
+        {
+            for (int j = 4; j < 8; ++j)
+                for (int i = 60; i < 68; ++i)
+                {
+                    solver.densitySource().at(i, j) = 10.0f;
+                    solver.temperatureSource().at(i, j) = 5.0f;
+                }
+            solver.step();
+        }
+        usage = solver.getSparseMemoryUsage();
+        return ScalarField(grid.density());
+    };
+
+    SparseMemoryUsage denseUsage, sparseUsage;
+    ScalarField dense = run(false, denseUsage);
+    ScalarField sparse = run(true, sparseUsage);
+
+    EXPECT_EQ(denseUsage.activeBlocks, denseUsage.totalBlocks);
+    EXPECT_EQ(denseUsage.activeSetBytes, 0u);
+    EXPECT_EQ(sparseUsage.totalBlocks, 64);
+    EXPECT_LT(sparseUsage.getActiveFraction(), 0.75);
+    // the state stays dense either way; sparse mode only adds the active set
+    EXPECT_EQ(sparseUsage.denseBytes, denseUsage.denseBytes);
+    EXPECT_EQ(sparseUsage.getTotalBytes(), sparseUsage.denseBytes + sparseUsage.activeSetBytes);
+    EXPECT_GT(sparseUsage.activeSetBytes, 0u);
+
+    double total = 0.0, difference = 0.0, largest = 0.0;
+    for (int j = 0; j < 128; ++j)
+        for (int i = 0; i < 128; ++i)
+        {
+            total += dense.at(i, j);
+            difference += std::fabs(sparse.at(i, j) - dense.at(i, j));
+            largest = std::max(largest, double(dense.at(i, j)));
+        }
+    EXPECT_GT(total, 100.0);
+    EXPECT_LT(difference, 0.02*total) << "active fraction " << sparseUsage.getActiveFraction();
+}
+
+#include "quadtree.hpp"
+
+TEST(Quadtree, refinesAroundObstaclesAndVorticesAndStaysBalanced){
+
+    // not a multiple of the root size, so the edge roots have to split
+    FluidGrid grid(70, 52);
+    for (int j = 35; j < 43; ++j)
+        for (int i = 31; i < 39; ++i)
+            grid.setSolid(i, j, true);
+    for (int j = 0; j < 52; ++j)
+        for (int i = 0; i < 70; ++i)
+        {
+            float dx = i - 50.0f, dy = j - 12.0f;
+            float swirl = std::exp(-(dx*dx + dy*dy) / 18.0f);
+            grid.u().at(i, j) = -dy*swirl;
+            grid.v().at(i, j) = dx*swirl;
+        }
+
+    QuadtreeGrid tree(70, 52);
+    QuadtreeCriteria criteria;
+    tree.build(grid, criteria);
+    EXPECT_TRUE(tree.isBalanced());
+
+    long covered = 0;
+    for (int l = 0; l < tree.getLeafCount(); ++l)
+    {
+        const QuadtreeLeaf& leaf = tree.getLeaves()[l];
+        ASSERT_LE(leaf.i0 + leaf.size, 70);
+        ASSERT_LE(leaf.j0 + leaf.size, 52);
+        covered += leaf.size*leaf.size;
+        EXPECT_EQ(tree.leafAt(leaf.i0 + leaf.size - 1, leaf.j0), l);
+    }
+    EXPECT_EQ(covered, 70*52);
+    EXPECT_LT(tree.getLeafCount(), 70*52 / 4);
+
+    // the obstacle's outline and the vortex core are resolved to single cells, quiet air is not
+    EXPECT_EQ(tree.getLeaves()[tree.leafAt(30, 38)].size, 1);
+    EXPECT_EQ(tree.getLeaves()[tree.leafAt(31, 38)].size, 1);
+    EXPECT_TRUE(tree.getLeaves()[tree.leafAt(31, 38)].solid);
+    EXPECT_TRUE(tree.getLeaves()[tree.leafAt(34, 38)].solid);
+    EXPECT_EQ(tree.getLeaves()[tree.leafAt(50, 12)].size, 1);
+    EXPECT_EQ(tree.getLeaves()[tree.leafAt(5, 5)].size, 16);
+
+    double faceArea = 0.0;
+    for (const QuadtreeFace& face : tree.getFaces())
+    {
+        const QuadtreeLeaf& a = tree.getLeaves()[face.a];
+        const QuadtreeLeaf& b = tree.getLeaves()[face.b];
+        EXPECT_FALSE(a.solid || b.solid);
+        EXPECT_LE(std::max(a.size, b.size), 2*std::min(a.size, b.size));
+        EXPECT_FLOAT_EQ(face.distance, 0.5f*(a.size + b.size));
+        faceArea += face.length;
+    }
+    EXPECT_GT(faceArea, 0.0);
+
+    QuadtreeCriteria odd;
+    odd.maxLeafSize = 12;
+    EXPECT_THROW(tree.build(grid, odd), std::invalid_argument);
+}
+
+TEST(Quadtree, singleCellLeavesSolveTheCellSystem){
+
+    FluidGrid grid(40, 36);
+    for (int j = 10; j < 25; ++j)
+        for (int i = 12; i < 16; ++i)
+            grid.setSolid(i, j, true);
+    ScalarField rhs = grid.makeScratchField();
+    fillPoissonRhs(rhs, grid.obstacle());
+
+    ThreadPool pool(2);
+    QuadtreePressureSolver solver(&pool);
+    solver.setMaxIterations(2000);
+    solver.setTolerance(1e-6);
+    PressureSolveStats stats = solver.solve(grid.pressure(), rhs, grid.obstacle());
+    EXPECT_TRUE(stats.converged);
+    EXPECT_EQ(solver.getTree().getLeafCount(), 40*36);
+    EXPECT_LT(computePoissonResidualNorm(grid.pressure(), rhs, grid.obstacle()) / computeFluidNorm(rhs, grid.obstacle()), 1e-4);
+}
+
+TEST(Quadtree, adaptiveProjectionRemovesMostOfTheDivergence){
+
+    FluidGrid grid(64, 64);
+    for (int j = 40; j < 46; ++j)
+        for (int i = 24; i < 40; ++i)
+            grid.setSolid(i, j, true);
+    FluidSolver solver(grid, 2);
+    solver.usePressureSolver(PressureSolverKind::Quadtree);
+    solver.getPressureSolver().setMaxIterations(500);
+    solver.getPressureSolver().setTolerance(1e-5);
+    for (int j = 0; j < 64; ++j)
+        for (int i = 0; i < 64; ++i)
+        {
+            if (grid.isSolid(i, j))
+                continue;
+            float dx = i - 32.0f, dy = j - 20.0f;
+            grid.v().at(i, j) = 2.0f*std::exp(-(dx*dx + dy*dy) / 30.0f);
+        }
+    applyBoundary(grid.u(), BoundaryKind::VelocityU);
+    applyBoundary(grid.v(), BoundaryKind::VelocityV);
+
+    double before = divergenceNorm(grid);
+    solver.project();
+    const QuadtreePressureSolver& quadtree = static_cast<const QuadtreePressureSolver&>(solver.getPressureSolver());
+    EXPECT_TRUE(solver.getLastPressureStats().converged);
+    EXPECT_LT(quadtree.getTree().getLeafCount(), 64*64 / 2);
+    EXPECT_LT(divergenceNorm(grid), 0.5*before);
+}
+
+#include "amr.hpp"
+
+// Lamb-Oseen-like vortex of core radius `core` centred on (cx, cy), plus a
+// density blob over the same spot
+static void seedVortex(FluidGrid& grid, float cx, float cy, float core, float strength){
+    for (int j = 0; j < grid.getNy(); ++j)
+        for (int i = 0; i < grid.getNx(); ++i)
+        {
+            float dx = i + 0.5f - cx, dy = j + 0.5f - cy;
+            float r2 = dx*dx + dy*dy;
+            float swirl = strength*std::exp(-r2 / (core*core));
+            grid.u().at(i, j) = -dy*swirl;
+            grid.v().at(i, j) = dx*swirl;
+            grid.density().at(i, j) = std::exp(-r2 / (4.0f*core*core));
+        }
+    applyBoundary(grid.u(), BoundaryKind::VelocityU);
+    applyBoundary(grid.v(), BoundaryKind::VelocityV);
+    applyBoundary(grid.density(), BoundaryKind::Scalar);
+}
+
+TEST(Amr, clusteringCoversEveryTagWithDisjointEfficientBoxes){
+
+    const int width = 40, height = 30;
+    std::vector<unsigned char> tags(width*height, 0);
+    // an L and a separate square
+    for (int j = 2; j < 20; ++j)
+        for (int i = 3; i < 7; ++i)
+            tags[j*width + i] = 1;
+    for (int j = 2; j < 6; ++j)
+        for (int i = 7; i < 18; ++i)
+            tags[j*width + i] = 1;
+    for (int j = 22; j < 28; ++j)
+        for (int i = 30; i < 37; ++i)
+            tags[j*width + i] = 1;
+
+    std::vector<AmrBox> boxes = clusterTaggedCells(tags, width, height, 0.8f, 64);
+    ASSERT_GE(boxes.size(), 3u);
+    std::vector<int> owners(width*height, 0);
+    int area = 0;
+    for (const AmrBox& box : boxes)
+    {
+        area += box.getCellCount();
+        for (int j = box.j0; j < box.j1; ++j)
+            for (int i = box.i0; i < box.i1; ++i)
+                ++owners[j*width + i];
+    }
+    for (int c = 0; c < width*height; ++c)
+    {
+        EXPECT_LE(owners[c], 1);
+        if (tags[c])
+        {
+            EXPECT_EQ(owners[c], 1);
+        }
+    }
+    int tagged = 18*4 + 4*11 + 6*7;
+    EXPECT_GE(tagged, 0.8*area);
+
+    // the size limit halves boxes that are efficient but too long
+    for (const AmrBox& box : clusterTaggedCells(tags, width, height, 0.8f, 5))
+    {
+        EXPECT_LE(box.getWidth(), 5);
+        EXPECT_LE(box.getHeight(), 5);
+    }
+    EXPECT_THROW(clusterTaggedCells(tags, width, height + 1, 0.8f, 8), std::invalid_argument);
+}
+
+TEST(Amr, patchesRefineTheVortexAndNestInTheirParents){
+
+    FluidGrid grid(64, 64);
+    seedVortex(grid, 44.0f, 20.0f, 5.0f, 0.2f);
+    AmrSolver amr(grid, 2);
+    AmrCriteria criteria;
+    criteria.maxLevel = 2;
+    criteria.blockingFactor = 4;
+    amr.setCriteria(criteria);
+    amr.regrid();
+
+    ASSERT_EQ(amr.getNumLevels(), 3);
+    for (int level = 1; level < amr.getNumLevels(); ++level)
+    {
+        AmrBox domain = amr.getLevelDomain(level);
+        bool coversCentre = false;
+        int scale = level == 1 ? 2 : 4;
+        for (int k = 0; k < amr.getPatchCount(level); ++k)
+        {
+            const AmrBox& box = amr.getPatchBox(level, k);
+            EXPECT_TRUE(domain.contains(box));
+            EXPECT_EQ(box.i0 % 2, 0);
+            EXPECT_EQ(box.j1 % 2, 0);
+            EXPECT_FLOAT_EQ(amr.getPatchGrid(level, k).getCellSize(), 1.0f / scale);
+            coversCentre = coversCentre || box.contains(44*scale, 20*scale);
+            // far from the vortex nothing is refined
+            EXPECT_FALSE(box.contains(8*scale, 56*scale));
+
+            // one parent holds the patch, and the level below has a cell to spare around it
+            AmrBox parentBox{box.i0 / 2, box.j0 / 2, box.i1 / 2, box.j1 / 2};
+            AmrBox parentCells{parentBox.i0 - 1, parentBox.j0 - 1, parentBox.i1 + 1, parentBox.j1 + 1};
+            parentCells = parentCells.intersect(amr.getLevelDomain(level - 1));
+            bool inOneParent = false;
+            for (int p = 0; p < amr.getPatchCount(level - 1); ++p)
+                inOneParent = inOneParent || amr.getPatchBox(level - 1, p).contains(parentBox);
+            EXPECT_TRUE(inOneParent);
+            for (int cj = parentCells.j0; cj < parentCells.j1; ++cj)
+                for (int ci = parentCells.i0; ci < parentCells.i1; ++ci)
+                {
+                    bool held = false;
+                    for (int p = 0; p < amr.getPatchCount(level - 1); ++p)
+                        held = held || amr.getPatchBox(level - 1, p).contains(ci, cj);
+                    EXPECT_TRUE(held);
+                }
+        }
+        EXPECT_TRUE(coversCentre);
+    }
+    for (int k = 0; k + 1 < amr.getPatchCount(1); ++k)
+        for (int m = k + 1; m < amr.getPatchCount(1); ++m)
+            EXPECT_TRUE(amr.getPatchBox(1, k).intersect(amr.getPatchBox(1, m)).isEmpty());
+
+    // the composite at level 2 repeats the base away from the patches
+    ScalarField composite(256, 256);
+    amr.sampleComposite(FluidField::Density, 2, composite);
+    EXPECT_FLOAT_EQ(composite.at(8*4 + 1, 56*4 + 2), grid.density().at(8, 56));
+    EXPECT_THROW(amr.sampleComposite(FluidField::Density, 1, composite), std::invalid_argument);
+}
+
+TEST(Amr, refluxingConservesDensityAcrossLevels){
+
+    auto run = [](bool reflux, double& before, double& after) {
+        FluidGrid grid(48, 48);
+        seedVortex(grid, 24.0f, 24.0f, 6.0f, 0.6f);
+        // shift the blob off the vortex so it streams across the patch edges
+        for (int j = 0; j < 48; ++j)
+            for (int i = 0; i < 48; ++i)
+            {
+                float dx = i + 0.5f - 30.0f, dy = j + 0.5f - 24.0f;
+                grid.density().at(i, j) = std::exp(-(dx*dx + dy*dy) / 20.0f);
+            }
+        AmrSolver amr(grid, 2);
+        AmrCriteria criteria;
+        criteria.maxLevel = 1;
+        criteria.blockingFactor = 4;
+        criteria.gradientThreshold = 1.0f;
+        criteria.regridInterval = 3;
+        amr.setCriteria(criteria);
+        amr.setRefluxing(reflux);
+        amr.parameters().timeStep = 0.5f;
+        amr.regrid();
+        EXPECT_GE(amr.getNumLevels(), 2);
+        before = amr.compositeSum(FluidField::Density);
+        for (int s = 0; s < 8; ++s)
+            amr.step();
+        after = amr.compositeSum(FluidField::Density);
+    };
+    double before = 0.0, after = 0.0;
+    run(true, before, after);
+    EXPECT_NEAR(after, before, 1e-4*before);
+
+    double unsyncedBefore = 0.0, unsyncedAfter = 0.0;
+    run(false, unsyncedBefore, unsyncedAfter);
+    EXPECT_GT(std::fabs(unsyncedAfter - unsyncedBefore), 10.0*std::fabs(after - before));
+}
+
+TEST(Amr, finerLevelsTakeMoreCflLimitedSubsteps){
+
+    FluidGrid grid(48, 48);
+    seedVortex(grid, 24.0f, 24.0f, 6.0f, 0.8f);
+    AmrSolver amr(grid, 2);
+    AmrCriteria criteria;
+    criteria.maxLevel = 1;
+    criteria.blockingFactor = 4;
+    criteria.gradientThreshold = 1.0f;
+    amr.setCriteria(criteria);
+    amr.parameters().timeStep = 0.5f;
+    amr.step();
+
+    ASSERT_EQ(amr.getNumLevels(), 2);
+    EXPECT_GE(amr.getSubsteps(0), 1);
+    EXPECT_GT(amr.getSubsteps(1), amr.getSubsteps(0));
+
+    // a still fluid needs one step per level and parent step
+    FluidGrid still(32, 32);
+    AmrSolver quiet(still, 1);
+    quiet.setCriteria(criteria);
+    quiet.step();
+    EXPECT_EQ(quiet.getNumLevels(), 1);
+    EXPECT_EQ(quiet.getSubsteps(0), 1);
+}
@@ -0,0 +1,105 @@
+#include "uploadslotring.hpp"
+
+UploadSlotRing::UploadSlotRing()
+{
+    reset();
+}
+
+void UploadSlotRing::reset()
+{
+    for (int k = 0; k < NumSlots; ++k)
+    {
+        this->states[k].store(static_cast<int>(SlotState::Free), std::memory_order_relaxed);
+        this->sequences[k].store(0, std::memory_order_relaxed);
+    }
+    this->nextSequence = 0;
+    this->droppedFrames.store(0, std::memory_order_relaxed);
+}
+
+bool UploadSlotRing::transition(int slot, SlotState from, SlotState to)
+{
+    int expected = static_cast<int>(from);
+    return this->states[slot].compare_exchange_strong(expected, static_cast<int>(to),
+                                                      std::memory_order_acq_rel, std::memory_order_acquire);
+}
+
+//--------------------------------PRODUCER-----------------------------------------
+int UploadSlotRing::acquireForWrite()
+{
+    for (int k = 0; k < NumSlots; ++k)
+    {
+        if (transition(k, SlotState::Free, SlotState::Writing))
+        {
+            return k;
+        }
+    }
+    this->droppedFrames.fetch_add(1, std::memory_order_relaxed);
+    return -1;
+}
+
+void UploadSlotRing::publish(int slot)
+{
+    // the sequence is stored before the release of the state, so a consumer that sees Ready sees it too
+    this->sequences[slot].store(++this->nextSequence, std::memory_order_relaxed);
+    this->states[slot].store(static_cast<int>(SlotState::Ready), std::memory_order_release);
+}
+
+void UploadSlotRing::cancel(int slot)
+{
+    this->states[slot].store(static_cast<int>(SlotState::Free), std::memory_order_release);
+}
+
+//--------------------------------CONSUMER-----------------------------------------
+int UploadSlotRing::acquireLatestForUpload()
+{
+    int newest = -1;
+    std::uint64_t newestSequence = 0;
+    for (int k = 0; k < NumSlots; ++k)
+    {
+        if (getState(k) == SlotState::Ready)
+        {
+            std::uint64_t sequence = this->sequences[k].load(std::memory_order_relaxed);
+            if (newest < 0 || sequence > newestSequence)
+            {
+                newest = k;
+                newestSequence = sequence;
+            }
+        }
+    }
+    if (newest < 0)
+    {
+        return -1;
+    }
+    // only the consumer moves slots out of Ready, so these cannot fail
+    transition(newest, SlotState::Ready, SlotState::Uploading);
+    for (int k = 0; k < NumSlots; ++k)
+    {
+        if (k != newest && getState(k) == SlotState::Ready &&
+            this->sequences[k].load(std::memory_order_relaxed) < newestSequence)
+        {
+            transition(k, SlotState::Ready, SlotState::Free);
+            this->droppedFrames.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    return newest;
+}
+
+void UploadSlotRing::markInFlight(int slot)
+{
+    this->states[slot].store(static_cast<int>(SlotState::InFlight), std::memory_order_release);
+}
+
+void UploadSlotRing::release(int slot)
+{
+    this->states[slot].store(static_cast<int>(SlotState::Free), std::memory_order_release);
+}
+
+UploadSlotRing::SlotState UploadSlotRing::getState(int slot) const
+{
+    return static_cast<SlotState>(this->states[slot].load(std::memory_order_acquire));
+}
+
+std::uint64_t UploadSlotRing::getSequence(int slot) const
+{
+    return this->sequences[slot].load(std::memory_order_relaxed);
+}
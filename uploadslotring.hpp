@@ -0,0 +1,58 @@
+#ifndef UPLOADSLOTRING_HPP
+#define UPLOADSLOTRING_HPP
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free ownership protocol for three upload buffers shared by one
+// producer (the simulation) and one consumer (the GL thread). A slot cycles
+//   Free -> Writing -> Ready -> Uploading -> InFlight -> Free
+// where Writing is owned by the producer and Uploading/InFlight by the
+// consumer. The producer never waits: with no Free slot it drops its frame.
+// The consumer takes the newest Ready slot and recycles older ones, so a slow
+// renderer skips frames instead of throttling the simulation.
+class UploadSlotRing
+{
+public:
+    static constexpr int NumSlots = 3;
+
+    enum class SlotState : int
+    {
+        Free,
+        Writing,
+        Ready,
+        Uploading,
+        InFlight    // upload issued, waiting for the GPU fence
+    };
+
+    UploadSlotRing();
+
+    //--------------producer---------------
+    // index of a slot now owned for writing, or -1 (frame dropped)
+    int acquireForWrite();
+    void publish(int slot);
+    void cancel(int slot);
+
+    //--------------consumer---------------
+    // newest Ready slot, now Uploading, or -1; older Ready slots become Free
+    int acquireLatestForUpload();
+    void markInFlight(int slot);
+    // Uploading or InFlight back to Free
+    void release(int slot);
+
+    SlotState getState(int slot) const;
+    std::uint64_t getSequence(int slot) const;
+    // producer frames that found no free slot plus ready frames skipped by the consumer
+    std::uint64_t getDroppedFrames() const { return this->droppedFrames.load(std::memory_order_relaxed); }
+    void reset();
+
+private:
+    bool transition(int slot, SlotState from, SlotState to);
+
+    std::atomic<int> states[NumSlots];
+    std::atomic<std::uint64_t> sequences[NumSlots];
+    std::uint64_t nextSequence{0};   // producer only
+    std::atomic<std::uint64_t> droppedFrames{0};
+};
+
+#endif // UPLOADSLOTRING_HPP